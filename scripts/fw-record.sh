@@ -0,0 +1,48 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Corpus recorder for the replay suite (scripts/fw-replay.sh).
+#
+# Prefix a real tool invocation with this script during a build run to
+# capture it:
+#
+#   fw-record.sh manifest.tsv corpus/ /path/to/trx -o out.trx kernel.bin
+#
+# Every argument naming an existing regular file is copied into the
+# corpus directory under its SHA-256 and recorded as @<sha>; everything
+# else (flags, output names) is recorded literally. An argument
+# following -o is always treated as the output name, even when a stale
+# file of that name exists from an earlier build. The invocation then
+# runs unchanged, so recording can be spliced into a production build.
+# Fields in the manifest are tab separated, one invocation per line,
+# starting with the tool's basename.
+
+set -e
+
+if [ $# -lt 3 ]; then
+	echo "usage: fw-record.sh <manifest> <corpus-dir> <tool> [args...]" >&2
+	exit 1
+fi
+
+manifest="$1"
+corpus="$2"
+shift 2
+tool="$1"
+shift
+
+mkdir -p "$corpus"
+
+rec="$(basename "$tool")"
+prev=""
+for arg in "$@"; do
+	if [ "$prev" != "-o" ] && [ -f "$arg" ] && [ -r "$arg" ]; then
+		sha=$(sha256sum -- "$arg" | cut -c1-64)
+		[ -e "$corpus/$sha" ] || cp -- "$arg" "$corpus/$sha"
+		arg="@$sha"
+	fi
+	prev="$arg"
+	rec="$rec	$arg"
+done
+printf '%s\n' "$rec" >> "$manifest"
+
+exec "$tool" "$@"
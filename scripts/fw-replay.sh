@@ -0,0 +1,155 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Corpus replayer: re-runs every invocation recorded by fw-record.sh
+# against the corpus and compares per-tool wall/CPU/IO totals against a
+# stored baseline. Complements the synthetic fw-bench microbenchmarks
+# with real, recorded jobs, so whole-tool regressions (a slow CRC, an
+# extra read pass) show up even when no single kernel got slower.
+#
+# Usage: fw-replay.sh <manifest> <corpus-dir> [build-dir] [baseline]
+#
+# Each job runs in its own scratch directory with @<sha> arguments
+# substituted by private scratch copies of their corpus blobs - the
+# shared, content-deduplicated corpus is never exposed to a tool that
+# might rewrite its arguments in place. Jobs repeat FW_REPLAY_RUNS times
+# (default 3) and the best wall time counts, which filters scheduler
+# noise. When the baseline file (default <manifest>.baseline) does not
+# exist it is written from this run; when it does, the replay fails if
+# any tool's wall time regressed by more than FW_REPLAY_THRESHOLD
+# percent (default 25).
+
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "usage: fw-replay.sh <manifest> <corpus-dir> [build-dir] [baseline]" >&2
+	exit 1
+fi
+
+manifest="$1"
+corpus="$2"
+bin="${3:-.}"
+baseline="${4:-$manifest.baseline}"
+
+runs="${FW_REPLAY_RUNS:-3}"
+threshold="${FW_REPLAY_THRESHOLD:-25}"
+
+if [ ! -f "$manifest" ]; then
+	echo "fw-replay: no manifest at $manifest (record one with fw-record.sh)" >&2
+	exit 1
+fi
+
+corpus=$(cd "$corpus" && pwd)
+bin=$(cd "$bin" && pwd)
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+results="$work/results"
+: > "$results"
+
+tab=$(printf '\t')
+
+# Run $cmd (tab separated) in $job, leaving "user sys inblk outblk" in
+# $work/rusage. Without /usr/bin/time only wall clock is measured.
+run_job() {
+	if [ -x /usr/bin/time ]; then
+		(cd "$job" && IFS=$tab && \
+		 exec /usr/bin/time -f '%U %S %I %O' -o "$work/rusage" \
+			$cmd > /dev/null 2>&1)
+	else
+		echo '0 0 0 0' > "$work/rusage"
+		(cd "$job" && IFS=$tab && exec $cmd > /dev/null 2>&1)
+	fi
+}
+
+while IFS= read -r line; do
+	[ -n "$line" ] || continue
+	case "$line" in '#'*) continue ;; esac
+
+	oldifs=$IFS; IFS=$tab; set -- $line; IFS=$oldifs
+	tool="$1"
+	shift
+
+	cmd="$bin/$tool"
+	blobs=""
+	for arg in "$@"; do
+		case "$arg" in
+		@*)
+			blobs="$blobs ${arg#@}"
+			arg="${arg#@}"
+			;;
+		esac
+		cmd="$cmd$tab$arg"
+	done
+
+	best=""
+	rusage=""
+	n=0
+	while [ "$n" -lt "$runs" ]; do
+		job="$work/job"
+		rm -rf "$job"
+		mkdir "$job"
+		for sha in $blobs; do
+			cp "$corpus/$sha" "$job/$sha"
+		done
+		start=$(date +%s%N)
+		run_job || {
+			echo "fw-replay: $tool failed" >&2
+			exit 1
+		}
+		wall=$(( $(date +%s%N) - start ))
+		if [ -z "$best" ] || [ "$wall" -lt "$best" ]; then
+			best=$wall
+			rusage=$(cat "$work/rusage")
+		fi
+		n=$((n + 1))
+	done
+	echo "$tool $best $rusage" >> "$results"
+done < "$manifest"
+
+awk -v baseline="$baseline" -v threshold="$threshold" '
+BEGIN {
+	while ((getline line < baseline) > 0) {
+		if (line ~ /^#/)
+			continue
+		split(line, f)
+		bwall[f[1]] = f[2]; bcpu[f[1]] = f[3]; bio[f[1]] = f[4]
+		have = 1
+	}
+	close(baseline)
+}
+{
+	wall[$1] += $2
+	cpu[$1] += ($3 + $4) * 1e6	# seconds -> ms, scaled below
+	io[$1] += $5 + $6
+}
+END {
+	status = 0
+	if (!have) {
+		print "# fw-replay baseline: tool wall_ns cpu_us io_blocks" > baseline
+		for (t in wall)
+			printf "%s %d %d %d\n", t, wall[t], cpu[t], io[t] > baseline
+		printf "fw-replay: baseline written to %s\n", baseline
+		exit 0
+	}
+	printf "%-24s %10s %10s %8s %8s\n", "tool", "wall-ms", "cpu-ms", "io-blk", "delta"
+	for (t in wall) {
+		if (!(t in bwall)) {
+			printf "%-24s %10.1f %10.1f %8d %8s\n",
+			       t, wall[t] / 1e6, cpu[t] / 1e3, io[t], "new"
+			continue
+		}
+		delta = (wall[t] - bwall[t]) * 100.0 / bwall[t]
+		flag = ""
+		if (delta > threshold) {
+			flag = " REGRESSED"
+			status = 1
+		}
+		printf "%-24s %10.1f %10.1f %8d %+7.1f%%%s\n",
+		       t, wall[t] / 1e6, cpu[t] / 1e3, io[t], delta, flag
+	}
+	for (t in bwall)
+		if (!(t in wall))
+			printf "%-24s %46s\n", t, "missing from this replay"
+	exit status
+}' "$results"
@@ -0,0 +1,49 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# PGO training workload for the firmware tools.
+#
+# Run against a build configured with -DPGO_GENERATE=ON (the pgo-train
+# target does this for you); the instrumented tools write their
+# profiles into the configured PGO_PROFILE_DIR. The workload exercises
+# the hot loops the profiles are meant to tune: CRC32 table walks
+# (trx, otrx, fwdigest), MD5 over partition vectors
+# (tplink-safeloader), the bcrypt byte mixer (buffalo-enc) and the
+# NAND ECC parity folds (nand_ecc).
+#
+# Usage: pgo-train.sh [build-dir]
+
+set -e
+
+bin="${1:-.}"
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+
+# Synthetic payloads in the size range of real images: a ~2 MiB
+# kernel, a ~4 MiB rootfs and a raw NAND dump.
+dd if=/dev/urandom of="$work/kernel.bin" bs=1024 count=2048 2>/dev/null
+dd if=/dev/urandom of="$work/rootfs.bin" bs=1024 count=4096 2>/dev/null
+dd if=/dev/urandom of="$work/nand.bin" bs=2048 count=2048 2>/dev/null
+
+# TRX create and re-checksum
+"$bin/trx" -o "$work/image.trx" "$work/kernel.bin" "$work/rootfs.bin"
+"$bin/trx" --fixup "$work/image.trx"
+
+# tplink-safeloader board sample build
+"$bin/tplink-safeloader" -B AD7200 -k "$work/kernel.bin" \
+	-r "$work/rootfs.bin" -o "$work/tplink.bin"
+
+# buffalo-enc round trip, normal and longstate
+"$bin/buffalo-enc" -i "$work/kernel.bin" -o "$work/buf.enc" \
+	-p TRAIN -v 1.00 > /dev/null
+"$bin/buffalo-enc" -d -i "$work/buf.enc" -o "$work/buf.dec" > /dev/null
+"$bin/buffalo-enc" -l -i "$work/kernel.bin" -o "$work/buf-l.enc" \
+	-p TRAIN -v 1.00 > /dev/null
+
+# ECC over the synthetic NAND dump
+"$bin/nand_ecc" "$work/nand.bin" "$work/nand.ecc"
+
+# Fused digest pass over the assembled image
+"$bin/fwdigest" "$work/image.trx" > /dev/null
+
+echo "pgo-train: workload complete"
@@ -24,6 +24,9 @@
 #include <netinet/in.h>
 #include <inttypes.h>
 
+#include "fwu_cache.h"
+#include "fwu_jobs.h"
+
 #define BPB 8 /* bits/byte */
 
 static uint32_t crc32[1<<BPB];
@@ -67,7 +70,7 @@ static void usage(const char *mess)
 	exit(1);
 }
 
-int main(int argc, char **argv)
+static int add_header_run(int argc, char **argv)
 {
 	off_t len;			// of original buf
 	off_t buflen;			// of the output file
@@ -75,12 +78,16 @@ int main(int argc, char **argv)
 	void *input_file;		// pointer to the input file (mmmapped)
 	struct header header;
 	unsigned char *buf;	// pointer to prefix + copy of original buf
+	struct fwu_cache cache;
 
 	// verify parameters
 
 	if (argc != 4)
 		usage("wrong number of arguments");
 
+	if (fwu_cache_lookup(&cache, "add_header", argv, argv[2], argv[3]) > 0)
+		return 0;
+
 	// mmap input_file
 	if ((fd = open(argv[2], O_RDONLY))  < 0
 	|| (len = lseek(fd, 0, SEEK_END)) < 0
@@ -122,5 +129,12 @@ int main(int argc, char **argv)
 
 	munmap(input_file,len);
 
+	fwu_cache_store(&cache);
+
 	return 0;
 }
+
+int main(int argc, char **argv)
+{
+	return fwu_jobs_run(argc, argv, add_header_run);
+}
@@ -50,6 +50,8 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include "fwu_cache.h"
+
 /**********************************************************************/
 
 #define CODE_ID		"U2ND"		/* from code_pattern.h */
@@ -174,6 +176,8 @@ int main(int argc, char **argv)
 	size_t off, n;
 	time_t t;
 	struct tm *ptm;
+	struct fwu_cache cache;
+	char cache_tool[64];
 
 	fprintf(stderr, "mjn3's addpattern replacement - v0.81\n");
 
@@ -265,6 +269,17 @@ int main(int argc, char **argv)
 		usage();
 	}
 
+	/* the header embeds the SOURCE_DATE_EPOCH date, so it belongs in
+	 * the cache key; with the epoch unset the output depends on the
+	 * wall clock and is not cacheable */
+	memset(&cache, 0, sizeof(cache));
+	if (ifn && ofn && getenv("SOURCE_DATE_EPOCH")) {
+		snprintf(cache_tool, sizeof(cache_tool), "addpattern:%s",
+			 getenv("SOURCE_DATE_EPOCH"));
+		if (fwu_cache_lookup(&cache, cache_tool, argv, ifn, ofn) > 0)
+			return EXIT_SUCCESS;
+	}
+
 	if (ifn && !(in = fopen(ifn, "r"))) {
 		fprintf(stderr, "can not open \"%s\" for reading\n", ifn);
 		usage();
@@ -341,5 +356,7 @@ int main(int argc, char **argv)
 	fclose(in);
 	fclose(out);
 
+	fwu_cache_store(&cache);
+
 	return EXIT_SUCCESS;
 }
@@ -20,6 +20,8 @@
 #include <byteswap.h>
 #include <zlib.h> /* crc32 */
 
+#include "fwu_crc32.h"
+
 /* Various defines picked from U-boot */
 
 #define FDT_MAGIC	0xD00DFEED
@@ -177,7 +179,7 @@ void update_iheader_crc(image_header_t * hdr, const void * data, size_t data_siz
 		data = (const void *)((char *)hdr + sizeof(image_header_t));
 
 	// Calculate payload checksum
-	hdr->ih_dcrc = htobe32(crc32(0, data, data_size));
+	hdr->ih_dcrc = htobe32(fwu_crc32_parallel(0, data, data_size, -1));
 	hdr->ih_size = htobe32(data_size);
 
 	// Calculate header checksum
@@ -314,11 +316,13 @@ int parse_args(int argc, char ** argv)
 }
 
 static
-char * load_image(size_t pad_size, size_t * psize)
+char * load_image(size_t pad_size, size_t * psize, int * prepended)
 {
 	uint32_t file_sz;
+	image_header_t lead;
 	size_t readed;
-	void * buf;
+	size_t need = 0;
+	char * buf;
 	FILE *fp;
 
 	fp = fopen(g_opt.imagefn, "rb");
@@ -340,21 +344,34 @@ char * load_image(size_t pad_size, size_t * psize)
 		ERR("Bad size: \"%s\" is no valid image", g_opt.imagefn);
 	}
 
-	buf = malloc(file_sz + pad_size);
+	// Peek the leading header to decide whether a uImage header has
+	// to be prepended; reserving the slot up front saves moving the
+	// whole payload later.
+	readed = fread(&lead, 1, sizeof(lead), fp);
+	if (readed != sizeof(lead)) {
+		fclose(fp);
+		ERR("Error reading file %s", g_opt.imagefn);
+	}
+	if (be32toh(lead.ih_magic) != IH_MAGIC)
+		need = sizeof(image_header_t);
+
+	buf = malloc(need + file_sz + pad_size);
 	if (!buf) {
 		fclose(fp);
 		ERR("Out of memory!");
 	}
-	memset(buf, 0, file_sz + pad_size);
+	memset(buf, 0, need + file_sz + pad_size);
 
-	readed = fread(buf, 1, file_sz, fp);
+	memcpy(buf + need, &lead, sizeof(lead));
+	readed = fread(buf + need + sizeof(lead), 1, file_sz - sizeof(lead), fp);
 	fclose(fp);
-	if (readed != (size_t)file_sz)
+	if (readed != file_sz - sizeof(lead))
 		ERR("Error reading file %s", g_opt.imagefn);
 
 	*psize = file_sz;
+	*prepended = need != 0;
 
-	return (char *)buf;
+	return buf;
 }
 
 static
@@ -524,9 +541,10 @@ int process_image(void)
 	image_header_t *hdr;
 	tail_footer_t *foot;
 	trx2_t *trx;
+	int prepended;
 	FILE *fp;
 
-	img = load_image(1024, &img_size);
+	img = load_image(1024, &img_size, &prepended);
 	if (!img)
 		ERR("Can't load file %s", g_opt.imagefn);
 
@@ -534,9 +552,8 @@ int process_image(void)
 		return show_info(img, img_size);
 
 	hdr = (image_header_t *)img;
-	if (be32toh(hdr->ih_magic) != IH_MAGIC) {
-		memmove(img + hsz, img, img_size);
-		memset(hdr, 0, hsz);
+	if (prepended) {
+		// load_image left a zeroed header slot in front of the payload
 		hdr->ih_magic = htobe32(IH_MAGIC);
 		hdr->ih_time = htobe32(get_timestamp());
 		hdr->ih_size = htobe32(img_size);
@@ -553,8 +570,11 @@ int process_image(void)
 	if (data_size + hsz > img_size)
 		ERR("Bad size: \"%s\" is no valid content size", g_opt.imagefn);
 
-	data_crc_c = crc32(0, (const unsigned char *)(img + hsz), data_size);
-	DBG("data: crc = %08X  (%08X) \n", be32toh(hdr->ih_dcrc), data_crc_c);
+	// The stored CRC is only echoed for -D/-x; don't pay for the pass otherwise
+	if (g_debug) {
+		data_crc_c = fwu_crc32_parallel(0, (const unsigned char *)(img + hsz), data_size, -1);
+		DBG("data: crc = %08X  (%08X) \n", be32toh(hdr->ih_dcrc), data_crc_c);
+	}
 
 	DBG("image type: %d \n", (int)hdr->ih_type);
 
@@ -18,6 +18,9 @@
 #include <getopt.h>     /* for getopt() */
 #include <byteswap.h>
 
+#include "fwu_crc32.h"
+#include "fwu_io.h"
+
 char *infile;
 char *outfile;
 char *progname;
@@ -26,24 +29,26 @@ enum {
 	MODEL_X490
 } model;
 
-#define CHUNK_SIZE 256
-
-uint32_t crc32_for_byte(uint32_t r)
-{
-	for (int j = 0; j < 8; ++j)
-		r = (r & 1 ? 0 : (uint32_t)0xEDB88320L) ^ r >> 1;
-	return r ^ (uint32_t)0xFF000000L;
-}
-
-void crc32(const void *data, size_t n_bytes, uint32_t *crc)
+/*
+ * XOR of all complete 32-bit words; four independent lanes so the
+ * compiler can use wide loads, folded at the end. Order doesn't
+ * matter for XOR, so this matches the old word-serial loop.
+ */
+static uint32_t xor32_buf(const uint32_t *words, size_t n_words)
 {
-	static uint32_t table[0x100];
+	uint32_t lane[4] = { 0, 0, 0, 0 };
+	size_t i;
+
+	for (i = 0; i + 4 <= n_words; i += 4) {
+		lane[0] ^= words[i];
+		lane[1] ^= words[i + 1];
+		lane[2] ^= words[i + 2];
+		lane[3] ^= words[i + 3];
+	}
+	for (; i < n_words; i++)
+		lane[0] ^= words[i];
 
-	if (!*table)
-		for (size_t i = 0; i < 0x100; ++i)
-			table[i] = crc32_for_byte(i);
-	for (size_t i = 0; i < n_bytes; ++i)
-		*crc = table[(uint8_t)*crc ^ ((uint8_t *)data)[i]] ^ *crc >> 8;
+	return lane[0] ^ lane[1] ^ lane[2] ^ lane[3];
 }
 
 static void usage(int status)
@@ -63,11 +68,11 @@ static void usage(int status)
 
 int main(int argc, char *argv[])
 {
+	struct fwu_input in = { 0 };
 	uint32_t crc = 0;
+	size_t length = 0;
 	FILE *in_fp;
 	FILE *out_fp;
-	uint32_t buf[CHUNK_SIZE];
-	size_t read;
 
 	progname = argv[0];
 
@@ -104,57 +109,48 @@ int main(int argc, char *argv[])
 	if (!infile || !outfile)
 		usage(EXIT_FAILURE);
 
+	if (fwu_input_open(&in, infile)) {
+		fprintf(stderr, "Error opening input file: %s\n", infile);
+		return EXIT_FAILURE;
+	}
 	in_fp = fopen(infile, "r");
 	if (!in_fp) {
 		fprintf(stderr, "Error opening input file: %s\n", infile);
+		fwu_input_close(&in);
 		return EXIT_FAILURE;
 	}
 	out_fp = fopen(outfile, "w");
 	if (!out_fp) {
 		fprintf(stderr, "Error opening output file: %s\n", outfile);
 		fclose(in_fp);
+		fwu_input_close(&in);
 		return EXIT_FAILURE;
 	}
 
-	while (!feof(in_fp)) {
-		switch (model) {
-		case MODEL_3390:
-			read = fread(buf, sizeof(uint32_t), CHUNK_SIZE, in_fp);
-			if (ferror(in_fp)) {
-				fprintf(stderr, "Error reading input file: %s\n", infile);
-				fclose(in_fp);
-				fclose(out_fp);
-				return EXIT_FAILURE;
-			}
-			for (int i = 0; i < read; i++)
-				crc = crc ^ buf[i];
-			fwrite(buf, sizeof(uint32_t), read, out_fp);
-			if (ferror(out_fp)) {
-				fprintf(stderr, "Error writing output file: %s\n", outfile);
-				fclose(in_fp);
-				fclose(out_fp);
-				return EXIT_FAILURE;
-			}
-			break;
-		case MODEL_X490:
-			read = fread(buf, 1, sizeof(uint32_t) * CHUNK_SIZE, in_fp);
-			if (ferror(in_fp)) {
-				fprintf(stderr, "Error reading input file: %s\n", infile);
-				fclose(in_fp);
-				fclose(out_fp);
-				return EXIT_FAILURE;
-			}
-			crc32(buf, read, &crc);
-			fwrite(buf, 1, read, out_fp);
-			if (ferror(out_fp)) {
-				fprintf(stderr, "Error writing output file: %s\n", outfile);
-				fclose(in_fp);
-				fclose(out_fp);
-				return EXIT_FAILURE;
-			}
-			break;
-		}
+	switch (model) {
+	case MODEL_3390:
+		/* whole words only; a trailing partial word never made it
+		 * into the checksum or the copy */
+		length = in.size & ~(size_t)3;
+		crc = xor32_buf(in.data, length / 4);
+		break;
+	case MODEL_X490:
+		/* the old private table walk computed a standard zlib
+		 * CRC-32; split it across the shared thread pool */
+		length = in.size;
+		crc = fwu_crc32_parallel(0L, in.data, in.size, -1);
+		break;
+	}
+
+	/* the payload is copied through unchanged, in the kernel */
+	if (fwu_copy_data(in_fp, out_fp, length) != (ssize_t)length) {
+		fprintf(stderr, "Error writing output file: %s\n", outfile);
+		fclose(in_fp);
+		fclose(out_fp);
+		fwu_input_close(&in);
+		return EXIT_FAILURE;
 	}
+
 	if (model == MODEL_X490)
 		crc = bswap_32(crc);
 	fwrite(&crc, sizeof(uint32_t), 1, out_fp);
@@ -162,10 +158,12 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "Error writing checksum to output file: %s\n", outfile);
 		fclose(in_fp);
 		fclose(out_fp);
+		fwu_input_close(&in);
 		return EXIT_FAILURE;
 	}
 	fclose(in_fp);
 	fclose(out_fp);
+	fwu_input_close(&in);
 	printf("Done.\n");
 	return EXIT_SUCCESS;
 }
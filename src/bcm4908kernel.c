@@ -12,6 +12,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "fwu_io.h"
+
 #if !defined(__BYTE_ORDER)
 #error "Unknown byte order"
 #endif
@@ -43,11 +45,9 @@ static void usage() {
 
 int main(int argc, char **argv) {
 	struct bcm4908kernel_header header;
-	uint8_t buf[1024];
 	FILE *out = NULL;
 	FILE *in = NULL;
-	size_t length;
-	size_t bytes;
+	ssize_t length;
 	int err = 0;
 	char c;
 
@@ -92,15 +92,15 @@ int main(int argc, char **argv) {
 		goto err_close;
 	}
 
-	length = 0;
+	/* the kernel payload is copied through unchanged; fwu_copy_data()
+	 * keeps it in the kernel instead of bouncing it through a 1 KiB
+	 * buffer */
 	rewind(in);
-	while ((bytes = fread(buf, 1, sizeof(buf), in)) > 0) {
-		if (fwrite(buf, 1, bytes, out) != bytes) {
-			fprintf(stderr, "Failed to write %zu B to the output file\n", bytes);
-			err = -EIO;
-			goto err_close;
-		}
-		length += bytes;
+	length = fwu_copy_data(in, out, 0);
+	if (length < 0) {
+		fprintf(stderr, "Failed to write to the output file\n");
+		err = -EIO;
+		goto err_close;
 	}
 
 	header.boot_load_addr = cpu_to_le32(0x00080000);
@@ -73,6 +73,12 @@ int dump_header ( ldr_header_t* hd );
  * @return
  */
 char* get_control_info ( uint16_t control );
+
+/**
+ * Fills the internal crc tables. Called lazily by get_buffer_crc; call it
+ * once up front before sharing the tables between threads.
+ */
+void init_crc_tab ( void );
 #endif
 
 /**
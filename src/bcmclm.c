@@ -4,8 +4,10 @@
  */
 
 #include <byteswap.h>
+#include <dirent.h>
 #include <endian.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -194,7 +196,7 @@ static int bcmclm_search(FILE *fp, struct bcmclm_info *info)
 	return -ENOENT;
 }
 
-static int bcmclm_parse(FILE *fp, struct bcmclm_info *info)
+static int bcmclm_parse(FILE *fp, struct bcmclm_info *info, int quick)
 {
 	struct bcmclm_header *header = &info->header;
 	struct bcmclm_lookup_table *lookup_table = &info->lookup_table;
@@ -226,6 +228,11 @@ static int bcmclm_parse(FILE *fp, struct bcmclm_info *info)
 
 	info->offsets_fixup = info->clm_offset - le32_to_cpu(header->virtual_header_address);
 
+	/* the header carries everything the existence/version check in CI
+	 * needs; quick mode stops here */
+	if (quick)
+		return 0;
+
 	/* Lookup table */
 
 	fseek(fp, le32_to_cpu(info->header.lookup_table_address) + info->offsets_fixup, SEEK_SET);
@@ -310,11 +317,12 @@ static int bcmclm_info(int argc, char **argv)
 	struct bcmclm_info info = {};
 	const char *pathname = NULL;
 	int search = 0;
+	int quick = 0;
 	FILE *fp;
 	int c;
 	int err = 0;
 
-	while ((c = getopt(argc, argv, "i:s")) != -1) {
+	while ((c = getopt(argc, argv, "i:sq")) != -1) {
 		switch (c) {
 		case 'i':
 			pathname = optarg;
@@ -322,6 +330,9 @@ static int bcmclm_info(int argc, char **argv)
 		case 's':
 			search = 1;
 			break;
+		case 'q':
+			quick = 1;
+			break;
 		}
 	}
 
@@ -340,7 +351,7 @@ static int bcmclm_info(int argc, char **argv)
 		}
 	}
 
-	err = bcmclm_parse(fp, &info);
+	err = bcmclm_parse(fp, &info, quick);
 	if (err) {
 		fprintf(stderr, "Failed to parse CLM\n");
 		goto err_close;
@@ -350,6 +361,10 @@ static int bcmclm_info(int argc, char **argv)
 	printf("Compiler: %s\n", info.header.compiler);
 	printf("clm_import_ver: %s\n", info.header.clm_import_ver);
 	printf("Manufacturer: %s\n", info.header.manufacturer);
+
+	if (quick)
+		goto err_close;
+
 	printf("\n");
 	printf("Virtual header address: 0x%08x (real: 0x%zx)\n", le32_to_cpu(info.header.virtual_header_address), le32_to_cpu(info.header.virtual_header_address) + info.offsets_fixup);
 	printf("Virtual lookup table address: 0x%08x (real: 0x%zx)\n", le32_to_cpu(info.header.lookup_table_address), le32_to_cpu(info.header.lookup_table_address) + info.offsets_fixup);
@@ -363,6 +378,188 @@ out:
 	return err;
 }
 
+/**************************************************
+ * Batch
+ **************************************************/
+
+struct bcmclm_batch_ctx {
+	char **paths;
+	size_t n_paths;
+	size_t next;
+	int quick;
+	int fails;
+	pthread_mutex_t lock;
+};
+
+static void *bcmclm_batch_worker(void *arg)
+{
+	struct bcmclm_batch_ctx *ctx = arg;
+
+	for (;;) {
+		struct bcmclm_info info = {};
+		const char *path;
+		FILE *fp;
+		int err;
+
+		pthread_mutex_lock(&ctx->lock);
+		if (ctx->next >= ctx->n_paths) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		path = ctx->paths[ctx->next++];
+		pthread_mutex_unlock(&ctx->lock);
+
+		fp = fopen(path, "r");
+		if (fp) {
+			err = bcmclm_parse(fp, &info, ctx->quick);
+			fclose(fp);
+		} else {
+			err = -EACCES;
+		}
+
+		/* one tab-separated line per blob, under the lock so lines
+		 * from different workers never interleave */
+		pthread_mutex_lock(&ctx->lock);
+		if (err) {
+			printf("%s\tFAIL\n", path);
+			ctx->fails++;
+		} else {
+			printf("%s\tOK\t%.20s\t%.30s\t%.22s\n", path,
+			       info.header.api, info.header.clm_import_ver,
+			       info.header.manufacturer);
+		}
+		pthread_mutex_unlock(&ctx->lock);
+	}
+
+	return NULL;
+}
+
+static int bcmclm_batch_add_path(struct bcmclm_batch_ctx *ctx, size_t *alloc, const char *path)
+{
+	if (ctx->n_paths == *alloc) {
+		char **paths;
+
+		*alloc = *alloc ? *alloc * 2 : 64;
+		paths = realloc(ctx->paths, *alloc * sizeof(*paths));
+		if (!paths)
+			return -ENOMEM;
+		ctx->paths = paths;
+	}
+
+	ctx->paths[ctx->n_paths] = strdup(path);
+	if (!ctx->paths[ctx->n_paths])
+		return -ENOMEM;
+	ctx->n_paths++;
+
+	return 0;
+}
+
+/*
+ * Check every CLM in a directory or newline-delimited manifest on a
+ * small thread pool; a release's worth of blobs costs one process
+ * start instead of one per blob.
+ */
+static int bcmclm_batch(int argc, char **argv)
+{
+	struct bcmclm_batch_ctx ctx = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	const char *pathname = NULL;
+	size_t alloc = 0;
+	pthread_t threads[16];
+	struct stat st;
+	long n_threads;
+	size_t i;
+	int c;
+	int err = 0;
+
+	while ((c = getopt(argc, argv, "i:q")) != -1) {
+		switch (c) {
+		case 'i':
+			pathname = optarg;
+			break;
+		case 'q':
+			ctx.quick = 1;
+			break;
+		}
+	}
+
+	if (!pathname || stat(pathname, &st)) {
+		fprintf(stderr, "No valid directory or manifest specified\n");
+		return -EINVAL;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		struct dirent *d;
+		char path[4096];
+		DIR *dir;
+
+		dir = opendir(pathname);
+		if (!dir) {
+			fprintf(stderr, "Failed to open %s\n", pathname);
+			return -EACCES;
+		}
+		while ((d = readdir(dir))) {
+			if (d->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", pathname, d->d_name);
+			if (stat(path, &st) || !S_ISREG(st.st_mode))
+				continue;
+			err = bcmclm_batch_add_path(&ctx, &alloc, path);
+			if (err)
+				break;
+		}
+		closedir(dir);
+	} else {
+		char *line = NULL;
+		size_t line_len = 0;
+		FILE *fp;
+
+		fp = fopen(pathname, "r");
+		if (!fp) {
+			fprintf(stderr, "Failed to open %s\n", pathname);
+			return -EACCES;
+		}
+		while (getline(&line, &line_len, fp) >= 0) {
+			line[strcspn(line, "\r\n")] = '\0';
+			if (!line[0] || line[0] == '#')
+				continue;
+			err = bcmclm_batch_add_path(&ctx, &alloc, line);
+			if (err)
+				break;
+		}
+		free(line);
+		fclose(fp);
+	}
+	if (err)
+		goto out;
+
+	n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads < 1)
+		n_threads = 1;
+	if ((size_t)n_threads > ctx.n_paths)
+		n_threads = ctx.n_paths;
+	if (n_threads > (long)ARRAY_SIZE(threads))
+		n_threads = ARRAY_SIZE(threads);
+
+	for (i = 0; i < (size_t)n_threads; i++)
+		if (pthread_create(&threads[i], NULL, bcmclm_batch_worker, &ctx)) {
+			n_threads = i;
+			break;
+		}
+	for (i = 0; i < (size_t)n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (ctx.fails)
+		err = -EPROTO;
+
+out:
+	for (i = 0; i < ctx.n_paths; i++)
+		free(ctx.paths[i]);
+	free(ctx.paths);
+	return err;
+}
+
 /**************************************************
  * Start
  **************************************************/
@@ -375,10 +572,17 @@ static void usage()
 	printf("\tbcmclm info <options>\n");
 	printf("\t-i <file>\t\t\t\t\tinput CLM\n");
 	printf("\t-s\t\t\t\t\tsearch for CLM data in bigger file\n");
+	printf("\t-q\t\t\t\t\theader only (quick existence/version check)\n");
+	printf("\n");
+	printf("Checking many CLMs at once:\n");
+	printf("\tbcmclm batch <options>\n");
+	printf("\t-i <dir|manifest>\t\t\t\tdirectory or newline-delimited list of CLMs\n");
+	printf("\t-q\t\t\t\t\theader only (quick existence/version check)\n");
 	printf("\n");
 	printf("Examples:\n");
 	printf("\tbcmclm info -i x.clm\n");
 	printf("\tbcmclm info -s -i brcmfmac4366c-pcie.bin\n");
+	printf("\tbcmclm batch -q -i clm-blobs/\n");
 }
 
 int main(int argc, char **argv)
@@ -387,6 +591,8 @@ int main(int argc, char **argv)
 		optind++;
 		if (!strcmp(argv[1], "info"))
 			return bcmclm_info(argc, argv);
+		else if (!strcmp(argv[1], "batch"))
+			return bcmclm_batch(argc, argv);
 	}
 
 	usage();
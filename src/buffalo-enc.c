@@ -10,8 +10,11 @@
 #include <libgen.h>
 #include <getopt.h>     /* for getopt() */
 #include <stdarg.h>
+#include <unistd.h>
 
 #include "buffalo-lib.h"
+#include "fwu_io.h"
+#include "fwu_perf.h"
 
 #define ERR(fmt, args...) do { \
 	fflush(0); \
@@ -77,6 +80,8 @@ static int decrypt_file(void)
 		goto out;
 	}
 
+	fwu_perf_phase("read");
+	fwu_perf_bytes(src_len);
 	err = read_file_to_buf(ifname, buf, src_len);
 	if (err) {
 		ERR("unable to read from file '%s'", ifname);
@@ -87,6 +92,8 @@ static int decrypt_file(void)
 	ep.key = (unsigned char *) crypt_key;
 	ep.longstate = longstate;
 
+	fwu_perf_phase("crypt");
+	fwu_perf_bytes(src_len - offset);
 	err = decrypt_buf(&ep, buf + offset, src_len - offset);
 	if (err) {
 		ERR("unable to decrypt '%s'", ifname);
@@ -100,6 +107,8 @@ static int decrypt_file(void)
 	printf("Data len\t: %u\n", ep.datalen);
 	printf("Checksum\t: 0x%08x\n", ep.csum);
 
+	fwu_perf_phase("write");
+	fwu_perf_bytes(ep.datalen);
 	err = write_buf_to_file(ofname, buf + offset, ep.datalen);
 	if (err) {
 		ERR("unable to write to file '%s'", ofname);
@@ -113,13 +122,18 @@ out:
 	return ret;
 }
 
+/*
+ * The payload is streamed through encrypt_stream() in fixed-size
+ * chunks; the old path buffered header plus whole image in memory,
+ * which large images tripped over.
+ */
 static int encrypt_file(void)
 {
 	struct enc_param ep;
-	ssize_t src_len, tail_dst, tail_len, tail_src;
-	unsigned char *buf;
-	uint32_t hdrlen;
-	ssize_t totlen = 0;
+	ssize_t src_len, tail_dst, tail_len = 0, pad;
+	unsigned long datalen;
+	FILE *ifp = NULL;
+	FILE *ofp = NULL;
 	int err;
 	int ret = -1;
 
@@ -129,62 +143,73 @@ static int encrypt_file(void)
 		goto out;
 	}
 
-	if (size) {
-		tail_dst = enc_compute_buf_len(product, version, size);
-		tail_len = src_len - size;
-		totlen = tail_dst + tail_len;
-	} else
-		totlen = enc_compute_buf_len(product, version, src_len);
-
-	buf = malloc(totlen);
-	if (buf == NULL) {
-		ERR("no memory for the buffer");
+	/* nothing to encrypt; don't emit a header-only image */
+	if (src_len == 0) {
+		ERR("empty input file '%s'", ifname);
 		goto out;
 	}
 
-	hdrlen = enc_compute_header_len(product, version);
+	datalen = (size) ? (unsigned long) size : (unsigned long) src_len;
+	if (size)
+		tail_len = src_len - size;
+	tail_dst = enc_compute_buf_len(product, version, datalen);
 
-	err = read_file_to_buf(ifname, &buf[hdrlen], src_len);
-	if (err) {
-		ERR("unable to read from file '%s'", ofname);
-		goto free_buf;
+	ifp = fopen(ifname, "r");
+	if (ifp == NULL) {
+		ERR("unable to read from file '%s'", ifname);
+		goto out;
 	}
 
-	if (size) {
-		tail_src = hdrlen + size;
-		memmove(&buf[tail_dst], &buf[tail_src], tail_len);
-		memset(&buf[tail_src], 0, tail_dst - tail_src);
-		src_len = size;
+	ofp = fopen(ofname, "w");
+	if (ofp == NULL) {
+		ERR("unable to write to file '%s'", ofname);
+		goto out;
 	}
 
 	memset(&ep, '\0', sizeof(ep));
 	ep.key = (unsigned char *) crypt_key;
 	ep.seed = seed;
 	ep.longstate = longstate;
-	ep.csum = buffalo_csum(src_len, &buf[hdrlen], src_len);
-	ep.datalen = src_len;
+	ep.datalen = datalen;
 	strcpy((char *) ep.magic, magic);
 	strcpy((char *) ep.product, product);
 	strcpy((char *) ep.version, version);
 
-	err = encrypt_buf(&ep, buf, &buf[hdrlen]);
+	fwu_perf_phase("crypt");
+	fwu_perf_bytes(datalen);
+	err = encrypt_stream(&ep, ifp, ofp);
 	if (err) {
-		ERR("invalid input file");
-		goto free_buf;
+		ERR("unable to encrypt '%s'", ifname);
+		goto out;
 	}
 
-	err = write_buf_to_file(ofname, buf, totlen);
-	if (err) {
+	/* zero pad up to the aligned total length */
+	pad = tail_dst - (enc_compute_header_len(product, version) +
+			  datalen + sizeof(uint32_t));
+	if (fwu_append_zeros(ofp, pad)) {
 		ERR("unable to write to file '%s'", ofname);
-		goto free_buf;
+		goto out;
+	}
+
+	/* the unencrypted tail (-S) is copied through verbatim */
+	fwu_perf_phase("tail");
+	fwu_perf_bytes(tail_len);
+	if (tail_len && fwu_copy_data(ifp, ofp, tail_len) != tail_len) {
+		ERR("unable to write to file '%s'", ofname);
+		goto out;
 	}
 
 	ret = 0;
 
-free_buf:
- 	free(buf);
 out:
- 	return ret;
+	if (ifp)
+		fclose(ifp);
+	if (ofp) {
+		fclose(ofp);
+		if (ret)
+			unlink(ofname);
+	}
+	return ret;
 }
 
 static int check_params(void)
@@ -308,6 +333,8 @@ int main(int argc, char *argv[])
 	else
 		err = encrypt_file();
 
+	fwu_perf_done("buffalo-enc");
+
 	if (err)
 		goto out;
 
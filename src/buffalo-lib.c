@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 
 #include "buffalo-lib.h"
+#include "fwu_xor.h"
 
 static uint32_t crc32_table[256] =
 {
@@ -117,22 +118,44 @@ int bcrypt_process(struct bcrypt_ctx *ctx, unsigned char *src,
 {
 	unsigned char *state = ctx->state;
 	unsigned long state_len = ctx->state_len;
+	unsigned char ks[4096];
+	unsigned long done = 0;
 	unsigned char i, j;
-	unsigned long k;
 
 	i = ctx->i;
 	j = ctx->j;
 
-	for (k = 0; k < len; k++) {
-		unsigned char t;
-
-		i = (i + 1) % state_len;
-		j = (j + state[i]) % state_len;
-		t = state[j];
-		state[j] = state[i];
-		state[i] = t;
-
-		dst[k] = src[k] ^ state[(state[i] + state[j]) % state_len];
+	/*
+	 * The state swaps are serially data-dependent, but the XOR with
+	 * the payload is not: generate the keystream for a cache-resident
+	 * block first, then apply it with wide XORs.
+	 */
+	while (done < len) {
+		unsigned long n = len - done;
+		unsigned long k;
+
+		if (n > sizeof(ks))
+			n = sizeof(ks);
+
+		for (k = 0; k < n; k++) {
+			unsigned char t;
+
+			i = (i + 1) % state_len;
+			j = (j + state[i]) % state_len;
+			t = state[j];
+			state[j] = state[i];
+			state[i] = t;
+
+			ks[k] = state[(state[i] + state[j]) % state_len];
+		}
+
+		/* decrypt_buf() moves data in place with overlapping
+		 * src/dst, so this must be memmove, not memcpy */
+		if (dst != src)
+			memmove(dst + done, src + done, n);
+		fwu_xor_buf(dst + done, ks, n);
+
+		done += n;
 	}
 
 	ctx->i = i;
@@ -188,23 +211,137 @@ uint32_t buffalo_csum(uint32_t csum, void *buf, unsigned long len)
 	return csum;
 }
 
-uint32_t buffalo_crc(void *buf, unsigned long len)
+/* Extended tables for the slice-by-8 walk below, derived from
+ * crc32_table on first use. */
+static uint32_t crc32_tab8[8][256];
+static int crc32_tab8_ready;
+
+static void crc32_tab8_init(void)
+{
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t crc = crc32_table[i];
+
+		crc32_tab8[0][i] = crc;
+		for (k = 1; k < 8; k++) {
+			crc = (crc << 8) ^ crc32_table[(crc >> 24) & 0xFF];
+			crc32_tab8[k][i] = crc;
+		}
+	}
+
+	crc32_tab8_ready = 1;
+}
+
+uint32_t buffalo_crc_update(uint32_t crc, void *buf, unsigned long len)
 {
 	unsigned char *p = buf;
-	unsigned long t = len;
-	uint32_t crc = 0;
+
+	if (len >= 8 && !crc32_tab8_ready)
+		crc32_tab8_init();
+
+	while (len >= 8) {
+		crc = crc32_tab8[7][(p[0] ^ (crc >> 24)) & 0xFF] ^
+		      crc32_tab8[6][(p[1] ^ (crc >> 16)) & 0xFF] ^
+		      crc32_tab8[5][(p[2] ^ (crc >> 8)) & 0xFF] ^
+		      crc32_tab8[4][(p[3] ^ crc) & 0xFF] ^
+		      crc32_tab8[3][p[4]] ^
+		      crc32_tab8[2][p[5]] ^
+		      crc32_tab8[1][p[6]] ^
+		      crc32_tab8[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
 
 	while (len--)
 		crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *p++) & 0xFF];
 
-	while (t) {
-		crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ t) & 0xFF];
-		t >>= 8;
+	return crc;
+}
+
+/* Fold the total length into the running CRC and invert; this is what
+ * distinguishes the Buffalo variant from plain CRC-32. */
+uint32_t buffalo_crc_final(uint32_t crc, unsigned long total_len)
+{
+	while (total_len) {
+		crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ total_len) & 0xFF];
+		total_len >>= 8;
 	}
 
 	return ~crc;
 }
 
+uint32_t buffalo_crc(void *buf, unsigned long len)
+{
+	return buffalo_crc_final(buffalo_crc_update(0, buf, len), len);
+}
+
+/* GF(2) matrix times vector, zlib style */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	while (vec) {
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+
+	return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+	int n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/*
+ * Advance a running (pre-final) CRC over len zero bytes in O(log len).
+ * The update step is linear over GF(2), so for a shared trailing block
+ * B the full CRC of tag||B is push_zeros(update(0, tag), len(B)) xor
+ * update(0, B): callers can compute update(0, B) once and stamp any
+ * number of differing equal-length tags in front of it.
+ */
+uint32_t buffalo_crc_push_zeros(uint32_t crc, unsigned long len)
+{
+	uint32_t even[32];	/* even-power-of-two zeros operator */
+	uint32_t odd[32];	/* odd-power-of-two zeros operator */
+	int n;
+
+	if (!len)
+		return crc;
+
+	/* operator for one zero bit: MSB-first shift with reduction */
+	for (n = 0; n < 31; n++)
+		odd[n] = 1U << (n + 1);
+	odd[31] = 0x04c11db7;
+
+	/* put operator for two zero bits in even, four in odd */
+	gf2_matrix_square(even, odd);
+	gf2_matrix_square(odd, even);
+
+	/* apply len zero bytes, squaring operators as we go */
+	do {
+		gf2_matrix_square(even, odd);
+		if (len & 1)
+			crc = gf2_matrix_times(even, crc);
+		len >>= 1;
+		if (!len)
+			break;
+
+		gf2_matrix_square(odd, even);
+		if (len & 1)
+			crc = gf2_matrix_times(odd, crc);
+		len >>= 1;
+	} while (len);
+
+	return crc;
+}
+
 unsigned long enc_compute_header_len(char *product, char *version)
 {
 	return ENC_MAGIC_LEN + 1 + strlen(product) + 1 +
@@ -316,6 +453,111 @@ out:
 	return ret;
 }
 
+/*
+ * Streaming counterpart of encrypt_buf(): reads ep->datalen plaintext
+ * bytes from 'from' and writes the header plus the encrypted payload to
+ * 'to' through a fixed-size buffer, so peak memory no longer scales
+ * with the image. The data checksum is accumulated on the fly and lands
+ * after the payload, so nothing needs patching up afterwards; ep->csum
+ * is set for the caller. With longstate the cipher state itself still
+ * grows with ep->datalen - that is inherent to the scheme.
+ */
+int encrypt_stream(struct enc_param *ep, FILE *from, FILE *to)
+{
+	unsigned char hdr[ENC_MAGIC_LEN + 1 + 3 * sizeof(uint32_t) +
+			  ENC_PRODUCT_LEN + ENC_VERSION_LEN];
+	unsigned char bckey[BCRYPT_MAX_KEYLEN + 1];
+	unsigned char buf[16384];
+	struct bcrypt_ctx ctx;
+	unsigned char *p = hdr;
+	unsigned long remain;
+	unsigned int keylen;
+	uint32_t csum;
+	uint32_t len;
+	unsigned char s;
+	int err;
+
+	/* setup magic */
+	len = strlen((char *) ep->magic) + 1;
+	memcpy(p, ep->magic, len);
+	p += len;
+
+	/* setup seed */
+	*p++ = ep->seed;
+
+	/* put product len */
+	len = strlen((char *) ep->product) + 1;
+	put_be32(p, len);
+	p += sizeof(uint32_t);
+
+	/* copy and crypt product name */
+	memcpy(p, ep->product, len);
+	err = bcrypt_buf(ep->seed, ep->key, p, p, len, ep->longstate);
+	if (err)
+		return -1;
+	s = *p;
+	p += len;
+
+	/* put version length */
+	len = strlen((char *) ep->version) + 1;
+	put_be32(p, len);
+	p += sizeof(uint32_t);
+
+	/* copy and crypt version */
+	memcpy(p, ep->version, len);
+	err = bcrypt_buf(s, ep->key, p, p, len, ep->longstate);
+	if (err)
+		return -1;
+	s = *p;
+	p += len;
+
+	/* put data length */
+	put_be32(p, ep->datalen);
+	p += sizeof(uint32_t);
+
+	if (fwrite(hdr, p - hdr, 1, to) != 1)
+		return -1;
+
+	/* setup the payload cipher, seeded by the encrypted version */
+	keylen = strlen((char *) ep->key);
+	bckey[0] = s;
+	memcpy(&bckey[1], ep->key, keylen);
+	keylen++;
+
+	err = bcrypt_init(&ctx, bckey, keylen,
+			  (ep->longstate) ? ep->datalen :
+					    BCRYPT_DEFAULT_STATE_LEN);
+	if (err)
+		return -1;
+
+	csum = ep->datalen;
+	remain = ep->datalen;
+	while (remain) {
+		unsigned long n = (remain < sizeof(buf)) ? remain : sizeof(buf);
+
+		if (fread(buf, n, 1, from) != 1)
+			goto err_free;
+		csum = buffalo_csum(csum, buf, n);
+		bcrypt_process(&ctx, buf, buf, n);
+		if (fwrite(buf, n, 1, to) != 1)
+			goto err_free;
+		remain -= n;
+	}
+	bcrypt_finish(&ctx);
+
+	/* put checksum */
+	ep->csum = csum;
+	put_be32(buf, csum);
+	if (fwrite(buf, sizeof(uint32_t), 1, to) != 1)
+		return -1;
+
+	return 0;
+
+err_free:
+	bcrypt_finish(&ctx);
+	return -1;
+}
+
 int decrypt_buf(struct enc_param *ep, unsigned char *data,
 		unsigned long datalen)
 {
@@ -7,6 +7,7 @@
 #define _BUFFALO_LIB_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define ARRAY_SIZE(_a)	(sizeof((_a)) / sizeof((_a)[0]))
 #define BIT(_x)		(1UL << (_x))
@@ -106,6 +107,7 @@ struct enc_param {
 
 int encrypt_buf(struct enc_param *ep, unsigned char *hdr,
 	        unsigned char *data);
+int encrypt_stream(struct enc_param *ep, FILE *from, FILE *to);
 int decrypt_buf(struct enc_param *ep, unsigned char *data,
 		unsigned long datalen);
 
@@ -129,6 +131,9 @@ int bcrypt_buf(unsigned char seed, unsigned char *key, unsigned char *src,
 
 uint32_t buffalo_csum(uint32_t csum, void *buf, unsigned long len);
 uint32_t buffalo_crc(void *buf, unsigned long len);
+uint32_t buffalo_crc_update(uint32_t crc, void *buf, unsigned long len);
+uint32_t buffalo_crc_final(uint32_t crc, unsigned long total_len);
+uint32_t buffalo_crc_push_zeros(uint32_t crc, unsigned long len);
 
 ssize_t get_file_size(char *name);
 int read_file_to_buf(char *name, void *buf, ssize_t buflen);
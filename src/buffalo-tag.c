@@ -12,6 +12,7 @@
 #include <netinet/in.h>
 
 #include "buffalo-lib.h"
+#include "fwu_io.h"
 
 #define ERR(fmt, ...) do { \
 	fflush(0); \
@@ -45,6 +46,7 @@ static char *region_code;
 static uint32_t region_mask;
 static int num_regions;
 static int dhp;
+static char *combofile;
 
 void usage(int status)
 {
@@ -68,6 +70,8 @@ void usage(int status)
 "  -r <region>     set image region to <region>\n"
 "		   valid regions: JP, US, EU, AP, TW, KR, M_\n"
 "  -s              skip CRC calculation\n"
+"  -T <file>       read (output, regions, language, platform) combinations\n"
+"		   from <file>, one whitespace-separated line each\n"
 "  -v <version>    set major version to <version>\n"
 "  -w <version>    set harwdware version to <version>\n"
 "  -h              show this screen\n"
@@ -94,17 +98,23 @@ static int check_params(void)
 	if (num_files == 0)
 		ERR("no input files specified");
 
-	CHECKSTR(ofname, "output file", 0);
 	CHECKSTR(brand, "brand", TAG_BRAND_LEN);
 	CHECKSTR(product, "product", TAG_PRODUCT_LEN);
-	CHECKSTR(platform, "platform", TAG_PLATFORM_LEN);
 	CHECKSTR(major, "major version", TAG_VERSION_LEN);
 	CHECKSTR(minor, "minor version", TAG_VERSION_LEN);
-	CHECKSTR(language, "language", TAG_LANGUAGE_LEN);
 
 	if (hwver)
 		CHECKSTR(hwver, "hardware version", 2);
 
+	/* output, region, language and platform come per line in
+	 * combinations mode */
+	if (combofile)
+		return 0;
+
+	CHECKSTR(ofname, "output file", 0);
+	CHECKSTR(platform, "platform", TAG_PLATFORM_LEN);
+	CHECKSTR(language, "language", TAG_LANGUAGE_LEN);
+
 	if (num_regions == 0) {
 		ERR("no region code specified");
 		return -1;
@@ -154,7 +164,7 @@ static int process_ifname(char *name)
 	return 0;
 }
 
-static void fixup_tag(unsigned char *buf, ssize_t buflen)
+static void fill_tag(unsigned char *buf, ssize_t buflen)
 {
 	struct buffalo_tag *tag = (struct buffalo_tag *) buf;
 
@@ -185,6 +195,13 @@ static void fixup_tag(unsigned char *buf, ssize_t buflen)
 		memcpy(tag->hwv, "hwv", 3);
 		memcpy(tag->hwv_val, hwver, strlen(hwver));
 	}
+}
+
+static void fixup_tag(unsigned char *buf, ssize_t buflen)
+{
+	struct buffalo_tag *tag = (struct buffalo_tag *) buf;
+
+	fill_tag(buf, buflen);
 
 	if (!skipcrc)
 		tag->crc = htonl(buffalo_crc(buf, buflen));
@@ -322,6 +339,109 @@ out:
 	return ret;
 }
 
+/*
+ * Combinations mode: one payload read and CRC pass serve every
+ * (region, language, platform) variant. The Buffalo CRC update is
+ * linear, so each variant's checksum is the payload CRC (computed
+ * once) xored with the tag's CRC pushed over the payload length.
+ */
+static int tag_file_combinations(void)
+{
+	struct buffalo_tag *tag;
+	struct fwu_input in = { 0 };
+	unsigned char tagbuf[sizeof(struct buffalo_tag)];
+	uint32_t payload_crc;
+	ssize_t buflen;
+	char *line = NULL;
+	size_t line_len = 0;
+	FILE *combo;
+	int lineno = 0;
+	int ret = -1;
+
+	if (num_files != 1 || dhp) {
+		ERR("combinations mode supports a single regular input file");
+		return -1;
+	}
+
+	if (fwu_input_open(&in, ifname[0])) {
+		ERR("unable to read from file '%s'", ifname[0]);
+		return -1;
+	}
+	fsize[0] = in.size;
+	buflen = sizeof(struct buffalo_tag) + in.size;
+
+	payload_crc = buffalo_crc_update(0, in.data, in.size);
+
+	combo = fopen(combofile, "r");
+	if (!combo) {
+		ERR("unable to open '%s'", combofile);
+		goto close_in;
+	}
+
+	while (getline(&line, &line_len, combo) >= 0) {
+		char *regions, *reg, *saveptr;
+		FILE *fin, *fout;
+		uint32_t crc;
+
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!line[0] || line[0] == '#')
+			continue;
+
+		ofname = strtok_r(line, " \t", &saveptr);
+		regions = strtok_r(NULL, " \t", &saveptr);
+		language = strtok_r(NULL, " \t", &saveptr);
+		platform = strtok_r(NULL, " \t", &saveptr);
+		if (!ofname || !regions || !language || !platform ||
+		    strlen(language) > TAG_LANGUAGE_LEN - 1 ||
+		    strlen(platform) > TAG_PLATFORM_LEN - 1) {
+			ERR("invalid combination on line %d of '%s'", lineno, combofile);
+			goto close_combo;
+		}
+
+		region_mask = 0;
+		num_regions = 0;
+		for (reg = strtok_r(regions, ",", &saveptr); reg;
+		     reg = strtok_r(NULL, ",", &saveptr)) {
+			if (process_region(reg))
+				goto close_combo;
+		}
+
+		fill_tag(tagbuf, buflen);
+
+		if (!skipcrc) {
+			crc = buffalo_crc_update(0, tagbuf, sizeof(tagbuf));
+			crc = buffalo_crc_push_zeros(crc, in.size) ^ payload_crc;
+			tag = (struct buffalo_tag *) tagbuf;
+			tag->crc = htonl(buffalo_crc_final(crc, buflen));
+		}
+
+		fout = fopen(ofname, "w");
+		fin = fopen(ifname[0], "r");
+		if (!fout || !fin ||
+		    fwrite(tagbuf, sizeof(tagbuf), 1, fout) != 1 ||
+		    fwu_copy_data(fin, fout, 0) != (ssize_t)in.size) {
+			ERR("unable to write to file '%s'", ofname);
+			if (fout)
+				fclose(fout);
+			if (fin)
+				fclose(fin);
+			goto close_combo;
+		}
+		fclose(fin);
+		fclose(fout);
+	}
+
+	ret = 0;
+
+close_combo:
+	free(line);
+	fclose(combo);
+close_in:
+	fwu_input_close(&in);
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	int res = EXIT_FAILURE;
@@ -332,7 +452,7 @@ int main(int argc, char *argv[])
 	while ( 1 ) {
 		int c;
 
-		c = getopt(argc, argv, "a:b:c:d:f:hi:l:m:o:p:r:sv:w:I:");
+		c = getopt(argc, argv, "a:b:c:d:f:hi:l:m:o:p:r:sv:w:I:T:");
 		if (c == -1)
 			break;
 
@@ -380,6 +500,9 @@ int main(int argc, char *argv[])
 		case 's':
 			skipcrc = 1;
 			break;
+		case 'T':
+			combofile = optarg;
+			break;
 		case 'v':
 			major = optarg;
 			break;
@@ -399,7 +522,10 @@ int main(int argc, char *argv[])
 	if (err)
 		goto out;
 
-	err = tag_file();
+	if (combofile)
+		err = tag_file_combinations();
+	else
+		err = tag_file();
 	if (err)
 		goto out;
 
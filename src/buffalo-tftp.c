@@ -10,8 +10,12 @@
 #include <libgen.h>
 #include <getopt.h>     /* for getopt() */
 #include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "buffalo-lib.h"
+#include "fwu_io.h"
 
 #define ERR(fmt, args...) do { \
 	fflush(0); \
@@ -64,44 +68,71 @@ static void crypt_header(unsigned char *buf, ssize_t len,
 
 static int crypt_file(void)
 {
-	unsigned char *buf = NULL;
-	ssize_t src_len;
-	int err;
+	struct fwu_input in = { 0 };
+	unsigned char hdr[512];
+	struct iovec iov[2];
+	int iovcnt = 1;
+	size_t hdr_len;
+	ssize_t done;
 	int ret = -1;
+	int fd = -1;
 
-	src_len = get_file_size(ifname);
-	if (src_len < 0) {
-		ERR("unable to get size of '%s'", ifname);
-		goto out;
-	}
-
-	buf = malloc(src_len);
-	if (buf == NULL) {
-		ERR("no memory for the buffer");
-		goto out;
-	}
-
-	err = read_file_to_buf(ifname, buf, src_len);
-	if (err) {
+	if (fwu_input_open(&in, ifname)) {
 		ERR("unable to read from file '%s'", ifname);
 		goto out;
 	}
 
+	/*
+	 * Only the first 512 bytes are transformed; crypt a copy of them
+	 * and emit header plus untouched mapped payload in one writev()
+	 * instead of duplicating the whole image in a writable buffer.
+	 */
+	hdr_len = in.size < sizeof(hdr) ? in.size : sizeof(hdr);
+	memcpy(hdr, in.data, hdr_len);
+
 	if (do_decrypt)
-		crypt_header(buf, 512, crypt_key2, crypt_key1);
+		crypt_header(hdr, hdr_len, crypt_key2, crypt_key1);
 	else
-		crypt_header(buf, 512, crypt_key1, crypt_key2);
+		crypt_header(hdr, hdr_len, crypt_key1, crypt_key2);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = hdr_len;
+	if (in.size > hdr_len) {
+		iov[1].iov_base = (unsigned char *)in.data + hdr_len;
+		iov[1].iov_len = in.size - hdr_len;
+		iovcnt = 2;
+	}
 
-	err = write_buf_to_file(ofname, buf, src_len);
-	if (err) {
+	fd = open(ofname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
 		ERR("unable to write to file '%s'", ofname);
 		goto out;
 	}
 
+	while (iovcnt) {
+		done = writev(fd, iov, iovcnt);
+		if (done < 0) {
+			ERR("unable to write to file '%s'", ofname);
+			goto out;
+		}
+
+		while (iovcnt && (size_t)done >= iov[0].iov_len) {
+			done -= iov[0].iov_len;
+			iov[0] = iov[1];
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov[0].iov_base = (unsigned char *)iov[0].iov_base + done;
+			iov[0].iov_len -= done;
+		}
+	}
+
 	ret = 0;
 
 out:
-	free(buf);
+	if (fd >= 0)
+		close(fd);
+	fwu_input_close(&in);
 	return ret;
 }
 
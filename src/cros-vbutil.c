@@ -53,6 +53,8 @@
 #include <openssl/x509.h>
 #include <openssl/sha.h>
 
+#include "fwu_jobs.h"
+
 #define BLOCK_PAD 65536
 /* Sections are aligned to 4K blocks */
 #define ALIGN 4096
@@ -347,6 +349,8 @@ struct vb2_kernel_preamble {
 	uint32_t flags;
 } __attribute__((packed));
 
+static RSA *rsa_key;
+
 /*
  * Order matters. |data| may overlap with |siginfo|, so we need to fill out
  * |siginfo| before computing the signature.
@@ -363,7 +367,6 @@ static int sign(const void *data, size_t len, struct vb2_signature *siginfo,
 	siginfo->sig_size = SIG_SIZE;
 	siginfo->data_size = len;
 
-	const unsigned char *p = privk;
 	char digest_info[] = {
 		0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
 		0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20,
@@ -378,13 +381,23 @@ static int sign(const void *data, size_t len, struct vb2_signature *siginfo,
 	memcpy(digest, digest_info, sizeof(digest_info));
 	memcpy(digest + sizeof(digest_info), hash, sizeof(hash));
 
-	RSA *key = d2i_RSAPrivateKey(0, &p, privk_len);
-	if (!key) {
-		fprintf(stderr, "Failed d2i_RSAPrivateKey()\n");
-		return -1;
+	/*
+	 * The key is baked into the binary, so parse it once and keep it;
+	 * OpenSSL also caches the Montgomery/CRT context inside the RSA
+	 * object after the first signature. This is what makes batch mode
+	 * cheap when many payloads are signed by one process.
+	 */
+	if (!rsa_key) {
+		const unsigned char *p = privk;
+
+		rsa_key = d2i_RSAPrivateKey(0, &p, privk_len);
+		if (!rsa_key) {
+			fprintf(stderr, "Failed d2i_RSAPrivateKey()\n");
+			return -1;
+		}
 	}
 
-	ret = RSA_private_encrypt(sizeof(digest), digest, sigout, key,
+	ret = RSA_private_encrypt(sizeof(digest), digest, sigout, rsa_key,
 				  RSA_PKCS1_PADDING);
 	if (ret == -1) {
 		fprintf(stderr, "%s: RSA_private_encrypt() failed\n", __func__);
@@ -497,6 +510,9 @@ static int vbutil_pack(const char *kernel, size_t kernel_len,
 	memcpy(p, kblob, kblob_len);
 	p += kblob_len;
 
+	free(h);
+	free(kblob);
+
 	if (outbuf) {
 		*out = outbuf;
 		*out_len = outlen;
@@ -540,7 +556,7 @@ static void * read_file(const char *path, size_t *out_len)
 	return p;
 }
 
-int main(int argc, char * const argv[])
+static int cros_vbutil_run(int argc, char **argv)
 {
 	int ret;
 	const char *kernel_file = NULL;
@@ -604,5 +620,13 @@ int main(int argc, char * const argv[])
 	}
 	close(fd);
 
+	free(kernel);
+	free(out);
+
 	return 0;
 }
+
+int main(int argc, char **argv)
+{
+	return fwu_jobs_run(argc, argv, cros_vbutil_run);
+}
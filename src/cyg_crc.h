@@ -103,6 +103,19 @@ cyg_ether_crc32_accumulate(cyg_uint32 crc, void *s, int len);
 __externC cyg_uint16
 cyg_crc16(void *s, int len);
 
+// 16 bit CRC, but accumulate the result from a previous CRC
+// calculation.
+
+__externC cyg_uint16
+cyg_crc16_accumulate(cyg_uint16 crc, void *s, int len);
+
+// Merge two 16 bit CRCs computed over adjacent chunks: crc1 over the
+// first chunk (any initial value), crc2 over the second chunk with
+// initial value 0 and length len2.
+
+__externC cyg_uint16
+cyg_crc16_combine(cyg_uint16 crc1, cyg_uint16 crc2, unsigned long len2);
+
 #endif // _SERVICES_CRC_CRC_H_
 
 
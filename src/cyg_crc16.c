@@ -95,17 +95,130 @@ static const cyg_uint16 crc16_tab[] = {
     0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0, 
 };
 
+/* Extended tables for the slice-by-8 walk below; crc16_tab8[k][b] is
+   the CRC of byte b followed by k zero bytes.  Derived from crc16_tab
+   on first use. */
+static cyg_uint16 crc16_tab8[8][256];
+static int crc16_tab8_ready;
+
+static void
+crc16_tab8_init(void)
+{
+    int i, k;
+
+    for (i = 0;  i < 256;  i++) {
+        cyg_uint16 crc = crc16_tab[i];
+
+        crc16_tab8[0][i] = crc;
+        for (k = 1;  k < 8;  k++) {
+            crc = crc16_tab[(crc >> 8) & 0xFF] ^ (crc << 8);
+            crc16_tab8[k][i] = crc;
+        }
+    }
+
+    crc16_tab8_ready = 1;
+}
+
+/* As above, but accumulate the CRC into the result of a previous
+   CRC calculation. */
 cyg_uint16
-cyg_crc16(void *ptr, int len)
+cyg_crc16_accumulate(cyg_uint16 cksum, void *ptr, int len)
 {
     unsigned char *buf = ptr;
-    int i;
-    cyg_uint16 cksum;
 
-    cksum = 0;
-    for (i = 0;  i < len;  i++) {
+    if (len >= 8 && !crc16_tab8_ready)
+        crc16_tab8_init();
+
+    while (len >= 8) {
+        cksum = crc16_tab8[7][(buf[0] ^ (cksum >> 8)) & 0xFF] ^
+                crc16_tab8[6][(buf[1] ^ cksum) & 0xFF] ^
+                crc16_tab8[5][buf[2]] ^
+                crc16_tab8[4][buf[3]] ^
+                crc16_tab8[3][buf[4]] ^
+                crc16_tab8[2][buf[5]] ^
+                crc16_tab8[1][buf[6]] ^
+                crc16_tab8[0][buf[7]];
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len-- > 0) {
         cksum = crc16_tab[((cksum>>8) ^ *buf++) & 0xFF] ^ (cksum << 8);
     }
     return cksum;
 }
 
+/* GF(2) matrix helpers for the combine below, zlib crc32_combine
+   style but over the 16 bit register. */
+static cyg_uint16
+gf2_matrix_times16(const cyg_uint16 *mat, cyg_uint16 vec)
+{
+    cyg_uint16 sum = 0;
+
+    while (vec) {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+
+    return sum;
+}
+
+static void
+gf2_matrix_square16(cyg_uint16 *square, const cyg_uint16 *mat)
+{
+    int n;
+
+    for (n = 0;  n < 16;  n++)
+        square[n] = gf2_matrix_times16(mat, mat[n]);
+}
+
+/* Merge two CRCs computed over adjacent chunks: crc1 over the first
+   chunk (any initial value), crc2 over the second chunk accumulated
+   from 0 over len2 bytes.  The update step carries no initial or
+   final xor, so it is linear over GF(2) and crc1 only needs to be
+   pushed over len2 zero bytes, in O(log len2). */
+cyg_uint16
+cyg_crc16_combine(cyg_uint16 crc1, cyg_uint16 crc2, unsigned long len2)
+{
+    cyg_uint16 even[16];        // even-power-of-two zeros operator
+    cyg_uint16 odd[16];         // odd-power-of-two zeros operator
+    int n;
+
+    if (len2 == 0)
+        return crc1 ^ crc2;
+
+    // operator for one zero bit: MSB-first shift with reduction
+    for (n = 0;  n < 15;  n++)
+        odd[n] = 1 << (n + 1);
+    odd[15] = 0x1021;
+
+    // put operator for two zero bits in even, four in odd
+    gf2_matrix_square16(even, odd);
+    gf2_matrix_square16(odd, even);
+
+    // apply len2 zero bytes to crc1, squaring operators as we go
+    do {
+        gf2_matrix_square16(even, odd);
+        if (len2 & 1)
+            crc1 = gf2_matrix_times16(even, crc1);
+        len2 >>= 1;
+        if (len2 == 0)
+            break;
+
+        gf2_matrix_square16(odd, even);
+        if (len2 & 1)
+            crc1 = gf2_matrix_times16(odd, crc1);
+        len2 >>= 1;
+    } while (len2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+cyg_uint16
+cyg_crc16(void *ptr, int len)
+{
+    return cyg_crc16_accumulate(0, ptr, len);
+}
+
@@ -57,6 +57,12 @@
 #include <cyg/crc/crc.h>
 #else
 #include "cyg_crc.h"
+#endif
+
+#include <string.h>
+
+#ifdef __ARM_FEATURE_CRC32
+#include <arm_acle.h>
 #endif
 
   /* ====================================================================== */
@@ -124,20 +130,84 @@ static const cyg_uint32 crc32_tab[] = {
       0x2d02ef8dL
    };
 
-/* This is the standard Gary S. Brown's 32 bit CRC algorithm, but
-   accumulate the CRC into the result of a previous CRC. */
-cyg_uint32 
-cyg_crc32_accumulate(cyg_uint32 crc32val, void *ptr, int len)
+/* Slice-by-8 tables, derived from crc32_tab on first use.  Processing
+   eight input bytes per iteration roughly quadruples throughput over
+   the classic byte-at-a-time walk on the large NAND images some of the
+   tools here run over. */
+static cyg_uint32 crc32_tab8[8][256];
+static int crc32_tab8_ready;
+
+static void
+crc32_tab8_init(void)
 {
-  unsigned char *s = ptr;
-  int i;
+  int i, k;
+
+  for (i = 0; i < 256; i++) {
+    cyg_uint32 c = crc32_tab[i];
+
+    crc32_tab8[0][i] = c;
+    for (k = 1; k < 8; k++) {
+      c = crc32_tab[c & 0xff] ^ (c >> 8);
+      crc32_tab8[k][i] = c;
+    }
+  }
+  crc32_tab8_ready = 1;
+}
+
+/* Core update loop shared by the plain and Ethernet FCS entry points
+   (the pre/post inversion of the FCS variant happens outside of it).
+   Uses the ARMv8 CRC32 instructions when the compiler targets them
+   (they implement the same reflected polynomial as crc32_tab), and a
+   slice-by-8 table walk otherwise. */
+static cyg_uint32
+crc32_update(cyg_uint32 crc32val, const unsigned char *s, int len)
+{
+#ifdef __ARM_FEATURE_CRC32
+  while (len >= 8) {
+    uint64_t d;
+
+    memcpy(&d, s, 8);
+    crc32val = __crc32d(crc32val, d);
+    s += 8;
+    len -= 8;
+  }
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (len >= 8 && !crc32_tab8_ready)
+    crc32_tab8_init();
+
+  while (len >= 8) {
+    cyg_uint32 lo, hi;
 
-  for (i = 0;  i < len;  i++) {
-    crc32val = crc32_tab[(crc32val ^ s[i]) & 0xff] ^ (crc32val >> 8);
+    memcpy(&lo, s, 4);
+    memcpy(&hi, s + 4, 4);
+    lo ^= crc32val;
+    crc32val = crc32_tab8[7][lo & 0xff] ^
+	       crc32_tab8[6][(lo >> 8) & 0xff] ^
+	       crc32_tab8[5][(lo >> 16) & 0xff] ^
+	       crc32_tab8[4][lo >> 24] ^
+	       crc32_tab8[3][hi & 0xff] ^
+	       crc32_tab8[2][(hi >> 8) & 0xff] ^
+	       crc32_tab8[1][(hi >> 16) & 0xff] ^
+	       crc32_tab8[0][hi >> 24];
+    s += 8;
+    len -= 8;
   }
+#endif
+
+  while (len-- > 0)
+    crc32val = crc32_tab[(crc32val ^ *s++) & 0xff] ^ (crc32val >> 8);
+
   return crc32val;
 }
 
+/* This is the standard Gary S. Brown's 32 bit CRC algorithm, but
+   accumulate the CRC into the result of a previous CRC. */
+cyg_uint32
+cyg_crc32_accumulate(cyg_uint32 crc32val, void *ptr, int len)
+{
+  return crc32_update(crc32val, ptr, len);
+}
+
 /* This is the standard Gary S. Brown's 32 bit CRC algorithm */
 cyg_uint32
 cyg_crc32(void *s, int len)
@@ -151,16 +221,9 @@ cyg_crc32(void *s, int len)
 cyg_uint32
 cyg_ether_crc32_accumulate(cyg_uint32 crc32val, void *ptr, int len)
 {
-  unsigned char *s = ptr;
-  int i;
-
-  if (s == 0) return 0L;
-  
-  crc32val = crc32val ^ 0xffffffff;
-  for (i = 0;  i < len;  i++) {
-      crc32val = crc32_tab[(crc32val ^ s[i]) & 0xff] ^ (crc32val >> 8);
-  }
-  return crc32val ^ 0xffffffff;
+  if (ptr == 0) return 0L;
+
+  return crc32_update(crc32val ^ 0xffffffff, ptr, len) ^ 0xffffffff;
 }
 
 /* Return a 32-bit CRC of the contents of the buffer, using the
@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "fwu_csum.h"
+
 
 #define IMG_SIZE     0x3e0000
 
@@ -136,10 +138,8 @@ unsigned char* read_rootfs(unsigned char* img, const char *fname)
 {
   FILE *fp;
   int size;
-  int i;
 
-  for (i=ROOTFS_START; i<ROOTFS_START+ROOTFS_SIZE; i++)
-    img[i] = 0xff;
+  memset(img+ROOTFS_START, 0xff, ROOTFS_SIZE);
 
   fp = fopen(fname, "rb");
   if (fp == NULL) {
@@ -173,10 +173,8 @@ unsigned char* read_kernel(unsigned char* img, const char *fname)
 {
   FILE *fp;
   int size;
-  int i;
 
-  for (i=KERNEL_START; i<KERNEL_START+KERNEL_SIZE; i++)
-    img[i] = 0xff;
+  memset(img+KERNEL_START, 0xff, KERNEL_SIZE);
 
   fp = fopen(fname, "rb");
   if (fp == NULL) {
@@ -225,13 +223,8 @@ void set_checksum(unsigned char*img, unsigned short sum)
 
 int compute_checksum(unsigned char* img)
 {
-  int i;
-  short s=0;
-
-  for (i=0; i<0x3dfffc; i++)
-    s += img[i];
-
-  return s;
+  /* plain byte sum; only the low 16 bits are kept */
+  return (short)fwu_byte_sum(img, 0x3dfffc);
 }
 
 
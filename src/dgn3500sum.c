@@ -16,7 +16,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 
 unsigned char PidDataWW[70] =
 {
@@ -45,52 +44,15 @@ unsigned char PidDataNA[70] =
     0x45, 0x72, 0x43, 0x6F, 0x4D, 0x6D,
 } ;
 
-/* *******************************************************************
-   Reads the file into memory and returns pointer to the buffer. */
-static char *readfile(char *filename, int *size)
-{
-	FILE		*fp;
-	char		*buffer;
-	struct stat	info;
-
-	if (stat(filename,&info)!=0)
-		return NULL;
-
-	if ((fp=fopen(filename,"r"))==NULL)
-		return NULL;
-
-	buffer=NULL;
-	for (;;)
-	{
-		if ((buffer=(char *)malloc(info.st_size+1))==NULL)
-			break;
-
-		if (fread(buffer,1,info.st_size,fp)!=info.st_size)
-		{
-			free(buffer);
-			buffer=NULL;
-			break;
-		}
-
-		buffer[info.st_size]='\0';
-		if(size) *size = info.st_size;
-
-		break;
-	}
-
-	(void)fclose(fp);
-
-	return buffer;
-}
-
+#define SUM_WINDOW	(1024 * 1024)
 
 /* ******************************************************************* */
 int main(int argc, char** argv)
 {
-  unsigned long start, i;
-  char *endptr, *buffer, *p;
-  int count;  // size of file in bytes
-  unsigned short sum = 0, sum1 = 0;
+  unsigned long start, pos, lim, i;
+  char *endptr, *window;
+  size_t n;
+  unsigned short sum = 0, sum1 = 0, presum = 0;
   char sumbuf[8 + 8 + 1];
 
   if(argc < 3) {
@@ -119,25 +81,42 @@ int main(int argc, char** argv)
 
   fclose(fp);
 
-  /* Read the file to calculate the checksums */
-  buffer = readfile(argv[1], &count);
-  if(!buffer) {
-    printf("ERROR: File %s not found!\n", argv[1]);
+  start = strtol(argv[2], &endptr, 16);
+
+  /* Stream the file through a fixed window to calculate the checksums.
+     The second sum covers the bytes from the start offset onwards; it
+     is derived from the full sum minus the sum of the bytes before the
+     offset, which is the same value mod 2^16. */
+  window = malloc(SUM_WINDOW);
+  if(!window) {
+    printf("ERROR: Out of memory!\n");
     return 1;
   }
 
-  p = buffer;
-  for(i = 0; i < count; i++)
-  {
-	sum += p[i];
+  fp = fopen(argv[1], "r");
+  if(!fp) {
+    printf("ERROR: File %s not found!\n", argv[1]);
+    free(window);
+    return 1;
   }
 
-  start = strtol(argv[2], &endptr, 16);
-  p = buffer+start;
-  for(i = 0; i < count - start; i++)
+  pos = 0;
+  while((n = fread(window, 1, SUM_WINDOW, fp)) > 0)
   {
-	sum1 += p[i];
+    for(i = 0; i < n; i++)
+	sum += window[i];
+
+    if(pos < start) {
+      lim = (start - pos < n) ? start - pos : n;
+      for(i = 0; i < lim; i++)
+	presum += window[i];
+    }
+
+    pos += n;
   }
+  fclose(fp);
+  free(window);
+  sum1 = sum - presum;
 
   sprintf(sumbuf,"%04X%04X",sum1,sum);
   /* Append the 2 checksums to end of file */
@@ -148,6 +127,5 @@ int main(int argc, char** argv)
   }
   fwrite(sumbuf, 8, sizeof(char), fp);
   fclose(fp);
-  free(buffer);
   return 0;
 }
@@ -17,6 +17,9 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include "fwu_csum.h"
+#include "fwu_io.h"
+
 #define MAX_MAGIC_LEN		16
 #define MAX_MODEL_LEN		32
 #define MAX_VERSION_LEN		14
@@ -50,6 +53,7 @@ static char *magic = "eDiMaX";
 static char *fw_version = "";
 static char *mtd_name;
 static int force;
+static char *matrix_file;
 static uint32_t start_addr;
 static uint32_t end_addr;
 static uint8_t image_type;
@@ -94,6 +98,11 @@ static void usage(int status)
 "  -s <addr>       set start address to <addr>\n"
 "  -t <type>       set image type to <type>\n"
 "  -v <version>    set firmware version to <version>\n"
+"  -D <file>       wrap the payload once per matrix line:\n"
+"                  <model> <magic> <mtd_name> <output>\n"
+"                  ('#' starts a comment); address, type, version and\n"
+"                  force flags are shared from the command line and the\n"
+"                  payload is read and checksummed only once\n"
 	);
 
 	exit(status);
@@ -242,14 +251,121 @@ out:
 
 static unsigned char checksum(unsigned char *p, unsigned len)
 {
-	unsigned char csum = 0;
+	/* plain byte sum via the shared kernel, with the Edimax twist */
+	return (unsigned char)fwu_byte_sum(p, len) ^ 0xb9;
+}
 
-	while (len--)
-		csum += *p++;
+/* Fill one header; data_csum is precomputed so the payload is not
+ * rescanned per device. */
+static void fill_header(struct edimax_header *hdr, const char *dev_model,
+			const char *dev_magic, const char *dev_mtd,
+			unsigned char data_csum)
+{
+	memset(hdr, 0, sizeof(*hdr));
 
-	csum ^= 0xb9;
+	strncpy(hdr->model, dev_model, sizeof(hdr->model));
+	strncpy(hdr->magic, dev_magic, sizeof(hdr->magic));
+	strncpy(hdr->fw_version, fw_version, sizeof(hdr->fw_version));
+	strncpy(hdr->mtd_name, dev_mtd, sizeof(hdr->mtd_name));
+
+	hdr->force = force;
+	hdr->start_addr = htonl(start_addr);
+	hdr->end_addr = htonl(end_addr);
+	hdr->data_size = htonl(data_size);
+	hdr->type = image_type;
 
-	return csum;
+	hdr->data_csum = data_csum;
+	hdr->header_csum = checksum((unsigned char *)hdr, sizeof(*hdr));
+}
+
+/*
+ * Matrix mode: one shared payload, one checksum pass, one wrapped
+ * output per matrix line. The payload bytes reach each output through
+ * fwu_copy_data() (copy_file_range), never through this process.
+ */
+static int build_matrix(void)
+{
+	struct fwu_input in = { 0 };
+	struct edimax_header hdr;
+	unsigned char data_csum;
+	char *line = NULL;
+	size_t line_len = 0;
+	size_t lineno = 0;
+	FILE *mf = NULL;
+	int ret = EXIT_FAILURE;
+
+	if (fwu_input_open(&in, ifname)) {
+		ERRS("could not open \"%s\" for reading", ifname);
+		goto out;
+	}
+	data_csum = checksum(in.data, data_size);
+
+	mf = fopen(matrix_file, "r");
+	if (mf == NULL) {
+		ERRS("could not open \"%s\" for reading", matrix_file);
+		goto out;
+	}
+
+	while (getline(&line, &line_len, mf) >= 0) {
+		char *dev_model, *dev_magic, *dev_mtd, *out, *saveptr;
+		FILE *fin, *fout;
+
+		lineno++;
+
+		dev_model = strtok_r(line, " \t\r\n", &saveptr);
+		if (!dev_model || dev_model[0] == '#')
+			continue;
+
+		dev_magic = strtok_r(NULL, " \t\r\n", &saveptr);
+		dev_mtd = strtok_r(NULL, " \t\r\n", &saveptr);
+		out = strtok_r(NULL, " \t\r\n", &saveptr);
+		if (!out) {
+			ERR("%s:%zu: expected <model> <magic> <mtd_name> <output>",
+			    matrix_file, lineno);
+			goto out;
+		}
+		if (strlen(dev_model) >= FIELD_SIZEOF(struct edimax_header, model) ||
+		    strlen(dev_magic) >= FIELD_SIZEOF(struct edimax_header, magic) ||
+		    strlen(dev_mtd) >= FIELD_SIZEOF(struct edimax_header, mtd_name)) {
+			ERR("%s:%zu: field too long", matrix_file, lineno);
+			goto out;
+		}
+
+		fill_header(&hdr, dev_model, dev_magic, dev_mtd, data_csum);
+
+		fout = fopen(out, "w");
+		if (fout == NULL) {
+			ERRS("could not open \"%s\" for writing", out);
+			goto out;
+		}
+
+		fin = fopen(ifname, "r");
+		errno = 0;
+		if (fwrite(&hdr, sizeof(hdr), 1, fout) != 1 ||
+		    fin == NULL ||
+		    fwu_copy_data(fin, fout, 0) != (ssize_t)data_size ||
+		    fflush(fout)) {
+			ERRS("unable to write output file");
+			if (fin)
+				fclose(fin);
+			fclose(fout);
+			unlink(out);
+			goto out;
+		}
+		fclose(fin);
+		fclose(fout);
+
+		DBG("firmware file \"%s\" completed", out);
+	}
+
+	ret = EXIT_SUCCESS;
+
+out:
+	free(line);
+	if (mf)
+		fclose(mf);
+	fwu_input_close(&in);
+	return ret;
 }
 
 static int build_fw(void)
@@ -277,22 +393,8 @@ static int build_fw(void)
 
 	/* fill firmware header */
 	hdr = (struct edimax_header *)buf;
-	memset(hdr, 0, sizeof(struct edimax_header));
-
-	strncpy(hdr->model, model, sizeof(hdr->model));
-	strncpy(hdr->magic, magic, sizeof(hdr->magic));
-	strncpy(hdr->fw_version, fw_version, sizeof(hdr->fw_version));
-	strncpy(hdr->mtd_name, mtd_name, sizeof(hdr->mtd_name));
-
-	hdr->force = force;
-	hdr->start_addr = htonl(start_addr);
-	hdr->end_addr = htonl(end_addr);
-	hdr->data_size = htonl(data_size);
-	hdr->type = image_type;
-
-	hdr->data_csum = checksum((unsigned char *)data, data_size);
-	hdr->header_csum = checksum((unsigned char *)hdr,
-				    sizeof(struct edimax_header));
+	fill_header(hdr, model, magic, mtd_name,
+		    checksum((unsigned char *)data, data_size));
 
 	ret = write_fw(buf, buflen);
 	if (ret)
@@ -315,7 +417,7 @@ int main(int argc, char *argv[])
 	while (1) {
 		int c;
 
-		c = getopt(argc, argv, "e:fhi:o:m:M:n:s:t:v:");
+		c = getopt(argc, argv, "e:fhi:o:m:M:n:s:t:v:D:");
 		if (c == -1)
 			break;
 
@@ -365,12 +467,29 @@ int main(int argc, char *argv[])
 		case 'v':
 			fw_version = optarg;
 			break;
+		case 'D':
+			matrix_file = optarg;
+			break;
 		default:
 			usage(EXIT_FAILURE);
 			break;
 		}
 	}
 
+	if (matrix_file) {
+		/* per-device fields come from the matrix */
+		if (ifname == NULL) {
+			ERR("no %s specified", "input file");
+			goto out;
+		}
+		data_size = get_file_size(ifname);
+		if (data_size < 0)
+			goto out;
+
+		ret = build_matrix();
+		goto out;
+	}
+
 	ret = check_options();
 	if (ret)
 		goto out;
@@ -18,61 +18,10 @@
 #include <string.h>
 #include <sys/stat.h>
 
-// *******************************************************************
-// CCITT polynom G(x)=x^16+x^12+x^5+1
-#define POLYNOM  0x1021
-
-// CRC algorithm with MSB first
-int make_crc16(int crc, char new)
-{
-  int i;
-  crc = crc ^ (((int)new) << 8);
-  
-  for(i=0; i<8; i++) {  // work on 8 bits in "new"
-    crc <<= 1;          // MSBs first
-    if(crc & 0x10000)  crc ^= POLYNOM;
-  }
-  return crc & 0xFFFF;
-}
-
-// *******************************************************************
-// Reads the file "filename" into memory and returns pointer to the buffer.
-static char *readfile(char *filename, int *size)
-{
-	FILE		*fp;
-	char		*buffer;
-	struct stat	info;
-	
-	if (stat(filename,&info)!=0)
-		return NULL;
-
-	if ((fp=fopen(filename,"r"))==NULL)
-		return NULL;
-
-	buffer=NULL;
-	for (;;)
-	{
-		if ((buffer=(char *)malloc(info.st_size+1))==NULL)
-			break;
-
-		if (fread(buffer,1,info.st_size,fp)!=info.st_size)
-		{
-			free(buffer);
-			buffer=NULL;
-			break;
-		}
-
-		buffer[info.st_size]='\0';
-		if(size) *size = info.st_size;
-
-		break;
-	}
-
-	(void)fclose(fp);
-
-	return buffer;
-}
+#include "cyg_crc.h"
+#include "fwu_io.h"
 
+#define ENCODE_CHUNK  (64 * 1024)
 
 // *******************************************************************
 int main(int argc, char** argv)
@@ -82,37 +31,21 @@ int main(int argc, char** argv)
     return 1;
   }
 
-  int count;  // size of file in bytes
-  char *p, *master = readfile(argv[1], &count);
-  if(!master) {
+  struct fwu_input in = { 0 };
+  char chunk[ENCODE_CHUNK];
+  char *p;
+  size_t done, n, z;
+
+  if(fwu_input_open(&in, argv[1])) {
     printf("ERROR: File not found!\n");
     return 1;
   }
 
-  int crc = 0xFFFF, z;
-
-  p = master;
-  for(z=0; z<count; z++)
-    crc = make_crc16(crc, *(p++));  // calculate CRC
+  // CRC16-CCITT, MSB first, init 0xFFFF - the shared table walk with
+  // the initial value passed in
+  int crc = cyg_crc16_accumulate(0xFFFF, in.data, in.size);
   short crc16 = (short)crc;
 
-	/*
-  if(argc > 2) {   // with flag for device recognition ?
-    p = argv[2];
-    for(z=strlen(p); z>0; z--) {
-      crc ^= (int)(*p);
-      *(p++) = (char)crc;  // encode device flag
-    }
-  }
-	*/
-
-  p = master;
-  for(z=0; z<count; z++) {
-    crc ^= (int)(*p);
-    *(p++) = (char)crc;  // encode file
-  }
-
-
   // write encoded file...
   FILE *fp = fopen(argv[2], "w");
   if(!fp) {
@@ -130,9 +63,22 @@ int main(int argc, char** argv)
 
   fwrite(&crc16, 1, sizeof(short), fp);     // first write CRC
 
-  fwrite(master, count, sizeof(char), fp);  // write content
+  // the encoding chains each output byte off the previous one, so it
+  // is inherently serial; run it chunk-wise from the mapping while
+  // writing, instead of in a second trip over a modifiable copy
+  for(done = 0; done < in.size; done += n) {
+    n = in.size - done;
+    if(n > ENCODE_CHUNK)  n = ENCODE_CHUNK;
+    memcpy(chunk, (char *)in.data + done, n);
+    p = chunk;
+    for(z = 0; z < n; z++) {
+      crc ^= (int)(*p);
+      *(p++) = (char)crc;  // encode file
+    }
+    fwrite(chunk, n, sizeof(char), fp);  // write content
+  }
   fclose(fp);
 
-  free(master);
+  fwu_input_close(&in);
   return 0;
 }
@@ -11,9 +11,11 @@
 #include <getopt.h>     /* for getopt() */
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "cyg_crc.h"
+#include "fwu_io.h"
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -49,14 +51,10 @@ struct u_media_header {
 	uint8_t		ih_UMedia_temp2;	/* U-Media didn't use this tag */
 } __attribute__ ((packed));
 
-struct if_info {
-	char		*file_name;	/* name of the file */
-	uint32_t	file_size;	/* length of the file */
-};
-
 static char *progname;
 static char *ofname;
-static struct if_info if_info;
+static char *ifname;
+static char *batchfile;
 static int factory_defaults;
 static uint32_t board_id;
 static uint8_t image_type;
@@ -90,9 +88,12 @@ static void usage(int status)
 "\n"
 "Options:\n"
 "  -B <board_id>   set board ID to <board_id>\n"
+"  -C <manifest>   fix all images listed in <manifest> in place; each\n"
+"                  line is <file> <board_id> <type> [F], '#' comments\n"
 "  -i <file>       read input from the file <file>\n"
 "  -F              load factory defaults\n"
 "  -o <file>       write output to the file <file>\n"
+"                  (if omitted, <file> is fixed in place)\n"
 "  -T <type>       set image type to <type>\n"
 "  -h              show this screen\n"
 	);
@@ -133,163 +134,240 @@ static int str2u8(char *arg, uint8_t *val)
 	return 0;
 }
 
-static int get_file_stat(struct if_info *fdata)
+static int check_options(void)
 {
-	struct stat st;
-	int res;
-
-	if (fdata->file_name == NULL)
-		return 0;
-
-	res = stat(fdata->file_name, &st);
-	if (res){
-		ERRS("stat failed on %s", fdata->file_name);
-		return res;
+	if (ifname == NULL) {
+		ERR("no %s specified", "input file");
+		return -1;
 	}
 
-	fdata->file_size = st.st_size;
 	return 0;
 }
 
-static int read_to_buf(struct if_info *fdata, char *buf)
+/*
+ * Verify and patch the 64-byte header of one image. Only the header
+ * is covered by the CRC, so the payload never needs to be touched:
+ * with no output name the header is rewritten in place, otherwise the
+ * header is written fresh and the payload streamed through the kernel.
+ */
+static int fix_file(const char *iname, const char *oname,
+		    uint32_t boardid, uint8_t imagetype, int factory)
 {
-	FILE *f;
+	struct u_media_header hdr;
+	uint32_t crc, crc_orig;
 	int ret = EXIT_FAILURE;
+	FILE *fin;
+	FILE *fout;
 
-	f = fopen(fdata->file_name, "r");
-	if (f == NULL) {
-		ERRS("could not open \"%s\" for reading", fdata->file_name);
-		goto out;
+	fin = fopen(iname, oname ? "r" : "r+");
+	if (fin == NULL) {
+		ERRS("could not open \"%s\" for %s", iname,
+		     oname ? "reading" : "updating");
+		return ret;
 	}
 
-	errno = 0;
-	fread(buf, fdata->file_size, 1, f);
-	if (errno != 0) {
-		ERRS("unable to read from file \"%s\"", fdata->file_name);
-		goto out_close;
+	if (fread(&hdr, sizeof(hdr), 1, fin) != 1) {
+		ERR("invalid input file\n");
+		goto out_close_in;
 	}
 
-	ret = EXIT_SUCCESS;
-
-out_close:
-	fclose(f);
-out:
-	return ret;
-}
-
-static int check_options(void)
-{
-	int ret;
-
-	if (ofname == NULL) {
-		ERR("no %s specified", "output file");
-		return -1;
+	if (ntohl(hdr.ih_magic) != IH_MAGIC) {
+		ERR("invalid input file, bad magic\n");
+		goto out_close_in;
 	}
 
-	if (if_info.file_name == NULL) {
-		ERR("no %s specified", "input file");
-		return -1;
+	/* verify header CRC */
+	crc_orig = ntohl(hdr.ih_hcrc);
+	hdr.ih_hcrc = 0;
+	crc = cyg_ether_crc32((unsigned char *) &hdr, sizeof(hdr));
+	if (crc != crc_orig) {
+		ERR("invalid input file, bad header CRC\n");
+		goto out_close_in;
 	}
 
-	ret = get_file_stat(&if_info);
-	if (ret)
-		return ret;
+	hdr.ih_name[IH_NMLEN - UM_HEADER_LEN - 1] = '\0';
 
-	return 0;
-}
+	/* set U-Media specific fields */
+	hdr.ih_UMedia_magic = htonl(UM_MAGIC);
+	hdr.ih_UMedia_boardID = htonl(boardid);
+	hdr.ih_UMedia_imageType = imagetype;
+	hdr.ih_UMedia_LoadDefault = (factory) ? 1 : 0;
 
-static int write_fw(char *data, int len)
-{
-	FILE *f;
-	int ret = EXIT_FAILURE;
+	/* update header CRC */
+	crc = cyg_ether_crc32((unsigned char *) &hdr, sizeof(hdr));
+	hdr.ih_hcrc = htonl(crc);
+
+	if (oname == NULL) {
+		/* in place: rewind and overwrite the header only */
+		if (fseek(fin, 0, SEEK_SET) ||
+		    fwrite(&hdr, sizeof(hdr), 1, fin) != 1) {
+			ERRS("unable to update \"%s\"", iname);
+			goto out_close_in;
+		}
+	} else {
+		fout = fopen(oname, "w");
+		if (fout == NULL) {
+			ERRS("could not open \"%s\" for writing", oname);
+			goto out_close_in;
+		}
 
-	f = fopen(ofname, "w");
-	if (f == NULL) {
-		ERRS("could not open \"%s\" for writing", ofname);
-		goto out;
+		if (fwrite(&hdr, sizeof(hdr), 1, fout) != 1 ||
+		    fwu_copy_data(fin, fout, 0) < 0) {
+			ERRS("unable to write output file");
+			fclose(fout);
+			unlink(oname);
+			goto out_close_in;
+		}
+		fclose(fout);
 	}
 
-	errno = 0;
-	fwrite(data, len, 1, f);
-	if (errno) {
-		ERRS("unable to write output file");
-		goto out_flush;
-	}
+	DBG("U-Media header fixed in \"%s\"", oname ? oname : iname);
 
 	ret = EXIT_SUCCESS;
 
-out_flush:
-	fflush(f);
-	fclose(f);
-	if (ret != EXIT_SUCCESS) {
-		unlink(ofname);
-	}
-out:
+out_close_in:
+	fclose(fin);
 	return ret;
 }
 
-static int fix_header(void)
+struct batch_entry {
+	char		*file_name;
+	uint32_t	board_id;
+	uint8_t		image_type;
+	int		factory;
+};
+
+struct batch_ctx {
+	struct batch_entry	*entries;
+	size_t			n_entries;
+	size_t			next;
+	int			fails;
+	pthread_mutex_t		lock;
+};
+
+static void *batch_worker(void *arg)
 {
-	int buflen;
-	char *buf;
-	uint32_t crc, crc_orig;
-	struct u_media_header *hdr;
-	int ret = EXIT_FAILURE;
+	struct batch_ctx *ctx = arg;
 
-	buflen = if_info.file_size;
-	if (buflen < sizeof(*hdr)) {
-		ERR("invalid input file\n");
-		return ret;
-	}
+	for (;;) {
+		struct batch_entry *e;
+		int ret;
 
-	buf = malloc(buflen);
-	if (!buf) {
-		ERR("no memory for buffer\n");
-		goto out;
-	}
+		pthread_mutex_lock(&ctx->lock);
+		if (ctx->next >= ctx->n_entries) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		e = &ctx->entries[ctx->next++];
+		pthread_mutex_unlock(&ctx->lock);
 
-	ret = read_to_buf(&if_info, buf);
-	if (ret)
-		goto out_free_buf;
+		ret = fix_file(e->file_name, NULL, e->board_id,
+			       e->image_type, e->factory);
 
-	hdr = (struct u_media_header *) buf;
-	if (ntohl(hdr->ih_magic) != IH_MAGIC) {
-		ERR("invalid input file, bad magic\n");
-		goto out_free_buf;
+		pthread_mutex_lock(&ctx->lock);
+		if (ret != EXIT_SUCCESS)
+			ctx->fails++;
+		pthread_mutex_unlock(&ctx->lock);
 	}
 
-	/* verify header CRC */
-	crc_orig = ntohl(hdr->ih_hcrc);
-	hdr->ih_hcrc = 0;
-	crc = cyg_ether_crc32((unsigned char *)hdr, sizeof(*hdr));
-	if (crc != crc_orig) {
-		ERR("invalid input file, bad header CRC\n");
-		goto out_free_buf;
+	return NULL;
+}
+
+/*
+ * Fix every image named in a manifest in place, one line per device:
+ * <file> <board_id> <image_type> [F]. The per-file work is a header
+ * patch, so the pool mostly overlaps the opens across the matrix.
+ */
+static int fix_batch(const char *manifest)
+{
+	struct batch_ctx ctx = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t threads[16];
+	size_t alloc = 0;
+	char *line = NULL;
+	size_t line_len = 0;
+	long n_threads;
+	size_t i;
+	FILE *fp;
+	int ret = EXIT_FAILURE;
+
+	fp = fopen(manifest, "r");
+	if (fp == NULL) {
+		ERRS("could not open \"%s\" for reading", manifest);
+		return ret;
 	}
 
-	hdr->ih_name[IH_NMLEN - UM_HEADER_LEN - 1] = '\0';
+	while (getline(&line, &line_len, fp) >= 0) {
+		struct batch_entry e = { 0 };
+		char *file, *board, *type, *flag;
+		char *save = NULL;
+
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!line[0] || line[0] == '#')
+			continue;
+
+		file = strtok_r(line, " \t", &save);
+		board = strtok_r(NULL, " \t", &save);
+		type = strtok_r(NULL, " \t", &save);
+		flag = strtok_r(NULL, " \t", &save);
+
+		if (!file || !board || !type ||
+		    str2u32(board, &e.board_id) ||
+		    str2u8(type, &e.image_type) ||
+		    (flag && strcmp(flag, "F") != 0)) {
+			ERR("invalid manifest line for '%s'", file ? file : "");
+			goto out;
+		}
+		e.factory = (flag != NULL);
 
-	/* set U-Media specific fields */
-	hdr->ih_UMedia_magic = htonl(UM_MAGIC);
-	hdr->ih_UMedia_boardID = htonl(board_id);
-	hdr->ih_UMedia_imageType = image_type;
-	hdr->ih_UMedia_LoadDefault = (factory_defaults) ? 1 : 0;
+		e.file_name = strdup(file);
+		if (!e.file_name) {
+			ERR("no memory for batch entry\n");
+			goto out;
+		}
 
-	/* update header CRC */
-	crc = cyg_ether_crc32((unsigned char *)hdr, sizeof(*hdr));
-	hdr->ih_hcrc = htonl(crc);
+		if (ctx.n_entries == alloc) {
+			struct batch_entry *entries;
 
-	ret = write_fw(buf, buflen);
-	if (ret)
-		goto out_free_buf;
+			alloc = alloc ? alloc * 2 : 32;
+			entries = realloc(ctx.entries,
+					  alloc * sizeof(*entries));
+			if (!entries) {
+				ERR("no memory for batch entries\n");
+				free(e.file_name);
+				goto out;
+			}
+			ctx.entries = entries;
+		}
+		ctx.entries[ctx.n_entries++] = e;
+	}
 
-	DBG("U-Media header fixed in \"%s\"", ofname);
+	n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads < 1)
+		n_threads = 1;
+	if ((size_t) n_threads > ctx.n_entries)
+		n_threads = ctx.n_entries;
+	if (n_threads > (long) (sizeof(threads) / sizeof(threads[0])))
+		n_threads = sizeof(threads) / sizeof(threads[0]);
+
+	for (i = 0; i < (size_t) n_threads; i++)
+		if (pthread_create(&threads[i], NULL, batch_worker, &ctx)) {
+			n_threads = i;
+			break;
+		}
+	for (i = 0; i < (size_t) n_threads; i++)
+		pthread_join(threads[i], NULL);
 
-	ret = EXIT_SUCCESS;
+	if (!ctx.fails)
+		ret = EXIT_SUCCESS;
 
-out_free_buf:
-	free(buf);
 out:
+	for (i = 0; i < ctx.n_entries; i++)
+		free(ctx.entries[i].file_name);
+	free(ctx.entries);
+	free(line);
+	fclose(fp);
 	return ret;
 }
 
@@ -302,7 +380,7 @@ int main(int argc, char *argv[])
 	while (1) {
 		int c;
 
-		c = getopt(argc, argv, "B:Fi:o:T:h");
+		c = getopt(argc, argv, "B:C:Fi:o:T:h");
 		if (c == -1)
 			break;
 
@@ -321,11 +399,14 @@ int main(int argc, char *argv[])
 				goto out;
 			}
 			break;
+		case 'C':
+			batchfile = optarg;
+			break;
 		case 'F':
 			factory_defaults = 1;
 			break;
 		case 'i':
-			if_info.file_name = optarg;
+			ifname = optarg;
 			break;
 		case 'o':
 			ofname = optarg;
@@ -339,11 +420,17 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (batchfile) {
+		ret = fix_batch(batchfile);
+		goto out;
+	}
+
 	ret = check_options();
 	if (ret)
 		goto out;
 
-	ret = fix_header();
+	ret = fix_file(ifname, ofname, board_id,
+		       image_type, factory_defaults);
 
 out:
 	return ret;
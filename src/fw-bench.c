@@ -0,0 +1,185 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * fw-bench - microbenchmark harness for the shared hot kernels
+ *
+ * Times the checksum, digest, cipher and XOR kernels the image tools
+ * spend their cycles in, over a deterministic synthetic image, and
+ * reports MB/s. Build with the fw-bench target; it is not installed.
+ * End-to-end tool timings (trx create, otrx check, ...) are best taken
+ * with `time` around the installed binaries, since fork/exec and I/O
+ * are part of what those measure.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "buffalo-lib.h"
+#include "cyg_crc.h"
+#include "md5.h"
+#include "sha1.h"
+#include "fwu_xor.h"
+
+static size_t buf_size = 64 * 1024 * 1024;
+static double min_seconds = 0.5;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* deterministic synthetic image data (xorshift64) */
+static void fill_buf(uint8_t *buf, size_t len)
+{
+	uint64_t x = 0x2545f4914f6cdd1dULL;
+	size_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		memcpy(buf + i, &x, 8);
+	}
+	for (; i < len; i++)
+		buf[i] = (uint8_t)(x >> (8 * (i % 8)));
+}
+
+/* sink for computed values so the kernels can't be optimized away */
+static volatile uint32_t sink;
+
+static void report(const char *name, int iters, double elapsed)
+{
+	double mb = (double)buf_size * iters / (1024.0 * 1024.0);
+
+	printf("%-24s %8.1f MB/s\n", name, mb / elapsed);
+}
+
+static void bench(const char *name, uint32_t (*kernel)(uint8_t *, size_t))
+{
+	static uint8_t *buf;
+	double start, elapsed;
+	int iters = 0;
+
+	if (!buf) {
+		buf = malloc(buf_size);
+		if (!buf) {
+			fprintf(stderr, "can't allocate %zu B buffer\n", buf_size);
+			exit(EXIT_FAILURE);
+		}
+		fill_buf(buf, buf_size);
+	}
+
+	start = now();
+	do {
+		sink = kernel(buf, buf_size);
+		iters++;
+		elapsed = now() - start;
+	} while (elapsed < min_seconds);
+
+	report(name, iters, elapsed);
+}
+
+static uint32_t kernel_crc32(uint8_t *buf, size_t len)
+{
+	return cyg_crc32_accumulate(~0U, buf, len) ^ ~0U;
+}
+
+static uint32_t kernel_ether_crc32(uint8_t *buf, size_t len)
+{
+	return cyg_ether_crc32(buf, len);
+}
+
+static uint32_t kernel_buffalo_crc(uint8_t *buf, size_t len)
+{
+	return buffalo_crc(buf, len);
+}
+
+static uint32_t kernel_buffalo_csum(uint8_t *buf, size_t len)
+{
+	return buffalo_csum(0, buf, len);
+}
+
+static uint32_t kernel_md5(uint8_t *buf, size_t len)
+{
+	uint8_t digest[16];
+	MD5_CTX ctx;
+
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, buf, len);
+	MD5_Final(digest, &ctx);
+
+	return digest[0];
+}
+
+static uint32_t kernel_sha1(uint8_t *buf, size_t len)
+{
+	uint8_t digest[20];
+
+	sha1_csum(buf, len, digest);
+
+	return digest[0];
+}
+
+static uint32_t kernel_bcrypt(uint8_t *buf, size_t len)
+{
+	unsigned char key[] = "bench";
+
+	bcrypt_buf(0x4f, key, buf, buf, len, 0);
+
+	return buf[0];
+}
+
+static uint32_t kernel_xor(uint8_t *buf, size_t len)
+{
+	static const uint8_t pattern[8] = "12345678";
+
+	fwu_xor_pattern(buf, len, pattern, sizeof(pattern), 0);
+
+	return buf[0];
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s size_mb] [-t min_seconds]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "s:t:h")) != -1) {
+		switch (c) {
+		case 's':
+			buf_size = strtoul(optarg, NULL, 0) * 1024 * 1024;
+			if (!buf_size)
+				usage(argv[0]);
+			break;
+		case 't':
+			min_seconds = strtod(optarg, NULL);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	printf("buffer: %zu MiB, min %.2f s per kernel\n",
+	       buf_size / (1024 * 1024), min_seconds);
+
+	bench("crc32", kernel_crc32);
+	bench("ether-crc32", kernel_ether_crc32);
+	bench("buffalo-crc", kernel_buffalo_crc);
+	bench("buffalo-csum", kernel_buffalo_csum);
+	bench("md5", kernel_md5);
+	bench("sha1", kernel_sha1);
+	bench("bcrypt", kernel_bcrypt);
+	bench("xor-pattern", kernel_xor);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * fwdigest - one-pass CRC32/MD5/SHA-1 over firmware payloads
+ *
+ * Build recipes that need several digests of the same image can run
+ * this once and feed the results to the individual tools, instead of
+ * letting each tool re-scan the payload. All requested digests are
+ * computed in a single fused pass (see fwu_digest.h).
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fwu_digest.h"
+#include "fwu_io.h"
+#include "fwu_jobs.h"
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-c] [-m] [-s] <file>...\n", progname);
+	fprintf(stderr, "  -c  CRC32 (zero seed, as used by otrx)\n");
+	fprintf(stderr, "  -m  MD5\n");
+	fprintf(stderr, "  -s  SHA-1\n");
+	fprintf(stderr, "With no digest option all three are computed.\n");
+	fprintf(stderr, "Output: one '<digest>:<hex>  <file>' line per digest.\n");
+}
+
+static void print_hex(const char *name, const unsigned char *digest,
+		      size_t len, const char *file)
+{
+	size_t i;
+
+	printf("%s:", name);
+	for (i = 0; i < len; i++)
+		printf("%02x", digest[i]);
+	printf("  %s\n", file);
+}
+
+static int fwdigest_run(int argc, char *argv[])
+{
+	unsigned int want = 0;
+	struct fwu_digest d;
+	struct fwu_input in;
+	int opt, i;
+	int ret = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "cmsh")) != -1) {
+		switch (opt) {
+		case 'c':
+			want |= FWU_DIGEST_CRC32;
+			break;
+		case 'm':
+			want |= FWU_DIGEST_MD5;
+			break;
+		case 's':
+			want |= FWU_DIGEST_SHA1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!want)
+		want = FWU_DIGEST_CRC32 | FWU_DIGEST_MD5 | FWU_DIGEST_SHA1;
+
+	for (i = optind; i < argc; i++) {
+		if (fwu_input_open(&in, argv[i]) < 0) {
+			fprintf(stderr, "%s: cannot open %s: %s\n",
+				argv[0], argv[i], strerror(errno));
+			ret = EXIT_FAILURE;
+			continue;
+		}
+
+		fwu_digest_init(&d, want);
+		fwu_digest_update(&d, in.data, in.size);
+		fwu_digest_final(&d);
+
+		if (want & FWU_DIGEST_CRC32)
+			printf("crc32:%08x  %s\n",
+			       (unsigned int)d.crc32, argv[i]);
+		if (want & FWU_DIGEST_MD5)
+			print_hex("md5", d.md5_digest,
+				  sizeof(d.md5_digest), argv[i]);
+		if (want & FWU_DIGEST_SHA1)
+			print_hex("sha1", d.sha1_digest,
+				  sizeof(d.sha1_digest), argv[i]);
+
+		fwu_input_close(&in);
+	}
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	return fwu_jobs_run(argc, argv, fwdigest_run);
+}
@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * fwpipe - run a recipe of image tools with in-memory intermediates
+ *
+ * Image recipes chain several tools, each writing a full temporary
+ * image that the next stage re-reads from scratch storage. fwpipe runs
+ * the stages of a recipe with every intermediate backed by a memfd:
+ * the tools run unmodified (they can open, seek and rewrite the
+ * intermediate as usual, which rules out plain pipes), but the bytes
+ * never leave the page cache.
+ *
+ * Recipe file: one command per line, '#' starts a comment. The token
+ * @IN expands to the previous stage's output (or the -i file for the
+ * first stage), @OUT to this stage's output (a fresh memfd, or the -o
+ * file for the last stage). Example:
+ *
+ *     trx -o @OUT -f vmlinux.bin -f root.squashfs
+ *     addpattern -i @IN -o @OUT -p W54S
+ *     xorimage -i @IN -o @OUT -p 12345678
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FWPIPE_STAGES_MAX	16
+#define FWPIPE_ARGV_MAX		64
+
+static char *progname;
+
+struct stage {
+	char *argv[FWPIPE_ARGV_MAX];
+	int argc;
+	char *line;
+};
+
+static void usage(int status)
+{
+	FILE *stream = (status != EXIT_SUCCESS) ? stderr : stdout;
+
+	fprintf(stream, "Usage: %s [OPTIONS...] -f <recipe>\n", progname);
+	fprintf(stream,
+"\n"
+"Options:\n"
+"  -f <recipe>     run the stages listed in the file <recipe>\n"
+"  -i <file>       input file substituted for @IN in the first stage\n"
+"  -o <file>       output file substituted for @OUT in the last stage\n"
+"  -v              print each stage before running it\n"
+"  -h              show this screen\n"
+	);
+
+	exit(status);
+}
+
+static int run_stage(struct stage *stage, char *in_path, char *out_path,
+		     int verbose)
+{
+	int status;
+	pid_t pid;
+	int i;
+
+	for (i = 0; i < stage->argc; i++) {
+		if (!strcmp(stage->argv[i], "@IN")) {
+			if (!in_path) {
+				fprintf(stderr, "%s: first stage uses @IN but no -i given\n",
+					progname);
+				return -1;
+			}
+			stage->argv[i] = in_path;
+		} else if (!strcmp(stage->argv[i], "@OUT")) {
+			stage->argv[i] = out_path;
+		}
+	}
+
+	if (verbose) {
+		fprintf(stderr, "[%s]", progname);
+		for (i = 0; i < stage->argc; i++)
+			fprintf(stderr, " %s", stage->argv[i]);
+		fprintf(stderr, "\n");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		fprintf(stderr, "%s: fork: %s\n", progname, strerror(errno));
+		return -1;
+	}
+	if (!pid) {
+		execvp(stage->argv[0], stage->argv);
+		fprintf(stderr, "%s: exec %s: %s\n", progname, stage->argv[0],
+			strerror(errno));
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) < 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		fprintf(stderr, "%s: stage '%s' failed\n", progname, stage->argv[0]);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct stage stages[FWPIPE_STAGES_MAX];
+	char memfd_paths[2][32];
+	char *cur_in;
+	char *recipe_path = NULL;
+	char *ifname = NULL;
+	char *ofname = NULL;
+	int verbose = 0;
+	int n_stages = 0;
+	int prev_fd = -1;
+	FILE *fp;
+	int i, c;
+
+	progname = basename(argv[0]);
+
+	while ((c = getopt(argc, argv, "f:i:o:vh")) != -1) {
+		switch (c) {
+		case 'f':
+			recipe_path = optarg;
+			break;
+		case 'i':
+			ifname = optarg;
+			break;
+		case 'o':
+			ofname = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+			usage(EXIT_SUCCESS);
+			break;
+		default:
+			usage(EXIT_FAILURE);
+			break;
+		}
+	}
+
+	if (!recipe_path || !ofname)
+		usage(EXIT_FAILURE);
+
+	fp = fopen(recipe_path, "r");
+	if (!fp) {
+		fprintf(stderr, "%s: can't open recipe '%s'\n", progname, recipe_path);
+		return EXIT_FAILURE;
+	}
+
+	while (n_stages < FWPIPE_STAGES_MAX) {
+		struct stage *stage = &stages[n_stages];
+		size_t line_size = 0;
+		char *tok, *save;
+
+		stage->line = NULL;
+		if (getline(&stage->line, &line_size, fp) < 0) {
+			free(stage->line);
+			break;
+		}
+		if (stage->line[0] == '#')
+			continue;
+
+		stage->argc = 0;
+		for (tok = strtok_r(stage->line, " \t\r\n", &save);
+		     tok && stage->argc < FWPIPE_ARGV_MAX - 1;
+		     tok = strtok_r(NULL, " \t\r\n", &save))
+			stage->argv[stage->argc++] = tok;
+		stage->argv[stage->argc] = NULL;
+
+		if (!stage->argc) {
+			free(stage->line);
+			continue;
+		}
+
+		n_stages++;
+	}
+	fclose(fp);
+
+	if (!n_stages) {
+		fprintf(stderr, "%s: recipe '%s' has no stages\n", progname, recipe_path);
+		return EXIT_FAILURE;
+	}
+
+	cur_in = ifname;
+
+	for (i = 0; i < n_stages; i++) {
+		char *cur_out;
+		int out_fd = -1;
+
+		if (i == n_stages - 1) {
+			cur_out = ofname;
+		} else {
+			/* in-memory intermediate; stages reopen it by path */
+			out_fd = memfd_create("fwpipe-stage", 0);
+			if (out_fd < 0) {
+				fprintf(stderr, "%s: memfd_create: %s\n",
+					progname, strerror(errno));
+				return EXIT_FAILURE;
+			}
+			cur_out = memfd_paths[i & 1];
+			snprintf(cur_out, sizeof(memfd_paths[0]),
+				 "/proc/self/fd/%d", out_fd);
+		}
+
+		if (run_stage(&stages[i], cur_in, cur_out, verbose)) {
+			if (out_fd >= 0)
+				close(out_fd);
+			return EXIT_FAILURE;
+		}
+
+		if (prev_fd >= 0)
+			close(prev_fd);
+		prev_fd = out_fd;
+		cur_in = cur_out;
+	}
+
+	if (prev_fd >= 0)
+		close(prev_fd);
+
+	for (i = 0; i < n_stages; i++)
+		free(stages[i].line);
+
+	return EXIT_SUCCESS;
+}
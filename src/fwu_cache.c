@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * fwu_cache - content-addressed output cache for the wrapper tools
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fwu_cache.h"
+#include "fwu_io.h"
+#include "sha1.h"
+
+/* Feed a whole file into the key digest. Returns 0, -1 on read error. */
+static int fwu_cache_hash_file(sha1_context *sha1, const char *path)
+{
+	unsigned char buf[64 * 1024];
+	size_t n;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		sha1_update(sha1, buf, n);
+
+	if (ferror(fp)) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+/*
+ * Copy one file over another. Never hardlink here: several tools patch
+ * their output in place after (or instead of) writing it, and a shared
+ * inode would let that mutate the published cache entry.
+ */
+static int fwu_cache_copy(const char *from_path, const char *to_path)
+{
+	FILE *from = fopen(from_path, "r");
+	FILE *to = from ? fopen(to_path, "w") : NULL;
+	int ok = from && to && fwu_copy_data(from, to, 0) >= 0;
+
+	if (from)
+		fclose(from);
+	if (to && (fclose(to) || !ok)) {
+		unlink(to_path);
+		ok = 0;
+	}
+
+	return ok ? 0 : -1;
+}
+
+int fwu_cache_lookup(struct fwu_cache *c, const char *tool, char **argv,
+		     const char *input, const char *output)
+{
+	unsigned char digest[20];
+	sha1_context sha1;
+	const char *dir;
+	char hex[41];
+	int i;
+
+	memset(c, 0, sizeof(*c));
+
+	dir = getenv("FWU_CACHE");
+	if (!dir || !*dir || !output)
+		return 0;
+
+	sha1_starts(&sha1);
+	sha1_update(&sha1, (void *)tool, strlen(tool) + 1);
+	for (i = 1; argv[i]; i++) {
+		if (!strcmp(argv[i], output))
+			continue;
+		if (input && !strcmp(argv[i], input)) {
+			if (fwu_cache_hash_file(&sha1, input))
+				return -1;
+			continue;
+		}
+		sha1_update(&sha1, argv[i], strlen(argv[i]) + 1);
+	}
+	sha1_finish(&sha1, digest);
+
+	for (i = 0; i < 20; i++)
+		snprintf(hex + i * 2, 3, "%02x", digest[i]);
+
+	if (snprintf(c->entry, sizeof(c->entry), "%s/%s", dir, hex) >=
+	    (int)sizeof(c->entry))
+		return 0;
+
+	c->enabled = 1;
+	c->output = output;
+
+	if (access(c->entry, R_OK))
+		return 0;
+
+	/* hit: materialize a private copy of the artifact */
+	if (!fwu_cache_copy(c->entry, output)) {
+		c->enabled = 0;
+		return 1;
+	}
+
+	/* unusable entry; fall through to a normal run */
+	return 0;
+}
+
+void fwu_cache_store(struct fwu_cache *c)
+{
+	char tmp[PATH_MAX];
+
+	if (!c->enabled)
+		return;
+	c->enabled = 0;
+
+	/* copy via a private name, publish atomically */
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", c->entry, getpid()) >=
+	    (int)sizeof(tmp))
+		return;
+
+	if (fwu_cache_copy(c->output, tmp))
+		return;
+	if (rename(tmp, c->entry))
+		unlink(tmp);
+}
@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * fwu_cache - content-addressed output cache for the wrapper tools
+ *
+ * The simple wrapper tools are pure functions of (input bytes,
+ * options), so identical invocations can reuse the previous output.
+ * Pointing FWU_CACHE at a directory opts a run in: the cache key is a
+ * SHA-1 over the tool name, the canonicalized argument vector (with
+ * the input path replaced by the input's content and the output path
+ * dropped) and a hit copies the cached artifact into place without
+ * reading or transforming anything. Unset FWU_CACHE means every call
+ * is a no-op.
+ */
+
+#ifndef __FWU_CACHE_H
+#define __FWU_CACHE_H
+
+#include <limits.h>
+
+struct fwu_cache {
+	int enabled;
+	char entry[PATH_MAX];
+	const char *output;
+};
+
+/*
+ * Probe the cache for this invocation. Returns 1 on a hit with the
+ * output already copied into place (the tool is done), 0 on a
+ * miss or with the cache disabled (do the work, then call
+ * fwu_cache_store()), -1 when the key cannot be computed (e.g. the
+ * input is unreadable; proceed and let the tool report it). argv is
+ * the NULL-terminated argument vector; tokens equal to input hash as
+ * the file's content, tokens equal to output are skipped.
+ */
+int fwu_cache_lookup(struct fwu_cache *c, const char *tool, char **argv,
+		     const char *input, const char *output);
+
+/* Publish the freshly written output under the key; no-op on miss-
+ * less runs (disabled cache or failed key). Best-effort: the tool's
+ * own output already exists either way. */
+void fwu_cache_store(struct fwu_cache *c);
+
+#endif /* __FWU_CACHE_H */
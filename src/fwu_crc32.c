@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * fwu_crc32 - threaded zlib CRC-32 shared by the image tools
+ *
+ * The payload CRC passes are the longest step for large images: split
+ * them over a thread pool and merge the per-chunk CRCs with zlib's
+ * crc32_combine(). The result is identical for any thread count.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "fwu_crc32.h"
+
+#define CRC_CHUNK_MIN	(1024 * 1024)
+#define CRC_JOBS_MAX	16
+
+struct crc_job {
+	pthread_t thread;
+	const Bytef *buf;
+	size_t len;
+	uLong crc;
+};
+
+static void *crc32_worker(void *arg)
+{
+	struct crc_job *job = arg;
+
+	job->crc = crc32(crc32(0L, Z_NULL, 0), job->buf, job->len);
+
+	return NULL;
+}
+
+uLong fwu_crc32_parallel(uLong crc, const Bytef *buf, size_t len, int jobs)
+{
+	struct crc_job crc_jobs[CRC_JOBS_MAX];
+	size_t chunk;
+	int n, i, created;
+
+	n = jobs;
+	if (n <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		n = cpus > 0 ? (int)cpus : 1;
+	}
+	if (n > CRC_JOBS_MAX)
+		n = CRC_JOBS_MAX;
+	if ((size_t)n > len / CRC_CHUNK_MIN)
+		n = len / CRC_CHUNK_MIN;
+
+	if (n <= 1)
+		return crc32(crc, buf, len);
+
+	chunk = len / n;
+	for (created = 1; created < n; created++) {
+		struct crc_job *job = &crc_jobs[created];
+
+		job->buf = buf + created * chunk;
+		job->len = (created == n - 1) ? len - created * chunk : chunk;
+		if (pthread_create(&job->thread, NULL, crc32_worker, job))
+			break;
+	}
+
+	crc = crc32(crc, buf, chunk);
+	for (i = 1; i < created; i++) {
+		pthread_join(crc_jobs[i].thread, NULL);
+		crc = crc32_combine(crc, crc_jobs[i].crc, crc_jobs[i].len);
+	}
+
+	/* chunks whose threads could not be created are finished inline */
+	if (created < n) {
+		size_t done = created * chunk;
+
+		crc = crc32(crc, buf + done, len - done);
+	}
+
+	return crc;
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * fwu_crc32 - threaded zlib CRC-32 shared by the image tools
+ */
+
+#ifndef __FWU_CRC32_H
+#define __FWU_CRC32_H
+
+#include <stddef.h>
+#include <zlib.h>
+
+/*
+ * crc32() over buf, split across a thread pool and merged with
+ * crc32_combine(). The result is identical for any thread count.
+ * jobs <= 0 sizes the pool from the online CPU count.
+ */
+uLong fwu_crc32_parallel(uLong crc, const Bytef *buf, size_t len, int jobs);
+
+#endif /* __FWU_CRC32_H */
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * fwu_csum - wide byte-sum checksum kernels shared by the image tools
+ */
+
+#ifndef __FWU_CSUM_H
+#define __FWU_CSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sum of all bytes in buf, mod 2^32 */
+uint32_t fwu_byte_sum(const void *buf, size_t len);
+
+/*
+ * Sum of little-endian 16-bit words in buf, mod 2^32; a trailing odd
+ * byte is added as-is.
+ */
+uint32_t fwu_le16_sum(const void *buf, size_t len);
+
+/*
+ * Advance a Fletcher-style checksum pair over buf: per input byte,
+ * c0 += byte; c1 += c0 (both mod 2^32). Equivalent to the scalar loop
+ * but computed from two independent reductions so it vectorizes.
+ */
+void fwu_fletcher_update(uint32_t *c0, uint32_t *c1, const void *buf,
+			 size_t len);
+
+#endif /* __FWU_CSUM_H */
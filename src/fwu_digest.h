@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * fwu_digest - fused multi-digest engine
+ *
+ * Recipes frequently stack tools over byte-identical payload ranges:
+ * otrx wants CRC32, seama and mktplinkfw want MD5, mkplanexfw wants
+ * SHA-1 - three full scans of the same image. This engine updates
+ * every requested accumulator per cache-sized chunk, so the payload
+ * crosses the memory bus once no matter how many digests are wanted.
+ */
+
+#ifndef __FWU_DIGEST_H
+#define __FWU_DIGEST_H
+
+#include <stddef.h>
+
+#include "cyg_crc.h"
+#include "md5.h"
+#include "sha1.h"
+
+#define FWU_DIGEST_CRC32	(1 << 0)	/* cyg_crc32(): zero seed */
+#define FWU_DIGEST_MD5		(1 << 1)
+#define FWU_DIGEST_SHA1		(1 << 2)
+
+struct fwu_digest {
+	unsigned int want;
+	cyg_uint32 crc32;
+	MD5_CTX md5;
+	sha1_context sha1;
+	unsigned char md5_digest[16];
+	unsigned char sha1_digest[20];
+};
+
+/* Start a digest run; want is an or of the FWU_DIGEST_* bits. */
+void fwu_digest_init(struct fwu_digest *d, unsigned int want);
+
+/* Feed len bytes to every requested accumulator in one pass. */
+void fwu_digest_update(struct fwu_digest *d, const void *data, size_t len);
+
+/*
+ * Finalize: afterwards the crc32 field and the md5_digest/sha1_digest
+ * arrays hold the results for whichever digests were requested.
+ */
+void fwu_digest_final(struct fwu_digest *d);
+
+#endif /* __FWU_DIGEST_H */
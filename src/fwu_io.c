@@ -0,0 +1,639 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * fwu_io - shared zero-copy input helpers for the firmware utilities
+ *
+ * Generalizes the map_input() helper that zytrx.c carried locally so
+ * every tool can use it.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#if defined(__linux__) && defined(__NR_io_uring_setup) && \
+    defined(__NR_io_uring_enter)
+#define FWU_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include "fwu_io.h"
+
+/* Inputs at least this big are evicted from the page cache on close. */
+#define FWU_DONTNEED_MIN	(64 * 1024 * 1024)
+
+/* Fallback for inputs fstat() cannot size: pipes, sockets, etc. */
+static int fwu_input_slurp(struct fwu_input *in, int fd)
+{
+	size_t bufsize = 1024 * 1024;
+	size_t len = 0;
+	char *buf;
+
+	buf = malloc(bufsize);
+	if (!buf)
+		return -1;
+
+	for (;;) {
+		ssize_t n;
+
+		if (len == bufsize) {
+			char *newbuf;
+
+			bufsize *= 2;
+			newbuf = realloc(buf, bufsize);
+			if (!newbuf) {
+				free(buf);
+				return -1;
+			}
+			buf = newbuf;
+		}
+
+		n = read(fd, buf + len, bufsize - len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return -1;
+		}
+		if (!n)
+			break;
+		len += n;
+	}
+
+	in->data = buf;
+	in->size = len;
+	in->mapped = 0;
+
+	return 0;
+}
+
+static int fwu_name_is_gz(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len > 3 && !strcmp(name + len - 3, ".gz");
+}
+
+int fwu_input_open(struct fwu_input *in, const char *name)
+{
+	struct stat st;
+	void *mapped;
+	int fd;
+	int err;
+
+	memset(in, 0, sizeof(*in));
+	in->fd = -1;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	if (!S_ISREG(st.st_mode)) {
+		err = fwu_input_slurp(in, fd);
+		close(fd);
+		return err;
+	}
+
+	/* mmap() rejects empty files; hand out a tiny buffer instead */
+	if (!st.st_size) {
+		close(fd);
+		in->data = malloc(1);
+		if (!in->data)
+			return -1;
+		return 0;
+	}
+
+	mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	/*
+	 * The tools make one forward pass over the image: prime the
+	 * readahead up front, and let big mappings use huge pages where
+	 * the kernel supports them for read-only file mappings. All of
+	 * these are best-effort hints.
+	 */
+	(void)madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+	(void)madvise(mapped, st.st_size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+	(void)madvise(mapped, st.st_size, MADV_HUGEPAGE);
+#endif
+
+	in->data = mapped;
+	in->size = st.st_size;
+	in->mapped = 1;
+	in->fd = fd;
+
+	return 0;
+}
+
+int fwu_append_zeros(FILE *fp, size_t length)
+{
+	struct stat st;
+
+	if (!length)
+		return 0;
+
+	if (fflush(fp))
+		return -1;
+
+	if (!fstat(fileno(fp), &st) && S_ISREG(st.st_mode)) {
+		static const char zero;
+
+		if (fseek(fp, length - 1, SEEK_CUR))
+			return -1;
+		if (fwrite(&zero, 1, 1, fp) != 1)
+			return -1;
+
+		return 0;
+	}
+
+	while (length) {
+		static const char zeros[64 * 1024];
+		size_t bytes = length < sizeof(zeros) ? length : sizeof(zeros);
+
+		if (fwrite(zeros, 1, bytes, fp) != bytes)
+			return -1;
+		length -= bytes;
+	}
+
+	return 0;
+}
+
+ssize_t fwu_copy_data(FILE *from, FILE *to, size_t size)
+{
+	int copy_all = size == 0;
+	struct stat ist, ost;
+	ssize_t ret = 0;
+	char buf[64 * 1024];
+
+	if (!fstat(fileno(from), &ist) && !fstat(fileno(to), &ost) &&
+	    S_ISREG(ist.st_mode) && S_ISREG(ost.st_mode) &&
+	    !fflush(from) && !fflush(to)) {
+		int fell_back = 0;
+
+		while (copy_all || size) {
+			size_t chunk = 32 * 1024 * 1024;
+			ssize_t bytes;
+
+			if (!copy_all && size < chunk)
+				chunk = size;
+
+			bytes = copy_file_range(fileno(from), NULL,
+						fileno(to), NULL, chunk, 0);
+			if (bytes < 0) {
+				/* old kernel or filesystem combination */
+				if (!ret && (errno == ENOSYS || errno == EXDEV ||
+					     errno == EINVAL || errno == EBADF)) {
+					fell_back = 1;
+					break;
+				}
+				return -EIO;
+			}
+			if (!bytes) {
+				if (copy_all)
+					break;
+				return -EIO;
+			}
+
+			if (!copy_all)
+				size -= bytes;
+			ret += bytes;
+		}
+
+		/* bring the stdio positions back in sync with the fds */
+		fseeko(from, lseek(fileno(from), 0, SEEK_CUR), SEEK_SET);
+		fseeko(to, lseek(fileno(to), 0, SEEK_CUR), SEEK_SET);
+
+		if (!fell_back)
+			return ret;
+	}
+
+	while (copy_all || size) {
+		size_t to_read = sizeof(buf);
+		size_t bytes;
+
+		if (!copy_all && size < to_read)
+			to_read = size;
+
+		bytes = fread(buf, 1, to_read, from);
+		if (!bytes) {
+			if (copy_all)
+				break;
+			return -EIO;
+		}
+		if (fwrite(buf, 1, bytes, to) != bytes)
+			return -EIO;
+
+		if (!copy_all)
+			size -= bytes;
+		ret += bytes;
+	}
+
+	return ret;
+}
+
+/* Streams handed out for pending ".gz" outputs, and their final names. */
+#define FWU_GZ_MAX_OPEN	8
+static struct {
+	FILE *fp;
+	char *name;
+} fwu_gz_open[FWU_GZ_MAX_OPEN];
+
+/* Inflate fd (taking ownership of it) into a seekable temporary file. */
+static FILE *fwu_gunzip_fd(int fd)
+{
+	char buf[64 * 1024];
+	FILE *out;
+	gzFile gz;
+	int n;
+
+	gz = gzdopen(fd, "rb");
+	if (!gz) {
+		close(fd);
+		return NULL;
+	}
+
+	out = tmpfile();
+	if (!out) {
+		gzclose(gz);
+		return NULL;
+	}
+
+	while ((n = gzread(gz, buf, sizeof(buf))) > 0) {
+		if (fwrite(buf, 1, n, out) != (size_t)n) {
+			n = -1;
+			break;
+		}
+	}
+	gzclose(gz);
+
+	if (n < 0) {
+		fclose(out);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	rewind(out);
+	return out;
+}
+
+FILE *fwu_fopen(const char *name, const char *mode)
+{
+	FILE *fp;
+	int c0, c1;
+
+	if (mode[0] == 'w' && fwu_name_is_gz(name)) {
+		size_t i;
+
+		for (i = 0; i < FWU_GZ_MAX_OPEN; i++)
+			if (!fwu_gz_open[i].fp)
+				break;
+		if (i == FWU_GZ_MAX_OPEN) {
+			errno = EMFILE;
+			return NULL;
+		}
+
+		fwu_gz_open[i].name = strdup(name);
+		if (!fwu_gz_open[i].name)
+			return NULL;
+
+		fp = tmpfile();
+		if (!fp) {
+			free(fwu_gz_open[i].name);
+			fwu_gz_open[i].name = NULL;
+			return NULL;
+		}
+		fwu_gz_open[i].fp = fp;
+
+		return fp;
+	}
+
+	fp = fopen(name, mode);
+	if (!fp || mode[0] != 'r' || strchr(mode, '+') ||
+	    !fwu_name_is_gz(name))
+		return fp;
+
+	c0 = fgetc(fp);
+	c1 = fgetc(fp);
+	if (c0 == 0x1f && c1 == 0x8b) {
+		int fd = dup(fileno(fp));
+
+		fclose(fp);
+		if (fd < 0)
+			return NULL;
+		if (lseek(fd, 0, SEEK_SET) < 0) {
+			close(fd);
+			return NULL;
+		}
+		return fwu_gunzip_fd(fd);
+	}
+	rewind(fp);
+
+	return fp;
+}
+
+int fwu_fclose(FILE *fp)
+{
+	char buf[64 * 1024];
+	gzFile gz = NULL;
+	int err = 0;
+	size_t i, n;
+
+	for (i = 0; i < FWU_GZ_MAX_OPEN; i++)
+		if (fwu_gz_open[i].fp == fp)
+			break;
+	if (i == FWU_GZ_MAX_OPEN)
+		return fclose(fp);
+
+	if (fflush(fp))
+		err = -1;
+	rewind(fp);
+
+	if (!err) {
+		gz = gzopen(fwu_gz_open[i].name, "wb");
+		if (!gz)
+			err = -1;
+	}
+
+	while (gz && (n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		if (gzwrite(gz, buf, n) != (int)n) {
+			err = -1;
+			break;
+		}
+	}
+	if (gz && ferror(fp))
+		err = -1;
+	if (gz && gzclose(gz) != Z_OK)
+		err = -1;
+
+	fclose(fp);
+	free(fwu_gz_open[i].name);
+	fwu_gz_open[i].fp = NULL;
+	fwu_gz_open[i].name = NULL;
+
+	return err;
+}
+
+struct fwu_wq_ent {
+	const void *data;
+	size_t len;
+	off_t off;
+	ssize_t res;		/* bytes already written by the flush */
+};
+
+void fwu_wq_init(struct fwu_wq *wq, int fd)
+{
+	memset(wq, 0, sizeof(*wq));
+	wq->fd = fd;
+}
+
+int fwu_wq_write(struct fwu_wq *wq, const void *data, size_t len, off_t off)
+{
+	struct fwu_wq_ent *e;
+
+	if (!len)
+		return 0;
+
+	if (wq->n_ents == wq->alloc) {
+		size_t alloc = wq->alloc ? wq->alloc * 2 : 16;
+
+		e = realloc(wq->ents, alloc * sizeof(*e));
+		if (!e)
+			return -1;
+		wq->ents = e;
+		wq->alloc = alloc;
+	}
+
+	e = &wq->ents[wq->n_ents++];
+	e->data = data;
+	e->len = len;
+	e->off = off;
+	e->res = 0;
+
+	return 0;
+}
+
+/* Write out (the remainder of) one queued region with plain pwrite(). */
+static int fwu_wq_pwrite(int fd, struct fwu_wq_ent *e)
+{
+	const char *p = (const char *)e->data + e->res;
+	size_t left = e->len - e->res;
+	off_t off = e->off + e->res;
+
+	while (left) {
+		ssize_t n = pwrite(fd, p, left, off);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!n) {
+			errno = EIO;
+			return -1;
+		}
+		p += n;
+		off += n;
+		left -= n;
+	}
+
+	return 0;
+}
+
+#ifdef FWU_HAVE_IO_URING
+/*
+ * Push the whole queue through one io_uring, submitting in ring-sized
+ * batches and draining the completions of each batch before the next.
+ * Per-entry results land in ent->res; anything the ring could not
+ * finish (old kernel, partial write) is completed by the caller with
+ * pwrite(). Returns -1 only when the ring itself cannot be set up.
+ */
+static int fwu_wq_flush_uring(struct fwu_wq *wq)
+{
+	struct io_uring_params p;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned char *sq_ptr, *cq_ptr = NULL;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	size_t sq_sz, cq_sz;
+	size_t done = 0;
+	int ring_fd;
+	int ret = -1;
+
+	memset(&p, 0, sizeof(p));
+	ring_fd = syscall(__NR_io_uring_setup, 64, &p);
+	if (ring_fd < 0)
+		return -1;
+
+	sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_sz > sq_sz)
+			sq_sz = cq_sz;
+	}
+
+	sq_ptr = mmap(NULL, sq_sz, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED)
+		goto out_close;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ptr = sq_ptr;
+	} else {
+		cq_ptr = mmap(NULL, cq_sz, PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_POPULATE, ring_fd,
+			      IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED)
+			goto out_unmap_sq;
+	}
+
+	sqes = mmap(NULL, p.sq_entries * sizeof(*sqes),
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		    ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		goto out_unmap_cq;
+
+	sq_tail = (unsigned *)(sq_ptr + p.sq_off.tail);
+	sq_mask = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+	sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+	cq_head = (unsigned *)(cq_ptr + p.cq_off.head);
+	cq_tail = (unsigned *)(cq_ptr + p.cq_off.tail);
+	cq_mask = (unsigned *)(cq_ptr + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)(cq_ptr + p.cq_off.cqes);
+
+	while (done < wq->n_ents) {
+		unsigned batch = wq->n_ents - done;
+		unsigned tail = *sq_tail;
+		unsigned head, ctail;
+		unsigned i;
+
+		if (batch > p.sq_entries)
+			batch = p.sq_entries;
+
+		for (i = 0; i < batch; i++) {
+			unsigned idx = tail & *sq_mask;
+			struct io_uring_sqe *sqe = &sqes[idx];
+			struct fwu_wq_ent *e = &wq->ents[done + i];
+
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_WRITE;
+			sqe->fd = wq->fd;
+			sqe->addr = (unsigned long)e->data;
+			sqe->len = e->len;
+			sqe->off = e->off;
+			sqe->user_data = done + i;
+			sq_array[idx] = idx;
+			tail++;
+		}
+		__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+		if (syscall(__NR_io_uring_enter, ring_fd, batch, batch,
+			    IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+			break;
+
+		head = *cq_head;
+		ctail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		while (head != ctail) {
+			struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+
+			if (cqe->user_data < wq->n_ents && cqe->res > 0)
+				wq->ents[cqe->user_data].res = cqe->res;
+			head++;
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+		done += batch;
+	}
+	ret = 0;
+
+	munmap(sqes, p.sq_entries * sizeof(*sqes));
+out_unmap_cq:
+	if (cq_ptr && cq_ptr != sq_ptr)
+		munmap(cq_ptr, cq_sz);
+out_unmap_sq:
+	munmap(sq_ptr, sq_sz);
+out_close:
+	close(ring_fd);
+	return ret;
+}
+#endif /* FWU_HAVE_IO_URING */
+
+int fwu_wq_flush(struct fwu_wq *wq)
+{
+	size_t i;
+	int ret = 0;
+
+#ifdef FWU_HAVE_IO_URING
+	static int no_uring;
+
+	if (!no_uring && wq->n_ents > 1 && fwu_wq_flush_uring(wq) < 0)
+		no_uring = 1;
+#endif
+
+	/* complete (or, without a ring, perform) every queued write */
+	for (i = 0; i < wq->n_ents; i++) {
+		struct fwu_wq_ent *e = &wq->ents[i];
+
+		if ((size_t)e->res != e->len && fwu_wq_pwrite(wq->fd, e)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	free(wq->ents);
+	wq->ents = NULL;
+	wq->n_ents = 0;
+	wq->alloc = 0;
+
+	return ret;
+}
+
+void fwu_input_close(struct fwu_input *in)
+{
+	if (!in->data)
+		return;
+
+	if (in->mapped) {
+		munmap(in->data, in->size);
+		if (in->fd >= 0) {
+			/*
+			 * The single pass is done. Images big enough to
+			 * push other jobs' pages out get dropped from the
+			 * page cache; small inputs stay cached for the
+			 * next tool in the pipeline.
+			 */
+			if (in->size >= FWU_DONTNEED_MIN)
+				(void)posix_fadvise(in->fd, 0, 0,
+						    POSIX_FADV_DONTNEED);
+			close(in->fd);
+		}
+	} else {
+		free(in->data);
+	}
+
+	memset(in, 0, sizeof(*in));
+	in->fd = -1;
+}
@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * fwu_io - shared zero-copy input helpers for the firmware utilities
+ *
+ * Regular files are mmap()ed read-only so that a pipeline of tools
+ * working on the same large image shares a single page-cache copy.
+ * Non-seekable inputs (pipes, character devices) transparently fall
+ * back to a malloc()ed buffer filled with read().
+ */
+
+#ifndef __FWU_IO_H
+#define __FWU_IO_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+struct fwu_input {
+	void *data;
+	size_t size;
+	int mapped;
+	int fd;		/* kept open on mapped inputs for the final fadvise */
+};
+
+/*
+ * Open and fully load/map an input file. Returns 0 on success, -1 on
+ * failure with errno set. On success in->data holds the whole file
+ * (read-only when mapped) and in->size its length. The bytes are always
+ * the file's bytes verbatim - many tools embed gzip files as payloads,
+ * so compressed intermediates are handled only by the explicitly scoped
+ * fwu_fopen()/fwu_fclose() streams below.
+ */
+int fwu_input_open(struct fwu_input *in, const char *name);
+
+/* Release whatever fwu_input_open() set up. Safe on a zeroed struct. */
+void fwu_input_close(struct fwu_input *in);
+
+/*
+ * Append length zero bytes at fp's current (end-of-file) position.
+ * Regular files get a sparse hole plus one materializing byte; pipes
+ * and other streams get real zeros. Returns 0 on success, -1 on error.
+ */
+int fwu_append_zeros(FILE *fp, size_t length);
+
+/*
+ * Copy size bytes (0 = until EOF) from one stream to the other,
+ * starting at their current positions. Regular-file-to-regular-file
+ * copies go through copy_file_range() so the data never enters
+ * userspace (and stays reflinked/sparse where the filesystem can);
+ * anything else takes a buffered loop. Returns the number of bytes
+ * copied or -EIO, with both stream positions advanced past the copy.
+ */
+ssize_t fwu_copy_data(FILE *from, FILE *to, size_t size);
+
+/*
+ * fopen()/fclose() drop-ins that keep intermediate artifacts gzip
+ * compressed on disk. A name ending in ".gz" opened for writing is
+ * backed by an unlinked temporary file which fwu_fclose() compresses
+ * into place; one opened for plain reading (and carrying the gzip
+ * magic) is inflated into an unlinked temporary file. Either way the
+ * tool sees a fully seekable stream of plain data. Every other
+ * name/mode combination is an ordinary fopen()/fclose() - firmware
+ * payloads are frequently gzip files themselves, so nothing is
+ * inspected unless the name opts in via the suffix. fwu_fclose()
+ * returns nonzero when the final compressed write fails.
+ */
+FILE *fwu_fopen(const char *name, const char *mode);
+int fwu_fclose(FILE *fp);
+
+/*
+ * Queued positioned writes for the heavy image writers. A tool queues
+ * every region of the output as it becomes known (the data must stay
+ * valid until the flush) and drains the lot with one fwu_wq_flush()
+ * before closing the fd. On Linux the flush goes through io_uring in
+ * ring-sized submission batches, collapsing the per-region syscalls;
+ * where that is unavailable it degrades to plain pwrite() per region.
+ */
+struct fwu_wq_ent;
+
+struct fwu_wq {
+	int fd;
+	struct fwu_wq_ent *ents;
+	size_t n_ents;
+	size_t alloc;
+};
+
+void fwu_wq_init(struct fwu_wq *wq, int fd);
+
+/* Queue len bytes at offset off. Returns 0, or -1 with errno set. */
+int fwu_wq_write(struct fwu_wq *wq, const void *data, size_t len, off_t off);
+
+/*
+ * Submit and drain every queued write, then reset the queue. Returns 0
+ * once everything is fully written, -1 with errno set otherwise.
+ */
+int fwu_wq_flush(struct fwu_wq *wq);
+
+#endif /* __FWU_IO_H */
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * fwu_jobs - resident job-server mode for the small header tools
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fwu_jobs.h"
+
+#define FWU_JOBS_ARGV_MAX 64
+
+static int fwu_jobs_from(FILE *fp, char *prog, int (*tool_run)(int, char **))
+{
+	char *line = NULL;
+	size_t line_size = 0;
+	int failed = 0;
+
+	while (getline(&line, &line_size, fp) >= 0) {
+		char *argv[FWU_JOBS_ARGV_MAX];
+		char *tok, *save;
+		int argc = 0;
+
+		if (line[0] == '#')
+			continue;
+
+		argv[argc++] = prog;
+		for (tok = strtok_r(line, " \t\r\n", &save);
+		     tok && argc < FWU_JOBS_ARGV_MAX - 1;
+		     tok = strtok_r(NULL, " \t\r\n", &save))
+			argv[argc++] = tok;
+		argv[argc] = NULL;
+
+		if (argc == 1)
+			continue;
+
+		/* restart getopt() for tools that use it */
+		optind = 0;
+		if (tool_run(argc, argv) != EXIT_SUCCESS)
+			failed++;
+	}
+
+	free(line);
+
+	if (failed)
+		fprintf(stderr, "%s: %d job(s) failed\n", prog, failed);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int fwu_jobs_run(int argc, char **argv, int (*tool_run)(int, char **))
+{
+	FILE *fp;
+	int ret;
+
+	if (argc != 3 || strcmp(argv[1], "--jobs-from")) {
+		optind = 0;
+		return tool_run(argc, argv);
+	}
+
+	if (!strcmp(argv[2], "-"))
+		return fwu_jobs_from(stdin, argv[0], tool_run);
+
+	fp = fopen(argv[2], "r");
+	if (!fp) {
+		fprintf(stderr, "%s: can't open job file '%s'\n", argv[0], argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	ret = fwu_jobs_from(fp, argv[0], tool_run);
+	fclose(fp);
+
+	return ret;
+}
@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * fwu_jobs - resident job-server mode for the small header tools
+ *
+ * Release builds invoke tools like add_header or mkchkimg tens of
+ * thousands of times, and fork/exec/dynamic-link dwarfs the per-image
+ * work. Tools route main() through fwu_jobs_run(); when invoked as
+ *   <tool> --jobs-from <file|->
+ * one resident process reads newline-delimited job specs (each line a
+ * complete argument list, '#' starts a comment) and runs the tool's
+ * logic once per line. Any other invocation behaves exactly as before.
+ */
+
+#ifndef __FWU_JOBS_H
+#define __FWU_JOBS_H
+
+/*
+ * tool_run is the tool's former main(); it must reset any file-scope
+ * state it mutates, since it may be called many times per process.
+ * Returns the exit status: tool_run's result for a plain invocation,
+ * or failure if any job in a batch failed.
+ */
+int fwu_jobs_run(int argc, char **argv, int (*tool_run)(int, char **));
+
+#endif /* __FWU_JOBS_H */
@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * fwu_perf - opt-in phase instrumentation for the image tools
+ *
+ * See fwu_perf.h for the output format and the enabling env var.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fwu_perf.h"
+
+#define FWU_PERF_MAX_PHASES	16
+
+#ifdef CLOCK_MONOTONIC_RAW
+#define FWU_PERF_CLOCK		CLOCK_MONOTONIC_RAW
+#else
+#define FWU_PERF_CLOCK		CLOCK_MONOTONIC
+#endif
+
+struct fwu_perf_rec {
+	const char *name;
+	uint64_t ns;
+	uint64_t bytes;
+};
+
+static int perf_on;	/* 0 = env not checked yet, -1 = off, 1 = on */
+static struct fwu_perf_rec perf_recs[FWU_PERF_MAX_PHASES];
+static int perf_n_recs;
+static int perf_cur = -1;
+static uint64_t perf_t_run;
+static uint64_t perf_t_phase;
+
+static uint64_t perf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(FWU_PERF_CLOCK, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Close the running phase and charge it the elapsed time. */
+static void perf_close_phase(uint64_t now)
+{
+	if (perf_cur >= 0)
+		perf_recs[perf_cur].ns += now - perf_t_phase;
+	perf_cur = -1;
+}
+
+void fwu_perf_phase(const char *name)
+{
+	uint64_t now;
+	int i;
+
+	if (!perf_on) {
+		const char *env = getenv("FWU_PERF");
+
+		perf_on = (env && *env) ? 1 : -1;
+	}
+	if (perf_on < 0)
+		return;
+
+	now = perf_now();
+	if (!perf_n_recs && perf_cur < 0)
+		perf_t_run = now;
+	perf_close_phase(now);
+
+	for (i = 0; i < perf_n_recs; i++)
+		if (!strcmp(perf_recs[i].name, name))
+			break;
+	if (i == perf_n_recs) {
+		if (perf_n_recs == FWU_PERF_MAX_PHASES)
+			return;
+		perf_recs[perf_n_recs++].name = name;
+	}
+
+	perf_cur = i;
+	perf_t_phase = now;
+}
+
+void fwu_perf_bytes(size_t n)
+{
+	if (perf_on > 0 && perf_cur >= 0)
+		perf_recs[perf_cur].bytes += n;
+}
+
+void fwu_perf_done(const char *tool)
+{
+	uint64_t now;
+	int i;
+
+	if (perf_on <= 0)
+		return;
+
+	now = perf_now();
+	perf_close_phase(now);
+
+	fprintf(stderr, "{\"tool\":\"%s\",\"total_ns\":%" PRIu64
+		",\"phases\":[", tool, now - perf_t_run);
+	for (i = 0; i < perf_n_recs; i++)
+		fprintf(stderr, "%s{\"name\":\"%s\",\"ns\":%" PRIu64
+			",\"bytes\":%" PRIu64 "}", i ? "," : "",
+			perf_recs[i].name, perf_recs[i].ns,
+			perf_recs[i].bytes);
+	fprintf(stderr, "]}\n");
+
+	/* reset so jobs-mode runs report individually */
+	memset(perf_recs, 0, sizeof(perf_recs));
+	perf_n_recs = 0;
+	perf_cur = -1;
+}
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * fwu_perf - opt-in phase instrumentation for the image tools
+ *
+ * Measuring the tools from outside (time, strace) cannot attribute
+ * cost between their read, checksum, transform and write phases. The
+ * hot tools carry phase markers instead; with FWU_PERF set to any
+ * non-empty value a run emits one JSON line on stderr:
+ *
+ *   {"tool":"otrx","total_ns":...,"phases":[
+ *     {"name":"crc32","ns":...,"bytes":...},...]}
+ *
+ * With FWU_PERF unset every marker is a single predictable branch on
+ * a cached flag, so they are safe to leave in the hot paths.
+ */
+
+#ifndef __FWU_PERF_H
+#define __FWU_PERF_H
+
+#include <stddef.h>
+
+/* Enter the named phase, closing the previous one. Re-entering a
+ * name accumulates into the same record. */
+void fwu_perf_phase(const char *name);
+
+/* Attribute n processed bytes to the current phase. */
+void fwu_perf_bytes(size_t n);
+
+/* Close the run, emit the JSON line and reset for the next run. */
+void fwu_perf_done(const char *tool);
+
+#endif /* __FWU_PERF_H */
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * fwu_pool - shared worker pool for the data-parallel tool modes
+ *
+ * Replaces the per-tool sysconf(_SC_NPROCESSORS_ONLN) pools so that
+ * every tool sizes itself the same way, and so that runs under a
+ * constrained scheduler (taskset, cgroup CPU quota) stop spawning one
+ * thread per machine core they are not allowed to use.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fwu_pool.h"
+
+#define FWU_POOL_MAX	64
+
+/* CPUs this process may actually run on, not CPUs in the machine */
+static unsigned fwu_pool_cpus(void)
+{
+	long cpus = 0;
+
+#ifdef __linux__
+	cpu_set_t set;
+
+	if (!sched_getaffinity(0, sizeof(set), &set))
+		cpus = CPU_COUNT(&set);
+#endif
+	if (cpus < 1)
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+
+	return cpus;
+}
+
+/*
+ * Whole CPUs granted by the cgroup CPU bandwidth quota, rounded up;
+ * 0 when no quota applies. Checks the v2 interface first, then v1.
+ */
+static unsigned fwu_pool_quota(void)
+{
+	unsigned long quota, period;
+	long q = -1, p = 0;
+	char buf[64];
+	FILE *fp;
+
+	fp = fopen("/sys/fs/cgroup/cpu.max", "r");
+	if (fp) {
+		/* "max 100000" fails the first %lu and means no limit */
+		if (!fgets(buf, sizeof(buf), fp) ||
+		    sscanf(buf, "%lu %lu", &quota, &period) != 2)
+			quota = period = 0;
+		fclose(fp);
+		if (quota && period)
+			return (quota + period - 1) / period;
+		return 0;
+	}
+
+	fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r");
+	if (fp) {
+		if (fscanf(fp, "%ld", &q) != 1)
+			q = -1;
+		fclose(fp);
+	}
+	fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+	if (fp) {
+		if (fscanf(fp, "%ld", &p) != 1)
+			p = 0;
+		fclose(fp);
+	}
+	if (q > 0 && p > 0)
+		return (q + p - 1) / p;
+
+	return 0;
+}
+
+unsigned fwu_pool_threads(size_t n_tasks)
+{
+	unsigned n = fwu_pool_cpus();
+	unsigned quota = fwu_pool_quota();
+	const char *env = getenv("FWU_THREADS");
+
+	if (quota && quota < n)
+		n = quota;
+
+	if (env) {
+		char *end;
+		unsigned long v = strtoul(env, &end, 0);
+
+		if (end != env && !*end && v >= 1)
+			n = v;
+	}
+
+	if (n > FWU_POOL_MAX)
+		n = FWU_POOL_MAX;
+	if (n_tasks && n > n_tasks)
+		n = n_tasks;
+	if (n < 1)
+		n = 1;
+
+	return n;
+}
+
+struct fwu_pool_job {
+	void (*task)(size_t idx, void *ctx);
+	void *ctx;
+	size_t n_tasks;
+	size_t next;
+	pthread_mutex_t lock;
+};
+
+static void *fwu_pool_worker(void *arg)
+{
+	struct fwu_pool_job *job = arg;
+
+	for (;;) {
+		size_t idx;
+
+		pthread_mutex_lock(&job->lock);
+		idx = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (idx >= job->n_tasks)
+			break;
+
+		job->task(idx, job->ctx);
+	}
+
+	return NULL;
+}
+
+void fwu_pool_run(size_t n_tasks, void (*task)(size_t idx, void *ctx),
+		  void *ctx)
+{
+	struct fwu_pool_job job = {
+		.task = task,
+		.ctx = ctx,
+		.n_tasks = n_tasks,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t threads[FWU_POOL_MAX];
+	unsigned i, n, started = 0;
+
+	if (!n_tasks)
+		return;
+
+	n = fwu_pool_threads(n_tasks);
+	/* a failed spawn just means fewer helpers; the work still runs */
+	for (i = 0; i + 1 < n; i++) {
+		if (pthread_create(&threads[started], NULL, fwu_pool_worker,
+				   &job))
+			break;
+		started++;
+	}
+
+	fwu_pool_worker(&job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+}
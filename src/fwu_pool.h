@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * fwu_pool - shared worker pool for the data-parallel tool modes
+ *
+ * One place deciding how many threads a tool run may use: the CPUs in
+ * the process's affinity mask, capped by the cgroup CPU quota when one
+ * applies (CI runners), overridable with FWU_THREADS. Tasks are
+ * claimed one at a time from a shared counter, so uneven items balance
+ * across the workers instead of being split up front.
+ */
+
+#ifndef __FWU_POOL_H
+#define __FWU_POOL_H
+
+#include <stddef.h>
+
+/*
+ * Worker budget for n_tasks independent tasks: min(affinity CPUs,
+ * cgroup CPU quota, n_tasks), at least 1. A valid FWU_THREADS value
+ * overrides the detected budget (but not the task count).
+ */
+unsigned fwu_pool_threads(size_t n_tasks);
+
+/*
+ * Run task(idx, ctx) for every idx in [0, n_tasks) across the worker
+ * budget; the calling thread works too, so a budget of 1 degenerates
+ * to a plain loop with no threads spawned. Returns once every task
+ * has finished.
+ */
+void fwu_pool_run(size_t n_tasks, void (*task)(size_t idx, void *ctx),
+		  void *ctx);
+
+#endif /* __FWU_POOL_H */
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * fwu_xor - wide XOR kernels shared by the image obfuscation tools
+ */
+
+#ifndef __FWU_XOR_H
+#define __FWU_XOR_H
+
+#include <stddef.h>
+
+/* XOR len bytes of data with an equally long mask, in place */
+void fwu_xor_buf(void *data, const void *mask, size_t len);
+
+/*
+ * XOR len bytes of data with a repeating pattern, starting at offset
+ * p_off into the pattern. Returns the pattern offset to continue from,
+ * so callers can keep the rolling key across buffer refills.
+ */
+int fwu_xor_pattern(void *data, size_t len, const void *pattern, int p_len,
+		    int p_off);
+
+#endif /* __FWU_XOR_H */
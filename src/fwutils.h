@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * fwutils - embeddable entry points for the high-frequency image tools
+ *
+ * Release builds invoke the small tools tens of thousands of times and
+ * the fork/exec/dynamic-link cost dwarfs the per-image work. The
+ * libfirmware-utils library compiles the hot tools with -DFWU_LIB,
+ * which turns each main() into the entry point declared here, so a
+ * build orchestrator can run them in-process.
+ *
+ * Contract: each call behaves exactly like one CLI invocation of the
+ * tool, arguments included. Callers must reset getopt (optind = 0)
+ * before every call. The tools keep their CLI error handling: a fatal
+ * error prints to stderr and calls exit(), so an orchestrator that
+ * must survive bad jobs should run them in a disposable child.
+ */
+
+#ifndef __FWUTILS_H
+#define __FWUTILS_H
+
+int trx_main(int argc, char **argv);
+int imagetag_main(int argc, char **argv);
+int mkedimaximg_main(int argc, char **argv);
+int seama_main(int argc, char *argv[], char *env[]);
+int tplink_safeloader_main(int argc, char *argv[]);
+
+#endif /* __FWUTILS_H */
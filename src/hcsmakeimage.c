@@ -8,9 +8,11 @@
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <libgen.h>
 #include "bcmalgo.h"
+#include "fwu_io.h"
 
 
 int flag_print_version;
@@ -38,6 +40,9 @@ static void print_help ( const char* ename )
 	printf ( "--ldaddress=value\t - hex value of the target load address. defaults to 0x80010000\n" );
 	printf ( "--input_file=value\t - What file are we packing?\n" );
 	printf ( "--output_file=value\t - What file shall we write? (default: image.bin)\n" );
+	printf ( "--batch=value\t\t - pack every image listed in a manifest file. One image per line:\n" );
+	printf ( "\t\t\t <input> <output> [magic] [rev_maj] [rev_min] [ldaddress]\n" );
+	printf ( "\t\t\t omitted fields fall back to the command line options, '#' comments\n" );
 #ifdef _HAX0RSTYLE
 	printf ( "--credz\t - Give some credz!\n" );
 #endif
@@ -58,6 +63,253 @@ static void set_source_date_epoch() {
         }
 }
 
+static uint32_t parse_magic ( const char* magic )
+{
+	uint32_t magicnum = sa2100_magic;
+
+	if ( strcmp ( magic,"sa2100" ) ==0 ) magicnum=sa2100_magic; else
+			if ( strcmp ( magic,"sa3349" ) ==0 ) magicnum=sa3349_magic; else
+		{
+			sscanf ( magic, "0x%04X", &magicnum );
+		}
+	return magicnum;
+}
+
+/*
+ * Packs one image. The input is mapped once and its crc taken straight
+ * from the mapping (the old path read the file twice - once for the crc
+ * and once for the copy). print_lock keeps the chatty header dump of
+ * concurrent batch jobs from interleaving; NULL in single-image mode.
+ */
+static int make_image ( const char* input, const char* output, uint32_t magicnum,
+			unsigned int majrev, unsigned int minrev, uint32_t ldaddress,
+			const char* filename, time_t t, pthread_mutex_t* print_lock )
+{
+	struct fwu_input in = { 0 };
+
+	if ( access ( input,R_OK ) !=0 )
+	{
+		printf ( "I cannot access the file %s. Is it there? Am I allowed?\n\n", input );
+		return 1;
+	}
+	char* dupe = strdup(input);
+	char* fname = basename ( dupe );
+	if ( filename )
+	{
+		fname = (char*) filename;
+	}
+
+	if ( fwu_input_open ( &in, input ) < 0 )
+	{
+		printf ( "I cannot access the file %s. Is it there? Am I allowed?\n\n", input );
+		free(dupe);
+		return 1;
+	}
+	uint32_t crc = get_buffer_crc ( in.data, in.size );
+
+	if ( print_lock )
+		pthread_mutex_lock ( print_lock );
+	ldr_header_t* head = construct_header ( magicnum, (uint16_t) majrev, (uint16_t) minrev, ( uint32_t ) t, ( uint32_t ) in.size, ldaddress, fname, crc );
+	free(dupe);
+	dump_header ( head );
+	FILE* fd_out = fopen ( output,"w+" );
+	if (!fd_out)
+		{
+		fprintf(stderr, "Failed to open output file: %s\n", output);
+		if ( print_lock )
+			pthread_mutex_unlock ( print_lock );
+		free(head);
+		fwu_input_close ( &in );
+		return 1;
+		}
+	fwrite ( head,1,sizeof ( ldr_header_t ),fd_out );
+	fwrite ( in.data,1,in.size,fd_out );
+	printf("Firmware image %s is ready\n", output);
+	if ( print_lock )
+		pthread_mutex_unlock ( print_lock );
+	free(head);
+	fclose(fd_out);
+	fwu_input_close ( &in );
+	return 0;
+}
+
+struct batch_entry
+{
+	char* input;
+	char* output;
+	uint32_t magicnum;
+	unsigned int majrev;
+	unsigned int minrev;
+	uint32_t ldaddress;
+};
+
+struct batch_ctx
+{
+	struct batch_entry* entries;
+	size_t n_entries;
+	size_t next;
+	int fails;
+	time_t t;
+	pthread_mutex_t lock;
+};
+
+static void* batch_worker ( void* arg )
+{
+	struct batch_ctx* ctx = arg;
+
+	for ( ;; )
+	{
+		struct batch_entry* e;
+		int ret;
+
+		pthread_mutex_lock ( &ctx->lock );
+		if ( ctx->next >= ctx->n_entries )
+		{
+			pthread_mutex_unlock ( &ctx->lock );
+			break;
+		}
+		e = &ctx->entries[ctx->next++];
+		pthread_mutex_unlock ( &ctx->lock );
+
+		ret = make_image ( e->input, e->output, e->magicnum, e->majrev,
+				   e->minrev, e->ldaddress, NULL, ctx->t, &ctx->lock );
+
+		pthread_mutex_lock ( &ctx->lock );
+		if ( ret )
+			ctx->fails++;
+		pthread_mutex_unlock ( &ctx->lock );
+	}
+
+	return NULL;
+}
+
+/*
+ * Packs every image listed in a manifest in one process, so the crc
+ * tables are initialized once and independent images proceed on worker
+ * threads. The command line options supply the defaults for fields a
+ * manifest line leaves out.
+ */
+static int make_images_batch ( const char* manifest, uint32_t magicnum,
+			       unsigned int majrev, unsigned int minrev,
+			       uint32_t ldaddress, time_t t )
+{
+	struct batch_ctx ctx =
+	{
+		.t = t,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t threads[16];
+	size_t alloc = 0;
+	char* line = NULL;
+	size_t line_len = 0;
+	long n_threads;
+	size_t i;
+	FILE* fp;
+	int ret = 1;
+
+	fp = fopen ( manifest,"r" );
+	if ( !fp )
+	{
+		printf ( "I cannot access the file %s. Is it there? Am I allowed?\n\n", manifest );
+		return ret;
+	}
+
+	while ( getline ( &line, &line_len, fp ) >= 0 )
+	{
+		struct batch_entry e;
+		char* in;
+		char* out;
+		char* tok;
+		char* save = NULL;
+
+		line[strcspn ( line, "\r\n" )] = '\0';
+		if ( !line[0] || line[0]=='#' )
+			continue;
+
+		in = strtok_r ( line, " \t", &save );
+		out = strtok_r ( NULL, " \t", &save );
+		if ( !in || !out )
+		{
+			fprintf ( stderr, "invalid manifest line for '%s'\n", in ? in : "" );
+			goto out;
+		}
+
+		e.input = strdup ( in );
+		e.output = strdup ( out );
+		if ( !e.input || !e.output )
+		{
+			fprintf ( stderr, "no memory for batch entry\n" );
+			goto out;
+		}
+		e.magicnum = magicnum;
+		e.majrev = majrev;
+		e.minrev = minrev;
+		e.ldaddress = ldaddress;
+
+		tok = strtok_r ( NULL, " \t", &save );
+		if ( tok )
+			e.magicnum = parse_magic ( tok );
+		tok = strtok_r ( NULL, " \t", &save );
+		if ( tok )
+			sscanf ( tok, "%d", &e.majrev );
+		tok = strtok_r ( NULL, " \t", &save );
+		if ( tok )
+			sscanf ( tok, "%d", &e.minrev );
+		tok = strtok_r ( NULL, " \t", &save );
+		if ( tok )
+			sscanf ( tok, "0x%08X", &e.ldaddress );
+
+		if ( ctx.n_entries == alloc )
+		{
+			struct batch_entry* entries;
+
+			alloc = alloc ? alloc*2 : 32;
+			entries = realloc ( ctx.entries, alloc*sizeof ( *entries ) );
+			if ( !entries )
+			{
+				fprintf ( stderr, "no memory for batch entries\n" );
+				goto out;
+			}
+			ctx.entries = entries;
+		}
+		ctx.entries[ctx.n_entries++] = e;
+	}
+
+	//fill the crc tables before the workers race for them
+	init_crc_tab();
+
+	n_threads = sysconf ( _SC_NPROCESSORS_ONLN );
+	if ( n_threads < 1 )
+		n_threads = 1;
+	if ( ( size_t ) n_threads > ctx.n_entries )
+		n_threads = ctx.n_entries;
+	if ( n_threads > ( long ) ( sizeof ( threads ) /sizeof ( threads[0] ) ) )
+		n_threads = sizeof ( threads ) /sizeof ( threads[0] );
+
+	for ( i = 0; i < ( size_t ) n_threads; i++ )
+		if ( pthread_create ( &threads[i], NULL, batch_worker, &ctx ) )
+		{
+			n_threads = i;
+			break;
+		}
+	for ( i = 0; i < ( size_t ) n_threads; i++ )
+		pthread_join ( threads[i], NULL );
+
+	if ( !ctx.fails )
+		ret = 0;
+
+out:
+	for ( i = 0; i < ctx.n_entries; i++ )
+	{
+		free ( ctx.entries[i].input );
+		free ( ctx.entries[i].output );
+	}
+	free ( ctx.entries );
+	free ( line );
+	fclose ( fp );
+	return ret;
+}
+
 int main ( int argc, char** argv )
 {
 	if ( argc<2 )
@@ -74,6 +326,7 @@ int main ( int argc, char** argv )
 		{"filename",       required_argument,   0,     'f'},
 		{"input_file",       required_argument,   0,     'i'},
 		{"output_file",       required_argument,   0,     'o'},
+		{"batch",       required_argument,   0,     'b'},
 		{"compress",     no_argument,       &flag_compress,    'c'},
 		{"version",     no_argument,       &flag_print_version,    'v'},
 		{"help",        no_argument,       &flag_print_help,    'h'},
@@ -88,10 +341,11 @@ int main ( int argc, char** argv )
 	char* minor=NULL;
 	char* ldaddr=NULL;
 	char* output=NULL;
+	char* manifest=NULL;
 
 	while ( opt_result>=0 )
 	{
-		opt_result = getopt_long ( argc, argv, "m:j:n:f:i:o:vh", long_options, &option_index );
+		opt_result = getopt_long ( argc, argv, "m:j:n:f:i:o:b:vh", long_options, &option_index );
 		switch ( opt_result )
 		{
 			case 0:
@@ -112,6 +366,9 @@ int main ( int argc, char** argv )
 			case 'o':
 				output=optarg;
 				break;
+			case 'b':
+				manifest=optarg;
+				break;
 			case 'm':
 				magic=optarg;
 				break;
@@ -123,25 +380,11 @@ int main ( int argc, char** argv )
 				break;
 		}
 	}
-	if ( input==NULL )
-	{
-		printf ( "Telepaths are still on holidays. I guess you should tell me what file should I process.\n\n" );
-		exit ( 1 );
-	}
-	if ( access ( input,R_OK ) !=0 )
-	{
-		printf ( "I cannot access the file %s. Is it there? Am I allowed?\n\n", input );
-		exit ( 1 );
-	}
 	uint32_t magicnum=sa2100_magic;
 
 	if ( magic )
 	{
-		if ( strcmp ( magic,"sa2100" ) ==0 ) magicnum=sa2100_magic; else
-				if ( strcmp ( magic,"sa3349" ) ==0 ) magicnum=sa3349_magic; else
-			{
-				sscanf ( magic, "0x%04X", &magicnum );
-			}
+		magicnum = parse_magic ( magic );
 	}
 	unsigned int majrev=0;
 	if ( major )
@@ -158,12 +401,6 @@ int main ( int argc, char** argv )
 	{
 		sscanf ( ldaddr, "0x%08X", &ldaddress );
 	}
-	char* dupe = strdup(input);
-	char* fname = basename ( dupe );
-	if ( filename )
-	{
-		fname = filename;
-	}
 
 	time_t t = -1;
 	set_source_date_epoch();
@@ -174,35 +411,21 @@ int main ( int argc, char** argv )
 		return EXIT_FAILURE;
 	}
 
-	struct stat buf;
-	stat ( input,&buf );
-	ldr_header_t* head = construct_header ( magicnum, (uint16_t) majrev, (uint16_t) minrev, ( uint32_t ) t, ( uint32_t ) buf.st_size, ldaddress, fname, get_file_crc ( input ) );
-	free(dupe);
-	//uint32_t magic, uint16_t rev_maj,uint16_t rev_min, uint32_t build_date, uint32_t filelen, uint32_t ldaddress, const char* filename, uint32_t crc
-	//FILE* fd = fopen ("/tftpboot/haxorware11rev32.bin","r");
-	//fread(head,sizeof(ldr_header_t),1,fd);
-	char* filebuffer = malloc ( buf.st_size+10 );
-	FILE* fd = fopen ( input,"r" );
-	fread ( filebuffer, 1, buf.st_size,fd );
-	fclose (fd);
+	if ( manifest )
+	{
+		return make_images_batch ( manifest, magicnum, majrev, minrev, ldaddress, t );
+	}
+
+	if ( input==NULL )
+	{
+		printf ( "Telepaths are still on holidays. I guess you should tell me what file should I process.\n\n" );
+		exit ( 1 );
+	}
 	if (!output)
 		{
-		output = malloc(strlen(input+5));
+		output = malloc(strlen(input)+5);
 		strcpy(output,input);
 		strcat(output,".bin");
 		}
-	dump_header ( head );
-	FILE* fd_out = fopen ( output,"w+" );
-	if (!fd_out)
-		{
-		fprintf(stderr, "Failed to open output file: %s\n", output);
-		free(filebuffer);
-		exit(1);
-		}
-	fwrite ( head,1,sizeof ( ldr_header_t ),fd_out );
-	fwrite ( filebuffer,1,buf.st_size,fd_out );
-	printf("Firmware image %s is ready\n", output);
-	free(filebuffer);
-	fclose(fd_out);
-	return 0;
+	return make_image ( input, output, magicnum, majrev, minrev, ldaddress, filename, t, NULL );
 }
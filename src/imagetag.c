@@ -12,13 +12,16 @@
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <inttypes.h>
 
 #include "bcm_tag.h"
 #include "imagetag_cmdline.h"
 #include "cyg_crc.h"
+#include "fwu_io.h"
 
 #define DEADCODE			0xDEADC0DE
 
@@ -59,6 +62,23 @@ uint32_t compute_crc32(uint32_t crc, FILE *binfile, size_t compute_start, size_t
 	return crc;
 }
 
+/* CRC an in-memory buffer; chunked so the int length of
+ * cyg_crc32_accumulate() can't overflow on very large mappings. */
+uint32_t buffer_crc32(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+	while (len > 0) {
+		size_t chunk = len > (1U << 30) ? (1U << 30) : len;
+
+		crc = cyg_crc32_accumulate(crc, (void *)p, chunk);
+		p += chunk;
+		len -= chunk;
+	}
+
+	return crc;
+}
+
 size_t getlen(FILE *fp)
 {
 	size_t retval, curpos;
@@ -92,6 +112,7 @@ int tagfile(const char *kernel, const char *rootfs, const char *bin, \
 	uint32_t kernelfscrc = IMAGETAG_CRC_START;
 	uint32_t fwaddr = 0;
 	const uint32_t deadcode = htonl(DEADCODE);
+	struct fwu_input payload = { 0 };
 	int i;
 	int is_pirelli = 0;
 
@@ -102,6 +123,11 @@ int tagfile(const char *kernel, const char *rootfs, const char *bin, \
 		fprintf(stderr, "imagetag can't create an image without both kernel and rootfs\n");
 	}
 
+	if (args->payload_given && (args->root_first_flag || args->cfe_given)) {
+		fprintf(stderr, "imagetag can't combine --payload with --root-first or --cfe\n");
+		return 1;
+	}
+
 	if (kernel && !(kernelfile = fopen(kernel, "rb"))) {
 		fprintf(stderr, "Unable to open kernel \"%s\"\n", kernel);
 		return 1;
@@ -112,7 +138,7 @@ int tagfile(const char *kernel, const char *rootfs, const char *bin, \
 		return 1;
 	}
 
-	if (!bin || !(binfile = fopen(bin, "wb+"))) {
+	if (!bin || (!args->payload_given && !(binfile = fwu_fopen(bin, "wb+")))) {
 		fprintf(stderr, "Unable to open output file \"%s\"\n", bin);
 		return 1;
 	}
@@ -171,9 +197,47 @@ int tagfile(const char *kernel, const char *rootfs, const char *bin, \
 	  imagelen = rootfsoff + rootfslen - kerneloff + sizeof(deadcode);
 	  rootfsoffpadlen = rootfsoff - (kerneloff + kernellen);
 	  
+	  if (args->payload_given) {
+	    /* The concatenated payload (kernel header, kernel, padding,
+	     * rootfs, deadc0de and any pad fill) was already built by the
+	     * previous stage; mmap it and run the CRCs straight over the
+	     * mapping instead of rewriting it through stdio buffers. */
+	    oldrootfslen = rootfslen;
+	    if (args->pad_given) {
+	      uint32_t pad_size = args->pad_arg * 1024 * 1024;
+
+	      /* The padding words must already be in the payload; account
+	       * for them the same way the write loop below would. */
+	      if (imagelen < pad_size) {
+	        size_t growth = ((pad_size - imagelen) + 3) & ~(size_t)3;
+
+	        imagelen += growth;
+	        rootfslen += growth;
+	      }
+	    }
+
+	    if (fwu_input_open(&payload, args->payload_arg) < 0) {
+	      fprintf(stderr, "Unable to open payload \"%s\"\n", args->payload_arg);
+	      return 1;
+	    }
+
+	    if (payload.size != imagelen) {
+	      fprintf(stderr, "Payload \"%s\" is %zu bytes, expected %zu\n",
+	              args->payload_arg, payload.size, imagelen);
+	      fwu_input_close(&payload);
+	      return 1;
+	    }
+
+	    /* Same CRC spans as the file-based path below */
+	    imagecrc = buffer_crc32(imagecrc, payload.data, imagelen);
+	    kernelcrc = buffer_crc32(kernelcrc, payload.data, kernellen + rootfsoffpadlen);
+	    kernelfscrc = buffer_crc32(kernelfscrc, payload.data, kernellen + rootfsoffpadlen + rootfslen + sizeof(deadcode));
+	    rootfscrc = buffer_crc32(rootfscrc, payload.data, rootfslen + sizeof(deadcode));
+	  } else {
+
 	  /* Seek to the start of the kernel */
 	  fseek(binfile, kerneloff - fwaddr + cfelen, SEEK_SET);
-	  
+
 	  /* Write the kernel header */
 	  fwrite(&khdr, sizeof(khdr), 1, binfile);
 	  
@@ -230,6 +294,8 @@ int tagfile(const char *kernel, const char *rootfs, const char *bin, \
 	   */
 	  rootfscrc = compute_crc32(rootfscrc, binfile, kerneloff - fwaddr + cfelen, rootfslen + sizeof(deadcode));
 
+	  }
+
 	} else {
 	  /* Build the kernel address and length (doesn't need to be aligned, read only) */
 	  rootfsoff = fwaddr + sizeof(tag);
@@ -376,16 +442,54 @@ int tagfile(const char *kernel, const char *rootfs, const char *bin, \
 	int2tag(tag.fskernelCRC, kernelfscrc);
 	int2tag(tag.headerCRC, cyg_crc32_accumulate(IMAGETAG_CRC_START, (uint8_t*)&tag, sizeof(tag) - 20));
 
+	if (args->payload_given) {
+		struct iovec iov[2];
+		int outfd;
+
+		outfd = open(bin, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (outfd < 0) {
+			fprintf(stderr, "Unable to open output file \"%s\"\n", bin);
+			fwu_input_close(&payload);
+			return 1;
+		}
+
+		/* Tag and mapped payload go out in one gathered write; the
+		 * payload pages never get copied through a stdio buffer. */
+		iov[0].iov_base = &tag;
+		iov[0].iov_len = sizeof(tag);
+		iov[1].iov_base = payload.data;
+		iov[1].iov_len = payload.size;
+
+		if (writev(outfd, iov, 2) != (ssize_t)(sizeof(tag) + payload.size)) {
+			fprintf(stderr, "Unable to write to output file \"%s\"\n", bin);
+			close(outfd);
+			fwu_input_close(&payload);
+			return 1;
+		}
+
+		close(outfd);
+		fwu_input_close(&payload);
+
+		return 0;
+	}
+
 	fseek(binfile, 0L, SEEK_SET);
 	fwrite(&tag, sizeof(uint8_t), sizeof(tag), binfile);
 
     fflush(binfile);
-	fclose(binfile);
+	if (fwu_fclose(binfile)) {
+		fprintf(stderr, "Unable to write output file \"%s\"\n", bin);
+		return 1;
+	}
 
 	return 0;
 }
 
+#ifdef FWU_LIB
+int imagetag_main(int argc, char **argv)
+#else
 int main(int argc, char **argv)
+#endif
 {
 	char *kernel, *rootfs, *bin;
 	uint32_t flash_start, image_offset, block_size, load_address, entry;
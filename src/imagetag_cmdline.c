@@ -60,6 +60,7 @@ const char *gengetopt_args_info_help[] = {
   "      --kernel-file-has-header  Indicates that the kernel file includes the \n                                  kernel header with correct load address and \n                                  entry point, so no changes are needed  \n                                  (default=off)",
   "  -p, --pad=size (in MiB)       Pad the image to this size if smaller (in MiB)",
   "      --align-rootfs            Align the rootfs start to erase block size  \n                                  (default=off)",
+  "      --payload=filename        File with the prebuilt kernel+rootfs payload \n                                  to tag in place (mmapped; written out behind \n                                  the tag without re-copying).",
     0
 };
 
@@ -118,6 +119,7 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->kernel_file_has_header_given = 0 ;
   args_info->pad_given = 0 ;
   args_info->align_rootfs_given = 0 ;
+  args_info->payload_given = 0 ;
 }
 
 static
@@ -172,7 +174,9 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->kernel_file_has_header_flag = 0;
   args_info->pad_orig = NULL;
   args_info->align_rootfs_flag = 0;
-  
+  args_info->payload_arg = NULL;
+  args_info->payload_orig = NULL;
+
 }
 
 static
@@ -208,7 +212,8 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->kernel_file_has_header_help = gengetopt_args_info_help[25] ;
   args_info->pad_help = gengetopt_args_info_help[26] ;
   args_info->align_rootfs_help = gengetopt_args_info_help[27] ;
-  
+  args_info->payload_help = gengetopt_args_info_help[28] ;
+
 }
 
 void
@@ -333,8 +338,10 @@ imagetag_cmdline_release (struct gengetopt_args_info *args_info)
   free_string_field (&(args_info->reserved2_arg));
   free_string_field (&(args_info->reserved2_orig));
   free_string_field (&(args_info->pad_orig));
-  
-  
+  free_string_field (&(args_info->payload_arg));
+  free_string_field (&(args_info->payload_orig));
+
+
 
   clear_given (args_info);
 }
@@ -460,7 +467,9 @@ imagetag_cmdline_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "pad", args_info->pad_orig, 0);
   if (args_info->align_rootfs_given)
     write_into_file(outfile, "align-rootfs", 0, 0 );
-  
+  if (args_info->payload_given)
+    write_into_file(outfile, "payload", args_info->payload_orig, 0);
+
 
   i = EXIT_SUCCESS;
   return i;
@@ -817,6 +826,7 @@ imagetag_cmdline_internal (
         { "kernel-file-has-header",	0, NULL, 0 },
         { "pad",	1, NULL, 'p' },
         { "align-rootfs",	0, NULL, 0 },
+        { "payload",	1, NULL, 0 },
         { 0,  0, 0, 0 }
       };
 
@@ -1158,9 +1168,23 @@ imagetag_cmdline_internal (
                 check_ambiguity, override, 1, 0, "align-rootfs", '-',
                 additional_error))
               goto failure;
-          
+
           }
-          
+          /* File with the prebuilt kernel+rootfs payload to tag in place..  */
+          else if (strcmp (long_options[option_index].name, "payload") == 0)
+          {
+
+
+            if (update_arg( (void *)&(args_info->payload_arg),
+                 &(args_info->payload_orig), &(args_info->payload_given),
+                &(local_args_info.payload_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "payload", '-',
+                additional_error))
+              goto failure;
+
+          }
+
           break;
         case '?':	/* Invalid option.  */
           /* `getopt_long' already printed an error message.  */
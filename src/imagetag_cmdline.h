@@ -114,7 +114,10 @@ struct gengetopt_args_info
   const char *pad_help; /**< @brief Pad the image to this size if smaller (in MiB) help description.  */
   int align_rootfs_flag;	/**< @brief Align the rootfs start to erase block size (default=off).  */
   const char *align_rootfs_help; /**< @brief Align the rootfs start to erase block size help description.  */
-  
+  char * payload_arg;	/**< @brief File with the prebuilt kernel+rootfs payload to tag in place..  */
+  char * payload_orig;	/**< @brief File with the prebuilt kernel+rootfs payload to tag in place. original value given at command line.  */
+  const char *payload_help; /**< @brief File with the prebuilt kernel+rootfs payload to tag in place. help description.  */
+
   unsigned int help_given ;	/**< @brief Whether help was given.  */
   unsigned int version_given ;	/**< @brief Whether version was given.  */
   unsigned int kernel_given ;	/**< @brief Whether kernel was given.  */
@@ -143,6 +146,7 @@ struct gengetopt_args_info
   unsigned int kernel_file_has_header_given ;	/**< @brief Whether kernel-file-has-header was given.  */
   unsigned int pad_given ;	/**< @brief Whether pad was given.  */
   unsigned int align_rootfs_given ;	/**< @brief Whether align-rootfs was given.  */
+  unsigned int payload_given ;	/**< @brief Whether payload was given.  */
 
 } ;
 
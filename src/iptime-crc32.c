@@ -23,6 +23,7 @@
 #include <unistd.h>
 
 #include "cyg_crc.h"
+#include "fwu_io.h"
 
 #if !defined(__BYTE_ORDER)
 #error "Unknown byte order"
@@ -91,7 +92,8 @@ uint32_t make_checksum(struct fw_header *header, uint8_t *payload, int size)
 	return (uint32_t)cyg_crc32_accumulate(checksum, payload, size);
 }
 
-void make_header(struct board_info *board, uint8_t *buffer, size_t img_size)
+void make_header(struct board_info *board, uint8_t *buffer, uint8_t *payload,
+		 size_t img_size)
 {
 	struct fw_header *header = (struct fw_header *)buffer;
 	uint32_t checksum;
@@ -99,7 +101,7 @@ void make_header(struct board_info *board, uint8_t *buffer, size_t img_size)
 	strncpy((char *)header->model, board->model, sizeof(header->model)-1);
 	strncpy((char *)header->version, FW_VERSION, sizeof(header->version)-1);
 	header->size = HOST_TO_LE32(img_size);
-	checksum = make_checksum(header, buffer + board->payload_offset, img_size);
+	checksum = make_checksum(header, payload, img_size);
 	header->checksum = HOST_TO_LE32(checksum);
 }
 
@@ -107,9 +109,8 @@ int main(int argc, const char *argv[])
 {
 	const char *model_name, *img_in, *img_out;
 	struct board_info *board;
-	int file_in, file_out;
-	struct stat stat_in;
-	size_t size_in, size_out;
+	struct fwu_input in = { 0 };
+	FILE *fin, *fout;
 	uint8_t *buffer;
 
 	if (argc != 4) {
@@ -126,31 +127,29 @@ int main(int argc, const char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	if ((file_in = open(img_in, O_RDONLY)) == -1)
+	/* CRC straight off the mapping; only the header region is staged */
+	if (fwu_input_open(&in, img_in))
 		err(EXIT_FAILURE, "%s", img_in);
 
-	if (fstat(file_in, &stat_in) == -1)
-		err(EXIT_FAILURE, "%s", img_in);
-
-	size_in = stat_in.st_size;
-	size_out = board->payload_offset + size_in;
-
-	if ((buffer = malloc(size_out)) == NULL)
-		err(EXIT_FAILURE, "malloc");
+	if ((buffer = calloc(1, board->payload_offset)) == NULL)
+		err(EXIT_FAILURE, "calloc");
 
-	read(file_in, buffer + board->payload_offset, size_in);
-	close(file_in);
+	make_header(board, buffer, in.data, in.size);
 
-	memset(buffer, 0, board->payload_offset);
-
-	make_header(board, buffer, size_in);
+	if ((fout = fopen(img_out, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", img_out);
 
-	if ((file_out = creat(img_out, 0644)) == -1)
+	fin = fopen(img_in, "r");
+	if (fwrite(buffer, board->payload_offset, 1, fout) != 1 ||
+	    fin == NULL ||
+	    fwu_copy_data(fin, fout, 0) != (ssize_t)in.size ||
+	    fflush(fout))
 		err(EXIT_FAILURE, "%s", img_out);
-	write(file_out, buffer, size_out);
-	close(file_out);
+	fclose(fin);
+	fclose(fout);
 
 	free(buffer);
+	fwu_input_close(&in);
 
 	return EXIT_SUCCESS;
 }
@@ -23,6 +23,9 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "fwu_csum.h"
+#include "fwu_jobs.h"
+
 #if !defined(__BYTE_ORDER)
 #error "Unknown byte order"
 #endif
@@ -135,12 +138,9 @@ char *get_ctime(void)
 
 uint32_t make_checksum(const char *model_name, uint8_t *bytes, int length)
 {
-	int i;
-	uint32_t sum = 0;
+	uint32_t sum = fwu_byte_sum(bytes, length);
 	uint32_t magic = 0x19283745;
 
-	for (i = 0; i < length; i++)
-		sum += bytes[i];
 	return ((uint32_t)strlen(model_name) * magic + ~sum) ^ sum;
 }
 
@@ -174,7 +174,7 @@ void make_header(struct board_info *board, uint8_t *buffer, size_t img_size)
 	}
 }
 
-int main(int argc, const char *argv[])
+static int naspkg_run(int argc, char *argv[])
 {
 	const char *model_name, *img_in, *img_out;
 	struct board_info *board;
@@ -214,6 +214,9 @@ int main(int argc, const char *argv[])
 	close(file_in);
 
 	memset(buffer, 0, FW_HEADER_SIZE);
+	/* the block-size padding is checksummed and written; zero it so
+	 * the package doesn't depend on heap garbage */
+	memset(buffer + FW_HEADER_SIZE + size_in, 0, size_in_padded - size_in);
 
 	make_header(board, buffer, size_in_padded);
 
@@ -226,3 +229,8 @@ int main(int argc, const char *argv[])
 
 	return EXIT_SUCCESS;
 }
+
+int main(int argc, char *argv[])
+{
+	return fwu_jobs_run(argc, argv, naspkg_run);
+}
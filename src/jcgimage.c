@@ -86,6 +86,8 @@
 #include <assert.h>
 #include <inttypes.h>
 
+#include "fwu_crc32.h"
+
 /*
  * JCG Firmware image header
  */
@@ -151,6 +153,8 @@ opensize(char *name, size_t *size)
 	return fd;
 }
 
+static int crc_jobs;	/* 0 = one per online CPU */
+
 static time_t source_date_epoch = -1;
 static void set_source_date_epoch() {
 	char *env = getenv("SOURCE_DATE_EPOCH");
@@ -195,7 +199,7 @@ mkjcgheader(struct jcg_header *h, size_t psize, char *version)
 
 	/* CRC over JCG payload (uImage) */
 	crc = crc32(0L, Z_NULL, 0);
-	crc = crc32(crc, payload, psize);
+	crc = fwu_crc32_parallel(crc, payload, psize, crc_jobs);
 	h->jh_dcrc  = htonl(crc);
 
 	/* CRC over JCG header */
@@ -229,7 +233,7 @@ mkuheader(struct uimage_header *h, size_t ksize, size_t fsize)
 
 	/* CRC over uImage payload (kernel and file system) */
 	crc = crc32(0L, Z_NULL, 0);
-	crc = crc32(crc, payload, ntohl(h->ih_size));
+	crc = fwu_crc32_parallel(crc, payload, ntohl(h->ih_size), crc_jobs);
 	h->ih_dcrc  = htonl(crc);
 	printf("CRC1: %08lx\n", crc);
 
@@ -268,7 +272,7 @@ craftcrc(uint32_t dcrc, uint8_t *buf, size_t len)
 
 		a >>= 1;
 	}
-	patch ^= ~crc32(crc, buf, len - 4);
+	patch ^= ~fwu_crc32_parallel(crc, buf, len - 4, crc_jobs);
 	for (i = 0; i < 4; i++) {
 		buf[len - 4 + i] = patch & 0xff;
 		patch >>= 8;
@@ -285,8 +289,8 @@ craftcrc(uint32_t dcrc, uint8_t *buf, size_t len)
 void
 usage() {
 	fprintf(stderr, "Usage:\n"
-		"jcgimage -o outfile -u uImage [-m maxsize] [-v version]\n"
-		"jcgimage -o outfile -k kernel -f rootfs [-m maxsize] [-v version]\n");
+		"jcgimage -o outfile -u uImage [-m maxsize] [-v version] [-j threads]\n"
+		"jcgimage -o outfile -k kernel -f rootfs [-m maxsize] [-v version] [-j threads]\n");
 	exit(1);
 }
 
@@ -319,7 +323,7 @@ main(int argc, char **argv)
 	assert(sizeof(struct uimage_header) == 64);
 	set_source_date_epoch();
 
-	while ((c = getopt(argc, argv, "o:k:f:u:v:m:h")) != -1) {
+	while ((c = getopt(argc, argv, "o:k:f:u:v:m:j:h")) != -1) {
 		switch (c) {
 		case 'o':
 			imagefile = optarg;
@@ -353,6 +357,11 @@ main(int argc, char **argv)
 		case 'v':
 			version = optarg;
 			break;
+		case 'j':
+			crc_jobs = atoi(optarg);
+			if (crc_jobs < 1)
+				errx(1, "invalid -j value \"%s\"", optarg);
+			break;
 		case 'h':
 		default:
 			usage();
@@ -10,14 +10,18 @@
 #include <byteswap.h>
 #include <endian.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "fwu_io.h"
+
 #if __BYTE_ORDER == __BIG_ENDIAN
 #define cpu_to_le32(x)	bswap_32(x)
 #define cpu_to_le16(x)	bswap_16(x)
@@ -172,38 +176,37 @@ err_out:
  */
 static ssize_t lxlfw_copy_data(FILE *from, FILE *to, size_t size)
 {
-	int copy_all = size == 0;
-	char buf[512];
-	size_t ret = 0;
+	ssize_t bytes = fwu_copy_data(from, to, size);
 
-	while (copy_all || size) {
-		size_t to_read = copy_all ? sizeof(buf) : min(size, sizeof(buf));
-		size_t bytes;
+	if (bytes < 0)
+		fprintf(stderr, "Failed to copy data\n");
 
-		bytes = fread(buf, 1, to_read, from);
-		if (bytes == 0 && copy_all) {
-			break;
-		} else if (bytes <= 0) {
-			fprintf(stderr, "Failed to read data\n");
-			return -EIO;
-		}
+	return bytes;
+}
 
-		if (fwrite(buf, 1, bytes, to) != bytes) {
-			fprintf(stderr, "Failed to write data\n");
-			return -EIO;
-		}
+/**
+ * lxlfw_blob_file_len - get size of a blob's external data file
+ *
+ * @pathname: external file pathname
+ */
+static ssize_t lxlfw_blob_file_len(const char *pathname)
+{
+	struct stat st;
 
-		if (!copy_all)
-			size -= bytes;
-		ret += bytes;
+	if (stat(pathname, &st)) {
+		fprintf(stderr, "Could not stat input file %s\n", pathname);
+		return -EIO;
 	}
 
-	return ret;
+	return st.st_size;
 }
 
 /**
  * lxlfw_write_blob - read data from external file and write blob to stream
  *
+ * The data file size is taken up front so the blob header is emitted
+ * first and the stream is written in a single forward pass.
+ *
  * @lxl: stream to write to
  * @type: blob type
  * @pathname: external file pathname to read blob data from
@@ -214,44 +217,82 @@ static ssize_t lxlfw_write_blob(FILE *lxl, uint16_t type, const char *pathname)
 		.magic = { 'D', '#' },
 		.type = cpu_to_le16(type),
 	};
-	char buf[512];
-	size_t blob_data_len;
+	ssize_t blob_data_len;
 	size_t bytes;
 	FILE *data;
 
+	blob_data_len = lxlfw_blob_file_len(pathname);
+	if (blob_data_len < 0)
+		return blob_data_len;
+
 	data = fopen(pathname, "r");
 	if (!data) {
 		fprintf(stderr, "Could not open input file %s\n", pathname);
 		return -EIO;
 	}
 
-	blob_data_len = 0;
-	fseek(lxl, sizeof(blob), SEEK_CUR);
-	while ((bytes = fread(buf, 1, sizeof(buf), data)) > 0) {
-		if (fwrite(buf, 1, bytes, lxl) != bytes) {
-			fprintf(stderr, "Could not copy %zu bytes from input file\n", bytes);
-			fclose(data);
-			return -EIO;
-		}
-		blob_data_len += bytes;
-	}
-
-	fclose(data);
-
 	blob.len = cpu_to_le32(blob_data_len);
 
-	fseek(lxl, -(blob_data_len + sizeof(blob)), SEEK_CUR);
 	bytes = fwrite(&blob, 1, sizeof(blob), lxl);
 	if (bytes != sizeof(blob)) {
-		fprintf(stderr, "Could not write Luxul's header\n");
+		fprintf(stderr, "Could not write blob header\n");
+		fclose(data);
+		return -EIO;
+	}
+
+	if (lxlfw_copy_data(data, lxl, blob_data_len) != blob_data_len) {
+		fprintf(stderr, "Could not copy %zd bytes from input file\n", blob_data_len);
+		fclose(data);
 		return -EIO;
 	}
 
-	fseek(lxl, blob_data_len, SEEK_CUR);
+	fclose(data);
 
 	return blob_data_len + sizeof(blob);
 }
 
+/**
+ * lxlfw_load_blob - build a blob in memory from an external file
+ *
+ * @buf: buffer to build the blob in
+ * @max: buffer size
+ * @type: blob type
+ * @pathname: external file pathname to read blob data from
+ */
+static ssize_t lxlfw_load_blob(uint8_t *buf, size_t max, uint16_t type,
+			       const char *pathname)
+{
+	struct lxl_blob *blob = (void *)buf;
+	ssize_t len;
+	FILE *data;
+
+	len = lxlfw_blob_file_len(pathname);
+	if (len < 0)
+		return len;
+	if (sizeof(*blob) + len > max)
+		return -ENOSPC;
+
+	memcpy(blob->magic, "D#", 2);
+	blob->type = cpu_to_le16(type);
+	blob->len = cpu_to_le32(len);
+
+	data = fopen(pathname, "r");
+	if (!data) {
+		fprintf(stderr, "Could not open input file %s\n", pathname);
+		return -EIO;
+	}
+
+	if (fread(blob->data, 1, len, data) != (size_t)len) {
+		fprintf(stderr, "Could not read %zd bytes from input file\n", len);
+		fclose(data);
+		return -EIO;
+	}
+
+	fclose(data);
+
+	return sizeof(*blob) + len;
+}
+
 /**************************************************
  * Info
  **************************************************/
@@ -428,10 +469,8 @@ out:
  * @path: external file pathname to write
  */
 static int lxlfw_blob_save(FILE *lxl, size_t len, const char *path) {
-	char buf[256];
-	size_t bytes;
-	FILE *out;
 	int err = 0;
+	FILE *out;
 
 	out = fopen(path, "w+");
 	if (!out) {
@@ -440,16 +479,7 @@ static int lxlfw_blob_save(FILE *lxl, size_t len, const char *path) {
 		goto err_out;
 	}
 
-	while (len && (bytes = fread(buf, 1, min(len, sizeof(buf)), lxl)) > 0) {
-		if (fwrite(buf, 1, bytes, out) != bytes) {
-			fprintf(stderr, "Could not copy %zu bytes from input file\n", bytes);
-			err = -EIO;
-			goto err_close_out;
-		}
-		len -= bytes;
-	}
-
-	if (len) {
+	if (lxlfw_copy_data(lxl, out, len) != len) {
 		fprintf(stderr, "Could not copy all signature\n");
 		err = -EIO;
 		goto err_close_out;
@@ -634,6 +664,39 @@ static int lxlfw_create(int argc, char **argv) {
 		goto out;
 	}
 
+	/*
+	 * Compute the final layout up front, so the output is written in
+	 * one forward pass and can be preallocated.
+	 */
+
+	blobs_len = 0;
+
+	if (certificate_path) {
+		bytes = lxlfw_blob_file_len(certificate_path);
+		if (bytes < 0) {
+			err = bytes;
+			goto out;
+		}
+		blobs_len += sizeof(struct lxl_blob) + bytes;
+	}
+	if (signature_path) {
+		bytes = lxlfw_blob_file_len(signature_path);
+		if (bytes < 0) {
+			err = bytes;
+			goto out;
+		}
+		blobs_len += sizeof(struct lxl_blob) + bytes;
+	}
+
+	if (blobs_len) {
+		hdr.blobs_offset = cpu_to_le32(hdr_raw_len);
+		hdr.blobs_len = cpu_to_le32(blobs_len);
+		hdr_len += blobs_len;
+	}
+
+	hdr.version = cpu_to_le32(version);
+	hdr.hdr_len = cpu_to_le32(hdr_len);
+
 	in = fopen(in_path, "r");
 	if (!in) {
 		fprintf(stderr, "Could not open input file %s\n", in_path);
@@ -648,18 +711,29 @@ static int lxlfw_create(int argc, char **argv) {
 		goto err_close_in;
 	}
 
-	/* Write blobs */
+	/* Preallocate; best effort, not all filesystems support it */
 
-	blobs_len = 0;
+	bytes = lxlfw_blob_file_len(in_path);
+	if (bytes > 0)
+		fallocate(fileno(lxl), 0, 0, hdr_len + bytes);
+
+	/* Write header */
+
+	bytes = fwrite(&hdr, 1, hdr_raw_len, lxl);
+	if (bytes != hdr_raw_len) {
+		fprintf(stderr, "Could not write Luxul's header\n");
+		err = -EIO;
+		goto err_close_lxl;
+	}
+
+	/* Write blobs */
 
-	fseek(lxl, hdr_raw_len, SEEK_SET);
 	if (certificate_path) {
 		bytes = lxlfw_write_blob(lxl, LXL_BLOB_CERTIFICATE, certificate_path);
 		if (bytes <= 0) {
 			fprintf(stderr, "Failed to write certificate\n");
 			goto err_close_lxl;
 		}
-		blobs_len += bytes;
 	}
 	if (signature_path) {
 		bytes = lxlfw_write_blob(lxl, LXL_BLOB_SIGNATURE, signature_path);
@@ -667,31 +741,10 @@ static int lxlfw_create(int argc, char **argv) {
 			fprintf(stderr, "Failed to write signature\n");
 			goto err_close_lxl;
 		}
-		blobs_len += bytes;
-	}
-
-	if (blobs_len) {
-		hdr.blobs_offset = cpu_to_le32(hdr_raw_len);
-		hdr.blobs_len = cpu_to_le32(blobs_len);
-		hdr_len += blobs_len;
-	}
-
-	/* Write header */
-
-	hdr.version = cpu_to_le32(version);
-	hdr.hdr_len = cpu_to_le32(hdr_len);
-
-	fseek(lxl, 0, SEEK_SET);
-	bytes = fwrite(&hdr, 1, hdr_raw_len, lxl);
-	if (bytes != hdr_raw_len) {
-		fprintf(stderr, "Could not write Luxul's header\n");
-		err = -EIO;
-		goto err_close_lxl;
 	}
 
 	/* Write input data */
 
-	fseek(lxl, 0, SEEK_END);
 	bytes = lxlfw_copy_data(in, lxl, 0);
 	if (bytes < 0) {
 		fprintf(stderr, "Could not copy %zu bytes from input file\n", bytes);
@@ -717,9 +770,14 @@ static int lxlfw_insert(int argc, char **argv) {
 	char *signature_path = NULL;
 	char *tmp_path = NULL;
 	uint32_t version = 0;
+	uint32_t old_version;
 	uint32_t hdr_raw_len;	/* Header length without blobs */
 	uint32_t hdr_len;	/* Header length with blobs */
+	uint32_t old_blobs_offset;
+	uint32_t old_blobs_len;
 	uint32_t blobs_len;
+	long data_offset;
+	struct stat st;
 	ssize_t bytes;
 	char *path;
 	FILE *lxl;
@@ -766,11 +824,183 @@ static int lxlfw_insert(int argc, char **argv) {
 		goto err_close_lxl;
 	}
 
+	old_version = version;
 	version = max(version, 3);
 
 	hdr_raw_len = lxlfw_hdr_len(version);
 	hdr_len = hdr_raw_len;
 
+	old_blobs_offset = le32_to_cpu(hdr.blobs_offset);
+	old_blobs_len = le32_to_cpu(hdr.blobs_len);
+
+	/*
+	 * Compute the final layout up front: walk the old blob table for
+	 * the sizes of the blobs that are kept and stat the new ones.
+	 */
+
+	blobs_len = 0;
+
+	if (old_blobs_offset) {
+		size_t offset;
+
+		fseek(lxl, old_blobs_offset, SEEK_SET);
+		for (offset = 0; offset < old_blobs_len; ) {
+			struct lxl_blob blob;
+			uint16_t type;
+			size_t len;
+
+			bytes = fread(&blob, 1, sizeof(blob), lxl);
+			if (bytes != sizeof(blob)) {
+				fprintf(stderr, "Failed to read blob section\n");
+				err = -ENXIO;
+				goto err_close_lxl;
+			}
+
+			type = le16_to_cpu(blob.type);
+			len = le32_to_cpu(blob.len);
+
+			/* Don't keep blobs that have to be replaced */
+			if (!(type == LXL_BLOB_CERTIFICATE && certificate_path) &&
+			    !(type == LXL_BLOB_SIGNATURE && signature_path))
+				blobs_len += sizeof(blob) + len;
+
+			fseek(lxl, len, SEEK_CUR);
+			offset += sizeof(blob) + len;
+		}
+	}
+
+	if (certificate_path) {
+		bytes = lxlfw_blob_file_len(certificate_path);
+		if (bytes < 0) {
+			err = bytes;
+			goto err_close_lxl;
+		}
+		blobs_len += sizeof(struct lxl_blob) + bytes;
+	}
+	if (signature_path) {
+		bytes = lxlfw_blob_file_len(signature_path);
+		if (bytes < 0) {
+			err = bytes;
+			goto err_close_lxl;
+		}
+		blobs_len += sizeof(struct lxl_blob) + bytes;
+	}
+
+	/* Original data (everything past the old header) starts here */
+	data_offset = ftell(lxl);
+
+	/*
+	 * Fast path: when the layout does not change (same header version
+	 * and same total blob size, e.g. re-signing with a fixed-size
+	 * signature), swap the blobs in place instead of rewriting the
+	 * whole firmware through a temporary file.
+	 */
+	if (version == old_version && old_blobs_offset &&
+	    blobs_len == old_blobs_len && blobs_len <= (1 << 20)) {
+		uint8_t *blobs = malloc(blobs_len);
+		size_t offset;
+		size_t pos = 0;
+		FILE *out;
+
+		if (!blobs) {
+			err = -ENOMEM;
+			goto err_close_lxl;
+		}
+
+		fseek(lxl, old_blobs_offset, SEEK_SET);
+		for (offset = 0; offset < old_blobs_len; ) {
+			struct lxl_blob blob;
+			uint16_t type;
+			size_t len;
+
+			bytes = fread(&blob, 1, sizeof(blob), lxl);
+			if (bytes != sizeof(blob)) {
+				fprintf(stderr, "Failed to read blob section\n");
+				err = -ENXIO;
+				goto err_free_blobs;
+			}
+
+			type = le16_to_cpu(blob.type);
+			len = le32_to_cpu(blob.len);
+
+			if ((type == LXL_BLOB_CERTIFICATE && certificate_path) ||
+			    (type == LXL_BLOB_SIGNATURE && signature_path)) {
+				fseek(lxl, len, SEEK_CUR);
+			} else {
+				memcpy(blobs + pos, &blob, sizeof(blob));
+				pos += sizeof(blob);
+				if (fread(blobs + pos, 1, len, lxl) != len) {
+					fprintf(stderr, "Failed to read original blob\n");
+					err = -EIO;
+					goto err_free_blobs;
+				}
+				pos += len;
+			}
+
+			offset += sizeof(blob) + len;
+		}
+
+		if (certificate_path) {
+			bytes = lxlfw_load_blob(blobs + pos, blobs_len - pos,
+						LXL_BLOB_CERTIFICATE, certificate_path);
+			if (bytes <= 0) {
+				fprintf(stderr, "Failed to load certificate\n");
+				err = -EIO;
+				goto err_free_blobs;
+			}
+			pos += bytes;
+		}
+		if (signature_path) {
+			bytes = lxlfw_load_blob(blobs + pos, blobs_len - pos,
+						LXL_BLOB_SIGNATURE, signature_path);
+			if (bytes <= 0) {
+				fprintf(stderr, "Failed to load signature\n");
+				err = -EIO;
+				goto err_free_blobs;
+			}
+			pos += bytes;
+		}
+
+		if (pos != blobs_len) {
+			/* a blob file changed size under us; take the slow path */
+			free(blobs);
+			goto slow_path;
+		}
+
+		out = fopen(argv[2], "r+");
+		if (!out) {
+			fprintf(stderr, "Could not open \"%s\" file\n", argv[2]);
+			err = -EIO;
+			goto err_free_blobs;
+		}
+
+		fseek(out, old_blobs_offset, SEEK_SET);
+		bytes = fwrite(blobs, 1, blobs_len, out);
+		fclose(out);
+		if (bytes != blobs_len) {
+			fprintf(stderr, "Failed to write blob section\n");
+			err = -EIO;
+			goto err_free_blobs;
+		}
+
+		free(blobs);
+		fclose(lxl);
+
+		return 0;
+
+err_free_blobs:
+		free(blobs);
+		goto err_close_lxl;
+	}
+
+slow_path:
+	hdr.blobs_offset = cpu_to_le32(hdr_raw_len);
+	hdr.blobs_len = cpu_to_le32(blobs_len);
+	hdr_len += blobs_len;
+
+	hdr.version = cpu_to_le32(version);
+	hdr.hdr_len = cpu_to_le32(hdr_len);
+
 	/* Temporary file */
 
 	path = strdup(argv[2]);
@@ -793,18 +1023,27 @@ static int lxlfw_insert(int argc, char **argv) {
 	}
 	tmp = fdopen(fd, "w+");
 
-	/* Blobs */
+	/* Preallocate; best effort, not all filesystems support it */
 
-	fseek(tmp, hdr_raw_len, SEEK_SET);
-	blobs_len = 0;
+	if (fstat(fileno(lxl), &st) == 0 && st.st_size > data_offset)
+		fallocate(fd, 0, 0, hdr_len + (st.st_size - data_offset));
+
+	/* Write header */
+
+	bytes = fwrite(&hdr, 1, hdr_raw_len, tmp);
+	if (bytes != hdr_raw_len) {
+		fprintf(stderr, "Could not write Luxul's header\n");
+		err = -EIO;
+		goto err_close_tmp;
+	}
 
 	/* Copy old blobs */
 
-	if (hdr.blobs_offset) {
+	if (old_blobs_offset) {
 		size_t offset;
 
-		fseek(lxl, le32_to_cpu(hdr.blobs_offset), SEEK_SET);
-		for (offset = 0; offset < le32_to_cpu(hdr.blobs_len); ) {
+		fseek(lxl, old_blobs_offset, SEEK_SET);
+		for (offset = 0; offset < old_blobs_len; ) {
 			struct lxl_blob blob;
 			uint16_t type;
 			size_t len;
@@ -831,7 +1070,6 @@ static int lxlfw_insert(int argc, char **argv) {
 					err = -EIO;
 					goto err_close_tmp;
 				}
-				blobs_len += sizeof(blob) + len;
 			}
 
 			offset += sizeof(blob) + len;
@@ -846,7 +1084,6 @@ static int lxlfw_insert(int argc, char **argv) {
 			fprintf(stderr, "Failed to write certificate\n");
 			goto err_close_tmp;
 		}
-		blobs_len += bytes;
 	}
 	if (signature_path) {
 		bytes = lxlfw_write_blob(tmp, LXL_BLOB_SIGNATURE, signature_path);
@@ -854,29 +1091,11 @@ static int lxlfw_insert(int argc, char **argv) {
 			fprintf(stderr, "Failed to write signature\n");
 			goto err_close_tmp;
 		}
-		blobs_len += bytes;
-	}
-
-	hdr.blobs_offset = cpu_to_le32(hdr_raw_len);
-	hdr.blobs_len = cpu_to_le32(blobs_len);
-	hdr_len += blobs_len;
-
-	/* Write header */
-
-	hdr.version = cpu_to_le32(version);
-	hdr.hdr_len = cpu_to_le32(hdr_len);
-
-	fseek(tmp, 0, SEEK_SET);
-	bytes = fwrite(&hdr, 1, hdr_raw_len, tmp);
-	if (bytes != hdr_raw_len) {
-		fprintf(stderr, "Could not write Luxul's header\n");
-		err = -EIO;
-		goto err_close_tmp;
 	}
 
 	/* Write original data */
 
-	fseek(tmp, 0, SEEK_END);
+	fseek(lxl, data_offset, SEEK_SET);
 	bytes = lxlfw_copy_data(lxl, tmp, 0);
 	if (bytes < 0) {
 		fprintf(stderr, "Failed to copy original file\n");
@@ -113,12 +113,15 @@ main(int argc, char *argv[])
   if (1 != fwrite(&zero, 3, 1, out))
     pexit("fwrite");
 
-  /* copy compressed data, calculate crc32 */
+  /* copy compressed data, calculate crc32 and record byte sum */
   while (0 < (elems = fread(&buf, sizeof buf[0], sizeof buf, in))) {
+    size_t i;
     compsize += elems;
     if (elems != fwrite(&buf, sizeof buf[0], elems, out))
       pexit("fwrite");
     datacrc32 = crc32(datacrc32, buf, elems);
+    for (i = 0; i < elems; ++i)
+      checksum += buf[i];
   }
   if (ferror(in))
     pexit("fread");
@@ -141,23 +144,17 @@ main(int argc, char *argv[])
   if (1 != fwrite(&datacrc32, sizeof datacrc32, 1, out))
     pexit("fwrite");
 
-  /* calculate record checksum */
+  /* complete record checksum; the payload bytes were summed while
+     copying, so the output is not re-read */
   checksum += reclength;
   checksum += loadaddress;
   checksum_add32(checksum, type);
   checksum_add32(checksum, compsize);
   checksum_add32(checksum, datasize32);
   checksum_add32(checksum, datacrc32);
-  if (fseek(out, 0, SEEK_CUR))
-    pexit("fseek");
-  while (0 < (elems = fread(&buf, sizeof buf[0], sizeof buf, out))) {
-    size_t i;
-    for (i = 0; i < elems; ++i)
-      checksum += buf[i];
-  }
-  if (ferror(out))
-    pexit("fread");
-  if (fseek(out, 0, SEEK_CUR))
+  checksum += properties;
+  checksum_add32(checksum, dictsize);
+  if (fseek(out, 0, SEEK_END))
     pexit("fseek");
 
   checksum = ~checksum + 1;
@@ -11,6 +11,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "fwu_io.h"
+
 
 /* defaults: Level One WAP-0007 */
 static char *ascii1 = "DDC_RUS001";
@@ -169,38 +171,6 @@ void makehdr(unsigned char *hdr, struct hdrinfo *info,
 	COPY_SHORT(hdr, 0x4e, ~checksum(hdr, HDRSIZE));
 }
 
-unsigned char *read_file(const char *name, long *size)
-{
-	FILE *f;
-	unsigned char *data = NULL;
-	*size = 0;
-	f = fopen(name, "r");
-	if (f != NULL)
-	{
-		if (fseek(f, 0, SEEK_END) == 0)
-		{
-	    *size = ftell(f);
-			if (*size != -1)
-			{
-				if (fseek(f, 0, SEEK_SET) == 0)
-				{
-					data = (unsigned char *)malloc(*size);
-					if (data != NULL)
-					{
-						if (fread(data, sizeof(char), *size, f) != *size)
-						{
-							free(data);
-							data = NULL;
-						}
-					}
-				}
-			}
-		}
-		fclose(f);
-	}
-	return data;
-}
-
 struct hdrinfo *find_hdrinfo(const char *name)
 {
 	int n;
@@ -247,12 +217,11 @@ void show_fwids(void)
 int main(int argc, char *argv[])
 {
 	unsigned char hdr[HDRSIZE];
-	unsigned char *data;
-	FILE *of;
+	struct fwu_input data;
+	FILE *of, *inf;
 	char *outfile = NULL;
 	char *type;
 	struct hdrinfo *info;
-	long size;
 	int last = 0;
 	int n;
 	for (n = 1; n < argc; n++)
@@ -282,16 +251,21 @@ int main(int argc, char *argv[])
 			info = find_hdrinfo(type);
 			if (info == NULL)
 				showhelp();
-			data = read_file(argv[n], &size);
-			if (data == NULL)
+			/* checksum runs over the mapping, the payload is
+			 * copied into place kernel-side */
+			if (fwu_input_open(&data, argv[n]))
 				showhelp();
-			makehdr(hdr, info, data, size, last);
+			makehdr(hdr, info, data.data, data.size, last);
 			/* showhdr(hdr); */
 			if (fwrite(hdr, HDRSIZE, 1, of) != 1)
 				oferror(of);
-			if (fwrite(data, size, 1, of) != 1)
+			inf = fopen(argv[n], "r");
+			if (inf == NULL)
+				oferror(of);
+			if (fwu_copy_data(inf, of, 0) != (ssize_t)data.size)
 				oferror(of);
-			free(data);
+			fclose(inf);
+			fwu_input_close(&data);
 		}
 		else
 			n++;
@@ -16,6 +16,8 @@
 #include <netinet/in.h>
 #include <inttypes.h>
 
+#include "fwu_jobs.h"
+
 static void usage(const char *) __attribute__ (( __noreturn__ ));
 
 static void usage(const char *mess)
@@ -71,7 +73,7 @@ static void emitload(int outfd, int reg, unsigned value)
 	}
 }
 
-int main(int argc, char **argv)
+static int mkbrncmdline_run(int argc, char **argv)
 {
 	int outfd;
 	int i;
@@ -81,6 +83,12 @@ int main(int argc, char **argv)
 	unsigned s_ofs;
 	char *buf;
 
+	/* may run many times per process in --jobs-from mode; input_file
+	 * doubles as the mmap pointer below, so reset all of it */
+	input_file = NULL;
+	output_file = NULL;
+	loadaddr = 0x80002000;
+
 	parseopts(&argc, &argv);
 
 	if (argc < 1)
@@ -154,3 +162,8 @@ int main(int argc, char **argv)
 
 	return 0;
 }
+
+int main(int argc, char **argv)
+{
+	return fwu_jobs_run(argc, argv, mkbrncmdline_run);
+}
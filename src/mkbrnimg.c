@@ -5,6 +5,7 @@
  * Copyright (C) 2011 Tobias Diedrich <ranma+openwrt@tdiedrich.de>
  */
 
+#define _GNU_SOURCE	/* fallocate */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
@@ -15,6 +16,7 @@
 #include <string.h>
 #include <netinet/in.h>
 #include <inttypes.h>
+#include <sys/stat.h>
 
 #define BPB 8 /* bits/byte */
 
@@ -122,7 +124,6 @@ static void appendfile(int outfd, char *path, int kernel) {
 		exit(1);
 	}
 
-	init_crc32();
 	crc = crc32buf(input_file, len);
 	fprintf(stderr, "crc32 for '%s' is %08x.\n", path, crc);
 
@@ -154,6 +155,8 @@ static void appendfile(int outfd, char *path, int kernel) {
 
 int main(int argc, char **argv)
 {
+	off_t total = 0;
+	struct stat st;
 	int outfd;
 	int i;
 
@@ -162,12 +165,25 @@ int main(int argc, char **argv)
 	if (argc < 1)
 		usage("wrong number of arguments");
 
+	/* one table for every input; the poly doesn't change per file */
+	init_crc32();
+
 	if ((outfd = open(output_file, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
 	{
 		fprintf(stderr, "Error opening '%s' for writing: %s\n", output_file, strerror(errno));
 		exit(1);
 	}
 
+	/* the layout is known up front: each file is padded to 1k with its
+	 * 12-byte footer inside the padding, then the signature trails.
+	 * Reserve the space in one go; best effort only. */
+	for (i=0; i<argc; i++) {
+		if (stat(argv[i], &st) == 0)
+			total += (st.st_size + 12 + 0x3ff) & ~(off_t)0x3ff;
+	}
+	total += strlen(signature)+1;
+	(void) fallocate(outfd, 0, 0, total);
+
 	for (i=0; i<argc; i++) {
 		appendfile(outfd, argv[i], i == 0);
 	}
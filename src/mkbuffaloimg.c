@@ -17,6 +17,9 @@
 #include <errno.h>
 #include <sys/stat.h>
 
+#include "fwu_csum.h"
+#include "fwu_io.h"
+
 #define DNI_HDR_LEN	128
 
 /*
@@ -71,11 +74,8 @@ void usage(int status)
 int main(int argc, char *argv[])
 {
 	int res = EXIT_FAILURE;
-	int buflen;
-	int err;
-	struct stat st;
-	char *buf;
-	int i;
+	struct fwu_input in = { 0 };
+	char hdr[DNI_HDR_LEN];
 	uint8_t csum;
 
 	FILE *outfile, *infile;
@@ -145,45 +145,21 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
-	err = stat(ifname, &st);
-	if (err){
-		ERRS("stat failed on %s", ifname);
-		goto err;
-	}
-
-	buflen = st.st_size + DNI_HDR_LEN + 1;
-	buf = malloc(buflen);
-	if (!buf) {
-		ERR("no memory for buffer\n");
+	if (fwu_input_open(&in, ifname)) {
+		ERRS("could not open \"%s\" for reading", ifname);
 		goto err;
 	}
 
-	memset(buf, 0, DNI_HDR_LEN);
-	snprintf(buf, DNI_HDR_LEN, "device:%s\nversion:%s\nregion:%s\n"
+	memset(hdr, 0, DNI_HDR_LEN);
+	snprintf(hdr, DNI_HDR_LEN, "device:%s\nversion:%s\nregion:%s\n"
 		 "RootfsSize:%s\nKernelSize:%s\nInfoHeadSize:128\n",
 		 board_id, version, region, rootfs_size, kernel_size);
-	buf[DNI_HDR_LEN - 2] = 0x12;
-	buf[DNI_HDR_LEN - 1] = 0x32;
+	hdr[DNI_HDR_LEN - 2] = 0x12;
+	hdr[DNI_HDR_LEN - 1] = 0x32;
 
-	infile = fopen(ifname, "r");
-	if (infile == NULL) {
-		ERRS("could not open \"%s\" for reading", ifname);
-		goto err_free;
-	}
-
-	errno = 0;
-	fread(buf +  DNI_HDR_LEN, st.st_size, 1, infile);
-	if (errno != 0) {
-		ERRS("unable to read from file %s", ifname);
-		goto err_close_in;
-	}
-
-	csum = 0;
-	for (i = 0; i < (st.st_size + DNI_HDR_LEN); i++)
-		csum += buf[i];
-
-	csum = 0xff - csum;
-	buf[st.st_size + DNI_HDR_LEN] = csum;
+	/* byte sum over header and mapped payload; no staging buffer */
+	csum = 0xff - (uint8_t)(fwu_byte_sum(hdr, DNI_HDR_LEN) +
+				fwu_byte_sum(in.data, in.size));
 
 	outfile = fopen(ofname, "w");
 	if (outfile == NULL) {
@@ -191,9 +167,11 @@ int main(int argc, char *argv[])
 		goto err_close_in;
 	}
 
-	errno = 0;
-	fwrite(buf, buflen, 1, outfile);
-	if (errno) {
+	infile = fopen(ifname, "r");
+	if (infile == NULL ||
+	    fwrite(hdr, DNI_HDR_LEN, 1, outfile) != 1 ||
+	    fwu_copy_data(infile, outfile, 0) != (ssize_t)in.size ||
+	    fputc(csum, outfile) == EOF) {
 		ERRS("unable to write to file %s", ofname);
 		goto err_close_out;
 	}
@@ -204,15 +182,14 @@ int main(int argc, char *argv[])
 
  err_close_out:
 	fclose(outfile);
+	if (infile != NULL)
+		fclose(infile);
 	if (res != EXIT_SUCCESS) {
 		unlink(ofname);
 	}
 
  err_close_in:
-	fclose(infile);
-
- err_free:
-	free(buf);
+	fwu_input_close(&in);
 
  err:
 	return res;
@@ -12,8 +12,11 @@
 #include <getopt.h>     /* for getopt() */
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+#include "fwu_io.h"
+
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
@@ -138,32 +141,6 @@ static int get_file_stat(struct file_info *fdata)
 	return 0;
 }
 
-static int read_to_buf(struct file_info *fdata, char *buf)
-{
-	FILE *f;
-	int ret = EXIT_FAILURE;
-
-	f = fopen(fdata->file_name, "r");
-	if (f == NULL) {
-		ERRS("could not open \"%s\" for reading", fdata->file_name);
-		goto out;
-	}
-
-	errno = 0;
-	fread(buf, fdata->file_size, 1, f);
-	if (errno != 0) {
-		ERRS("unable to read from file \"%s\"", fdata->file_name);
-		goto out_close;
-	}
-
-	ret = EXIT_SUCCESS;
-
-out_close:
-	fclose(f);
-out:
-	return ret;
-}
-
 static int check_options(void)
 {
 	int ret;
@@ -248,111 +225,149 @@ static int check_options(void)
 	return 0;
 }
 
-static int write_fw(char *data, int len)
+static uint32_t get_csum(const unsigned char *p, size_t len)
 {
-	FILE *f;
-	int ret = EXIT_FAILURE;
-
-	f = fopen(ofname, "w");
-	if (f == NULL) {
-		ERRS("could not open \"%s\" for writing", ofname);
-		goto out;
+	uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+	/* the checksum is a plain byte sum, so it splits into
+	 * independent lanes */
+	while (len >= 4) {
+		s0 += p[0];
+		s1 += p[1];
+		s2 += p[2];
+		s3 += p[3];
+		p += 4;
+		len -= 4;
 	}
+	while (len--)
+		s0 += *p++;
 
-	errno = 0;
-	fwrite(data, len, 1, f);
-	if (errno) {
-		ERRS("unable to write output file");
-		goto out_flush;
-	}
-
-	DBG("firmware file \"%s\" completed", ofname);
-
-	ret = EXIT_SUCCESS;
-
-out_flush:
-	fflush(f);
-	fclose(f);
-	if (ret != EXIT_SUCCESS) {
-		unlink(ofname);
-	}
-out:
-	return ret;
+	return s0 + s1 + s2 + s3;
 }
 
-static uint32_t get_csum(unsigned char *p, uint32_t len)
-{
-	uint32_t csum = 0;
+struct csum_job {
+	const unsigned char	*data;
+	size_t			len;
+	uint32_t		sum;
+};
 
-	while (len--)
-		csum += *p++;
+static void *csum_worker(void *arg)
+{
+	struct csum_job *job = arg;
 
-	return csum;
+	job->sum = get_csum(job->data, job->len);
+	return NULL;
 }
 
 static int build_fw(void)
 {
-	int buflen;
-	char *buf;
-	char *p;
+	struct fwu_input kernel = { 0 };
+	struct fwu_input rootfs = { 0 };
+	struct csum_job kernel_job;
+	struct csum_job rootfs_job = { 0 };
+	struct img_header hdr;
+	pthread_t thread;
+	int threaded;
 	uint32_t csum;
-	struct img_header *hdr;
+	FILE *f = NULL;
 	int ret = EXIT_FAILURE;
 
-	buflen = sizeof(struct img_header) +
-		 kernel_info.write_size + rootfs_info.write_size;
-
-	buf = malloc(buflen);
-	if (!buf) {
-		ERR("no memory for buffer\n");
+	if (fwu_input_open(&kernel, kernel_info.file_name)) {
+		ERRS("could not open \"%s\" for reading",
+		     kernel_info.file_name);
 		goto out;
 	}
 
-	memset(buf, 0, buflen);
-
-	p = buf + sizeof(struct img_header);
+	if (!combined && fwu_input_open(&rootfs, rootfs_info.file_name)) {
+		ERRS("could not open \"%s\" for reading",
+		     rootfs_info.file_name);
+		goto out;
+	}
 
-	/* read kernel data */
-	ret = read_to_buf(&kernel_info, p);
-	if (ret)
-		goto out_free_buf;
+	/*
+	 * Padding bytes are zero and do not contribute, so the image
+	 * checksum is just the two payload sums. Checksum the kernel
+	 * mapping on a helper thread while the rootfs is summed and the
+	 * payloads are streamed out; the header slot is filled in last.
+	 */
+	kernel_job.data = kernel.data;
+	kernel_job.len = kernel.size;
+	threaded = !combined &&
+		   pthread_create(&thread, NULL, csum_worker, &kernel_job) == 0;
+	if (!threaded)
+		csum_worker(&kernel_job);
 
 	if (!combined) {
-		p += kernel_info.write_size;
+		rootfs_job.data = rootfs.data;
+		rootfs_job.len = rootfs.size;
+		csum_worker(&rootfs_job);
+	}
 
-		/* read rootfs data */
-		ret = read_to_buf(&rootfs_info, p);
-		if (ret)
-			goto out_free_buf;
+	f = fopen(ofname, "w");
+	if (f == NULL) {
+		ERRS("could not open \"%s\" for writing", ofname);
+		goto out_join;
 	}
 
-	csum = get_csum((unsigned char *)(buf + sizeof(struct img_header)),
-			buflen - sizeof(struct img_header));
+	errno = 0;
+	if (fseek(f, sizeof(hdr), SEEK_SET) ||
+	    (kernel.size &&
+	     fwrite(kernel.data, kernel.size, 1, f) != 1) ||
+	    fwu_append_zeros(f, kernel_info.write_size - kernel.size))
+		goto out_write_err;
+
+	if (!combined &&
+	    ((rootfs.size &&
+	      fwrite(rootfs.data, rootfs.size, 1, f) != 1) ||
+	     fwu_append_zeros(f, rootfs_info.write_size - rootfs.size)))
+		goto out_write_err;
+
+	if (threaded) {
+		pthread_join(thread, NULL);
+		threaded = 0;
+	}
+	csum = kernel_job.sum + rootfs_job.sum;
 
 	/* fill firmware header */
-	hdr = (struct img_header *) buf;
+	memset(&hdr, 0, sizeof(hdr));
 
-	hdr->checksum = htonl(csum);
-	hdr->image_size = htonl(buflen - sizeof(struct img_header));
+	hdr.checksum = htonl(csum);
+	hdr.image_size = htonl(kernel_info.write_size +
+			       rootfs_info.write_size);
 	if (!combined)
-		hdr->kernel_size = htonl(kernel_info.write_size);
+		hdr.kernel_size = htonl(kernel_info.write_size);
 	else
-		hdr->kernel_size = htonl(kernel_size);
-	hdr->header_len = sizeof(struct img_header);
-	strncpy(hdr->model, model, sizeof(hdr->model));
-	strncpy(hdr->signature, signature, sizeof(hdr->signature));
-	strncpy(hdr->version, version, sizeof(hdr->version));
-	strncpy(hdr->region, region, sizeof(hdr->region));
-
-	ret = write_fw(buf, buflen);
-	if (ret)
-		goto out_free_buf;
+		hdr.kernel_size = htonl(kernel_size);
+	hdr.header_len = sizeof(struct img_header);
+	strncpy(hdr.model, model, sizeof(hdr.model));
+	strncpy(hdr.signature, signature, sizeof(hdr.signature));
+	strncpy(hdr.version, version, sizeof(hdr.version));
+	strncpy(hdr.region, region, sizeof(hdr.region));
+
+	if (fseek(f, 0, SEEK_SET) ||
+	    fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto out_write_err;
+
+	DBG("firmware file \"%s\" completed", ofname);
 
 	ret = EXIT_SUCCESS;
+	goto out_close;
 
-out_free_buf:
-	free(buf);
+out_write_err:
+	ERRS("unable to write output file");
+out_join:
+	if (threaded)
+		pthread_join(thread, NULL);
+out_close:
+	if (f) {
+		fflush(f);
+		fclose(f);
+		if (ret != EXIT_SUCCESS)
+			unlink(ofname);
+	}
 out:
+	fwu_input_close(&rootfs);
+	fwu_input_close(&kernel);
 	return ret;
 }
 
@@ -14,6 +14,7 @@
 #include <getopt.h>     /* for getopt() */
 #include <stdarg.h>
 #include <errno.h>
+#include <fcntl.h>	/* for posix_fallocate() */
 #include <sys/stat.h>
 #include <endian.h>     /* for __BYTE_ORDER */
 #include <byteswap.h>
@@ -720,6 +721,18 @@ image_writeout(FILE *outfile, struct image_desc *desc)
 }
 
 
+size_t
+header_size(void)
+{
+	switch (board->header_type) {
+	case HEADER_TYPE_CAS:
+		return sizeof(struct fwhdr_cas);
+	case HEADER_TYPE_NFS:
+		return sizeof(struct fwhdr_nfs);
+	}
+	return 0;
+}
+
 int
 write_out_header(FILE *outfile)
 {
@@ -1000,6 +1013,11 @@ main(int argc, char *argv[])
 		goto out;
 	}
 
+	/* the final size is known up front; reserve it in one extent so
+	 * concurrent builds don't fragment or overcommit the filesystem */
+	posix_fallocate(fileno(outfile), 0, header_size()
+			+ kernel_image.out_size + fs_image.out_size);
+
 	if (write_out_header(outfile) != 0) {
 		res = ERR_FATAL;
 		goto out_flush;
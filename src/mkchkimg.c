@@ -13,8 +13,13 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
-#define BUF_LEN (2048)
+#include "fwu_csum.h"
+#include "fwu_io.h"
+#include "fwu_jobs.h"
 
 #define MAX_BOARD_ID_LEN (64)
 
@@ -90,12 +95,7 @@ netgear_checksum_init (struct ngr_checksum * c)
 static inline void
 netgear_checksum_add (struct ngr_checksum * c, unsigned char * buf, size_t len)
 {
-	size_t i;
-
-	for (i=0; i<len; i++) {
-		c->c0 += buf[i] & 0xff;
-		c->c1 += c->c0;
-	}
+	fwu_fletcher_update (&c->c0, &c->c1, buf, len);
 }
 
 static inline unsigned long
@@ -111,24 +111,45 @@ netgear_checksum_fini (struct ngr_checksum * c)
 	return checksum;
 }
 
+struct chk_csum_job {
+	const void * data;
+	size_t size;
+	uint32_t c0;
+	uint32_t c1;
+};
+
+static void *
+chk_csum_worker (void * arg)
+{
+	struct chk_csum_job * job = arg;
+
+	job->c0 = job->c1 = 0;
+	fwu_fletcher_update (&job->c0, &job->c1, job->data, job->size);
+	return NULL;
+}
+
 static void
 print_help (void)
 {
 	fprintf (stderr, "Usage: mkchkimg -o output -k kernel [-f filesys] [-b board_id] [-r region]\n");
 }
 
-int
-main (int argc, char * argv[])
+static int
+mkchkimg_run (int argc, char * argv[])
 {
 	int opt;
 	char * ptr;
-	size_t len;
 	size_t header_len;
 	struct chk_header * hdr;
 	struct ngr_checksum chk_part, chk_whole;
-	char buf[BUF_LEN];
+	struct chk_csum_job kern_job, fs_job;
+	struct fwu_input kern_in, fs_in;
+	struct iovec iov[4];
+	pthread_t fs_thread;
+	int fs_threaded;
+	int n_iov;
+	int out_fd;
 	char * output_file, * kern_file, * fs_file;
-	FILE * out_fp, * kern_fp, * fs_fp;
 	char * board_id;
 	unsigned long region;
 
@@ -138,7 +159,9 @@ main (int argc, char * argv[])
 	output_file = NULL;
 	kern_file = NULL;
 	fs_file = NULL;
-	fs_fp = NULL;
+	fs_threaded = 0;
+	memset (&fs_in, 0, sizeof (fs_in));
+	memset (&fs_job, 0, sizeof (fs_job));
 
 	while ((opt = getopt (argc, argv, ":b:r:k:f:o:h")) != -1) {
 		switch (opt) {
@@ -208,39 +231,17 @@ main (int argc, char * argv[])
 	}
 	message ("Netgear CHK writer - v0.1");
 
-	/* Open the input file */
-	kern_fp = fopen (kern_file, "r");
-	if (!kern_fp) {
+	/* Map the input files */
+	if (fwu_input_open (&kern_in, kern_file) < 0) {
 		fatal_error (errno, "Cannot open %s", kern_file);
 	}
-
-	/* Open the fs file, if specified */
-	if (fs_file) {
-		fs_fp = fopen (fs_file, "r");
-		if (!fs_fp) {
-			fclose(kern_fp);
-			fatal_error (errno, "Cannot open %s", fs_file);
-		}
-	}
-
-	/* Open the output file */
-	out_fp = fopen (output_file, "w+");
-	if (!out_fp) {
-		fclose(kern_fp);
-		if (fs_fp) {
-			fclose(fs_fp);
-		}
-		fatal_error (errno, "Cannot open %s", output_file);
-	}
-
-	/* Write zeros when the chk header will be */
-	buf[0] = '\0';
-	header_len = sizeof (struct chk_header) + strlen (board_id);
-	if (fwrite (buf, 1, header_len, out_fp) != header_len) {
-		fatal_error (errno, "Cannot write header");
+	if (fs_file && fwu_input_open (&fs_in, fs_file) < 0) {
+		fwu_input_close (&kern_in);
+		fatal_error (errno, "Cannot open %s", fs_file);
 	}
 
 	/* Allocate storage for header, we fill in as we go */
+	header_len = sizeof (struct chk_header) + strlen (board_id);
 	hdr = malloc (sizeof (struct chk_header));
 	if (!hdr) {
 		fatal_error (0, "malloc failed");
@@ -254,47 +255,44 @@ main (int argc, char * argv[])
 	memset(&hdr->reserved[1], 99, sizeof(hdr->reserved) - 1);
 
 	message ("       Board Id: %s", board_id);
-	message ("         Region: %s", region == 1 ? "World Wide (WW)" 
+	message ("         Region: %s", region == 1 ? "World Wide (WW)"
 			: (region == 2 ? "North America (NA)" : "Unknown"));
 
-	/* Copy the trx file, calculating the checksum as we go */
-	netgear_checksum_init (&chk_part);
-	netgear_checksum_init (&chk_whole);
-	while (!feof (kern_fp)) {
-		len = fread (buf, 1, BUF_LEN, kern_fp);
-		if (len < 1) {
-			break;
-		}
-		if (fwrite (buf, len, 1, out_fp) != 1) {
-			fatal_error (errno, "Write error");
-		}
-		hdr->kernel_len += len;
-		netgear_checksum_add (&chk_part, (unsigned char *)buf, len);
-		netgear_checksum_add (&chk_whole, (unsigned char *)buf, len);
+	/*
+	 * Checksum the two payloads concurrently: they are independent
+	 * inputs, so the rootfs runs on its own thread while this one
+	 * does the kernel. If no thread can be spawned, fall back to
+	 * doing both here.
+	 */
+	if (fs_file) {
+		fs_job.data = fs_in.data;
+		fs_job.size = fs_in.size;
+		fs_threaded = !pthread_create (&fs_thread, NULL,
+					       chk_csum_worker, &fs_job);
+	}
+	kern_job.data = kern_in.data;
+	kern_job.size = kern_in.size;
+	chk_csum_worker (&kern_job);
+	if (fs_file && !fs_threaded) {
+		chk_csum_worker (&fs_job);
 	}
-	fclose(kern_fp);
+	if (fs_threaded) {
+		pthread_join (fs_thread, NULL);
+	}
+
+	hdr->kernel_len = kern_in.size;
+	chk_part.c0 = kern_job.c0;
+	chk_part.c1 = kern_job.c1;
 	hdr->kernel_chksum = netgear_checksum_fini (&chk_part);
 	message ("     Kernel Len: %u", hdr->kernel_len);
 	message ("Kernel Checksum: 0x%08x", hdr->kernel_chksum);
 	hdr->kernel_len = htonl (hdr->kernel_len);
 	hdr->kernel_chksum = htonl (hdr->kernel_chksum);
 
-	/* Now copy the root fs, calculating the checksum as we go */
-	if (fs_fp) {
-		netgear_checksum_init (&chk_part);
-		while (!feof (fs_fp)) {
-			len = fread (buf, 1, BUF_LEN, fs_fp);
-			if (len < 1) {
-				break;
-			}
-			if (fwrite (buf, len, 1, out_fp) != 1) {
-				fatal_error (errno, "Write error");
-			}
-			hdr->rootfs_len += len;
-			netgear_checksum_add (&chk_part, (unsigned char *)buf, len);
-			netgear_checksum_add (&chk_whole, (unsigned char *)buf, len);
-		}
-		fclose(fs_fp);
+	if (fs_file) {
+		hdr->rootfs_len = fs_in.size;
+		chk_part.c0 = fs_job.c0;
+		chk_part.c1 = fs_job.c1;
 		hdr->rootfs_chksum = (netgear_checksum_fini (&chk_part));
 		message ("     Rootfs Len: %u", hdr->rootfs_len);
 		message ("Rootfs Checksum: 0x%08x", hdr->rootfs_chksum);
@@ -302,30 +300,63 @@ main (int argc, char * argv[])
 		hdr->rootfs_chksum = htonl (hdr->rootfs_chksum);
 	}
 
-	/* Calcautate the image checksum */
+	/*
+	 * Calcautate the image checksum. The running sums are exact mod
+	 * 2^32, so the whole-image sums combine from the per-payload
+	 * ones: appending the rootfs after the kernel adds its length
+	 * times the kernel's c0 into c1.
+	 */
+	chk_whole.c0 = kern_job.c0 + fs_job.c0;
+	chk_whole.c1 = kern_job.c1 + fs_job.c1 +
+			(uint32_t) fs_job.size * kern_job.c0;
 	hdr->image_chksum = netgear_checksum_fini (&chk_whole);
 	message (" Image Checksum: 0x%08x", hdr->image_chksum);
 	hdr->image_chksum = htonl (hdr->image_chksum);
 
 	/* Calculate the header checksum */
 	netgear_checksum_init (&chk_part);
-	netgear_checksum_add (&chk_part, (unsigned char *)hdr, 
+	netgear_checksum_add (&chk_part, (unsigned char *)hdr,
 				sizeof (struct chk_header));
 	netgear_checksum_add (&chk_part, (unsigned char *)board_id,
 				strlen (board_id));
 	hdr->header_chksum = htonl (netgear_checksum_fini (&chk_part));
 
-	/* Finally rewind the output and write headers */
-	rewind (out_fp);
-	if (fwrite (hdr, sizeof (struct chk_header), 1, out_fp) != 1) {
-		fatal_error (errno, "Cannot write header");
+	/* The header is complete before any output is written, so the
+	 * whole image goes out in one gathered write. */
+	out_fd = open (output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out_fd < 0) {
+		fatal_error (errno, "Cannot open %s", output_file);
+	}
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof (struct chk_header);
+	iov[1].iov_base = board_id;
+	iov[1].iov_len = strlen (board_id);
+	iov[2].iov_base = kern_in.data;
+	iov[2].iov_len = kern_in.size;
+	n_iov = 3;
+	if (fs_file) {
+		iov[3].iov_base = fs_in.data;
+		iov[3].iov_len = fs_in.size;
+		n_iov = 4;
 	}
-	if (fwrite (board_id, strlen (board_id), 1, out_fp) != 1) {
-		fatal_error (errno, "Cannot write board id");
+	if (writev (out_fd, iov, n_iov) !=
+	    (ssize_t)(header_len + kern_in.size + fs_in.size)) {
+		fatal_error (errno, "Write error");
 	}
 
 	/* Success */
-	fclose(out_fp);
+	close (out_fd);
+	free (hdr);
+	fwu_input_close (&kern_in);
+	if (fs_file) {
+		fwu_input_close (&fs_in);
+	}
 	return EXIT_SUCCESS;
 }
 
+int
+main (int argc, char * argv[])
+{
+	return fwu_jobs_run (argc, argv, mkchkimg_run);
+}
+
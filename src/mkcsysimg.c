@@ -22,6 +22,8 @@
 #include <byteswap.h>
 
 #include "csysimg.h"
+#include "md5.h"
+#include "fwu_io.h"
 
 #if (__BYTE_ORDER == __LITTLE_ENDIAN)
 #  define HOST_TO_LE16(x)	(x)
@@ -231,6 +233,8 @@ usage(int status)
 "                  add webpages to the image\n"
 "  -x <file>[:<align>[:<padc>]]\n"
 "                  add extra data at the end of the image\n"
+"  -C <file>       keep a rebuild cache in <file>; unchanged blocks are\n"
+"                  copied from the previous output instead of rebuilt\n"
 "  -h              show this screen\n"
 "Parameters:\n"
 "  <file>          write output to the file <file>\n"
@@ -699,25 +703,223 @@ block_writeout(FILE *outfile, struct csys_block *block)
 }
 
 
+/*
+ * Optional rebuild cache (-C <sidecar>).  Every emitted block region is
+ * self-contained (header, data, padding and its own checksum), so a
+ * block whose input digest and geometry are unchanged since the last
+ * build produces byte-identical output at the same offset.  The sidecar
+ * records an MD5 digest plus geometry and output region per block; on
+ * rebuild, matching regions are copied from the previous output with
+ * fwu_copy_data() instead of being re-emitted.
+ */
+#define CACHE_MAX_ENTRIES	(MAX_NUM_BLOCKS + 4)
+
+struct cache_ent {
+	int		valid;
+	char		digest[33];	/* MD5 hex, "-" if no input file */
+	uint32_t	addr;
+	uint32_t	size;
+	uint32_t	size_avail;
+	uint32_t	size_hdr;
+	uint32_t	size_csum;
+	uint32_t	file_size;
+	uint32_t	padc;
+	long		offset;
+	long		length;
+};
+
+char *cache_fname = NULL;
+FILE *cache_oldf = NULL;		/* previous output, if reusable */
+struct cache_ent cache_old[CACHE_MAX_ENTRIES];
+struct cache_ent cache_new[CACHE_MAX_ENTRIES];
+int cache_num_new = 0;
+
+int
+cache_digest_file(struct csys_block *block, char *hex)
+{
+	unsigned char digest[16];
+	MD5_CTX ctx;
+	int i;
+
+	if (block->file_name == NULL) {
+		strcpy(hex, "-");
+		return 0;
+	}
+
+	struct fwu_input in = {};
+	if (fwu_input_open(&in, block->file_name)) {
+		ERRS("unable to open file: %s", block->file_name);
+		return -1;
+	}
+
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, in.data, in.size);
+	MD5_Final(digest, &ctx);
+	fwu_input_close(&in);
+
+	for (i = 0; i < 16; i++)
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+
+	return 0;
+}
+
+void
+cache_read_sidecar(void)
+{
+	char digest[33];
+	struct cache_ent *e;
+	FILE *f;
+	int i;
+
+	f = fopen(cache_fname, "r");
+	if (f == NULL)
+		return;
+
+	for (i = 0; i < CACHE_MAX_ENTRIES; i++) {
+		e = &cache_old[i];
+		if (fscanf(f, "%32s %u %u %u %u %u %u %u %ld %ld",
+			   digest, &e->addr, &e->size, &e->size_avail,
+			   &e->size_hdr, &e->size_csum, &e->file_size,
+			   &e->padc, &e->offset, &e->length) != 10)
+			break;
+		snprintf(e->digest, sizeof(e->digest), "%s", digest);
+		e->valid = 1;
+	}
+
+	fclose(f);
+}
+
+void
+cache_write_sidecar(void)
+{
+	struct cache_ent *e;
+	FILE *f;
+	int i;
+
+	f = fopen(cache_fname, "w");
+	if (f == NULL) {
+		WARN("unable to write cache file %s", cache_fname);
+		return;
+	}
+
+	for (i = 0; i < cache_num_new; i++) {
+		e = &cache_new[i];
+		fprintf(f, "%s %u %u %u %u %u %u %u %ld %ld\n",
+			e->digest, e->addr, e->size, e->size_avail,
+			e->size_hdr, e->size_csum, e->file_size,
+			e->padc, e->offset, e->length);
+	}
+
+	fclose(f);
+}
+
+/*
+ * The previous output lives at ofname, which is about to be truncated.
+ * Unlinking the path first keeps the old inode readable through our
+ * open stream while the new build is written in its place.
+ */
+void
+cache_open_previous(void)
+{
+	if (cache_fname == NULL)
+		return;
+
+	cache_read_sidecar();
+
+	cache_oldf = fopen(ofname, "r");
+	if (cache_oldf != NULL)
+		unlink(ofname);
+}
+
+int
+block_writeout_cached(FILE *outfile, struct csys_block *block)
+{
+	struct cache_ent *e;
+	int idx = cache_num_new;
+	long start;
+	int res;
+
+	if (block == NULL)
+		return 0;
+
+	if (cache_fname == NULL)
+		return block_writeout(outfile, block);
+
+	if (idx >= CACHE_MAX_ENTRIES)
+		return block_writeout(outfile, block);
+
+	e = &cache_new[idx];
+	if (cache_digest_file(block, e->digest))
+		return -1;
+	e->addr = block->addr;
+	e->size = block->size;
+	e->size_avail = block->size_avail;
+	e->size_hdr = block->size_hdr;
+	e->size_csum = block->size_csum;
+	e->file_size = block->file_size;
+	e->padc = block->padc;
+
+	start = ftell(outfile);
+	e->offset = start;
+
+	if (cache_oldf != NULL && cache_old[idx].valid &&
+	    strcmp(cache_old[idx].digest, e->digest) == 0 &&
+	    cache_old[idx].addr == e->addr &&
+	    cache_old[idx].size == e->size &&
+	    cache_old[idx].size_avail == e->size_avail &&
+	    cache_old[idx].size_hdr == e->size_hdr &&
+	    cache_old[idx].size_csum == e->size_csum &&
+	    cache_old[idx].file_size == e->file_size &&
+	    cache_old[idx].padc == e->padc &&
+	    cache_old[idx].offset == start) {
+		ssize_t copied;
+
+		if (fseek(cache_oldf, start, SEEK_SET) == 0) {
+			copied = fwu_copy_data(cache_oldf, outfile,
+					       cache_old[idx].length);
+			if (copied == cache_old[idx].length) {
+				DBG(1, "block reused from previous image,"
+				       " offset=%ld len=%ld", start, copied);
+				e->length = copied;
+				e->valid = 1;
+				cache_num_new++;
+				return 0;
+			}
+		}
+		/* fall back to a fresh emission on any reuse failure */
+		if (fseek(outfile, start, SEEK_SET))
+			return -1;
+	}
+
+	res = block_writeout(outfile, block);
+	if (res)
+		return res;
+
+	e->length = ftell(outfile) - start;
+	e->valid = 1;
+	cache_num_new++;
+	return 0;
+}
+
 int
 write_out_blocks(FILE *outfile)
 {
 	struct csys_block *block;
 	int i, res;
 
-	res = block_writeout(outfile, boot_block);
+	res = block_writeout_cached(outfile, boot_block);
 	if (res)
 		return res;
 
-	res = block_writeout(outfile, conf_block);
+	res = block_writeout_cached(outfile, conf_block);
 	if (res)
 		return res;
 
-	res = block_writeout(outfile, webp_block);
+	res = block_writeout_cached(outfile, webp_block);
 	if (res)
 		return res;
 
-	res = block_writeout(outfile, code_block);
+	res = block_writeout_cached(outfile, code_block);
 	if (res)
 		return res;
 
@@ -728,7 +930,7 @@ write_out_blocks(FILE *outfile)
 		if (block->type != BLOCK_TYPE_XTRA)
 			continue;
 
-		res = block_writeout(outfile, block);
+		res = block_writeout_cached(outfile, block);
 		if (res)
 			break;
 	}
@@ -1043,7 +1245,7 @@ main(int argc, char *argv[])
 	while ( 1 ) {
 		optinvalid = 0;
 
-		c = getopt(argc, argv, "b:B:c:dhkr:vw:x:");
+		c = getopt(argc, argv, "b:B:c:C:dhkr:vw:x:");
 		if (c == -1)
 			break;
 
@@ -1062,6 +1264,9 @@ main(int argc, char *argv[])
 			}
 			optinvalid = parse_opt_block(c,optarg);
 			break;
+		case 'C':
+			cache_fname = optarg;
+			break;
 		case 'd':
 			invalid_causes_error = 0;
 			break;
@@ -1120,6 +1325,8 @@ main(int argc, char *argv[])
 		WARN("generating invalid image: \"%s\"", ofname);
 	}
 
+	cache_open_previous();
+
 	outfile = fopen(ofname, "w");
 	if (outfile == NULL) {
 		ERRS("could not open \"%s\" for writing", ofname);
@@ -1132,6 +1339,9 @@ main(int argc, char *argv[])
 		goto out_flush;
 	}
 
+	if (cache_fname != NULL)
+		cache_write_sidecar();
+
 	DBG(1,"Image file %s completed.", ofname);
 
 out_flush:
@@ -11,6 +11,8 @@
 
 #include <netinet/in.h>	// htonl
 
+#include "fwu_jobs.h"
+
 // Usage: mkdapimg [-p] [-m <model>] -s <sig> -i <input> -o <output>
 //
 // e.g.: mkdapimg -s RT3052-AP-DAP1350-3 -i sysupgrade.bin -o factory.bin
@@ -58,8 +60,8 @@ usage()
 	exit(1);
 }
 
-int
-main(int ac, char *av[])
+static int
+mkdapimg_run(int ac, char *av[])
 {
 	char model[MAX_MODEL_NAME_LEN+1];
 	char signature[MAX_SIG_LEN+1];
@@ -71,11 +73,14 @@ main(int ac, char *av[])
 
 	FILE *ifile = NULL;
 	FILE *ofile = NULL;
-	int c;
+	uint8_t buf[64 * 1024];
+	size_t rbytes, i;
+	long hdrtotal;
 	uint32_t cksum;
 	uint32_t bcnt;
 
 	progname = basename(av[0]);
+	optind = 0;
 	memset(model, 0, sizeof(model));
 	memset(signature, 0, sizeof(signature));
 	memset(region, 0, sizeof(region));
@@ -163,17 +168,33 @@ main(int ac, char *av[])
 	if (patchmode) {
 		if (fread(&imghdr, sizeof(imghdr), 1, ifile) < 0)
 			perrexit(2, "fread on input");
+	} else {
+		memset(&imghdr, 0, sizeof(imghdr));
 	}
 
-	for (bcnt = 0, cksum = 0 ; (c = fgetc(ifile)) != EOF ; bcnt++)
-		cksum += c & 0xff;
+	// Reserve room for the header, then checksum the payload while
+	// copying it in one pass; the header is patched in afterwards.
+	hdrtotal = sizeof(imghdr);
+	if (have_regionversion)
+		hdrtotal += MAX_REGION_LEN + MAX_VERSION_LEN;
+	if (fseek(ofile, hdrtotal, SEEK_SET) < 0)
+		perrexit(2, "fseek on output");
+
+	bcnt = 0;
+	cksum = 0;
+	while ((rbytes = fread(buf, 1, sizeof(buf), ifile)) > 0) {
+		for (i = 0; i < rbytes; i++)
+			cksum += buf[i];
+		if (fwrite(buf, 1, rbytes, ofile) != rbytes)
+			perrexit(2, "fwrite on output");
+		bcnt += rbytes;
+	}
 
-	if (fseek(ifile, patchmode ? sizeof(imghdr) : 0, SEEK_SET) < 0)
-		perrexit(2, "fseek on input");
+	if (ferror(ifile))
+		perrexit(2, "fread on input");
 
 	if (patchmode == 0) {
 		// Fill in the header
-		memset(&imghdr, 0, sizeof(imghdr));
 		imghdr.checksum = htonl(cksum);
 		imghdr.partition = 0 ; // don't care?
 		imghdr.hdr_len = sizeof(imghdr);
@@ -205,6 +226,8 @@ main(int ac, char *av[])
 	strncpy(imghdr.model, model, MAX_MODEL_NAME_LEN);
 	strncpy(imghdr.sig, signature, MAX_SIG_LEN);
 
+	if (fseek(ofile, 0, SEEK_SET) < 0)
+		perrexit(2, "fseek on output");
 	if (fwrite(&imghdr, sizeof(imghdr), 1, ofile) < 0)
 		perrexit(2, "fwrite header on output");
 	if (have_regionversion) {
@@ -214,15 +237,14 @@ main(int ac, char *av[])
 			perrexit(2, "fwrite header on output");
 	}
 
-	while ((c = fgetc(ifile)) != EOF) {
-		if (fputc(c, ofile) == EOF)
-			perrexit(2, "fputc on output");
-	}
-
-	if (ferror(ifile))
-		perrexit(2, "fgetc on input");
-
-
 	fclose(ofile);
 	fclose(ifile);
+
+	return 0;
+}
+
+int
+main(int ac, char *av[])
+{
+	return fwu_jobs_run(ac, av, mkdapimg_run);
 }
@@ -15,6 +15,8 @@
 
 #include <netinet/in.h>	// htonl
 
+#include "fwu_jobs.h"
+
 // Usage: mkdapimg2 -s signature [-v version] [-r region]
 //                  [-k uImage block size] -i <input> -o <output>
 //
@@ -81,8 +83,8 @@ usage()
 	exit(1);
 }
 
-int
-main(int ac, char *av[])
+static int
+mkdapimg2_run(int ac, char *av[])
 {
 	char signature[MAX_SIGN_LEN];
 	char version[MAX_FW_VER_LEN];
@@ -91,12 +93,14 @@ main(int ac, char *av[])
 
 	FILE *ifile = NULL;
 	FILE *ofile = NULL;
-	int c;
+	uint8_t buf[64 * 1024];
+	size_t rbytes, i;
 
 	uint32_t cksum;
 	uint32_t bcnt;
 
 	progname = basename(av[0]);
+	optind = 0;
 
 	memset(signature, 0, sizeof(signature));
 	memset(version, 0, sizeof(version));
@@ -159,11 +163,23 @@ main(int ac, char *av[])
 		exit(1);
 	}
 
-	for (bcnt = 0, cksum = 0 ; (c = fgetc(ifile)) != EOF ; bcnt++)
-		cksum += c & 0xff;
+	// Reserve room for the header, then checksum the payload while
+	// copying it in one pass; the header is patched in afterwards.
+	if (fseek(ofile, sizeof(imghdr), SEEK_SET) < 0)
+		perrexit(2, "fseek on output");
+
+	bcnt = 0;
+	cksum = 0;
+	while ((rbytes = fread(buf, 1, sizeof(buf), ifile)) > 0) {
+		for (i = 0; i < rbytes; i++)
+			cksum += buf[i];
+		if (fwrite(buf, 1, rbytes, ofile) != rbytes)
+			perrexit(2, "fwrite on output");
+		bcnt += rbytes;
+	}
 
-	if (fseek(ifile, 0, SEEK_SET) < 0)
-		perrexit(2, "fseek on input");
+	if (ferror(ifile))
+		perrexit(2, "fread on input");
 
 	// Fill in the header
 	memset(&imghdr, 0, sizeof(imghdr));
@@ -176,17 +192,11 @@ main(int ac, char *av[])
 	strncpy(imghdr.fw_ver, version, MAX_FW_VER_LEN);
 	strncpy(imghdr.fw_reg, region, MAX_REG_LEN);
 
+	if (fseek(ofile, 0, SEEK_SET) < 0)
+		perrexit(2, "fseek on output");
 	if (fwrite(&imghdr, sizeof(imghdr), 1, ofile) < 0)
 		perrexit(2, "fwrite header on output");
 
-	while ((c = fgetc(ifile)) != EOF) {
-		if (fputc(c, ofile) == EOF)
-			perrexit(2, "fputc on output");
-	}
-
-	if (ferror(ifile))
-		perrexit(2, "fgetc on input");
-
 	fclose(ofile);
 	fclose(ifile);
 
@@ -200,3 +210,9 @@ main(int ac, char *av[])
 
 	return 0;
 }
+
+int
+main(int ac, char *av[])
+{
+	return fwu_jobs_run(ac, av, mkdapimg2_run);
+}
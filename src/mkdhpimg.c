@@ -15,6 +15,7 @@
 #include "buffalo-lib.h"
 
 #define DHP_HEADER_SIZE	20
+#define COPY_BUF_SIZE	(64 * 1024)
 
 static char *progname;
 
@@ -29,9 +30,12 @@ usage(void)
 int
 main(int argc, char *argv[])
 {
+	uint8_t hdr[DHP_HEADER_SIZE];
+	uint8_t crcbuf[4];
 	struct stat in_st;
 	size_t size;
 	uint32_t crc;
+	ssize_t n;
 	int in, out;
 	uint8_t *buf;
 
@@ -48,31 +52,47 @@ main(int argc, char *argv[])
 
 	size = DHP_HEADER_SIZE + in_st.st_size;
 
-	if ((buf = malloc(size)) == NULL)
+	if ((buf = malloc(COPY_BUF_SIZE)) == NULL)
 		err(EXIT_FAILURE, "malloc");
 
-	memset(buf, 0, DHP_HEADER_SIZE);
-	buf[0x0] = 0x62;
-	buf[0x1] = 0x67;
-	buf[0x2] = 0x6e;
-	buf[0xb] = 0xb1;
-	buf[0xc] = (size >> 24) & 0xff;
-	buf[0xd] = (size >> 16) & 0xff;
-	buf[0xe] = (size >> 8) & 0xff;
-	buf[0xf] = size & 0xff;
-
-	read(in, &buf[DHP_HEADER_SIZE], in_st.st_size);
+	memset(hdr, 0, DHP_HEADER_SIZE);
+	hdr[0x0] = 0x62;
+	hdr[0x1] = 0x67;
+	hdr[0x2] = 0x6e;
+	hdr[0xb] = 0xb1;
+	hdr[0xc] = (size >> 24) & 0xff;
+	hdr[0xd] = (size >> 16) & 0xff;
+	hdr[0xe] = (size >> 8) & 0xff;
+	hdr[0xf] = size & 0xff;
+
+	if ((out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		err(EXIT_FAILURE, "%s", argv[2]);
+
+	/* The CRC covers the header (crc field still zero) and the
+	 * payload; run it incrementally over a fixed window so memory
+	 * stays bounded no matter how large images grow, then patch the
+	 * four CRC bytes in place. */
+	if (write(out, hdr, DHP_HEADER_SIZE) != DHP_HEADER_SIZE)
+		err(EXIT_FAILURE, "%s", argv[2]);
+
+	crc = buffalo_crc_update(0, hdr, DHP_HEADER_SIZE);
+	while ((n = read(in, buf, COPY_BUF_SIZE)) > 0) {
+		crc = buffalo_crc_update(crc, buf, n);
+		if (write(out, buf, n) != n)
+			err(EXIT_FAILURE, "%s", argv[2]);
+	}
+	if (n == -1)
+		err(EXIT_FAILURE, "%s", argv[1]);
 	close(in);
 
-	crc = buffalo_crc(buf, size);
-	buf[0x10] = (crc >> 24) & 0xff;
-	buf[0x11] = (crc >> 16) & 0xff;
-	buf[0x12] = (crc >> 8) & 0xff;
-	buf[0x13] = crc & 0xff;
+	crc = buffalo_crc_final(crc, size);
+	crcbuf[0] = (crc >> 24) & 0xff;
+	crcbuf[1] = (crc >> 16) & 0xff;
+	crcbuf[2] = (crc >> 8) & 0xff;
+	crcbuf[3] = crc & 0xff;
 
-	if ((out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+	if (pwrite(out, crcbuf, sizeof(crcbuf), 0x10) != sizeof(crcbuf))
 		err(EXIT_FAILURE, "%s", argv[2]);
-	write(out, buf, size);
 	close(out);
 
 	free(buf);
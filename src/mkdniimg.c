@@ -14,6 +14,11 @@
 #include <errno.h>
 #include <sys/stat.h>
 
+#include "fwu_cache.h"
+#include "fwu_csum.h"
+#include "fwu_io.h"
+#include "fwu_jobs.h"
+
 #define DNI_HDR_LEN	128
 
 /*
@@ -27,6 +32,7 @@ static char *region = "";
 static char *hd_id;
 
 static char *board_id;
+static char *variants_file;
 /*
  * Message macros
  */
@@ -57,13 +63,122 @@ void usage(int status)
 "  -v <version>    set image version to <version>\n"
 "  -r <region>     set image region to <region>\n"
 "  -H <hd_id>      set image hardware id to <hd_id>\n"
+"  -V <file>       stamp one variant per manifest line:\n"
+"                  <board> <version> <region> <output> [hd_id]\n"
+"                  ('-' for an empty region, '#' starts a comment);\n"
+"                  the payload is read and summed only once\n"
 "  -h              show this screen\n"
 	);
 
 	exit(status);
 }
 
-int main(int argc, char *argv[])
+/* Fill the 128-byte DNI header for one variant. */
+static void fill_header(char *hdr, const char *board, const char *ver,
+			const char *reg, const char *hd)
+{
+	int pos, rem;
+
+	memset(hdr, 0, DNI_HDR_LEN);
+	pos = snprintf(hdr, DNI_HDR_LEN, "device:%s\nversion:V%s\nregion:%s\n",
+		       board, ver, reg);
+	rem = DNI_HDR_LEN - pos;
+	if (pos >= 0 && rem > 1 && hd)
+		snprintf(hdr + pos, rem, "hd_id:%s\n", hd);
+}
+
+/*
+ * Stamp every variant listed in the manifest over one shared payload.
+ * Only the header strings and the trailing byte-sum differ between
+ * variants, so the payload is byte-summed once and then duplicated per
+ * output with fwu_copy_data() (copy_file_range underneath) instead of
+ * re-reading and re-summing the image per device id.
+ */
+static int mkdniimg_variants(void)
+{
+	struct fwu_input in = { 0 };
+	char hdr[DNI_HDR_LEN];
+	uint32_t payload_sum;
+	char *line = NULL;
+	size_t line_len = 0;
+	size_t lineno = 0;
+	FILE *vf = NULL;
+	int res = EXIT_FAILURE;
+
+	if (fwu_input_open(&in, ifname)) {
+		ERRS("could not open \"%s\" for reading", ifname);
+		goto err;
+	}
+	payload_sum = fwu_byte_sum(in.data, in.size);
+
+	vf = fopen(variants_file, "r");
+	if (vf == NULL) {
+		ERRS("could not open \"%s\" for reading", variants_file);
+		goto err;
+	}
+
+	while (getline(&line, &line_len, vf) >= 0) {
+		char *board, *ver, *reg, *out, *hd;
+		char *saveptr;
+		FILE *outfile, *infile;
+		uint8_t csum;
+
+		lineno++;
+
+		board = strtok_r(line, " \t\r\n", &saveptr);
+		if (!board || board[0] == '#')
+			continue;
+
+		ver = strtok_r(NULL, " \t\r\n", &saveptr);
+		reg = strtok_r(NULL, " \t\r\n", &saveptr);
+		out = strtok_r(NULL, " \t\r\n", &saveptr);
+		hd = strtok_r(NULL, " \t\r\n", &saveptr);
+		if (!out) {
+			ERR("%s:%zu: expected <board> <version> <region> <output> [hd_id]",
+			    variants_file, lineno);
+			goto err;
+		}
+		if (strcmp(reg, "-") == 0)
+			reg = "";
+
+		fill_header(hdr, board, ver, reg, hd);
+		csum = 0xff - (uint8_t)(payload_sum + fwu_byte_sum(hdr, DNI_HDR_LEN));
+
+		outfile = fopen(out, "w");
+		if (outfile == NULL) {
+			ERRS("could not open \"%s\" for writing", out);
+			goto err;
+		}
+
+		infile = fopen(ifname, "r");
+		errno = 0;
+		if (fwrite(hdr, DNI_HDR_LEN, 1, outfile) != 1 ||
+		    infile == NULL ||
+		    fwu_copy_data(infile, outfile, 0) != (ssize_t)in.size ||
+		    fputc(csum, outfile) == EOF ||
+		    fflush(outfile) != 0) {
+			ERRS("unable to write to file %s", out);
+			if (infile)
+				fclose(infile);
+			fclose(outfile);
+			unlink(out);
+			goto err;
+		}
+		fclose(infile);
+		fclose(outfile);
+	}
+
+	res = EXIT_SUCCESS;
+
+ err:
+	free(line);
+	if (vf)
+		fclose(vf);
+	fwu_input_close(&in);
+	return res;
+}
+
+static int mkdniimg_run(int argc, char *argv[])
 {
 	int res = EXIT_FAILURE;
 	int buflen;
@@ -72,15 +187,23 @@ int main(int argc, char *argv[])
 	char *buf;
 	int pos, rem, i;
 	uint8_t csum;
+	struct fwu_cache cache;
 
 	FILE *outfile, *infile;
 
 	progname = basename(argv[0]);
+	board_id = NULL;
+	ifname = NULL;
+	ofname = NULL;
+	version = "1.00.00";
+	region = "";
+	hd_id = NULL;
+	variants_file = NULL;
 
 	while ( 1 ) {
 		int c;
 
-		c = getopt(argc, argv, "B:i:o:v:r:H:h");
+		c = getopt(argc, argv, "B:i:o:v:r:H:V:h");
 		if (c == -1)
 			break;
 
@@ -103,6 +226,9 @@ int main(int argc, char *argv[])
 		case 'H':
 			hd_id = optarg;
 			break;
+		case 'V':
+			variants_file = optarg;
+			break;
 		case 'h':
 			usage(EXIT_SUCCESS);
 			break;
@@ -112,13 +238,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (board_id == NULL) {
-		ERR("no board specified");
+	if (ifname == NULL) {
+		ERR("no input file specified");
 		goto err;
 	}
 
-	if (ifname == NULL) {
-		ERR("no input file specified");
+	if (variants_file != NULL)
+		return mkdniimg_variants();
+
+	if (board_id == NULL) {
+		ERR("no board specified");
 		goto err;
 	}
 
@@ -127,6 +256,9 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
+	if (fwu_cache_lookup(&cache, "mkdniimg", argv, ifname, ofname) > 0)
+		return EXIT_SUCCESS;
+
 	err = stat(ifname, &st);
 	if (err){
 		ERRS("stat failed on %s", ifname);
@@ -184,6 +316,7 @@ int main(int argc, char *argv[])
 	res = EXIT_SUCCESS;
 
 	fflush(outfile);
+	fwu_cache_store(&cache);
 
  err_close_out:
 	fclose(outfile);
@@ -200,3 +333,8 @@ int main(int argc, char *argv[])
  err:
 	return res;
 }
+
+int main(int argc, char *argv[])
+{
+	return fwu_jobs_run(argc, argv, mkdniimg_run);
+}
@@ -13,6 +13,10 @@
 #include <sys/stat.h>
 #include <endian.h>	/* for __BYTE_ORDER */
 
+#include "fwu_cache.h"
+#include "fwu_io.h"
+#include "fwu_jobs.h"
+
 #define FALSE 0
 #define TRUE 1
 
@@ -98,60 +102,27 @@ static unsigned short fwcsum (struct buf *buf) {
     return ret;
 }
 
-static int fwread(struct finfo *finfo, struct buf *buf)
-{
-    FILE *f;
-    
-    f = fopen(finfo->name, "r");
-    if (!f) {
-	fprintf(stderr, "could not open \"%s\" for reading\n", finfo->name);
-	usage(EXIT_FAILURE);
-    }
-
-    buf->size = fread(buf->start, 1, finfo->size, f);
-    if (buf->size != finfo->size) {
-	fprintf(stderr, "unable to read from file \"%s\"\n", finfo->name);
-	usage(EXIT_FAILURE);
-    }
-
-    fclose(f);
-
-    return EXIT_SUCCESS;
-}
-
-static int fwwrite(struct finfo *finfo, struct buf *buf)
-{
-    FILE *f;
-
-    f = fopen(finfo->name, "w");
-    if (!f) {
-	fprintf(stderr, "could not open \"%s\" for writing\n", finfo->name);
-	usage(EXIT_FAILURE);
-    }
-
-    buf->size = fwrite(buf->start, 1, finfo->size, f);
-    if (buf->size != finfo->size) {
-	fprintf(stderr, "unable to write to file \"%s\"\n", finfo->name);
-	usage(EXIT_FAILURE);
-    }
-
-    fclose(f);
-
-    return EXIT_SUCCESS;
-}	
-  
-int main(int argc, char **argv)
+#ifdef FWU_LIB
+int mkedimaximg_main(int argc, char **argv)
+#else
+static int mkedimaximg_run(int argc, char **argv)
+#endif
 {
     struct stat st;
     struct header header;
-    struct buf ibuf, obuf;
+    struct fwu_input in = { 0 };
+    struct buf ibuf;
+    struct fwu_cache cache;
     struct finfo ifinfo, ofinfo;
+    size_t osize;
     unsigned short csum;
+    FILE *fin, *fout;
     int c;
 
     ifinfo.name = ofinfo.name = NULL;
     header.flash = header.size = header.start = 0;
     progname = basename(argv[0]);
+    force_be = FALSE;
 
     while((c = getopt(argc, argv, "i:o:m:s:f:S:h:b")) != -1) {
 	switch (c) {
@@ -234,49 +205,66 @@ int main(int argc, char **argv)
 	usage(EXIT_FAILURE);
     }
 
+    if (fwu_cache_lookup(&cache, "mkedimaximg", argv, ifinfo.name,
+			 ofinfo.name) > 0)
+	return EXIT_SUCCESS;
+
     ifinfo.size = st.st_size;
 
-    obuf.size = ifinfo.size + sizeof(struct header) + sizeof(unsigned short);
-    if (obuf.size % sizeof(unsigned short))
-	obuf.size++;
+    osize = ifinfo.size + sizeof(struct header) + sizeof(unsigned short);
+    if (osize % sizeof(unsigned short))
+	osize++;
 
-    obuf.start = malloc(obuf.size);
-    if (!obuf.start) {
-	fprintf(stderr, "no memory for buffer\n");
+    /* checksum straight over the mapping; no whole-image staging buffer */
+    if (fwu_input_open(&in, ifinfo.name)) {
+	fprintf(stderr, "could not open \"%s\" for reading\n", ifinfo.name);
 	usage(EXIT_FAILURE);
     }
-    memset(obuf.start, 0, obuf.size);
-
     ibuf.size = ifinfo.size;
-    ibuf.start = obuf.start + sizeof(struct header);
-    
-    if (fwread(&ifinfo, &ibuf))
-	usage(EXIT_FAILURE);
+    ibuf.start = in.data;
 
     if (force_be == FALSE) {
 	header.flash = HOST_TO_LE32(header.flash);
-	header.size = HOST_TO_LE32(obuf.size - sizeof(struct header));
+	header.size = HOST_TO_LE32(osize - sizeof(struct header));
 	header.start = HOST_TO_LE32(header.start);
+	csum = HOST_TO_LE16(fwcsum(&ibuf));
     } else {
 	header.flash = HOST_TO_BE32(header.flash);
-	header.size = HOST_TO_BE32(obuf.size - sizeof(struct header));
+	header.size = HOST_TO_BE32(osize - sizeof(struct header));
 	header.start = HOST_TO_BE32(header.start);
-    }
-
-    memcpy (obuf.start, &header, sizeof(struct header));
-
-    if (force_be == FALSE)
-	csum = HOST_TO_LE16(fwcsum(&ibuf));
-    else
 	csum = HOST_TO_BE16(fwcsum(&ibuf));
+    }
 
-    memcpy(obuf.start + obuf.size - sizeof(unsigned short),
-	   &csum, sizeof(unsigned short));
-
-    ofinfo.size = obuf.size;
+    fout = fopen(ofinfo.name, "w");
+    if (!fout) {
+	fprintf(stderr, "could not open \"%s\" for writing\n", ofinfo.name);
+	usage(EXIT_FAILURE);
+    }
 
-    if (fwwrite(&ofinfo, &obuf))
+    /* header, payload via the kernel, an even-size pad byte if needed,
+     * then the trailing checksum */
+    fin = fopen(ifinfo.name, "r");
+    if (fwrite(&header, sizeof(struct header), 1, fout) != 1 ||
+	fin == NULL ||
+	fwu_copy_data(fin, fout, 0) != (ssize_t)ifinfo.size ||
+	(ifinfo.size % 2 && fputc(0, fout) == EOF) ||
+	fwrite(&csum, sizeof(csum), 1, fout) != 1 ||
+	fflush(fout)) {
+	fprintf(stderr, "unable to write to file \"%s\"\n", ofinfo.name);
 	usage(EXIT_FAILURE);
+    }
+    fclose(fin);
+    fclose(fout);
+    fwu_input_close(&in);
+
+    fwu_cache_store(&cache);
 
     return EXIT_SUCCESS;
 }
+
+#ifndef FWU_LIB
+int main(int argc, char **argv)
+{
+    return fwu_jobs_run(argc, argv, mkedimaximg_run);
+}
+#endif
@@ -165,12 +165,13 @@ typedef struct part_data {
 #define DEFAULT_OUTPUT_FILE 	"firmware-image.bin"
 #define DEFAULT_VERSION		"UNKNOWN"
 
-#define OPTIONS "B:hv:m:o:r:k:"
+#define OPTIONS "B:hv:m:o:O:r:k:"
 
 typedef struct image_info {
 	char magic[16];
 	char version[256];
 	char outputfile[PATH_MAX];
+	char outputfile2[PATH_MAX];
 	u_int32_t	part_count;
 	part_data_t parts[MAX_SECTIONS];
 	struct fw_info* fwinfo;
@@ -268,6 +269,7 @@ static void usage(const char* progname)
              "Usage: %s [options]\n"
 	     "\t-v <version string>\t - firmware version information, default: %s\n"
 	     "\t-o <output file>\t - firmware output file, default: %s\n"
+	     "\t-O <output file>\t - also emit the image with the alternate (signed <-> raw) trailer\n"
 	     "\t-m <magic>\t - firmware magic, default: %s\n"
 	     "\t-k <kernel file>\t\t - kernel file\n"
 	     "\t-r <rootfs file>\t\t - rootfs file\n"
@@ -398,27 +400,49 @@ static int validate_image_layout(image_info_t* im)
 	return 0;
 }
 
+static int write_image_file(char* mem, u_int32_t mem_size, const char* outputfile)
+{
+	FILE* f;
+
+	if ((f = fopen(outputfile, "w")) == NULL)
+	{
+		ERROR("Can not create output file: '%s'\n", outputfile);
+		return -10;
+	}
+
+	if (fwrite(mem, mem_size, 1, f) != 1)
+	{
+		ERROR("Could not write %d bytes into file: '%s'\n",
+				mem_size, outputfile);
+		fclose(f);
+		return -11;
+	}
+
+	fclose(f);
+	return 0;
+}
+
 static int build_image(image_info_t* im)
 {
 	char* mem;
 	char* ptr;
+	u_int32_t body_size;
 	u_int32_t mem_size;
-	FILE* f;
 	unsigned int i;
+	int rc;
 
-	// build in-memory buffer
-	mem_size = sizeof(header_t);
-	if(im->fwinfo->sign) {
-		mem_size += sizeof(signature_rsa_t);
-	} else {
-		mem_size += sizeof(signature_t);
-	}
+	// build the shared body (header + parts) once; the signed and raw
+	// variants only differ in the trailing signature
+	body_size = sizeof(header_t);
 	for (i = 0; i < im->part_count; ++i)
 	{
 		part_data_t* d = &im->parts[i];
-		mem_size += sizeof(part_t) + d->stats.st_size + sizeof(part_crc_t);
+		body_size += sizeof(part_t) + d->stats.st_size + sizeof(part_crc_t);
 	}
 
+	mem_size = body_size + ((sizeof(signature_rsa_t) > sizeof(signature_t)) ?
+				sizeof(signature_rsa_t) : sizeof(signature_t));
+
 	mem = (char*)calloc(mem_size, 1);
 	if (mem == NULL)
 	{
@@ -433,39 +457,50 @@ static int build_image(image_info_t* im)
 	for (i = 0; i < im->part_count; ++i)
 	{
 		part_data_t* d = &im->parts[i];
-		int rc;
 		if ((rc = write_part(ptr, d)) != 0)
 		{
 			ERROR("ERROR: failed writing part %u '%s'\n", i, d->partition_name);
 		}
 		ptr += sizeof(part_t) + d->stats.st_size + sizeof(part_crc_t);
 	}
-	// write signature
+
+	// write signature and emit the primary layout
 	if(im->fwinfo->sign) {
-		write_signature_rsa(mem, mem_size - sizeof(signature_rsa_t));
+		write_signature_rsa(mem, body_size);
+		rc = write_image_file(mem, body_size + sizeof(signature_rsa_t),
+				      im->outputfile);
 	} else {
-		write_signature(mem, mem_size - sizeof(signature_t));
+		write_signature(mem, body_size);
+		rc = write_image_file(mem, body_size + sizeof(signature_t),
+				      im->outputfile);
 	}
-
-	// write in-memory buffer into file
-	if ((f = fopen(im->outputfile, "w")) == NULL)
+	if (rc != 0)
 	{
-		ERROR("Can not create output file: '%s'\n", im->outputfile);
 		free(mem);
-		return -10;
+		return rc;
 	}
 
-	if (fwrite(mem, mem_size, 1, f) != 1)
+	// emit the alternate layout from the same buffers, without
+	// re-reading or re-checksumming the parts
+	if (im->outputfile2[0])
 	{
-		ERROR("Could not write %d bytes into file: '%s'\n",
-				mem_size, im->outputfile);
-		free(mem);
-		fclose(f);
-		return -11;
+		if(im->fwinfo->sign) {
+			write_signature(mem, body_size);
+			rc = write_image_file(mem, body_size + sizeof(signature_t),
+					      im->outputfile2);
+		} else {
+			write_signature_rsa(mem, body_size);
+			rc = write_image_file(mem, body_size + sizeof(signature_rsa_t),
+					      im->outputfile2);
+		}
+		if (rc != 0)
+		{
+			free(mem);
+			return rc;
+		}
 	}
 
 	free(mem);
-	fclose(f);
 	return 0;
 }
 
@@ -499,6 +534,10 @@ int main(int argc, char* argv[])
 			if (optarg)
 				strncpy(im.outputfile, optarg, sizeof(im.outputfile) - 1);
 			break;
+		case 'O':
+			if (optarg)
+				strncpy(im.outputfile2, optarg, sizeof(im.outputfile2) - 1);
+			break;
 		case 'm':
 			if (optarg)
 				strncpy(im.magic, optarg, sizeof(im.magic) - 1);
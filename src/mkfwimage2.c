@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include "fw.h"
+#include "fwu_jobs.h"
 
 #undef VERSION
 #define VERSION "1.2-OpenWrt.1"
@@ -37,6 +38,7 @@ typedef struct part_data {
 	u_int32_t	partition_memaddr;
 	u_int32_t	partition_entryaddr;
 	u_int32_t	partition_length;
+	u_int32_t	image_offset;
 
 	char		filename[PATH_MAX];
 	struct stat	stats;
@@ -66,23 +68,20 @@ static void write_header(void* mem, const char* version)
 	header->pad = 0L;
 }
 
-static void write_signature(void* mem, u_int32_t sig_offset)
-{
-	/* write signature */
-	signature_t* sign = (signature_t*)(mem + sig_offset);
-	memset(sign, 0, sizeof(signature_t));
-
-	memcpy(sign->magic, MAGIC_END, MAGIC_LENGTH);
-	sign->crc = htonl(crc32(0L,(unsigned char *)mem, sig_offset));
-	sign->pad = 0L;
-}
-
-static int write_part(void* mem, part_data_t* d)
+/*
+ * Write one part record at its precomputed image offset: part header
+ * and mapped payload go straight to the output, and the payload bytes
+ * are folded into both the part CRC and the running signature CRC, so
+ * the image never needs a full in-memory copy or a re-read pass.
+ */
+static int write_part(int ofd, part_data_t* d, uLong *sig_crc)
 {
 	char* addr;
 	int fd;
-	part_t* p = mem;
-	part_crc_t* crc = mem + sizeof(part_t) + d->stats.st_size;
+	part_t p;
+	part_crc_t crc;
+	uLong part_crc;
+	off_t offset = d->image_offset;
 
 	fd = open(d->filename, O_RDONLY);
 	if (fd < 0) {
@@ -96,21 +95,37 @@ static int write_part(void* mem, part_data_t* d)
 		return -2;
 	}
 
-	memcpy(mem + sizeof(part_t), addr, d->stats.st_size);
-	munmap(addr, d->stats.st_size);
+	memset(&p, 0, sizeof(p));
+	memcpy(p.magic, MAGIC_PART, MAGIC_LENGTH);
+	strncpy(p.name, d->partition_name, sizeof(p.name));
+	p.index = htonl(d->partition_index);
+	p.data_size = htonl(d->stats.st_size);
+	p.part_size = htonl(d->partition_length);
+	p.baseaddr = htonl(d->partition_baseaddr);
+	p.memaddr = htonl(d->partition_memaddr);
+	p.entryaddr = htonl(d->partition_entryaddr);
+
+	part_crc = crc32(0L, (unsigned char *)&p, sizeof(p));
+	part_crc = crc32(part_crc, (unsigned char *)addr, d->stats.st_size);
+	crc.crc = htonl(part_crc);
+	crc.pad = 0L;
+
+	if (pwrite(ofd, &p, sizeof(p), offset) != sizeof(p) ||
+	    pwrite(ofd, addr, d->stats.st_size,
+		   offset + sizeof(p)) != d->stats.st_size ||
+	    pwrite(ofd, &crc, sizeof(crc),
+		   offset + sizeof(p) + d->stats.st_size) != sizeof(crc)) {
+		munmap(addr, d->stats.st_size);
+		close(fd);
+		return -3;
+	}
 
-	memset(p->name, 0, sizeof(p->name));
-	strncpy(p->magic, MAGIC_PART, MAGIC_LENGTH);
-	strncpy(p->name, d->partition_name, sizeof(p->name));
-	p->index = htonl(d->partition_index);
-	p->data_size = htonl(d->stats.st_size);
-	p->part_size = htonl(d->partition_length);
-	p->baseaddr = htonl(d->partition_baseaddr);
-	p->memaddr = htonl(d->partition_memaddr);
-	p->entryaddr = htonl(d->partition_entryaddr);
+	*sig_crc = crc32(*sig_crc, (unsigned char *)&p, sizeof(p));
+	*sig_crc = crc32(*sig_crc, (unsigned char *)addr, d->stats.st_size);
+	*sig_crc = crc32(*sig_crc, (unsigned char *)&crc, sizeof(crc));
 
-	crc->crc = htonl(crc32(0L, mem, d->stats.st_size + sizeof(part_t)));
-	crc->pad = 0L;
+	munmap(addr, d->stats.st_size);
+	close(fd);
 
 	return 0;
 }
@@ -308,69 +323,74 @@ static int image_layout_verify(void)
 
 static int build_image(void)
 {
-	char* mem;
-	char* ptr;
+	header_t header;
+	signature_t sign;
 	u_int32_t mem_size;
-	FILE* f;
+	uLong sig_crc;
+	int fd;
 	int i;
 
-	/* build in-memory buffer */
-	mem_size = sizeof(header_t) + sizeof(signature_t);
+	/* precompute the layout: every part's offset in the image */
+	mem_size = sizeof(header_t);
 	for (i = 0; i < im.part_count; ++i) {
 		part_data_t* d = &im.parts[i];
+		d->image_offset = mem_size;
 		mem_size += sizeof(part_t) + d->stats.st_size + sizeof(part_crc_t);
 	}
+	mem_size += sizeof(signature_t);
 
-	mem = (char*)calloc(mem_size, 1);
-	if (mem == NULL) {
-		ERROR("Cannot allocate memory chunk of size '%u'\n", mem_size);
-		return -1;
+	fd = open(im.outputfile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		ERROR("Can not create output file: '%s'\n", im.outputfile);
+		return -10;
 	}
 
+	/* reserve the final size up front; best effort only */
+	if (posix_fallocate(fd, 0, mem_size))
+		(void) ftruncate(fd, mem_size);
+
 	/* write header */
-	write_header(mem, im.version);
-	ptr = mem + sizeof(header_t);
+	write_header(&header, im.version);
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+		goto err_write;
+	sig_crc = crc32(0L, (unsigned char *)&header, sizeof(header));
 
-	/* write all parts */
+	/* write all parts at their precomputed offsets */
 	for (i = 0; i < im.part_count; ++i) {
 		part_data_t* d = &im.parts[i];
 		int rc;
-		if ((rc = write_part(ptr, d)) != 0) {
+		if ((rc = write_part(fd, d, &sig_crc)) != 0) {
 			ERROR("ERROR: failed writing part %u '%s'\n", i, d->partition_name);
+			close(fd);
 			return -1;
 		}
-		ptr += sizeof(part_t) + d->stats.st_size + sizeof(part_crc_t);
-	}
-
-
-	/* write signature */
-	write_signature(mem, mem_size - sizeof(signature_t));
-
-	/* write in-memory buffer into file */
-	if ((f = fopen(im.outputfile, "w")) == NULL) {
-		ERROR("Can not create output file: '%s'\n", im.outputfile);
-		free(mem);
-		return -10;
 	}
 
-	if (fwrite(mem, mem_size, 1, f) != 1) {
-		ERROR("Could not write %d bytes into file: '%s'\n",
-				mem_size, im.outputfile);
-		free(mem);
-		fclose(f);
-		return -11;
-	}
+	/* write signature; its CRC was accumulated alongside the writes */
+	memset(&sign, 0, sizeof(sign));
+	memcpy(sign.magic, MAGIC_END, MAGIC_LENGTH);
+	sign.crc = htonl(sig_crc);
+	sign.pad = 0L;
+	if (pwrite(fd, &sign, sizeof(sign),
+		   mem_size - sizeof(signature_t)) != sizeof(sign))
+		goto err_write;
 
-	free(mem);
-	fclose(f);
+	close(fd);
 	return 0;
+
+err_write:
+	ERROR("Could not write %d bytes into file: '%s'\n",
+			mem_size, im.outputfile);
+	close(fd);
+	return -11;
 }
 
-int main(int argc, char* argv[])
+static int mkfwimage2_run(int argc, char* argv[])
 {
 	int o, rc;
 
 	memset(&im, 0, sizeof(im));
+	zero_part_baseaddr = 0;
 
 	strcpy(im.outputfile, DEFAULT_OUTPUT_FILE);
 	strcpy(im.version, DEFAULT_VERSION);
@@ -438,3 +458,8 @@ int main(int argc, char* argv[])
 
 	return 0;
 }
+
+int main(int argc, char* argv[])
+{
+	return fwu_jobs_run(argc, argv, mkfwimage2_run);
+}
@@ -10,6 +10,9 @@
 #include <endian.h>
 #include <getopt.h>
 
+#include "cyg_crc.h"
+#include "fwu_io.h"
+
 
 #if !defined(__BYTE_ORDER)
 #error "Unknown byte order"
@@ -114,46 +117,36 @@ struct image_header {
 } __attribute__ ((packed));
 
 
-static void *buf;
+/* headers are built in place here; file-scope statics, so zeroed */
+static struct image_header ihdr;
+static struct file_header fhdr;
+
+static struct fwu_input in;
+static uint8_t padding[8];	/* up to 7 zero bytes after the payload */
+
 static size_t buflen;
 
 static size_t length_unpadded;
 static size_t length;
 
 
-static uint32_t crc16_xmodem(char *buf, size_t len) {
-	uint32_t poly = 0x1021;
-	uint32_t crc = 0;
-	char b;
-	int i, j;
-
-	for (i = 0; i < len; i++) {
-		b = buf[i];
-		crc = crc ^ (b << 8);
-
-		for (j = 0; j < 8; j++) {
-			crc = crc << 1;
-			if (crc & 0x10000) {
-				crc = (crc ^ poly) & 0xffff;
-			}
-		}
-	}
-
-	return crc;
+/*
+ * CRC of the padded payload, continuing from crc. The input mapping
+ * plus the zero padding tail stand in for the contiguous staging
+ * buffer the tool used to assemble.
+ */
+static uint16_t payload_crc16(uint16_t crc) {
+	crc = cyg_crc16_accumulate(crc, in.data, length_unpadded);
+	return cyg_crc16_accumulate(crc, padding, length - length_unpadded);
 }
 
-static int create_buffer_and_read_file(char *filename) {
-	FILE *f;
-
-	f = fopen(filename, "r");
-	if (f == NULL) {
+static int open_input_file(char *filename) {
+	if (fwu_input_open(&in, filename)) {
 		fprintf(stderr, "failed to open input file\n");
-		goto err;
+		return -1;
 	}
 
-	fseek(f, 0L, SEEK_END);
-	length_unpadded = ftell(f);
-	rewind(f);
+	length_unpadded = in.size;
 
 	length = length_unpadded;
 	if (length_unpadded % 8 != 0) {
@@ -161,32 +154,12 @@ static int create_buffer_and_read_file(char *filename) {
 	}
 
 	buflen = sizeof(struct file_header) + sizeof(struct image_header) + length;
-	buf = malloc(buflen);
-	if (!buf) {
-		fprintf(stderr, "failed to allocate buffer\n");
-		goto err_close;
-	}
-
-	memset(buf, 0, buflen);
-
-	if (fread(buf + sizeof(struct file_header) + sizeof(struct image_header), length_unpadded, 1, f) != 1) {
-		fprintf(stderr, "failed to read input file\n");
-		goto err_free;
-	}
 
-	fclose(f);
 	return 0;
-
-err_free:
-	free(buf);
-err_close:
-	fclose(f);
-err:
-	return -1;
 }
 
 static void build_file_header(uint32_t product_id, uint32_t device_id, uint32_t compression_type) {
-	struct file_header *header = buf + sizeof(struct image_header);
+	struct file_header *header = &fhdr;
 	uint32_t crc;
 
 	header->file_type = cpu_to_be32(FILE_TYPE_APPLICATION);
@@ -211,19 +184,19 @@ static void build_file_header(uint32_t product_id, uint32_t device_id, uint32_t
 
 	header->length = cpu_to_be32(length);
 
-	crc = crc16_xmodem(buf + sizeof(struct image_header) + sizeof(struct file_header), length);
+	crc = payload_crc16(0);
 	header->file_crc = cpu_to_be32(crc);
 
 	header->compression_type = cpu_to_be32(compression_type);
 
-	crc = crc16_xmodem((char *)header + sizeof(header->res1) + sizeof(header->header_crc),
+	crc = cyg_crc16((char *)header + sizeof(header->res1) + sizeof(header->header_crc),
 		sizeof(struct file_header) - sizeof(header->res1) - sizeof(header->header_crc));
 	header->header_crc = cpu_to_be32(crc);
 }
 
 static void build_image_header(uint32_t product_id, uint32_t device_id) {
-	struct image_header *header = buf;
-	struct file_header *file_header = buf + sizeof(struct image_header);
+	struct image_header *header = &ihdr;
+	struct file_header *file_header = &fhdr;
 	uint32_t crc;
 
 	header->version = cpu_to_be32(IMAGE_VERSION);
@@ -240,7 +213,14 @@ static void build_image_header(uint32_t product_id, uint32_t device_id) {
 	header->minute = 0;
 	header->second = 0;
 
-	crc = crc16_xmodem(buf + sizeof(struct file_header), buflen - sizeof(struct file_header));
+	/* the package CRC starts sizeof(struct file_header) bytes into the
+	 * image header and runs to the end of the image; the covered part
+	 * of the image header (the files table onward) is still zero at
+	 * this point, as it was in the staging-buffer layout */
+	crc = cyg_crc16_accumulate(0, (char *)header + sizeof(struct file_header),
+		sizeof(struct image_header) - sizeof(struct file_header));
+	crc = cyg_crc16_accumulate(crc, file_header, sizeof(struct file_header));
+	crc = payload_crc16(crc);
 	header->package_crc = cpu_to_be16(crc);
 	header->package_flag = cpu_to_be16(PACKAGE_FLAG);
 
@@ -253,13 +233,13 @@ static void build_image_header(uint32_t product_id, uint32_t device_id) {
 	header->files[0].version = file_header->version;
 	header->files[0].type_mask = cpu_to_be32(FILE_TYPE_MASK);
 
-	crc = crc16_xmodem((char *)header, sizeof(struct image_header) - sizeof(header->header_crc));
+	crc = cyg_crc16((char *)header, sizeof(struct image_header) - sizeof(header->header_crc));
 	header->header_crc = cpu_to_be32(crc);
 }
 
-static int write_output_file(char *filename) {
+static int write_output_file(char *input_filename, char *filename) {
 	int ret = 0;
-	FILE *f;
+	FILE *f, *fin;
 
 	f = fopen(filename, "w");
 	if (f == NULL) {
@@ -268,11 +248,19 @@ static int write_output_file(char *filename) {
 		goto err;
 	}
 
-	if (fwrite(buf, buflen, 1, f) != 1) {
+	fin = fopen(input_filename, "r");
+	if (fwrite(&ihdr, sizeof(ihdr), 1, f) != 1 ||
+	    fwrite(&fhdr, sizeof(fhdr), 1, f) != 1 ||
+	    fin == NULL ||
+	    fwu_copy_data(fin, f, 0) != (ssize_t)length_unpadded ||
+	    (length != length_unpadded &&
+	     fwrite(padding, length - length_unpadded, 1, f) != 1)) {
 		fprintf(stderr, "failed to write output file\n");
 		ret = -1;
 	}
 
+	if (fin)
+		fclose(fin);
 	fclose(f);
 
 err:
@@ -345,7 +333,7 @@ int main(int argc, char* argv[]) {
 		goto err;
 	}
 
-	if (create_buffer_and_read_file(input_filename)) {
+	if (open_input_file(input_filename)) {
 		goto err;
 	}
 
@@ -353,14 +341,14 @@ int main(int argc, char* argv[]) {
 
 	build_image_header(product_id, device_id);
 
-	if (write_output_file(output_filename)) {
+	if (write_output_file(input_filename, output_filename)) {
 		goto err_free;
 	}
 
 	ret = EXIT_SUCCESS;
 
 err_free:
-	free(buf);
+	fwu_input_close(&in);
 err:
 	return ret;
 }
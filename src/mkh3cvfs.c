@@ -87,7 +87,16 @@ struct file_entry {
 #define FLAG_READONLY   0x01
 
 
-static FILE *f;
+/*
+ * The image is assembled in memory, eraseblock by eraseblock, and
+ * written out in one go at the end. The previous implementation
+ * seeked around a stdio stream, filled fresh eraseblocks with
+ * byte-sized writes and read FAT entries back from disk to update
+ * their next pointers; for images with many blocks that dominated the
+ * build time.
+ */
+static char *image;
+static size_t image_alloc = 0;
 static size_t file_size = 0;
 
 static int dir_block = 1;
@@ -108,23 +117,28 @@ static inline size_t block_offset(int block) {
 
 static int init_eraseblock(size_t offset) {
 	size_t end = offset - (offset % ERASEBLOCK_SIZE) + ERASEBLOCK_SIZE;
-	char *fill = "\xff";
-	int i;
 
-	while (file_size < end) {
-		if (fseek(f, file_size, SEEK_SET)) {
-			fprintf(stderr, "failed to seek to end\n");
-			return -1;
+	if (end > image_alloc) {
+		size_t alloc = image_alloc ? image_alloc : ERASEBLOCK_SIZE;
+		char *grown;
+
+		while (alloc < end) {
+			alloc *= 2;
 		}
 
-		for (i = 0; i < ERASEBLOCK_SIZE; i++) {
-			if (fwrite(fill, 1, 1, f) != 1) {
-				fprintf(stderr, "failed to write eraseblock\n");
-				return -1;
-			}
+		grown = realloc(image, alloc);
+		if (!grown) {
+			fprintf(stderr, "failed to grow image buffer\n");
+			return -1;
 		}
 
-		file_size += ERASEBLOCK_SIZE;
+		image = grown;
+		image_alloc = alloc;
+	}
+
+	if (file_size < end) {
+		memset(image + file_size, '\xff', end - file_size);
+		file_size = end;
 	}
 
 	return 0;
@@ -141,15 +155,7 @@ static int read_fat_entry(struct fat_entry *out, int block) {
 		return -1;
 	}
 
-	if (fseek(f, offset, SEEK_SET)) {
-		fprintf(stderr, "failed to seek to fat entry\n");
-		return -1;
-	}
-
-	if (fread(out, sizeof(struct fat_entry), 1, f) != 1) {
-		fprintf(stderr, "failed to read fat entry\n");
-		return -1;
-	}
+	memcpy(out, image + offset, sizeof(struct fat_entry));
 
 	return 0;
 }
@@ -161,15 +167,7 @@ static int write_fat_entry(struct fat_entry *in, int block) {
 		return -1;
 	}
 
-	if (fseek(f, offset, SEEK_SET)) {
-		fprintf(stderr, "failed to seek to fat entry\n");
-		return -1;
-	}
-
-	if (fwrite(in, sizeof(struct fat_entry), 1, f) != 1) {
-		fprintf(stderr, "failed to write fat entry\n");
-		return -1;
-	}
+	memcpy(image + offset, in, sizeof(struct fat_entry));
 
 	return 0;
 }
@@ -185,15 +183,7 @@ static int write_file_entry(struct file_entry *in, int block, int index) {
 		return -1;
 	}
 
-	if (fseek(f, offset, SEEK_SET)) {
-		fprintf(stderr, "failed to seek to file entry\n");
-		return -1;
-	}
-
-	if (fwrite(in, sizeof(struct file_entry), 1, f) != 1) {
-		fprintf(stderr, "failed to write file entry\n");
-		return -1;
-	}
+	memcpy(image + offset, in, sizeof(struct file_entry));
 
 	return 0;
 }
@@ -201,19 +191,18 @@ static int write_file_entry(struct file_entry *in, int block, int index) {
 static int write_block(void *in, size_t len, int block) {
 	size_t offset = block_offset(block);
 
-	if (init_eraseblock(offset)) {
+	/* zero-length blocks (empty input file) have always been
+	 * rejected; keep it that way */
+	if (len == 0) {
+		fprintf(stderr, "failed to write block\n");
 		return -1;
 	}
 
-	if (fseek(f, offset, SEEK_SET)) {
-		fprintf(stderr, "failed to seek to block\n");
+	if (init_eraseblock(offset)) {
 		return -1;
 	}
 
-	if (fwrite(in, len, 1, f) != 1) {
-		fprintf(stderr, "failed to write block\n");
-		return -1;
-	}
+	memcpy(image + offset, in, len);
 
 	return 0;
 }
@@ -367,6 +356,7 @@ static void usage(char* argv[]) {
 
 int main(int argc, char* argv[]) {
 	int ret = EXIT_FAILURE;
+	FILE *f;
 
 	static char *filename = NULL;
 	static char *input_filename = NULL;
@@ -403,17 +393,22 @@ int main(int argc, char* argv[]) {
 		goto err;
 	}
 
-	f = fopen(output_filename, "w+");
-	if (f == NULL) {
-		fprintf(stderr, "failed to open output file\n");
-		goto err;
-	}
-
 	if (create_root_directory()) {
-		goto err_close;
+		goto err_free;
 	}
 
 	if (write_file(filename, input_filename)) {
+		goto err_free;
+	}
+
+	f = fopen(output_filename, "w");
+	if (f == NULL) {
+		fprintf(stderr, "failed to open output file\n");
+		goto err_free;
+	}
+
+	if (fwrite(image, file_size, 1, f) != 1) {
+		fprintf(stderr, "failed to write output file\n");
 		goto err_close;
 	}
 
@@ -421,6 +416,8 @@ int main(int argc, char* argv[]) {
 
 err_close:
 	fclose(f);
+err_free:
+	free(image);
 err:
 	return ret;
 }
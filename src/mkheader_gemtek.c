@@ -24,6 +24,8 @@
 
 #include <zlib.h>		/* for crc32() */
 
+#include "fwu_io.h"
+
 /*
  * The header is in little-endian format. In case
  * we are on a BE host, we need to swap binary
@@ -93,11 +95,11 @@ struct machines mach_def[] = {
 int
 main(int argc, char *argv[])
 {
-	unsigned long 	res, flen;
+	unsigned long 	flen;
 	struct gemtek_header my_hdr;
+	struct fwu_input in = { 0 };
 	FILE           *f, *f_out;
 	int 		image_type = -1, index;
-	uint8_t        *buf;
 	uint32_t 	crc;
 
 	if (argc < 3) {
@@ -131,14 +133,11 @@ main(int argc, char *argv[])
 
 	printf("Opening %s...\n", argv[1]);
 
-	f = fopen(argv[1], "r");
-	if(!f) {
+	if (fwu_input_open(&in, argv[1])) {
 		fprintf(stderr, "\nERROR: couldn't open input image\n");
 		exit(-1);
 	}
-
-	fseek(f, 0, SEEK_END);
-	flen = (unsigned long) ftell(f);
+	flen = in.size;
 
 	printf("  %lu (0x%lX) bytes long\n", flen, flen);
 
@@ -147,21 +146,10 @@ main(int argc, char *argv[])
 		goto f_error;
 	}
 
-	buf = malloc(flen + HDRLEN);
-	if (!buf) {
-		fprintf(stderr, "\nERROR: couldn't allocate buffer\n");
-		goto f_error;
-	}
-	rewind(f);
-	res = fread(buf + HDRLEN, 1, flen, f);
-	if (res != flen) {
-		perror("Couldn't read entire file: fread()");
-		goto f_error;
-	}
-	fclose(f);
-
 	printf("\nCreating %s...\n", argv[2]);
 
+	/* the per-machine template carries everything constant; only the
+	 * image size and the checksum are folded in per run */
 	memcpy(&my_hdr, &mach_def[image_type].header, HDRLEN);
 
 	printf("  Using %s magic\n", mach_def[image_type].desc);
@@ -169,13 +157,13 @@ main(int argc, char *argv[])
 	my_hdr.imagesz = le32(flen + HDRLEN);
 	memcpy(my_hdr.lang, "EN", 2);
 
-	memcpy(buf, &my_hdr, HDRLEN);
-
-	crc = crc32(0, buf, flen + HDRLEN);
+	/* checksum field is zero from the template while the CRC is taken,
+	 * exactly as the old staging-buffer pass had it */
+	crc = crc32(0, (const Bytef *)&my_hdr, HDRLEN);
+	crc = crc32(crc, in.data, flen);
 	printf("  CRC32: %08X\n", crc);
 
 	my_hdr.checksum = le32(crc);
-	memcpy(buf, &my_hdr, HDRLEN);
 
 	printf("  Writing...\n");
 
@@ -185,14 +173,21 @@ main(int argc, char *argv[])
 		exit(-1);
 	}
 
-	fwrite(buf, 1, flen + HDRLEN, f_out);
-
+	f = fopen(argv[1], "r");
+	if (!f ||
+	    fwrite(&my_hdr, HDRLEN, 1, f_out) != 1 ||
+	    fwu_copy_data(f, f_out, 0) != (ssize_t)flen) {
+		fprintf(stderr, "\nERROR: couldn't write output image\n");
+		fclose(f_out);
+		exit(-1);
+	}
+	fclose(f);
 	fclose(f_out);
 
-	free(buf);
+	fwu_input_close(&in);
 	return 0;
 
 f_error:
-	fclose(f);
+	fwu_input_close(&in);
 	exit(-1);
 }
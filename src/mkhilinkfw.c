@@ -23,7 +23,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
- 
+
+#include "fwu_io.h"
+
 #define DES_KEY "H@L9K*(3"
  
 #ifndef min
@@ -56,8 +58,7 @@ static DES_key_schedule schedule;
 static void show_usage(const char *arg0);
 static void exit_cleanup(void);
 static void copy_file(int src, int dst);
-static void do_encrypt(void *p, off_t len);
-static void do_decrypt(void *p, off_t len);
+static void des_crypt(void *p, off_t len, int dir);
  
  
 int main(int argc, char **argv)
@@ -199,7 +200,7 @@ int main(int argc, char **argv)
 			munmap(p, file_len);
 			exit(EXIT_FAILURE);
 		}
-		do_encrypt(p, len);
+		des_crypt(p, len, DES_ENCRYPT);
 		munmap(p, file_len);
 		if (len != file_len) {
 			if (ftruncate(temp_fd, len) < 0) {
@@ -212,7 +213,7 @@ int main(int argc, char **argv)
 	if (decrypt_opt) {
 		off_t header_len = min(file_len, sizeof(image_header_t) + 3);
 		memcpy(buf, p, header_len);
-		do_decrypt(buf, header_len);
+		des_crypt(buf, header_len, DES_DECRYPT);
 		header = (image_header_t *)buf;
 		if (ntohl(header->ih_magic) != IH_MAGIC) {
 			fprintf(stderr, "Header magic incorrect: "
@@ -220,7 +221,7 @@ int main(int argc, char **argv)
 			        IH_MAGIC, ntohl(header->ih_magic));
 			exit(EXIT_FAILURE);
 		}
-		do_decrypt(p, file_len);
+		des_crypt(p, file_len, DES_DECRYPT);
 		munmap(p, file_len);
 	}
  
@@ -262,50 +263,73 @@ static void exit_cleanup(void)
  
 static void copy_file(int src, int dst)
 {
-	char buf[4096];
-	ssize_t size;
- 
-	while ((size = read(src, buf, 4096)) > 0) {
-        write(dst, buf, size);
-    }
+	FILE *from, *to;
+
+	/* dup() so closing the streams doesn't close the caller's fds;
+	 * the dup shares the file offset, which the caller relies on */
+	from = fdopen(dup(src), "r");
+	to = fdopen(dup(dst), "w");
+	if (from && to)
+		fwu_copy_data(from, to, 0);
+	if (to)
+		fclose(to);
+	if (from)
+		fclose(from);
 }
- 
-static void do_encrypt(void *p, off_t len)
+
+static void des_pass(uint8_t *p, size_t start, size_t end, int dir)
 {
-	DES_cblock *pblock;
-	int num_blocks;
- 
-	num_blocks = len / 8;
-	pblock = (DES_cblock *) p;
-	while (num_blocks--) {
-		DES_ecb_encrypt(pblock, pblock, &schedule, DES_ENCRYPT);
-		pblock++;
-	}
- 
-	num_blocks = (len - 3) / 8;
-	pblock = (DES_cblock *) (p + 3);
+	DES_cblock *pblock = (DES_cblock *) (p + start);
+	size_t num_blocks = (end - start) / 8;
+
 	while (num_blocks--) {
-		DES_ecb_encrypt(pblock, pblock, &schedule, DES_ENCRYPT);
+		DES_ecb_encrypt(pblock, pblock, &schedule, dir);
 		pblock++;
 	}
 }
- 
-static void do_decrypt(void *p, off_t len)
+
+/*
+ * The cipher runs two overlapping ECB passes over the image, at offsets
+ * 0 and 3 (reversed for decryption); the second pass reads the first
+ * pass's output. Rather than traversing the whole image twice, run both
+ * passes chunk-wise and let the second trail the first just far enough
+ * that it only touches blocks the first pass has finished — one
+ * cache-hot traversal instead of two trips through memory.
+ */
+#define DES_CHUNK	(64 * 1024)
+
+static void des_crypt(void *p, off_t len, int dir)
 {
-	DES_cblock *pblock;
-	int num_blocks;
- 
-	num_blocks = (len - 3) / 8;
-	pblock = (DES_cblock *) (p + 3);
-	while (num_blocks--) {
-		DES_ecb_encrypt(pblock, pblock, &schedule, DES_DECRYPT);
-		pblock++;
-	}
- 
-	num_blocks = len / 8;
-	pblock = (DES_cblock *) p;
-	while (num_blocks--) {
-		DES_ecb_encrypt(pblock, pblock, &schedule, DES_DECRYPT);
-		pblock++;
+	size_t f_off = (dir == DES_ENCRYPT) ? 0 : 3;
+	size_t s_off = (dir == DES_ENCRYPT) ? 3 : 0;
+	size_t f_end, s_end, f_cur, s_cur;
+
+	f_end = f_off + (((size_t)len > f_off ? len - f_off : 0) / 8) * 8;
+	s_end = s_off + (((size_t)len > s_off ? len - s_off : 0) / 8) * 8;
+	f_cur = f_off;
+	s_cur = s_off;
+
+	while (f_cur < f_end || s_cur < s_end) {
+		size_t f_next = f_cur + DES_CHUNK;
+		size_t s_limit;
+
+		if (f_next > f_end)
+			f_next = f_end;
+		des_pass(p, f_cur, f_next, dir);
+		f_cur = f_next;
+
+		/* blocks of the trailing pass ending at or before f_cur
+		 * only see finished bytes; once the leading pass is done
+		 * the rest (including any tail past f_end) is fair game */
+		if (f_cur >= f_end)
+			s_limit = s_end;
+		else
+			s_limit = s_off + ((f_cur - s_off) / 8) * 8;
+		if (s_limit > s_end)
+			s_limit = s_end;
+		if (s_limit > s_cur) {
+			des_pass(p, s_cur, s_limit, dir);
+			s_cur = s_limit;
+		}
 	}
 }
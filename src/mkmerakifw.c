@@ -9,6 +9,8 @@
  * <https://github.com/riptidewave93/meraki-partbuilder>
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -16,8 +18,10 @@
 #include <libgen.h>
 #include <getopt.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 
+#include "fwu_io.h"
 #include "sha1.h"
 
 #define PADDING_BYTE		0xff
@@ -173,12 +177,12 @@ int main(int argc, char *argv[])
 	int ret = EXIT_FAILURE;
 	long klen;
 	size_t kspace;
-	unsigned char *kernel;
+	struct fwu_input input = { 0 };
 	size_t buflen;
-	unsigned char *buf;
+	unsigned char buf[HDR_LENGTH];
 	bool strip_padding = false;
 	char *ofname = NULL, *ifname = NULL;
-	FILE *out, *in;
+	FILE *out;
 
 	progname = basename(argv[0]);
 
@@ -232,8 +236,8 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
-	in = fopen(ifname, "r");
-	if (in == NULL) {
+	/* Map the kernel instead of copying it into a padded buffer */
+	if (fwu_input_open(&input, ifname)) {
 		ERRS("could not open \"%s\" for reading: %s", ifname);
 		goto err;
 	}
@@ -241,10 +245,7 @@ int main(int argc, char *argv[])
 	buflen = board->imagelen;
 	kspace = buflen - HDR_LENGTH;
 
-	/* Get kernel length */
-	fseek(in, 0, SEEK_END);
-	klen = ftell(in);
-	rewind(in);
+	klen = input.size;
 
 	if (klen > kspace) {
 		ERR("file \"%s\" is too big - max size: 0x%08lX\n",
@@ -256,17 +257,7 @@ int main(int argc, char *argv[])
 	if (strip_padding)
 		buflen = klen + HDR_LENGTH;
 
-	/* Allocate and initialize buffer for final image */
-	buf = malloc(buflen);
-	if (buf == NULL) {
-		ERRS("no memory for buffer: %s\n");
-		goto err_close_in;
-	}
-	memset(buf, PADDING_BYTE, buflen);
-
-	/* Load kernel */
-	kernel = buf + HDR_LENGTH;
-	fread(kernel, klen, 1, in);
+	memset(buf, PADDING_BYTE, sizeof(buf));
 
 	/* Write magic values */
 	writel(buf, HDR_OFF_MAGIC1, board->magic1);
@@ -278,7 +269,7 @@ int main(int argc, char *argv[])
 	writel(buf, HDR_OFF_IMAGELEN, klen);
 
 	/* Write checksum and static hash */
-	sha1_csum(kernel, klen, buf + HDR_OFF_CHECKSUM);
+	sha1_csum(input.data, klen, buf + HDR_OFF_CHECKSUM);
 
 	switch (board->magic2) {
 	case 0xa1f0beef:
@@ -293,23 +284,42 @@ int main(int argc, char *argv[])
 		break;
 	}
 
-	/* Save finished image */
+	/* Save finished image: header, kernel, then streamed padding */
 	out = fopen(ofname, "w");
 	if (out == NULL) {
 		ERRS("could not open \"%s\" for writing: %s", ofname);
-		goto err_free;
+		goto err_close_in;
+	}
+
+	/* Tell the filesystem the final size up front (best effort) */
+	fallocate(fileno(out), 0, 0, buflen);
+
+	fwrite(buf, HDR_LENGTH, 1, out);
+	fwrite(input.data, klen, 1, out);
+
+	if (buflen > HDR_LENGTH + (size_t)klen) {
+		unsigned char padding[64 * 1024];
+		size_t todo = buflen - HDR_LENGTH - klen;
+
+		memset(padding, PADDING_BYTE, sizeof(padding));
+		while (todo) {
+			size_t bytes = todo < sizeof(padding) ? todo : sizeof(padding);
+
+			if (fwrite(padding, 1, bytes, out) != bytes) {
+				ERR("unable to write padding to \"%s\"", ofname);
+				fclose(out);
+				goto err_close_in;
+			}
+			todo -= bytes;
+		}
 	}
-	fwrite(buf, buflen, 1, out);
 
 	ret = EXIT_SUCCESS;
 
 	fclose(out);
 
-err_free:
-	free(buf);
-
 err_close_in:
-	fclose(in);
+	fwu_input_close(&input);
 
 err:
 	return ret;
@@ -12,6 +12,7 @@
 #include <getopt.h>     /* for getopt() */
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <endian.h>     /* for __BYTE_ORDER */
 #include <byteswap.h>
@@ -38,6 +39,7 @@ struct fw_block {
 	uint32_t	flags;
 
 	char		*name;  /* name of the file */
+	uint8_t		*data;  /* file content, loaded once */
 	uint32_t	size;  	/* length of the file */
 	uint32_t	crc;    /* crc value of the file */
 };
@@ -350,50 +352,88 @@ find_board(char *model){
 }
 
 
+/*
+ * Load a block's file once; the buffer both feeds the partition header
+ * CRC and is streamed to the output, so input data is read one time.
+ */
 int
-get_file_crc(struct fw_block *ff)
+load_block_file(struct fw_block *ff)
 {
 	FILE *f;
-	uint8_t buf[FILE_BUF_LEN];
-	uint32_t readlen = sizeof(buf);
-	int res = -1;
-	size_t len;
 
-	if ((ff->flags & BLOCK_FLAG_HAVEHDR) == 0) {
-		res = 0;
-		goto out;
+	if (ff->name == NULL || ff->data != NULL)
+		return 0;
+
+	ff->data = malloc(ff->size ? ff->size : 1);
+	if (ff->data == NULL) {
+		errmsg(1,"not enough memory for %s", ff->name);
+		return -1;
 	}
 
 	errno = 0;
 	f = fopen(ff->name,"r");
 	if (errno) {
 		errmsg(1,"unable to open file %s", ff->name);
-		goto out;
+		return -1;
 	}
 
+	errno = 0;
+	fread(ff->data, ff->size, 1, f);
+	if (errno) {
+		errmsg(1,"unable to read from file %s",	ff->name);
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void *
+block_crc_worker(void *arg)
+{
+	struct fw_block *ff = arg;
+
 	ff->crc = 0;
-	len = ff->size;
-	while (len > 0) {
-		if (len < readlen)
-			readlen = len;
+	update_crc(ff->data, ff->size, &ff->crc);
+	return NULL;
+}
 
-		errno = 0;
-		fread(buf, readlen, 1, f);
-		if (errno) {
-			errmsg(1,"unable to read from file %s",	ff->name);
-			goto out_close;
-		}
+/*
+ * Partition CRCs are independent, so when several blocks carry a
+ * header they are checksummed on separate threads.
+ */
+int
+precompute_block_crcs(void)
+{
+	pthread_t threads[MAX_FW_BLOCKS];
+	int started[MAX_FW_BLOCKS];
+	struct fw_block *b;
+	int i;
 
-		update_crc(buf, readlen, &ff->crc);
-		len -= readlen;
+	init_crc_table();
+
+	for (i = 0; i < fw_num_blocks; i++) {
+		b = &fw_blocks[i];
+		started[i] = 0;
+
+		if ((b->flags & BLOCK_FLAG_HAVEHDR) == 0)
+			continue;
+
+		if (load_block_file(b) != 0)
+			return -1;
+
+		if (pthread_create(&threads[i], NULL, block_crc_worker, b) == 0)
+			started[i] = 1;
+		else
+			block_crc_worker(b);
 	}
 
-	res = 0;
+	for (i = 0; i < fw_num_blocks; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
 
-out_close:
-	fclose(f);
-out:
-	return res;
+	return 0;
 }
 
 
@@ -527,9 +567,6 @@ write_out_file(FILE *outfile, struct fw_block *block, uint32_t *crc)
 	if ((block->flags & BLOCK_FLAG_HAVEHDR) != 0) {
 		struct mylo_partition_header ph;
 
-		if (get_file_crc(block) != 0)
-		        return -1;
-
 		ph.crc = HOST_TO_LE32(block->crc);
 		ph.len = HOST_TO_LE32(block->size);
 
@@ -537,32 +574,38 @@ write_out_file(FILE *outfile, struct fw_block *block, uint32_t *crc)
 			return -1;
 	}
 
-	f = fopen(block->name,"r");
-	if (errno) {
-		errmsg(1,"unable to open file: %s", block->name);
-		return -1;
-	}
-
-	len = block->size;
-	while (len > 0) {
-		if (len < buflen)
-			buflen = len;
-
-		/* read data from source file */
-		errno = 0;
-		fread(buff, buflen, 1, f);
-		if (errno != 0) {
-			errmsg(1,"unable to read from file: %s",block->name);
+	if (block->data != NULL) {
+		/* already loaded for the partition CRC; stream from memory */
+		if (write_out_data(outfile, block->data, block->size, crc) != 0)
+			return -1;
+	} else {
+		f = fopen(block->name,"r");
+		if (errno) {
+			errmsg(1,"unable to open file: %s", block->name);
 			return -1;
 		}
 
-		if (write_out_data(outfile, buff, buflen, crc) != 0)
-			return -1;
+		len = block->size;
+		while (len > 0) {
+			if (len < buflen)
+				buflen = len;
+
+			/* read data from source file */
+			errno = 0;
+			fread(buff, buflen, 1, f);
+			if (errno != 0) {
+				errmsg(1,"unable to read from file: %s",block->name);
+				return -1;
+			}
 
-		len -= buflen;
-	}
+			if (write_out_data(outfile, buff, buflen, crc) != 0)
+				return -1;
 
-	fclose(f);
+			len -= buflen;
+		}
+
+		fclose(f);
+	}
 
 	/* align next block on a 4 byte boundary */
 	len = block->size % 4;
@@ -1245,6 +1288,10 @@ main(int argc, char *argv[])
 		goto out;
 	}
 
+	if (precompute_block_crcs() != 0) {
+		goto out;
+	}
+
 	outfile = fopen(ofname, "w");
 	if (outfile == NULL) {
 		errmsg(1, "could not open \"%s\" for writing", ofname);
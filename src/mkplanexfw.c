@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 
+#include "fwu_jobs.h"
 #include "sha1.h"
 
 #if (__BYTE_ORDER == __BIG_ENDIAN)
@@ -112,26 +113,54 @@ void usage(int status)
 "  -o <file>       write output to the file <file>\n"
 "  -v <version>    set image version to <version>\n"
 "  -h              show this screen\n"
+"\n"
+"Repeating -B/-v/-o stamps several variants from one shared payload;\n"
+"give -B (and optionally -v) before the -o they apply to.\n"
 	);
 
 	exit(status);
 }
 
-int main(int argc, char *argv[])
+#define MAX_VARIANTS	16
+
+struct variant {
+	char		*board_id;
+	char		*version;
+	char		*ofname;
+};
+
+/* Payload digests only depend on (seed, datalen), not on the header */
+struct digest_cache {
+	uint32_t	seed;
+	uint32_t	datalen;
+	uint8_t		sha1sum[20];
+};
+
+static int mkplanexfw_run(int argc, char *argv[])
 {
+	struct digest_cache cache[MAX_VARIANTS];
+	struct variant variants[MAX_VARIANTS];
+	int n_variants = 0;
+	int n_cached = 0;
 	int res = EXIT_FAILURE;
 	int buflen;
 	int err;
+	int i;
 	struct stat st;
+	char *payload;
 	char *buf;
-	struct planex_hdr *hdr;
 	sha1_context ctx;
 	uint32_t seed;
 
-	FILE *outfile, *infile;
+	FILE *infile;
 
 	progname = basename(argv[0]);
+	board_id = NULL;
+	ifname = NULL;
+	ofname = NULL;
+	version = "1.00.00";
 
+	optind = 0;
 	while ( 1 ) {
 		int c;
 
@@ -148,6 +177,14 @@ int main(int argc, char *argv[])
 			break;
 		case 'o':
 			ofname = optarg;
+			if (n_variants >= MAX_VARIANTS) {
+				ERR("too many output files");
+				goto err;
+			}
+			variants[n_variants].board_id = board_id;
+			variants[n_variants].version = version;
+			variants[n_variants].ofname = optarg;
+			n_variants++;
 			break;
 		case 'v':
 			version = optarg;
@@ -166,12 +203,6 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
-	board = find_board(board_id);
-	if (board == NULL) {
-		ERR("unknown board '%s'", board_id);
-		goto err;
-	};
-
 	if (ifname == NULL) {
 		ERR("no input file specified");
 		goto err;
@@ -182,83 +213,149 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
+	/*
+	 * With a single output, options may come in any order; take the
+	 * final values like the tool always did.
+	 */
+	if (n_variants == 1) {
+		variants[0].board_id = board_id;
+		variants[0].version = version;
+	}
+
+	for (i = 0; i < n_variants; i++) {
+		if (variants[i].board_id == NULL) {
+			ERR("no board specified for %s", variants[i].ofname);
+			goto err;
+		}
+		if (find_board(variants[i].board_id) == NULL) {
+			ERR("unknown board '%s'", variants[i].board_id);
+			goto err;
+		}
+	}
+
 	err = stat(ifname, &st);
 	if (err){
 		ERRS("stat failed on %s", ifname);
 		goto err;
 	}
 
-	if (st.st_size > board->datalen) {
-		ERR("file '%s' is too big - max size: 0x%08X (exceeds %lu bytes)\n",
-		    ifname, board->datalen, st.st_size - board->datalen);
-		goto err;
-	}
-
-	buflen = board->datalen + 0x10000;
-	buf = malloc(buflen);
-	if (!buf) {
+	payload = malloc(st.st_size);
+	if (!payload) {
 		ERR("no memory for buffer\n");
 		goto err;
 	}
 
-	memset(buf, 0xff, buflen);
-	hdr = (struct planex_hdr *)buf;
-
-	hdr->datalen = HOST_TO_BE32(board->datalen);
-	hdr->unk1[0] = board->unk[0];
-	hdr->unk1[1] = board->unk[1];
-
-	snprintf(hdr->version, sizeof(hdr->version), "%s", version);
-
 	infile = fopen(ifname, "r");
 	if (infile == NULL) {
 		ERRS("could not open \"%s\" for reading", ifname);
-		goto err_free;
+		goto err_free_payload;
 	}
 
 	errno = 0;
-	fread(buf +  sizeof(*hdr), st.st_size, 1, infile);
+	fread(payload, st.st_size, 1, infile);
 	if (errno != 0) {
 		ERRS("unable to read from file %s", ifname);
 		goto err_close_in;
 	}
 
-	seed = HOST_TO_BE32(board->seed);
-	sha1_starts(&ctx);
-	sha1_update(&ctx, (uchar *) &seed, sizeof(seed));
-	sha1_update(&ctx, buf + sizeof(*hdr), board->datalen);
-	sha1_finish(&ctx, hdr->sha1sum);
+	for (i = 0; i < n_variants; i++) {
+		struct planex_hdr *hdr;
+		struct digest_cache *digest = NULL;
+		FILE *outfile;
+		int ok = 0;
+		int j;
 
-	outfile = fopen(ofname, "w");
-	if (outfile == NULL) {
-		ERRS("could not open \"%s\" for writing", ofname);
-		goto err_close_in;
-	}
+		board = find_board(variants[i].board_id);
 
-	errno = 0;
-	fwrite(buf, buflen, 1, outfile);
-	if (errno) {
-		ERRS("unable to write to file %s", ofname);
-		goto err_close_out;
-	}
+		if (st.st_size > board->datalen) {
+			ERR("file '%s' is too big - max size: 0x%08X (exceeds %lu bytes)\n",
+			    ifname, board->datalen, st.st_size - board->datalen);
+			goto err_close_in;
+		}
 
-	res = EXIT_SUCCESS;
+		buflen = board->datalen + 0x10000;
+		buf = malloc(buflen);
+		if (!buf) {
+			ERR("no memory for buffer\n");
+			goto err_close_in;
+		}
 
-	fflush(outfile);
+		memset(buf, 0xff, buflen);
+		hdr = (struct planex_hdr *)buf;
+
+		hdr->datalen = HOST_TO_BE32(board->datalen);
+		hdr->unk1[0] = board->unk[0];
+		hdr->unk1[1] = board->unk[1];
+
+		snprintf(hdr->version, sizeof(hdr->version), "%s", variants[i].version);
+
+		memcpy(buf + sizeof(*hdr), payload, st.st_size);
+
+		/*
+		 * The digest covers the seed and then the padded payload,
+		 * so it can only be shared between variants with the same
+		 * seed and datalen - but those are exactly the ones that
+		 * differ in header fields only.
+		 */
+		for (j = 0; j < n_cached; j++) {
+			if (cache[j].seed == board->seed &&
+			    cache[j].datalen == board->datalen) {
+				digest = &cache[j];
+				break;
+			}
+		}
+		if (!digest) {
+			digest = &cache[n_cached++];
+			digest->seed = board->seed;
+			digest->datalen = board->datalen;
+
+			seed = HOST_TO_BE32(board->seed);
+			sha1_starts(&ctx);
+			sha1_update(&ctx, (uchar *) &seed, sizeof(seed));
+			sha1_update(&ctx, buf + sizeof(*hdr), board->datalen);
+			sha1_finish(&ctx, digest->sha1sum);
+		}
+		memcpy(hdr->sha1sum, digest->sha1sum, sizeof(hdr->sha1sum));
 
- err_close_out:
-	fclose(outfile);
-	if (res != EXIT_SUCCESS) {
-		unlink(ofname);
+		outfile = fopen(variants[i].ofname, "w");
+		if (outfile == NULL) {
+			ERRS("could not open \"%s\" for writing", variants[i].ofname);
+			free(buf);
+			goto err_close_in;
+		}
+
+		errno = 0;
+		fwrite(buf, buflen, 1, outfile);
+		if (errno) {
+			ERRS("unable to write to file %s", variants[i].ofname);
+		} else {
+			ok = 1;
+		}
+
+		fflush(outfile);
+		fclose(outfile);
+		free(buf);
+
+		if (!ok) {
+			unlink(variants[i].ofname);
+			goto err_close_in;
+		}
 	}
 
+	res = EXIT_SUCCESS;
+
  err_close_in:
 	fclose(infile);
 
- err_free:
-	free(buf);
+ err_free_payload:
+	free(payload);
 
  err:
 	return res;
 }
 
+int main(int argc, char *argv[])
+{
+	return fwu_jobs_run(argc, argv, mkplanexfw_run);
+}
+
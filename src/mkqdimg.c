@@ -17,6 +17,7 @@
 #include <endian.h>
 
 #include "sha1.h"
+#include "fwu_io.h"
 
 #define HDR_PADDING_BYTE	0x00
 #define PADDING_BYTE		0xff
@@ -37,6 +38,8 @@
 #define HDR_OFF_FIRMWARE_LEN	76
 #define HDR_MAGIC		538248722
 
+#define MAX_OUTPUTS		8
+
 /*
  * Globals
  */
@@ -70,7 +73,8 @@ static void usage(int status)
 "  -V <version>    version string\n"
 "  -u <file>       read uboot image from the file <file>\n"
 "  -f <file>       read firmware image from the file <file>\n"
-"  -o <file>       write output to the file <file>\n"
+"  -o <file>       write output to the file <file>; may be given\n"
+"                  several times, e.g. for the flash and TFTP copies\n"
 "  -h              show this screen\n"
 	);
 
@@ -88,7 +92,9 @@ int main(int argc, char *argv[])
 	int ret = EXIT_FAILURE;
 	long ulen, flen, buflen = HDR_LENGTH, fspace;
 	unsigned char *buf;
-	char *board_id = NULL, *version = NULL, *ufname = NULL, *ffname = NULL, *ofname = NULL;
+	char *board_id = NULL, *version = NULL, *ufname = NULL, *ffname = NULL;
+	char *ofnames[MAX_OUTPUTS];
+	int n_ofnames = 0, i;
 	FILE *out, *uboot = NULL, *firmware = NULL;
 
 	progname = basename(argv[0]);
@@ -114,7 +120,11 @@ int main(int argc, char *argv[])
 			ffname = optarg;
 			break;
 		case 'o':
-			ofname = optarg;
+			if (n_ofnames == MAX_OUTPUTS) {
+				ERR("too many output files - max: %d", MAX_OUTPUTS);
+				goto err;
+			}
+			ofnames[n_ofnames++] = optarg;
 			break;
 		case 'h':
 			usage(EXIT_SUCCESS);
@@ -142,7 +152,7 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
-	if (ofname == NULL) {
+	if (n_ofnames == 0) {
 		ERR("no output file specified");
 		goto err;
 	}
@@ -241,16 +251,34 @@ int main(int argc, char *argv[])
 	sha1_csum(buf + HDR_LENGTH, buflen - HDR_LENGTH, buf + HDR_OFF_CHECKSUM);
 
 	/* Save finished image */
-	out = fopen(ofname, "w");
+	out = fopen(ofnames[0], "w");
 	if (out == NULL) {
-		ERRS("could not open \"%s\" for writing: %s", ofname);
+		ERRS("could not open \"%s\" for writing: %s", ofnames[0]);
 		goto err_free;
 	}
 	fwrite(buf, buflen, 1, out);
+	fclose(out);
 
-	ret = EXIT_SUCCESS;
+	/* Further outputs are identical; clone the first one kernel-side
+	 * instead of pushing the buffer out again */
+	for (i = 1; i < n_ofnames; i++) {
+		FILE *src = fopen(ofnames[0], "r");
+
+		out = fopen(ofnames[i], "w");
+		if (src == NULL || out == NULL ||
+		    fwu_copy_data(src, out, 0) != buflen) {
+			ERRS("could not write \"%s\": %s", ofnames[i]);
+			if (out != NULL)
+				fclose(out);
+			if (src != NULL)
+				fclose(src);
+			goto err_free;
+		}
+		fclose(out);
+		fclose(src);
+	}
 
-	fclose(out);
+	ret = EXIT_SUCCESS;
 
 err_free:
 	free(buf);
@@ -44,6 +44,9 @@
 
 #include <arpa/inet.h>
 
+#include "fwu_csum.h"
+#include "fwu_io.h"
+
 #define VERSION_STRING_LEN 31
 #define ROOTFS_HEADER_LEN 40
 
@@ -113,20 +116,6 @@ void unmap_file(struct file_info *finfo)
     }
 }
 
-void write_file(struct file_info *finfo)
-{
-    FILE *fout = fopen(finfo->name, "w");
-
-    fwrite(finfo->data, finfo->size, 1, fout);
-
-    if (ferror(fout)) {
-        ERR("Wanted to write, but something went wrong.");
-        exit(EXIT_FAILURE);
-    }
-
-    fclose(fout);
-}
-
 void usage(int status)
 {
     FILE *stream = (status != EXIT_SUCCESS) ? stderr : stdout;
@@ -148,16 +137,11 @@ void usage(int status)
     exit(status);
 }
 
-static int sysv_chksm(const unsigned char *data, int size)
+/* Fold a 32-bit byte sum down to the 16-bit System V checksum */
+static int sysv_fold(unsigned int s)
 {
     int r;
     int checksum;
-    unsigned int s = 0; /* The sum of all the input bytes, modulo (UINT_MAX + 1).  */
-
-
-    for (int i = 0; i < size; i++) {
-        s += data[i];
-    }
 
     r = (s & 0xffff) + ((s & 0xffffffff) >> 16);
     checksum = (r & 0xffff) + (r >> 16);
@@ -165,15 +149,20 @@ static int sysv_chksm(const unsigned char *data, int size)
     return checksum;
 }
 
+static int sysv_chksm(const unsigned char *data, int size)
+{
+    return sysv_fold(fwu_byte_sum(data, size));
+}
+
 static int zyxel_chksm(const unsigned char *data, int size)
 {
      return htonl(sysv_chksm(data, size));
 }
 
-char *generate_rootfs_header(struct file_info filesystem, char *version)
+char *generate_rootfs_header(unsigned int chksm, size_t rootfs_out_size, char *version)
 {
     size_t version_string_length;
-    unsigned int chksm, size;
+    unsigned int size;
     char *rootfs_header;
     size_t ptr = 0;
 
@@ -186,8 +175,7 @@ char *generate_rootfs_header(struct file_info filesystem, char *version)
     /* Prepare padding for firmware-version string here */
     memset(rootfs_header, 0xff, ROOTFS_HEADER_LEN);
 
-    chksm = zyxel_chksm((const unsigned char *)filesystem.data, filesystem.size);
-    size = htonl(filesystem.size);
+    size = htonl(rootfs_out_size);
 
     /* 4 bytes:  checksum of the rootfs image */
     memcpy(rootfs_header + ptr, &chksm, 4);
@@ -305,8 +293,9 @@ int build_image()
     char *rootfs_header = NULL;
     char *kernel_header = NULL;
     char *board_header = NULL;
-
-    size_t ptr;
+    char *header_partition = NULL;
+    unsigned int rootfs_chksm;
+    FILE *fout, *fin;
 
     /* Load files */
     if (kernel.name)
@@ -324,51 +313,73 @@ int build_image()
     rootfs_out.size = rootfs_size < rootfs.size ? rootfs.size : rootfs_size;
 
     /*
-     * Allocate memory and copy input rootfs for temporary output rootfs.
-     * This is important as we have to generate the rootfs checksum over the
-     * entire rootfs partition. As we might have to pad the partition to allow
-     * for flashing via ZyXEL's Web-GUI, we prepare the rootfs partition for the
-     * output image here (and also use it for calculating the rootfs checksum).
-     *
-     * The roofs padding has to be done with 0x00.
+     * The rootfs checksum covers the entire padded rootfs partition,
+     * but the padding is 0x00 and contributes nothing to a System V
+     * sum — so it is computed straight from the input mapping and no
+     * padded copy of the rootfs is ever materialized.
      */
-    rootfs_out.data = calloc(rootfs_out.size, sizeof(char));
-    memcpy(rootfs_out.data, rootfs.data, rootfs.size);
+    rootfs_chksm = htonl(sysv_fold(fwu_byte_sum(rootfs.data, rootfs.size)));
 
     /* Prepare headers */
-    rootfs_header = generate_rootfs_header(rootfs_out, version_name);
+    rootfs_header = generate_rootfs_header(rootfs_chksm, rootfs_out.size, version_name);
     if (kernel.name)
         kernel_header = generate_kernel_header(kernel);
     board_header = generate_board_header(kernel_header, rootfs_header, board_name);
 
-    /* Prepare output file */
-    out.size = header_length + rootfs_out.size;
+    /* Assemble the header partition (0xff padded to header_length) */
+    header_partition = malloc(header_length);
+    if (!header_partition) {
+        ERR("Couldn't allocate memory for header partition!");
+        exit(EXIT_FAILURE);
+    }
+    memset(header_partition, 0xFF, header_length);
+    memcpy(header_partition, rootfs_header, ROOTFS_HEADER_LEN);
+    memcpy(header_partition + ROOTFS_HEADER_LEN, board_header, BOARD_HEADER_LEN);
     if (kernel.name)
-        out.size += kernel.size;
-    out.data = malloc(out.size);
-    memset(out.data, 0xFF, out.size);
+        memcpy(header_partition + ROOTFS_HEADER_LEN + BOARD_HEADER_LEN, kernel_header, KERNEL_HEADER_LEN);
 
-    /* Build output image */
-    memcpy(out.data, rootfs_header, ROOTFS_HEADER_LEN);
-    memcpy(out.data + ROOTFS_HEADER_LEN, board_header, BOARD_HEADER_LEN);
-    if (kernel.name)
-        memcpy(out.data + ROOTFS_HEADER_LEN + BOARD_HEADER_LEN, kernel_header, KERNEL_HEADER_LEN);
-    ptr = header_length;
-    memcpy(out.data + ptr, rootfs_out.data, rootfs_out.size);
-    ptr += rootfs_out.size;
-    if (kernel.name)
-        memcpy(out.data + ptr, kernel.data, kernel.size);
+    /*
+     * Stream each section to its offset: header partition from the
+     * buffer above, rootfs body kernel-side, the 0x00 rootfs padding
+     * as a sparse hole, then the kernel body. Peak memory is one
+     * header partition regardless of image size.
+     */
+    fout = fopen(out.name, "w");
+    if (!fout) {
+        ERR("Wanted to write, but something went wrong.");
+        exit(EXIT_FAILURE);
+    }
 
-    /* Write back output image */
-    write_file(&out);
+    fin = fopen(rootfs.name, "r");
+    if (fwrite(header_partition, header_length, 1, fout) != 1 ||
+        !fin || fwu_copy_data(fin, fout, 0) != (ssize_t)rootfs.size ||
+        fwu_append_zeros(fout, rootfs_out.size - rootfs.size)) {
+        ERR("Wanted to write, but something went wrong.");
+        exit(EXIT_FAILURE);
+    }
+    fclose(fin);
+
+    if (kernel.name) {
+        fin = fopen(kernel.name, "r");
+        if (!fin || fwu_copy_data(fin, fout, 0) != (ssize_t)kernel.size) {
+            ERR("Wanted to write, but something went wrong.");
+            exit(EXIT_FAILURE);
+        }
+        fclose(fin);
+    }
+
+    if (fflush(fout) != 0) {
+        ERR("Wanted to write, but something went wrong.");
+        exit(EXIT_FAILURE);
+    }
+    fclose(fout);
 
     /* Free allocated memory */
     if (kernel.name)
         unmap_file(&kernel);
     unmap_file(&rootfs);
-    free(out.data);
-    free(rootfs_out.data);
 
+    free(header_partition);
     free(rootfs_header);
     if (kernel.name)
         free(kernel_header);
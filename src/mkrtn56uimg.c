@@ -16,6 +16,8 @@
 #include <unistd.h>
 #include <zlib.h>
 
+#include "fwu_crc32.h"
+
 #define IH_MAGIC	0x27051956
 #define IH_NMLEN	32
 #define IH_PRODLEN	23
@@ -82,9 +84,11 @@ void
 calc_crc(image_header_t *hdr, void *data, uint32_t len)
 {
 	/*
-	 * Calculate payload checksum
+	 * Calculate payload checksum; the payload is untouched by the
+	 * header rewrite and can span most of the image, so it is the
+	 * only part worth threading.
 	 */
-	hdr->ih_dcrc = htonl(crc32(0, (Bytef *)data, len));
+	hdr->ih_dcrc = htonl(fwu_crc32_parallel(0, (Bytef *)data, len, 0));
 	hdr->ih_size = htonl(len);
 	/*
 	 * Calculate header checksum
@@ -13,6 +13,7 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include "fwu_jobs.h"
 #include "md5.h"
 
 #define HDR_LEN                 0x60
@@ -110,30 +111,6 @@ static int header_checksum(void *data, size_t len)
 	return -1;
 }
 
-static int md5_file(const char *filename, uint8_t *dst)
-{
-	FILE *fp_src;
-	MD5_CTX ctx;
-	char buf[BUF_SIZE];
-	size_t bytes_read;
-
-	MD5_Init(&ctx);
-
-	fp_src = fopen(filename, "r+b");
-	if (!fp_src) {
-		return -1;
-	}
-	while (!feof(fp_src)) {
-		bytes_read = fread(&buf, 1, BUF_SIZE, fp_src);
-		MD5_Update(&ctx, &buf, bytes_read);
-	}
-	fclose(fp_src);
-
-	MD5_Final(dst, &ctx);
-
-	return 0;
-}
-
 static int encode_image(const char *input_file_name,
 			const char *output_file_name, img_header *header,
 			struct capwap_header *cw_header, int block_size)
@@ -142,11 +119,13 @@ static int encode_image(const char *input_file_name,
 	size_t pad_len = 0;
 	size_t bytes_avail;
 	size_t bytes_read;
+	MD5_CTX md5_ctx;
 
 	FILE *fp_output;
 	FILE *fp_input;
 
 	int model_size;
+	long hdr_len;
 	long magic;
 	size_t i;
 
@@ -177,12 +156,51 @@ static int encode_image(const char *input_file_name,
 		pad_len = block_size - (header->filesize % block_size);
 	}
 
-	if (md5_file(input_file_name, (uint8_t *) &header->md5sum) < 0) {
-		fprintf(stderr, "MD5 failed on file %s\n", input_file_name);
+	/*
+	 * Leave room for the header(s); they are patched in once the
+	 * payload pass below has produced the MD5. The digest covers
+	 * the plain input bytes only, so it can ride along with the
+	 * encoding loop instead of re-reading the file up front.
+	 */
+	hdr_len = HDR_LEN;
+	if (cw_header)
+		hdr_len += sizeof(struct capwap_header) + cw_header->model_size;
+	if (fseek(fp_output, hdr_len, SEEK_SET)) {
+		fprintf(stderr, "Cannot seek on %s !!\n", output_file_name);
 		fclose(fp_input);
 		fclose(fp_output);
 		return -1;
 	}
+
+	MD5_Init(&md5_ctx);
+	magic = header->magic;
+
+	while (!feof(fp_input) || pad_len > 0) {
+
+		if (!feof(fp_input))
+			bytes_read = fread(&buf, 1, BUF_SIZE, fp_input);
+		else
+			bytes_read = 0;
+
+		MD5_Update(&md5_ctx, &buf, bytes_read);
+
+		/*
+		 * No more bytes read, start padding
+		 */
+		if (bytes_read < BUF_SIZE && pad_len > 0) {
+			bytes_avail = BUF_SIZE - bytes_read;
+			memset( &buf[bytes_read], 0, bytes_avail);
+			bytes_read += bytes_avail < pad_len ? bytes_avail : pad_len;
+			pad_len -= bytes_avail < pad_len ? bytes_avail : pad_len;
+		}
+
+		for (i = 0; i < bytes_read; i++)
+			buf[i] ^= magic >> (i % 8) & 0xff;
+		fwrite(&buf, bytes_read, 1, fp_output);
+	}
+
+	MD5_Final((uint8_t *) &header->md5sum, &md5_ctx);
+
 	header->zero = 0;
 	header->chksum = header_checksum(header, HDR_LEN);
 	if (cw_header) {
@@ -196,9 +214,9 @@ static int encode_image(const char *input_file_name,
 	header->firmware_type = htonl(header->firmware_type);
 	header->filesize = htonl(header->filesize);
 	header->chksum = htonl(header->chksum);
-	magic = header->magic;
 	header->magic = htonl(header->magic);
 
+	rewind(fp_output);
 	fwrite(header, HDR_LEN, 1, fp_output);
 
 	if (cw_header) {
@@ -217,28 +235,6 @@ static int encode_image(const char *input_file_name,
 		       fp_output);
 	}
 
-	while (!feof(fp_input) || pad_len > 0) {
-
-		if (!feof(fp_input))
-			bytes_read = fread(&buf, 1, BUF_SIZE, fp_input);
-		else
-			bytes_read = 0;
-
-		/*
-		 * No more bytes read, start padding
-		 */
-		if (bytes_read < BUF_SIZE && pad_len > 0) {
-			bytes_avail = BUF_SIZE - bytes_read;
-			memset( &buf[bytes_read], 0, bytes_avail);
-			bytes_read += bytes_avail < pad_len ? bytes_avail : pad_len;
-			pad_len -= bytes_avail < pad_len ? bytes_avail : pad_len;
-		}
-
-		for (i = 0; i < bytes_read; i++)
-			buf[i] ^= magic >> (i % 8) & 0xff;
-		fwrite(&buf, bytes_read, 1, fp_output);
-	}
-
 	fclose(fp_input);
 	fclose(fp_output);
 	return 1;
@@ -384,7 +380,7 @@ static void usage(const char *progname, int status)
 	exit(status);
 }
 
-int main(int argc, char *argv[])
+static int mksenaofw_run(int argc, char *argv[])
 {
 	static const char period[2] = ".";
 	struct capwap_header cw_header;
@@ -405,6 +401,7 @@ int main(int argc, char *argv[])
 
 	block_size = DEFAULT_BLOCK_SIZE;
 	progname = basename(argv[0]);
+	optind = 0;
 
 	memset(&header, 0, sizeof(img_header));
 	header.magic = DEFAULT_MAGIC;
@@ -560,9 +557,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (encode_image(input_file, output_file, &header, pcw_header,
-				pad ? block_size : 0) < 0)
+	tmp = encode_image(input_file, output_file, &header, pcw_header,
+				pad ? block_size : 0);
+	free(pcw_header);
+	if (tmp < 0)
 		return EXIT_FAILURE;
 
 	return EXIT_SUCCESS;
 }
+
+int main(int argc, char *argv[])
+{
+	return fwu_jobs_run(argc, argv, mksenaofw_run);
+}
@@ -6,7 +6,12 @@
 #include <unistd.h>
 #include <byteswap.h>
 #include <endian.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fwu_csum.h"
 
 #if !defined(__BYTE_ORDER)
 #error "Unknown byte order"
@@ -50,6 +55,7 @@ static const int header_sz = 512;
 static const int footer_sz = 71;
 
 static int is_header = 1;
+static int in_place = 0;
 
 struct file_info {
 	char* file_name; /* name of the file */
@@ -58,19 +64,12 @@ struct file_info {
 };
 
 static u_int8_t getCheckSum(char* data, int len) {
-	u_int8_t new = 0;
-	int i;
-
 	if (!data) {
 		ERR("Invalid pointer provided!\n");
 		return 0;
 	}
 
-	for (i = 0; i < len; i++) {
-		new += data[i];
-	}
-
-	return new;
+	return (u_int8_t) fwu_byte_sum(data, len);
 }
 
 /*
@@ -179,10 +178,98 @@ static void usage(char* argv[]) {
 	       "  -b <hwid>     use hardware id specified with <hwid> (ASCII)\n"
 	       "  -r <hwrev>    use hardware revision specified with <hwrev> (ASCII)\n"
 	       "  -v <version>  set image version to <version> (decimal, hex or octal notation)\n"
+	       "  -p            patch the header in place; the first 512 bytes of the\n"
+	       "                input must be zeroed headroom for it\n"
 	       "  -i <file>     input file\n"
 	       , argv[0]);
 }
 
+/* Fill the Sercomm identification fields at data */
+static void fillHeader(char* data, char* hwID, char* hwVer, u_int32_t swVer) {
+	strncpy(data + 0, magic, 7);
+	memcpy(data + 7, version, sizeof(version));
+	strncpy(data + 11, hwID, 34);
+	strncpy(data + 45, hwVer, 10);
+	memcpy(data + 55, &swVer, sizeof(swVer));
+	strncpy(data + 63, magic, 7);
+}
+
+/*
+ * -p: the build recipe reserved 512 zeroed bytes at the start of the
+ * staging file, so the header and checksum can be patched through a
+ * writable mapping without rewriting the payload behind them.
+ */
+static int patchInPlace(char* file_name, char* hwID, char* hwVer, u_int32_t swVer) {
+	struct stat st;
+	u_int8_t chkSum;
+	char* data;
+	int i, fd;
+
+	if (!(fd = open(file_name, O_RDWR)) || fd < 0) {
+		ERR("Error opening file: %s\n", file_name);
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < header_sz) {
+		ERR("File too small for in-place header: %s\n", file_name);
+		close(fd);
+		return -1;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		ERR("Error mapping file: %s\n", file_name);
+		return -1;
+	}
+
+	/* refuse to clobber a file that has no headroom */
+	for (i = 0; i < header_sz; i++) {
+		if (data[i]) {
+			ERR("No zeroed headroom in %s, not patching\n", file_name);
+			munmap(data, st.st_size);
+			return -1;
+		}
+	}
+
+	fillHeader(data, hwID, hwVer, swVer);
+
+	/* checksum byte (511) is still zero here, as the format wants */
+	chkSum = getCheckSum(data, st.st_size);
+	chkSum = (chkSum ^ 0xFF) + 1;
+	DBG("Checksum for Image: %hhX\n", chkSum);
+	data[511] = (char) chkSum;
+
+	if (munmap(data, st.st_size)) {
+		ERR("Error unmapping file: %s\n", file_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The footer lands behind the payload, so it can simply be appended */
+static int appendFooter(char* file_name, char* hwID, char* hwVer, u_int32_t swVer) {
+	char footer[71] = { 0 };
+	FILE* fp;
+
+	fillHeader(footer, hwID, hwVer, swVer);
+
+	if (!(fp = fopen(file_name, "a"))) {
+		ERR("Error opening file: %s\n", file_name);
+		return -1;
+	}
+
+	if (fwrite(footer, 1, footer_sz, fp) != footer_sz) {
+		ERR("Wanted to write, but something went wrong!\n");
+		fclose(fp);
+		return -1;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
 int main(int argc, char* argv[]) {
 	struct file_info image = { 0 };
 
@@ -195,7 +282,7 @@ int main(int argc, char* argv[]) {
 	while ( 1 ) {
 		int c;
 
-		c = getopt(argc, argv, "b:i:r:v:f");
+		c = getopt(argc, argv, "b:i:r:v:fp");
 		if (c == -1)
 			break;
 
@@ -209,6 +296,9 @@ int main(int argc, char* argv[]) {
 		case 'i':
 			image.file_name = optarg;
 			break;
+		case 'p':
+			in_place = 1;
+			break;
 		case 'r':
 			hwVer = optarg;
 			break;
@@ -227,6 +317,23 @@ int main(int argc, char* argv[]) {
 			return EXIT_FAILURE;
 	}
 
+	if (in_place) {
+		if (!is_header) {
+			ERR("-p only applies to header mode\n");
+			return EXIT_FAILURE;
+		}
+		if (patchInPlace(image.file_name, hwID, hwVer, swVer))
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
+	/* footer mode never rewrites the payload; just append */
+	if (!is_header) {
+		if (appendFooter(image.file_name, hwID, hwVer, swVer))
+			return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
 	/*
 	 * copy input to buffer, add extra space for header/footer and return
 	 * header position
@@ -237,12 +344,7 @@ int main(int argc, char* argv[]) {
 
 	DBG("Filling header: %s %s %2X %s\n", hwID, hwVer, swVer, magic);
 
-	strncpy(image.file_data + hdr_offset + 0, magic, 7);
-	memcpy(image.file_data + hdr_offset + 7, version, sizeof(version));
-	strncpy(image.file_data + hdr_offset + 11, hwID, 34);
-	strncpy(image.file_data + hdr_offset + 45, hwVer, 10);
-	memcpy(image.file_data + hdr_offset + 55, &swVer, sizeof(swVer));
-	strncpy(image.file_data + hdr_offset + 63, magic, 7);
+	fillHeader(image.file_data + hdr_offset, hwID, hwVer, swVer);
 
 	/* calculate checksum and invert checksum */
 	if (is_header) {
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <libgen.h>
+#include <pthread.h>
 #include "mktitanimg.h"
 
 
@@ -13,6 +14,25 @@ struct checksumrecord
  Excepting the
                                            checksum block */
 };
+
+/* Per-section checksum job. The sections are independent of each other
+   until the descriptor table is assembled, so each one gets its cksum
+   CRC computed on its own thread while the main thread lays the
+   payloads out in the image. */
+struct section_sum
+{
+	char		*data;		/* whole input file */
+	unsigned int	size;
+	unsigned long	chksum;
+};
+
+static void *section_sum_worker(void *arg)
+{
+	struct section_sum *ss = arg;
+
+	ss->chksum = cs_calc_buf_sum(ss->data, ss->size);
+	return NULL;
+}
 /***************************************************************************
  * void print_help(void)
  ***************************************************************************/
@@ -130,7 +150,11 @@ int main(int argc, char* argv[], char* env[])
 	struct nsp_img_hdr_info *img_hdr_info;
 	struct nsp_img_hdr_section_info *img_hdr_section_info ;
 	struct nsp_img_hdr_sections	*img_hdr_sections, *section;	/* Section pointers */
-	
+
+	struct section_sum	sums[2];	/* preloaded section payloads */
+	pthread_t		sum_threads[2];
+	int			sum_started[2];
+
 
 	/* Configure the command line. */
 	cmdline_configure(&cmd_line_cfg);
@@ -230,43 +254,59 @@ int main(int argc, char* argv[], char* env[])
 		
 
 	}
-	/* Write out all specified images (with -i option) */
+	/* Load the specified images (with -i option) and kick off their
+	   section checksums in the background */
 	for(i=0; i < num_sects; i++) {
 		char*	file_name;		/* input file name */
 		FILE*	filep;			/* input file pointer */
-		int	padding;		/* number of padding bytes to prepend */
-		int	align;			/* align factor from command line */
-		int	result;			/* intermediate result */
-		char * buf;
 
-		/* Open the specified image for reading */
 		file_name	= argv[cmdline_getarg(cmdline_getarg_list('i'),i)];
 		filep		= fopen(file_name, "rb");
 		if(filep==NULL) {
 			printf("ERROR: can't open file %s for reading.\n", file_name);
 			return -1;
 		}
-		section->flags = ~0x00;
 		/* Determine file size */
 		fseek(filep,0,SEEK_END);
-		section->raw_size=ftell(filep);
-		fseek(filep,0,SEEK_SET);
-		cs_calc_sum(filep,(unsigned long *)&section->chksum,0);
+		sums[i].size=ftell(filep);
 		fseek(filep,0,SEEK_SET);
+		sums[i].data=malloc(sums[i].size);
+		if(fread(sums[i].data, 1, sums[i].size, filep)!=sums[i].size) {
+			printf("ERROR: can't read file %s.\n", file_name);
+			fclose(filep);
+			return -1;
+		}
+		fclose(filep);
+
+		sum_started[i] = (pthread_create(&sum_threads[i], NULL,
+					section_sum_worker, &sums[i]) == 0);
+	}
+
+	/* Write out all sections */
+	for(i=0; i < num_sects; i++) {
+		int	padding;		/* number of padding bytes to prepend */
+		int	align;			/* align factor from command line */
+		char * buf;
+
+		section->flags = ~0x00;
+		section->raw_size=sums[i].size;
+
+		/* Collect the section checksum computed in the background */
+		if(sum_started[i])
+			pthread_join(sum_threads[i], NULL);
+		else
+			section_sum_worker(&sums[i]);
+		section->chksum=sums[i].chksum;
 
-		/* Retrieve the alignment constant */
 		/* Set image offset from the beginning of the out file */
 		section->offset=total;// + padding;
 
 		//total += padding;
 
 		/* Copy the image file into nsp_image */
-		count = section->raw_size;
-		buf=malloc(count);
-		result=fread(buf, 1, count, filep);
-		fwrite(buf, 1, result, nsp_image);
-		free(buf);
-		
+		fwrite(sums[i].data, 1, sums[i].size, nsp_image);
+		free(sums[i].data);
+
 		/* HACK: This is a hack to get the names and types to the files.
 			TODO: Fix this to be a real method */
 		if(i==0){
@@ -317,8 +357,6 @@ int main(int argc, char* argv[], char* env[])
 		//total += section->raw_size;
 		total = section->total_size + section->offset;
 		printf("total=0x%x\n",total);
-		/* Close the input file */
-		fclose(filep);
 
 		/* Move the section pointer to the next slot */
 		section++;
@@ -40,6 +40,9 @@ extern int add_jffs2_eof;
 
 static unsigned char jffs2_eof_mark[4] = {0xde, 0xad, 0xc0, 0xde};
 
+char *ofname_alt;
+void (*fill_header_alt)(char *buf, int len);
+
 void fill_header(char *buf, int len);
 
 struct flash_layout *find_layout(struct flash_layout *layouts, const char *id)
@@ -252,6 +255,17 @@ int build_fw(size_t header_size)
 	if (ret)
 		goto out_free_buf;
 
+	if (ofname_alt && fill_header_alt) {
+		/* Second header variant over the same payload: reuse the
+		 * assembled buffer so the inputs are read and padded only
+		 * once. The header is the first thing the image MD5 covers,
+		 * so the digest itself is recomputed per variant. */
+		fill_header_alt(buf, writelen);
+		ret = write_fw(ofname_alt, buf, writelen);
+		if (ret)
+			goto out_free_buf;
+	}
+
 	ret = EXIT_SUCCESS;
 
 out_free_buf:
@@ -50,6 +50,11 @@ struct flash_layout {
 	uint32_t	rootfs_ofs;
 };
 
+/* Optional second header variant written from the same assembled
+ * payload buffer; tools set these before calling build_fw(). */
+extern char *ofname_alt;
+extern void (*fill_header_alt)(char *buf, int len);
+
 struct flash_layout *find_layout(struct flash_layout *layouts, const char *id);
 void get_md5(const char *data, int size, uint8_t *md5);
 int get_file_stat(struct file_info *fdata);
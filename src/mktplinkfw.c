@@ -214,6 +214,7 @@ static void usage(int status)
 "  -V <version>    set image version to <version>\n"
 "  -v <version>    set firmware version to <version>\n"
 "  -m <version>    set header version to <version>\n"
+"  -u <file>       also write an image with the other header version to <file>\n"
 "  -i <file>       inspect given firmware file <file>\n"
 "  -x              extract kernel and rootfs while inspecting (requires -i)\n"
 "  -X <size>       reserve <size> bytes in the firmware image (hexval prefixed with 0x)\n"
@@ -418,6 +419,15 @@ void fill_header(char *buf, int len)
 		get_md5(buf, len, hdr->md5sum1);
 }
 
+/* Second pass for -u: same payload, the other header version. The MD5
+ * covers the header bytes first, so it is recomputed per variant. */
+static void fill_header_other_version(char *buf, int len)
+{
+	hdr_ver = (hdr_ver == HEADER_VERSION_V1) ?
+			HEADER_VERSION_V2 : HEADER_VERSION_V1;
+	fill_header(buf, len);
+}
+
 static int inspect_fw(void)
 {
 	char *buf;
@@ -548,7 +558,7 @@ int main(int argc, char *argv[])
 	while ( 1 ) {
 		int c;
 
-		c = getopt(argc, argv, "a:H:E:F:L:m:V:N:W:C:ci:k:r:R:o:OxX:ehsjv:");
+		c = getopt(argc, argv, "a:H:E:F:L:m:V:N:W:C:ci:k:r:R:o:Ou:xX:ehsjv:");
 		if (c == -1)
 			break;
 
@@ -604,6 +614,10 @@ int main(int argc, char *argv[])
 		case 'O':
 			rootfs_ofs_calc = 1;
 			break;
+		case 'u':
+			ofname_alt = optarg;
+			fill_header_alt = fill_header_other_version;
+			break;
 		case 's':
 			strip_padding = 1;
 			break;
@@ -216,6 +216,7 @@ static void usage(int status)
 "  -j              add jffs2 end-of-filesystem markers\n"
 "  -N <vendor>     set image vendor to <vendor>\n"
 "  -T <version>    set header version to <version>\n"
+"  -u <file>       also write an image with the other header version to <file>\n"
 "  -V <version>    set image version to <version>\n"
 "  -v <version>    set firmware version to <version>\n"
 "  -y <version>    set secondary version to <version>\n"
@@ -444,6 +445,14 @@ void fill_header(char *buf, int len) {
 	fill_header_bootloader(buf, len, 0);
 }
 
+/* Second pass for -u: same payload, the other header version. The MD5
+ * covers the header bytes first, so it is recomputed per variant. */
+static void fill_header_other_version(char *buf, int len)
+{
+	hdr_ver = (hdr_ver == 2) ? 3 : 2;
+	fill_header(buf, len);
+}
+
 static int inspect_fw(void)
 {
 	char *buf;
@@ -683,7 +692,7 @@ int main(int argc, char *argv[])
 	while ( 1 ) {
 		int c;
 
-		c = getopt(argc, argv, "a:b:H:E:F:L:V:N:W:w:ci:k:r:R:o:xhsjv:y:T:e");
+		c = getopt(argc, argv, "a:b:H:E:F:L:V:N:W:w:ci:k:r:R:o:u:xhsjv:y:T:e");
 		if (c == -1)
 			break;
 
@@ -754,6 +763,10 @@ int main(int argc, char *argv[])
 		case 'T':
 			hdr_ver = atoi(optarg);
 			break;
+		case 'u':
+			ofname_alt = optarg;
+			fill_header_alt = fill_header_other_version;
+			break;
 		case 'e':
 			custom_board.flags = FLAG_LE_KERNEL_LA_EP;
 			break;
@@ -32,6 +32,7 @@
 } while (0)
 
 #define WRGG03_MAGIC	0x20080321
+#define COPY_BUF_SIZE	(1024 * 1024)
 
 struct wrgg03_header {
 	char		signature[32];
@@ -100,25 +101,13 @@ static void put_u32(void *data, uint32_t val, int swap)
 	}
 }
 
-static void get_digest(struct wrgg03_header *header, char *data, int size)
-{
-	MD5_CTX ctx;
-
-	MD5_Init(&ctx);
-
-	MD5_Update(&ctx, (char *)&header->offset, sizeof(header->offset));
-	MD5_Update(&ctx, (char *)&header->devname, sizeof(header->devname));
-	MD5_Update(&ctx, data, size);
-
-	MD5_Final((unsigned char *)header->digest, &ctx);
-}
-
 int main(int argc, char *argv[])
 {
-	struct wrgg03_header *header;
+	struct wrgg03_header header;
 	char *buf;
 	struct stat st;
-	int buflen;
+	MD5_CTX ctx;
+	size_t n;
 	int err;
 	int res = EXIT_FAILURE;
 
@@ -212,8 +201,7 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
-	buflen = st.st_size + sizeof(struct wrgg03_header);
-	buf = malloc(buflen);
+	buf = malloc(COPY_BUF_SIZE);
 	if (!buf) {
 		ERR("no memory for buffer\n");
 		goto err;
@@ -225,29 +213,19 @@ int main(int argc, char *argv[])
 		goto err_free;
 	}
 
-	errno = 0;
-	fread(buf + sizeof(struct wrgg03_header), st.st_size, 1, infile);
-	if (errno != 0) {
-		ERRS("unable to read from file %s", ifname);
-		goto close_in;
-	}
-
-	header = (struct wrgg03_header *) buf;
-	memset(header, '\0', sizeof(struct wrgg03_header));
-
-	strncpy(header->signature, signature, sizeof(header->signature));
-	put_u32(&header->magic1, WRGG03_MAGIC, 0);
-	put_u32(&header->magic2, WRGG03_MAGIC, 0);
-	strncpy(header->version, version, sizeof(header->version));
-	strncpy(header->model, model, sizeof(header->model));
-	put_u32(&header->flag, flag, 0);
-	put_u32(&header->reserve, reserve, 0);
-	strncpy(header->buildno, buildno, sizeof(header->buildno));
-	put_u32(&header->size, st.st_size, big_endian);
-	put_u32(&header->offset, offset, big_endian);
-	strncpy(header->devname, devname, sizeof(header->devname));
+	memset(&header, '\0', sizeof(header));
 
-	get_digest(header, buf + sizeof(struct wrgg03_header), st.st_size);
+	strncpy(header.signature, signature, sizeof(header.signature));
+	put_u32(&header.magic1, WRGG03_MAGIC, 0);
+	put_u32(&header.magic2, WRGG03_MAGIC, 0);
+	strncpy(header.version, version, sizeof(header.version));
+	strncpy(header.model, model, sizeof(header.model));
+	put_u32(&header.flag, flag, 0);
+	put_u32(&header.reserve, reserve, 0);
+	strncpy(header.buildno, buildno, sizeof(header.buildno));
+	put_u32(&header.size, st.st_size, big_endian);
+	put_u32(&header.offset, offset, big_endian);
+	strncpy(header.devname, devname, sizeof(header.devname));
 
 	outfile = fopen(ofname, "w");
 	if (outfile == NULL) {
@@ -255,14 +233,41 @@ int main(int argc, char *argv[])
 		goto close_in;
 	}
 
+	/* write the header with a zeroed digest now, stream the payload
+	 * through the digest while copying it, and patch the final header
+	 * in afterwards -- the image is never held in memory as a whole */
 	errno = 0;
-	fwrite(buf, buflen, 1, outfile);
+	fwrite(&header, sizeof(header), 1, outfile);
 	if (errno) {
 		ERRS("unable to write to file %s", ofname);
 		goto close_out;
 	}
 
-	fflush(outfile);
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, (char *)&header.offset, sizeof(header.offset));
+	MD5_Update(&ctx, (char *)&header.devname, sizeof(header.devname));
+
+	while ((n = fread(buf, 1, COPY_BUF_SIZE, infile)) > 0) {
+		MD5_Update(&ctx, buf, n);
+		errno = 0;
+		fwrite(buf, n, 1, outfile);
+		if (errno) {
+			ERRS("unable to write to file %s", ofname);
+			goto close_out;
+		}
+	}
+	if (ferror(infile)) {
+		ERRS("unable to read from file %s", ifname);
+		goto close_out;
+	}
+
+	MD5_Final((unsigned char *)header.digest, &ctx);
+
+	if (fflush(outfile) != 0 ||
+	    pwrite(fileno(outfile), &header, sizeof(header), 0) != sizeof(header)) {
+		ERRS("unable to write to file %s", ofname);
+		goto close_out;
+	}
 
 	res = EXIT_SUCCESS;
 
@@ -15,6 +15,7 @@
 #include <sys/stat.h>
 
 #include "md5.h"
+#include "fwu_io.h"
 
 #define ERR(fmt, ...) do { \
 	fflush(0); \
@@ -30,6 +31,7 @@
 } while (0)
 
 #define WRG_MAGIC	0x20040220
+#define MAX_VARIANTS	8
 
 struct wrg_header {
 	char		signature[32];
@@ -43,8 +45,10 @@ struct wrg_header {
 
 static char *progname;
 static char *ifname;
-static char *ofname;
-static char *signature;
+static char *signatures[MAX_VARIANTS];
+static char *ofnames[MAX_VARIANTS];
+static int n_signatures;
+static int n_ofnames;
 static char *dev_name;
 static uint32_t offset;
 static int big_endian;
@@ -63,6 +67,8 @@ void usage(int status)
 "  -o <file>       write output to the file <file>\n"
 "  -O <offset>     set offset to <offset>\n"
 "  -s <sig>        set image signature to <sig>\n"
+"                  -s/-o may be repeated (in pairs) to emit several\n"
+"                  signature variants of the same payload in one run\n"
 "  -h              show this screen\n"
 	);
 
@@ -86,6 +92,10 @@ static void put_u32(void *data, uint32_t val)
 	}
 }
 
+/*
+ * The digest covers offset, devname and payload -- not the signature --
+ * so every signature variant of one payload shares the same digest.
+ */
 static void get_digest(struct wrg_header *header, char *data, int size)
 {
 	MD5_CTX ctx;
@@ -101,14 +111,15 @@ static void get_digest(struct wrg_header *header, char *data, int size)
 
 int main(int argc, char *argv[])
 {
-	struct wrg_header *header;
-	char *buf;
+	struct wrg_header header;
+	struct fwu_input in = { 0 };
 	struct stat st;
-	int buflen;
+	const char *ofname = NULL;
 	int err;
+	int i;
 	int res = EXIT_FAILURE;
 
-	FILE *outfile, *infile;
+	FILE *outfile = NULL, *infile = NULL;
 
 	progname = basename(argv[0]);
 
@@ -130,10 +141,18 @@ int main(int argc, char *argv[])
 			ifname = optarg;
 			break;
 		case 'o':
-			ofname = optarg;
+			if (n_ofnames >= MAX_VARIANTS) {
+				ERR("too many output files");
+				goto err;
+			}
+			ofnames[n_ofnames++] = optarg;
 			break;
 		case 's':
-			signature = optarg;
+			if (n_signatures >= MAX_VARIANTS) {
+				ERR("too many signatures");
+				goto err;
+			}
+			signatures[n_signatures++] = optarg;
 			break;
 		case 'O':
 			offset = strtoul(optarg, NULL, 0);
@@ -148,7 +167,7 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (signature == NULL) {
+	if (n_signatures == 0) {
 		ERR("no signature specified");
 		goto err;
 	}
@@ -158,11 +177,16 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
-	if (ofname == NULL) {
+	if (n_ofnames == 0) {
 		ERR("no output file specified");
 		goto err;
 	}
 
+	if (n_signatures != n_ofnames) {
+		ERR("each -s needs a matching -o");
+		goto err;
+	}
+
 	if (dev_name == NULL) {
 		ERR("no device name specified");
 		goto err;
@@ -174,63 +198,68 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
-	buflen = st.st_size + sizeof(struct wrg_header);
-	buf = malloc(buflen);
-	if (!buf) {
-		ERR("no memory for buffer\n");
+	if (fwu_input_open(&in, ifname)) {
+		ERRS("could not open \"%s\" for reading", ifname);
 		goto err;
 	}
 
-	infile = fopen(ifname, "r");
-	if (infile == NULL) {
-		ERRS("could not open \"%s\" for reading", ifname);
-		goto err_free;
-	}
+	memset(&header, '\0', sizeof(header));
 
-	errno = 0;
-	fread(buf + sizeof(struct wrg_header), st.st_size, 1, infile);
-	if (errno != 0) {
-		ERRS("unable to read from file %s", ifname);
-		goto close_in;
-	}
+	strncpy(header.devname, dev_name, sizeof(header.signature));
+	put_u32(&header.magic1, WRG_MAGIC);
+	put_u32(&header.magic2, WRG_MAGIC);
+	put_u32(&header.size, st.st_size);
+	put_u32(&header.offset, offset);
 
-	header = (struct wrg_header *) buf;
-	memset(header, '\0', sizeof(struct wrg_header));
+	/* one digest pass serves every variant */
+	get_digest(&header, in.data, st.st_size);
 
-	strncpy(header->signature, signature, sizeof(header->signature));
-	strncpy(header->devname, dev_name, sizeof(header->signature));
-	put_u32(&header->magic1, WRG_MAGIC);
-	put_u32(&header->magic2, WRG_MAGIC);
-	put_u32(&header->size, st.st_size);
-	put_u32(&header->offset, offset);
+	for (i = 0; i < n_signatures; i++) {
+		ofname = ofnames[i];
 
-	get_digest(header, buf + sizeof(struct wrg_header), st.st_size);
+		memset(header.signature, '\0', sizeof(header.signature));
+		strncpy(header.signature, signatures[i], sizeof(header.signature));
 
-	outfile = fopen(ofname, "w");
-	if (outfile == NULL) {
-		ERRS("could not open \"%s\" for writing", ofname);
-		goto close_in;
-	}
+		outfile = fopen(ofname, "w");
+		if (outfile == NULL) {
+			ERRS("could not open \"%s\" for writing", ofname);
+			goto close_in;
+		}
 
-	errno = 0;
-	fwrite(buf, buflen, 1, outfile);
-	if (errno) {
-		ERRS("unable to write to file %s", ofname);
-		goto close_out;
-	}
+		errno = 0;
+		fwrite(&header, sizeof(header), 1, outfile);
+		if (errno) {
+			ERRS("unable to write to file %s", ofname);
+			goto close_out;
+		}
+
+		/* share the payload bytes via copy_file_range instead of
+		 * pushing the mapping back out through userspace */
+		infile = fopen(ifname, "r");
+		if (infile == NULL ||
+		    fwu_copy_data(infile, outfile, 0) != (ssize_t)st.st_size) {
+			ERRS("unable to write to file %s", ofname);
+			goto close_out;
+		}
+		fclose(infile);
+		infile = NULL;
 
-	fflush(outfile);
+		fflush(outfile);
+		fclose(outfile);
+		outfile = NULL;
+	}
 
 	res = EXIT_SUCCESS;
 
 close_out:
-	fclose(outfile);
-	if (res != EXIT_SUCCESS)
+	if (outfile)
+		fclose(outfile);
+	if (res != EXIT_SUCCESS && ofname)
 		unlink(ofname);
 close_in:
-	fclose(infile);
-err_free:
-	free(buf);
+	if (infile)
+		fclose(infile);
+	fwu_input_close(&in);
 err:
 	return res;
 }
@@ -16,6 +16,7 @@
 #include <sys/stat.h>
 
 #include "cyg_crc.h"
+#include "fwu_io.h"
 
 #if (__BYTE_ORDER == __BIG_ENDIAN)
 #  define HOST_TO_BE32(x)	(x)
@@ -157,7 +158,8 @@ static int get_file_stat(struct file_info *fdata)
 	return 0;
 }
 
-static int read_to_buf(struct file_info *fdata, char *buf)
+/* Copy fdata's file into the output, kernel-side where possible */
+static int copy_to_fw(struct file_info *fdata, FILE *out)
 {
 	FILE *f;
 	int ret = EXIT_FAILURE;
@@ -168,9 +170,7 @@ static int read_to_buf(struct file_info *fdata, char *buf)
 		goto out;
 	}
 
-	errno = 0;
-	fread(buf, fdata->file_size, 1, f);
-	if (errno != 0) {
+	if (fwu_copy_data(f, out, 0) != (ssize_t)fdata->file_size) {
 		ERRS("unable to read from file \"%s\"", fdata->file_name);
 		goto out_close;
 	}
@@ -234,120 +234,104 @@ static int check_options(void)
 	return 0;
 }
 
-static int write_fw(char *data, int len)
-{
-	FILE *f;
-	int ret = EXIT_FAILURE;
-
-	f = fopen(ofname, "w");
-	if (f == NULL) {
-		ERRS("could not open \"%s\" for writing", ofname);
-		goto out;
-	}
-
-	errno = 0;
-	fwrite(data, len, 1, f);
-	if (errno) {
-		ERRS("unable to write output file");
-		goto out_flush;
-	}
-
-	DBG("firmware file \"%s\" completed", ofname);
-
-	ret = EXIT_SUCCESS;
-
- out_flush:
-	fflush(f);
-	fclose(f);
-	if (ret != EXIT_SUCCESS) {
-		unlink(ofname);
-	}
- out:
-	return ret;
-}
-
 static int build_fw(void)
 {
 	int buflen;
-	char *buf;
-	char *p;
 	int ret = EXIT_FAILURE;
-	struct fw_header *hdr;
-	struct fw_tail *tail;
+	struct fwu_input kernel = { 0 }, rootfs = { 0 };
+	struct fw_header fw_hdr, kernel_hdr, rootfs_hdr;
+	struct fw_tail kernel_tail, rootfs_tail, fw_tail;
+	uint32_t crc;
+	FILE *f;
 
 	buflen = 3 * sizeof(struct fw_header) +
 		 kernel_info.file_size + rootfs_info.file_size +
 		 3 * sizeof(struct fw_tail);
 
-	buf = malloc(buflen);
-	if (!buf) {
-		ERR("no memory for buffer\n");
+	if (fwu_input_open(&kernel, kernel_info.file_name)) {
+		ERRS("could not open \"%s\" for reading", kernel_info.file_name);
 		goto out;
 	}
 
-	p = buf;
-	memset(p, 0, buflen);
-
-	/* fill firmware header */
-	hdr = (struct fw_header *) p;
-	hdr->magic = HOST_TO_LE32(MAGIC_FIRMWARE);
-	hdr->length = HOST_TO_LE32(buflen - sizeof(struct fw_header));
-	p += sizeof(struct fw_header);
-
-	/* fill kernel block header */
-	hdr = (struct fw_header *) p;
-	hdr->magic = HOST_TO_LE32(MAGIC_KERNEL);
-	hdr->length = HOST_TO_LE32(kernel_info.file_size +
-				   sizeof(struct fw_tail));
-	p += sizeof(struct fw_header);
-
-	/* read kernel data */
-	ret = read_to_buf(&kernel_info, p);
-	if (ret)
-		goto out_free_buf;
-
-	/* fill firmware tail */
-	tail = (struct fw_tail *) (p + kernel_info.file_size);
-	tail->hw_id = HOST_TO_BE32(board->hw_id);
-	tail->crc = HOST_TO_BE32(cyg_crc32(p, kernel_info.file_size +
-				 	   sizeof(struct fw_tail) - 4));
-
-	p += kernel_info.file_size + sizeof(struct fw_tail);
+	if (fwu_input_open(&rootfs, rootfs_info.file_name)) {
+		ERRS("could not open \"%s\" for reading", rootfs_info.file_name);
+		goto out_close_in;
+	}
 
-	/* fill rootfs block header */
-	hdr = (struct fw_header *) p;
-	hdr->magic = HOST_TO_LE32(MAGIC_ROOTFS);
-	hdr->length = HOST_TO_LE32(rootfs_info.file_size +
-				   sizeof(struct fw_tail));
-	p += sizeof(struct fw_header);
+	memset(&fw_hdr, 0, sizeof(fw_hdr));
+	memset(&kernel_hdr, 0, sizeof(kernel_hdr));
+	memset(&rootfs_hdr, 0, sizeof(rootfs_hdr));
 
-	/* read rootfs data */
-	ret = read_to_buf(&rootfs_info, p);
-	if (ret)
-		goto out_free_buf;
+	/* fill firmware header */
+	fw_hdr.magic = HOST_TO_LE32(MAGIC_FIRMWARE);
+	fw_hdr.length = HOST_TO_LE32(buflen - sizeof(struct fw_header));
+
+	/* fill kernel block header and tail; the block CRC covers the
+	 * payload and the tail's hw_id */
+	kernel_hdr.magic = HOST_TO_LE32(MAGIC_KERNEL);
+	kernel_hdr.length = HOST_TO_LE32(kernel_info.file_size +
+					 sizeof(struct fw_tail));
+	kernel_tail.hw_id = HOST_TO_BE32(board->hw_id);
+	crc = cyg_crc32_accumulate(0, kernel.data, kernel_info.file_size);
+	crc = cyg_crc32_accumulate(crc, &kernel_tail.hw_id, 4);
+	kernel_tail.crc = HOST_TO_BE32(crc);
+
+	/* fill rootfs block header and tail */
+	rootfs_hdr.magic = HOST_TO_LE32(MAGIC_ROOTFS);
+	rootfs_hdr.length = HOST_TO_LE32(rootfs_info.file_size +
+					 sizeof(struct fw_tail));
+	rootfs_tail.hw_id = HOST_TO_BE32(board->hw_id);
+	crc = cyg_crc32_accumulate(0, rootfs.data, rootfs_info.file_size);
+	crc = cyg_crc32_accumulate(crc, &rootfs_tail.hw_id, 4);
+	rootfs_tail.crc = HOST_TO_BE32(crc);
+
+	/* fill firmware tail; its CRC spans everything after the
+	 * firmware header up to and including its own hw_id, accumulated
+	 * over the pieces instead of a contiguous staging buffer */
+	fw_tail.hw_id = HOST_TO_BE32(board->hw_id);
+	crc = cyg_crc32_accumulate(0, &kernel_hdr, sizeof(kernel_hdr));
+	crc = cyg_crc32_accumulate(crc, kernel.data, kernel_info.file_size);
+	crc = cyg_crc32_accumulate(crc, &kernel_tail, sizeof(kernel_tail));
+	crc = cyg_crc32_accumulate(crc, &rootfs_hdr, sizeof(rootfs_hdr));
+	crc = cyg_crc32_accumulate(crc, rootfs.data, rootfs_info.file_size);
+	crc = cyg_crc32_accumulate(crc, &rootfs_tail, sizeof(rootfs_tail));
+	crc = cyg_crc32_accumulate(crc, &fw_tail.hw_id, 4);
+	fw_tail.crc = HOST_TO_BE32(crc);
 
-	/* fill firmware tail */
-	tail = (struct fw_tail *) (p + rootfs_info.file_size);
-	tail->hw_id = HOST_TO_BE32(board->hw_id);
-	tail->crc = HOST_TO_BE32(cyg_crc32(p, rootfs_info.file_size +
-				 	   sizeof(struct fw_tail) - 4));
+	f = fopen(ofname, "w");
+	if (f == NULL) {
+		ERRS("could not open \"%s\" for writing", ofname);
+		goto out_close_in2;
+	}
 
-	p += rootfs_info.file_size + sizeof(struct fw_tail);
+	/* write headers and tails from the stack, payloads kernel-side */
+	errno = 0;
+	if (fwrite(&fw_hdr, sizeof(fw_hdr), 1, f) != 1 ||
+	    fwrite(&kernel_hdr, sizeof(kernel_hdr), 1, f) != 1 ||
+	    copy_to_fw(&kernel_info, f) != EXIT_SUCCESS ||
+	    fwrite(&kernel_tail, sizeof(kernel_tail), 1, f) != 1 ||
+	    fwrite(&rootfs_hdr, sizeof(rootfs_hdr), 1, f) != 1 ||
+	    copy_to_fw(&rootfs_info, f) != EXIT_SUCCESS ||
+	    fwrite(&rootfs_tail, sizeof(rootfs_tail), 1, f) != 1 ||
+	    fwrite(&fw_tail, sizeof(fw_tail), 1, f) != 1) {
+		ERRS("unable to write output file");
+		fflush(f);
+		fclose(f);
+		unlink(ofname);
+		goto out_close_in2;
+	}
 
-	/* fill firmware tail */
-	tail = (struct fw_tail *) p;
-	tail->hw_id = HOST_TO_BE32(board->hw_id);
-	tail->crc = HOST_TO_BE32(cyg_crc32(buf + sizeof(struct fw_header),
-				 buflen - sizeof(struct fw_header) - 4));
+	DBG("firmware file \"%s\" completed", ofname);
 
-	ret = write_fw(buf, buflen);
-	if (ret)
-		goto out_free_buf;
+	fflush(f);
+	fclose(f);
 
 	ret = EXIT_SUCCESS;
 
- out_free_buf:
-	free(buf);
+ out_close_in2:
+	fwu_input_close(&rootfs);
+ out_close_in:
+	fwu_input_close(&kernel);
  out:
 	return ret;
 }
@@ -22,6 +22,8 @@
 #endif
 #include <inttypes.h>
 
+#include "fwu_jobs.h"
+
 #include "zynos.h"
 
 #if (__BYTE_ORDER == __LITTLE_ENDIAN)
@@ -628,22 +630,91 @@ write_out_mmap(FILE *outfile, struct fw_mmap *mmap, struct csum_state *css)
 }
 
 
+/*
+ * Input blocks are cached for the life of the process.  A release run
+ * invokes the tool once per board off the same bootbase/kernel inputs
+ * (see --jobs-from below), so each input file is read exactly once.
+ */
+struct file_cache {
+	struct file_cache *next;
+	char		*name;
+	uint8_t		*data;
+	uint32_t	size;
+};
+
+static struct file_cache *file_cache;
+
+static struct file_cache *
+cache_load_file(char *name)
+{
+	struct file_cache *fc;
+	struct stat st;
+	FILE *f;
+
+	for (fc = file_cache; fc != NULL; fc = fc->next)
+		if (strcmp(fc->name, name) == 0)
+			return fc;
+
+	if (stat(name, &st)) {
+		ERRS("stat failed on %s", name);
+		return NULL;
+	}
+
+	fc = malloc(sizeof(*fc));
+	if (fc == NULL) {
+		ERR("not enough memory");
+		return NULL;
+	}
+
+	fc->name = strdup(name);
+	fc->size = st.st_size;
+	fc->data = malloc(fc->size ? fc->size : 1);
+	if (fc->name == NULL || fc->data == NULL) {
+		ERR("not enough memory");
+		goto err_free;
+	}
+
+	errno = 0;
+	f = fopen(name, "r");
+	if (errno) {
+		ERRS("unable to open file: %s", name);
+		goto err_free;
+	}
+
+	errno = 0;
+	fread(fc->data, fc->size, 1, f);
+	if (errno != 0) {
+		ERRS("unable to read from file: %s", name);
+		fclose(f);
+		goto err_free;
+	}
+	fclose(f);
+
+	fc->next = file_cache;
+	file_cache = fc;
+	return fc;
+
+err_free:
+	free(fc->name);
+	free(fc->data);
+	free(fc);
+	return NULL;
+}
+
+
 int
 block_stat_file(struct fw_block *block)
 {
-	struct stat st;
-	int res;
+	struct file_cache *fc;
 
 	if (block->file_name == NULL)
 		return 0;
 
-	res = stat(block->file_name, &st);
-	if (res){
-		ERRS("stat failed on %s", block->file_name);
-		return res;
-	}
+	fc = cache_load_file(block->file_name);
+	if (fc == NULL)
+		return -1;
 
-	block->file_size = st.st_size;
+	block->file_size = fc->size;
 	return 0;
 }
 
@@ -651,72 +722,40 @@ block_stat_file(struct fw_block *block)
 int
 read_magic(uint16_t *magic)
 {
-	FILE *f;
-	int res;
+	struct file_cache *fc;
 
-	errno = 0;
-	f = fopen(bootext_block->file_name,"r");
-	if (errno) {
-		ERRS("unable to open file: %s", bootext_block->file_name);
+	fc = cache_load_file(bootext_block->file_name);
+	if (fc == NULL)
 		return -1;
-	}
 
-	errno = 0;
-	fread(magic, 2, 1, f);
-	if (errno != 0) {
-		ERRS("unable to read from file: %s", bootext_block->file_name);
-		res = -1;
-		goto err;
+	if (fc->size < 2) {
+		ERR("file too short: %s", bootext_block->file_name);
+		return -1;
 	}
 
-	res = 0;
-
-err:
-	fclose(f);
-	return res;
+	memcpy(magic, fc->data, 2);
+	return 0;
 }
 
 
 int
 write_out_file(FILE *outfile, char *name, size_t len, struct csum_state *css)
 {
-	char buf[FILE_BUF_LEN];
-	size_t buflen = sizeof(buf);
-	FILE *f;
-	int res;
+	struct file_cache *fc;
 
 	DBG(2, "writing out file, name=%s, len=%zu",
 		name, len);
 
-	errno = 0;
-	f = fopen(name,"r");
-	if (errno) {
-		ERRS("unable to open file: %s", name);
+	fc = cache_load_file(name);
+	if (fc == NULL)
 		return -1;
-	}
-
-	while (len > 0) {
-		if (len < buflen)
-			buflen = len;
 
-		/* read data from source file */
-		errno = 0;
-		fread(buf, buflen, 1, f);
-		if (errno != 0) {
-			ERRS("unable to read from file: %s",name);
-			res = -1;
-			break;
-		}
-
-		res = write_out_data(outfile, buf, buflen, css);
-		if (res)
-			break;
-
-		len -= buflen;
+	if (len > fc->size) {
+		ERR("file shrunk: %s", name);
+		return -1;
 	}
 
-	fclose(f);
-	return res;
+	return write_out_data(outfile, fc->data, len, css);
 }
 
 
@@ -1038,17 +1077,27 @@ process_blocks(void)
 }
 
 
-int
-main(int argc, char *argv[])
+static int
+mkzynfw_run(int argc, char *argv[])
 {
 	int optinvalid = 0;   /* flag for invalid option */
 	int c;
+	int i;
 	int res = EXIT_FAILURE;
 
 	FILE *outfile;
 
 	progname=basename(argv[0]);
 
+	/* reset per-image state; one process may build many boards */
+	board = NULL;
+	ofname = NULL;
+	for (i = 0; i < num_blocks; i++)
+		free(blocks[i].file_name);
+	memset(blocks, 0, sizeof(blocks));
+	bootext_block = NULL;
+	num_blocks = 0;
+
 	opterr = 0;  /* could not print standard getopt error messages */
 	while ( 1 ) {
 		optinvalid = 0;
@@ -1125,3 +1174,9 @@ out_flush:
 out:
 	return res;
 }
+
+int
+main(int argc, char *argv[])
+{
+	return fwu_jobs_run(argc, argv, mkzynfw_run);
+}
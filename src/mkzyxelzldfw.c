@@ -7,7 +7,7 @@
  */
 
 #define _POSIX_SOURCE
-#define _POSIX_C_SOURCE 199309L /* getopt */
+#define _POSIX_C_SOURCE 200809L /* getopt, posix_fallocate, pwrite */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -18,7 +18,11 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include "md5.h"
+#include "fwu_io.h"
+#include "fwu_perf.h"
 
 #define ZYXEL_MAGIC	0xdeadbeaf
 #define MAX_MODELS	5
@@ -389,6 +393,33 @@ static uint32_t checksum_calculate_file(char *filename)
 	return checksum_finish(&ctx);
 }
 
+static uint32_t checksum_calculate_buf(const void *data, size_t size)
+{
+	MD5_CTX ctx;
+
+	MD5_Init(&ctx);
+	checksum_add_from_buf(&ctx, (void *)data, size, 0);
+
+	return checksum_finish(&ctx);
+}
+
+/* One per-file checksum job; the MD5 pass runs on a worker thread
+ * while the main thread streams the payloads into the container. */
+struct csum_job {
+	const void *data;
+	size_t size;
+	uint32_t csum;
+};
+
+static void *csum_worker(void *arg)
+{
+	struct csum_job *job = arg;
+
+	job->csum = checksum_calculate_buf(job->data, job->size);
+
+	return NULL;
+}
+
 static void parse_firmware(struct firmware *fw, FILE *fp)
 {
 	struct firmware_file *file;
@@ -531,22 +562,6 @@ static void init_fw_header(struct firmware *fw)
 	fw->header.magic = ZYXEL_MAGIC;
 }
 
-static void write_headers(FILE *fp, struct firmware *fw)
-{
-	struct firmware_file *file;
-	unsigned int i;
-
-	fseek(fp, 0, SEEK_SET);
-
-	if (1 != fwrite(&fw->header, sizeof(fw->header), 1, fp))
-		error("Failed to write firmware header\n");
-
-	for (i = 0, file = fw->files; i < fw->files_count; i++, file++)
-		if (1 !=
-		    fwrite(&file->header, sizeof(struct fw_header_file), 1, fp))
-			error("Failed to write file header #%u\n", i + 1);
-}
-
 static void usage(char *progname)
 {
 	printf("Usage: %s\n"
@@ -574,14 +589,20 @@ int main(int argc, char *argv[])
 	struct firmware fw;
 	struct firmware_file *file;
 	struct firmware_file *core_file = NULL;
+	struct fwu_input inputs[MAX_FILES];
+	struct csum_job jobs[MAX_FILES];
+	pthread_t tids[MAX_FILES];
+	struct fw_header_kernel dummy;
 	struct stat attr;
+	MD5_CTX ctx;
 	static const char *optstr = "e:v:b:c:m:d:i:o:r:t:x:h";
 	const char *capwap_version = "undefined";
 	const char *separator = " | ";
 	char *filename;
-	FILE *fp_src, *fp_dst;
 	size_t kernel_offset = 0;
+	struct fwu_wq wq;
 	unsigned int i;
+	int fd_dst;
 	int opt;
 
 	memset(&fw, 0, sizeof(fw));
@@ -731,38 +752,75 @@ int main(int argc, char *argv[])
 	}
 
 	filename = argv[optind];
-	if (!(fp_dst = fopen(filename, "w+b")))
-		error("Failed to open %s for writing\n", filename);
 
-	write_headers(fp_dst, &fw);
+	/* Map each input once: the same pages feed the checksum workers,
+	 * the payload writes and the final archive checksum, so no file
+	 * is read twice and the container is never read back. */
+	fwu_perf_phase("read");
+	for (i = 0, file = fw.files; i < fw.files_count; i++, file++) {
+		if (fwu_input_open(&inputs[i], file->filepath) < 0)
+			error("Failed to open %s for reading\n",
+			      file->filepath);
+
+		file->header.length = inputs[i].size;
+		fwu_perf_bytes(inputs[i].size);
+	}
 
 	fw.header.info_length = sizeof(struct fw_header_file);
 	fw.header.files_offset =
 		sizeof(fw.header) + fw.files_count * fw.header.info_length;
-	if ((size_t)ftell(fp_dst) != fw.header.files_offset)
-		error("Oops. Something went wrong writing the file headers");
 
+	/* lay the container out up front so it can be preallocated and
+	 * every payload gets a fixed write position */
 	fw.header.total_length = fw.header.files_offset;
 	for (i = 0, file = fw.files; i < fw.files_count; i++, file++) {
-		file->header.checksum = checksum_calculate_file(file->filepath);
+		file->offset = fw.header.total_length;
 
-		if (!(fp_src = fopen(file->filepath, "rb")))
-			error("Failed to open %s for writing\n", filename);
+		if (file->header.type == FILE_TYPE_KERNEL) {
+			file->header.length += sizeof(fw.kernel_header);
+			kernel_offset = file->offset;
+		}
 
-		file->offset = fw.header.total_length;
+		fw.header.total_length += file->header.length;
+	}
+
+	if (!kernel_offset)
+		error("Kernel image needed for checksum calculation\n");
+
+	if ((fd_dst = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		error("Failed to open %s for writing\n", filename);
 
-		file->header.length = get_file_size(fp_src);
+	if (posix_fallocate(fd_dst, 0, fw.header.total_length))
+		if (ftruncate(fd_dst, fw.header.total_length))
+			error("Failed to preallocate %s\n", filename);
+
+	fwu_wq_init(&wq, fd_dst);
+
+	/* the per-file checksums run while the payloads are queued */
+	fwu_perf_phase("checksum");
+	for (i = 0; i < fw.files_count; i++) {
+		jobs[i].data = inputs[i].data;
+		jobs[i].size = inputs[i].size;
+		if (pthread_create(&tids[i], NULL, csum_worker, &jobs[i]))
+			error("Failed to start checksum thread\n");
+	}
+
+	for (i = 0, file = fw.files; i < fw.files_count; i++, file++) {
+		size_t payload_offset = file->offset;
 
 		if (file->header.type == FILE_TYPE_KERNEL)
-			if (1 != fwrite(&fw.kernel_header,
-					sizeof(fw.kernel_header), 1, fp_dst))
-				error("Failed to write kernel header\n");
+			payload_offset += sizeof(fw.kernel_header);
 
-		copy_from_to_file(fp_src, 0, fp_dst, 0, file->header.length);
+		if (fwu_wq_write(&wq, inputs[i].data, inputs[i].size,
+				 payload_offset))
+			error("Failed to write %s\n", file->filepath);
+	}
+
+	for (i = 0, file = fw.files; i < fw.files_count; i++, file++) {
+		pthread_join(tids[i], NULL);
+		file->header.checksum = jobs[i].csum;
 
 		if (file->header.type == FILE_TYPE_KERNEL) {
-			file->header.length += sizeof(fw.kernel_header);
-			kernel_offset = file->offset;
 			fw.kernel_header.kernel_checksum =
 				file->header.checksum;
 			if (strlen(file->header.revision) + strlen(separator) +
@@ -779,25 +837,31 @@ int main(int argc, char *argv[])
 			core_file = file;
 		}
 
-		fw.header.total_length += file->header.length;
-
 		translate_file_header(&file->header);
-
-		fclose(fp_src);
 	}
 
 	/* update headers with correct lengths and endianness */
 	translate_fw_header(&fw.header);
 
-	write_headers(fp_dst, &fw);
-
-	if (!kernel_offset)
-		error("Kernel image needed for checksum calculation\n");
+	/* The archive checksum covers the final header bytes (minus the
+	 * checksum word), a zeroed kernel header and the payloads.  All
+	 * of that is in memory, so accumulate it from the header structs
+	 * and the input mappings instead of re-reading the container. */
+	memset(&dummy, 0, sizeof(dummy));
+	MD5_Init(&ctx);
+	checksum_add_from_buf(&ctx, &fw.header,
+			      sizeof(fw.header) - CHECKSUM_SIZE,
+			      CHECKSUM_SIZE);
+	for (i = 0, file = fw.files; i < fw.files_count; i++, file++)
+		checksum_add_from_buf(&ctx, &file->header,
+				      sizeof(file->header), 0);
+	for (i = 0, file = fw.files; i < fw.files_count; i++, file++) {
+		if (file->offset == kernel_offset)
+			checksum_add_from_buf(&ctx, &dummy, sizeof(dummy), 0);
+		checksum_add_from_buf(&ctx, inputs[i].data, inputs[i].size, 0);
+	}
 
-	/* update headers with correct checksum */
-	fw.header.checksum = htonl(checksum_calculate(fp_dst, kernel_offset));
-	fseek(fp_dst, 0, SEEK_SET);
-	fwrite(&fw.header.checksum, sizeof(fw.header.checksum), 1, fp_dst);
+	fw.header.checksum = htonl(checksum_finish(&ctx));
 
 	fw.kernel_header.zld_checksum = fw.header.checksum;
 	strncpy(fw.kernel_header.model_name, fw.header.model_name,
@@ -821,10 +885,30 @@ int main(int argc, char *argv[])
 		strcat(fw.kernel_header.core_version, core_file->header.date);
 	}
 
-	fseek(fp_dst, (long int)kernel_offset, SEEK_SET);
-	fwrite(&fw.kernel_header, sizeof(fw.kernel_header), 1, fp_dst);
+	fwu_perf_phase("write");
+	fwu_perf_bytes(ntohl(fw.header.total_length));
+	if (fwu_wq_write(&wq, &fw.header, sizeof(fw.header), 0))
+		error("Failed to write firmware header\n");
 
-	fclose(fp_dst);
+	for (i = 0, file = fw.files; i < fw.files_count; i++, file++)
+		if (fwu_wq_write(&wq, &file->header, sizeof(file->header),
+				 sizeof(fw.header) + i * sizeof(file->header)))
+			error("Failed to write file header #%u\n", i + 1);
+
+	if (fwu_wq_write(&wq, &fw.kernel_header, sizeof(fw.kernel_header),
+			 kernel_offset))
+		error("Failed to write kernel header\n");
+
+	/* one completion-drained flush writes the whole container */
+	if (fwu_wq_flush(&wq))
+		error("Failed to write %s\n", filename);
+
+	close(fd_dst);
+
+	for (i = 0; i < fw.files_count; i++)
+		fwu_input_close(&inputs[i]);
+
+	fwu_perf_done("mkzyxelzldfw");
 
 	exit(0);
 }
@@ -38,32 +38,71 @@
 #include <netinet/in.h>
 #include <inttypes.h>
 
-#define BPB 8 /* bits/byte */
+#include "cyg_crc.h"
+#include "fwu_io.h"
 
-static uint32_t crc32[1<<BPB];
+/* GF(2) matrix times vector, zlib style, for combining chunk CRCs */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+
+	while (vec) {
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+
+	return sum;
+}
 
-static void init_crc32()
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
 {
-	const uint32_t poly = ntohl(0x2083b8ed);
 	int n;
 
-	for (n = 0; n < 1<<BPB; n++) {
-		uint32_t crc = n;
-		int bit;
-
-		for (bit = 0; bit < BPB; bit++)
-			crc = (crc & 1) ? (poly ^ (crc >> 1)) : (crc >> 1);
-		crc32[n] = crc;
-	}
+	for (n = 0; n < 32; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
 }
 
-static uint32_t crc32buf(unsigned char *buf, size_t len)
+/* Append a chunk's CRC (computed with initial value 0) to crc1 */
+static uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
 {
-	uint32_t crc = 0xFFFFFFFF;
+	uint32_t even[32];	/* even-power-of-two zeros operator */
+	uint32_t odd[32];	/* odd-power-of-two zeros operator */
+	uint32_t row;
+	int n;
 
-	for (; len; len--, buf++)
-		crc = crc32[(uint8_t)crc ^ *buf] ^ (crc >> BPB);
-	return crc;
+	if (!len2)
+		return crc1;
+
+	/* put operator for one zero bit in odd */
+	odd[0] = 0xedb88320;
+	row = 1;
+	for (n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	/* put operator for two zero bits in even, four in odd */
+	gf2_matrix_square(even, odd);
+	gf2_matrix_square(odd, even);
+
+	/* apply len2 zero bytes to crc1, squaring operators as we go */
+	do {
+		gf2_matrix_square(even, odd);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(even, crc1);
+		len2 >>= 1;
+		if (!len2)
+			break;
+
+		gf2_matrix_square(odd, even);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(odd, crc1);
+		len2 >>= 1;
+	} while (len2);
+
+	return crc1 ^ crc2;
 }
 
 struct motorola {
@@ -89,7 +128,7 @@ static void usage(const char *mess)
 	const struct model *m;
 
 	fprintf(stderr, "Error: %s\n", mess);
-	fprintf(stderr, "Usage: motorola-bin -device|--strip infile outfile\n");
+	fprintf(stderr, "Usage: motorola-bin -device|--strip infile outfile [-device2 outfile2]...\n");
 	fprintf(stderr, "Known devices: ");
 
 	for (m = models; m->digit != '\0'; m++)
@@ -99,17 +138,35 @@ static void usage(const char *mess)
 	exit(1);
 }
 
+#define MAX_VARIANTS	8
+
+static uint32_t parse_device(const char *df)
+{
+	const struct model *m;
+
+	if (*df != '-')
+		usage("device argument must start with -");
+	if (*++df == '-')
+		++df;	/* allow but don't require second - */
+
+	for (m = models; ; m++) {
+		if (m->digit == '\0')
+			usage("unrecognized device specified");
+		if ((df[0] == m->digit && df[1] == '\0') || strcasecmp(df, m->name) == 0)
+			return m->flags;
+	}
+}
+
 int main(int argc, char **argv)
 {
 	off_t len;	// of original firmware
 	int fd;
 	void *trx;	// pointer to original firmware (mmmapped)
-	struct motorola *firmware;	// pionter to prefix + copy of original firmware
-	uint32_t flags;
+	struct motorola *firmware;	// pionter to original firmware
 
 	// verify parameters
 
-	if (argc != 4)
+	if (argc < 4 || (argc - 4) % 2 != 0)
 		usage("wrong number of arguments");
 
 	// mmap trx file
@@ -122,19 +179,20 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	init_crc32();
-
 	if (strcmp(argv[1], "--strip") == 0)
 	{
 		const char *ugh = NULL;
 
+		if (argc != 4)
+			usage("--strip takes one input and one output");
+
 		if (len < sizeof(struct motorola)) {
 			ugh = "input file too short";
 		} else {
 			const struct model *m;
 
 			firmware = trx;
-			if (htonl(crc32buf(trx + offsetof(struct motorola, flags), len - offsetof(struct motorola, flags))) != firmware->crc)
+			if (htonl(cyg_crc32_accumulate(0xFFFFFFFF, trx + offsetof(struct motorola, flags), len - offsetof(struct motorola, flags))) != firmware->crc)
 				ugh = "Invalid CRC";
 			for (m = models; ; m++) {
 				if (m->digit == '\0') {
@@ -164,46 +222,68 @@ int main(int argc, char **argv)
 		}
 		
 	} else {
-		// setup the firmware flags magic number
-		const struct model *m;
-		const char *df = argv[1];
-
-		if (*df != '-')
-			usage("first argument must start with -");
-		if (*++df == '-')
-			++df;	/* allow but don't require second - */
-
-		for (m = models; ; m++) {
-			if (m->digit == '\0')
-				usage("unrecognized device specified");
-			if ((df[0] == m->digit && df[1] == '\0') || strcasecmp(df, m->name) == 0) {
-				flags = m->flags;
-				break;
-			}
+		struct {
+			uint32_t flags;
+			const char *ofname;
+		} variants[MAX_VARIANTS];
+		int n_variants = 0;
+		uint32_t payload_crc;
+		struct motorola hdr;
+		int i;
+
+		// collect the requested device/output pairs
+		variants[0].flags = parse_device(argv[1]);
+		variants[0].ofname = argv[3];
+		n_variants = 1;
+		for (i = 4; i + 1 < argc; i += 2) {
+			if (n_variants >= MAX_VARIANTS)
+				usage("too many device/output pairs");
+			variants[n_variants].flags = parse_device(argv[i]);
+			variants[n_variants].ofname = argv[i + 1];
+			n_variants++;
 		}
 
-
-		// create a firmware image in memory
-		// and copy the trx to it
-		firmware = malloc(sizeof(struct motorola) + len);
-		memcpy(&firmware[1], trx, len);
-
-		// setup the motorola headers
-		firmware->flags = htonl(flags);
-
-		// CRC of flags + firmware
-		firmware->crc = htonl(crc32buf((unsigned char *)&firmware->flags, sizeof(firmware->flags) + len));
-
-		// write the firmware
-		if ((fd = open(argv[3], O_CREAT|O_WRONLY|O_TRUNC,0644)) < 0
-		|| write(fd, firmware, sizeof(struct motorola) + len) != sizeof(struct motorola) + len
-		|| close(fd) < 0)
-		{
-			fprintf(stderr, "Error storing file %s: %s\n", argv[3], strerror(errno));
-			exit(2);
+		// Each variant's CRC covers its 4 flag bytes followed by the
+		// same payload, so CRC the payload once (initial value 0) and
+		// splice it behind each flags CRC instead of re-reading len
+		// bytes per variant.
+		payload_crc = cyg_crc32_accumulate(0, trx, len);
+
+		for (i = 0; i < n_variants; i++) {
+			// setup the motorola headers
+			hdr.flags = htonl(variants[i].flags);
+			hdr.crc = htonl(crc32_combine(
+					cyg_crc32_accumulate(0xFFFFFFFF, &hdr.flags, sizeof(hdr.flags)),
+					payload_crc, len));
+
+			if (i == 0) {
+				// write the firmware
+				if ((fd = open(variants[0].ofname, O_CREAT|O_WRONLY|O_TRUNC,0644)) < 0
+				|| write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+				|| write(fd, trx, len) != len
+				|| close(fd) < 0)
+				{
+					fprintf(stderr, "Error storing file %s: %s\n", variants[0].ofname, strerror(errno));
+					exit(2);
+				}
+			} else {
+				// further variants differ in the header only; let
+				// the kernel share the payload bytes already written
+				FILE *src = fopen(variants[0].ofname, "r");
+				FILE *dst = fopen(variants[i].ofname, "w");
+
+				if (src == NULL || dst == NULL
+				|| fwrite(&hdr, sizeof(hdr), 1, dst) != 1
+				|| fseek(src, sizeof(hdr), SEEK_SET) != 0
+				|| fwu_copy_data(src, dst, len) != (ssize_t)len)
+				{
+					fprintf(stderr, "Error storing file %s: %s\n", variants[i].ofname, strerror(errno));
+					exit(2);
+				}
+				fclose(dst);
+				fclose(src);
+			}
 		}
-
-		free(firmware);
 	}
 
 	munmap(trx,len);
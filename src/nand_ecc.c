@@ -12,9 +12,12 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <fcntl.h>
 #include <stdio.h>
 
+#include "fwu_pool.h"
+
 #define DEF_NAND_PAGE_SIZE   2048
 #define DEF_NAND_OOB_SIZE     64
 #define DEF_NAND_ECC_OFFSET   0x28
@@ -23,54 +26,65 @@ static int page_size = DEF_NAND_PAGE_SIZE;
 static int oob_size = DEF_NAND_OOB_SIZE;
 static int ecc_offset = DEF_NAND_ECC_OFFSET;
 
-/*
- * Pre-calculated 256-way 1 byte column parity
- */
-static const uint8_t nand_ecc_precalc_table[] = {
-	0x00, 0x55, 0x56, 0x03, 0x59, 0x0c, 0x0f, 0x5a, 0x5a, 0x0f, 0x0c, 0x59, 0x03, 0x56, 0x55, 0x00,
-	0x65, 0x30, 0x33, 0x66, 0x3c, 0x69, 0x6a, 0x3f, 0x3f, 0x6a, 0x69, 0x3c, 0x66, 0x33, 0x30, 0x65,
-	0x66, 0x33, 0x30, 0x65, 0x3f, 0x6a, 0x69, 0x3c, 0x3c, 0x69, 0x6a, 0x3f, 0x65, 0x30, 0x33, 0x66,
-	0x03, 0x56, 0x55, 0x00, 0x5a, 0x0f, 0x0c, 0x59, 0x59, 0x0c, 0x0f, 0x5a, 0x00, 0x55, 0x56, 0x03,
-	0x69, 0x3c, 0x3f, 0x6a, 0x30, 0x65, 0x66, 0x33, 0x33, 0x66, 0x65, 0x30, 0x6a, 0x3f, 0x3c, 0x69,
-	0x0c, 0x59, 0x5a, 0x0f, 0x55, 0x00, 0x03, 0x56, 0x56, 0x03, 0x00, 0x55, 0x0f, 0x5a, 0x59, 0x0c,
-	0x0f, 0x5a, 0x59, 0x0c, 0x56, 0x03, 0x00, 0x55, 0x55, 0x00, 0x03, 0x56, 0x0c, 0x59, 0x5a, 0x0f,
-	0x6a, 0x3f, 0x3c, 0x69, 0x33, 0x66, 0x65, 0x30, 0x30, 0x65, 0x66, 0x33, 0x69, 0x3c, 0x3f, 0x6a,
-	0x6a, 0x3f, 0x3c, 0x69, 0x33, 0x66, 0x65, 0x30, 0x30, 0x65, 0x66, 0x33, 0x69, 0x3c, 0x3f, 0x6a,
-	0x0f, 0x5a, 0x59, 0x0c, 0x56, 0x03, 0x00, 0x55, 0x55, 0x00, 0x03, 0x56, 0x0c, 0x59, 0x5a, 0x0f,
-	0x0c, 0x59, 0x5a, 0x0f, 0x55, 0x00, 0x03, 0x56, 0x56, 0x03, 0x00, 0x55, 0x0f, 0x5a, 0x59, 0x0c,
-	0x69, 0x3c, 0x3f, 0x6a, 0x30, 0x65, 0x66, 0x33, 0x33, 0x66, 0x65, 0x30, 0x6a, 0x3f, 0x3c, 0x69,
-	0x03, 0x56, 0x55, 0x00, 0x5a, 0x0f, 0x0c, 0x59, 0x59, 0x0c, 0x0f, 0x5a, 0x00, 0x55, 0x56, 0x03,
-	0x66, 0x33, 0x30, 0x65, 0x3f, 0x6a, 0x69, 0x3c, 0x3c, 0x69, 0x6a, 0x3f, 0x65, 0x30, 0x33, 0x66,
-	0x65, 0x30, 0x33, 0x66, 0x3c, 0x69, 0x6a, 0x3f, 0x3f, 0x6a, 0x69, 0x3c, 0x66, 0x33, 0x30, 0x65,
-	0x00, 0x55, 0x56, 0x03, 0x59, 0x0c, 0x0f, 0x5a, 0x5a, 0x0f, 0x0c, 0x59, 0x03, 0x56, 0x55, 0x00
-};
-
 /**
  * nand_calculate_ecc - [NAND Interface] Calculate 3-byte ECC for 256-byte block
  * @dat:	raw data
  * @ecc_code:	buffer for ECC
+ *
+ * The byte-table walk is replaced by 64-bit XOR folds: every column
+ * parity bit (CP0-CP5) and row parity bit (LP0-LP15) is the parity of
+ * a fixed subset of the block, so each is one wide XOR reduction plus
+ * a popcount parity. The resulting code matches the old table walk
+ * bit for bit.
  */
 int nand_calculate_ecc(const uint8_t *dat,
 		       uint8_t *ecc_code)
 {
-	uint8_t idx, reg1, reg2, reg3, tmp1, tmp2;
-	int i;
-
-	/* Initialize variables */
-	reg1 = reg2 = reg3 = 0;
-
-	/* Build up column parity */
-	for(i = 0; i < 256; i++) {
-		/* Get CP0 - CP5 from table */
-		idx = nand_ecc_precalc_table[*dat++];
-		reg1 ^= (idx & 0x3f);
-
-		/* All bit XOR = 1 ? */
-		if (idx & 0x40) {
-			reg3 ^= (uint8_t) i;
-			reg2 ^= ~((uint8_t) i);
-		}
+	uint64_t w, all = 0, racc[5] = { 0, 0, 0, 0, 0 };
+	uint8_t lane[8], col, reg1, reg2, reg3, tmp1, tmp2;
+	int i, b;
+
+	for (i = 0; i < 32; i++) {
+		memcpy(&w, dat + i * 8, 8);
+		all ^= w;
+		/* index bits 3..7 select whole 8-byte words */
+		for (b = 0; b < 5; b++)
+			if ((i >> b) & 1)
+				racc[b] ^= w;
+	}
+
+	/* lane[j] is the XOR of all bytes with index i % 8 == j */
+	memcpy(lane, &all, 8);
+	col = lane[0] ^ lane[1] ^ lane[2] ^ lane[3] ^
+	      lane[4] ^ lane[5] ^ lane[6] ^ lane[7];
+
+	/* Column parity, CP0..CP5 */
+	reg1  = __builtin_parity(col & 0x55);
+	reg1 |= __builtin_parity(col & 0xaa) << 1;
+	reg1 |= __builtin_parity(col & 0x33) << 2;
+	reg1 |= __builtin_parity(col & 0xcc) << 3;
+	reg1 |= __builtin_parity(col & 0x0f) << 4;
+	reg1 |= __builtin_parity(col & 0xf0) << 5;
+
+	/* Row parity: index bits 0..2 select byte lanes within a word */
+	reg3 = 0;
+	for (b = 0; b < 3; b++) {
+		uint8_t x = 0;
+
+		for (i = 0; i < 8; i++)
+			if ((i >> b) & 1)
+				x ^= lane[i];
+		reg3 |= (uint8_t)__builtin_parity(x) << b;
 	}
+	for (b = 0; b < 5; b++)
+		reg3 |= (uint8_t)__builtin_parityll(racc[b]) << (b + 3);
+
+	/*
+	 * reg2 accumulated ~i instead of i, so it differs from reg3 by
+	 * 0xff whenever an odd number of bytes had odd parity - which is
+	 * exactly the parity of the whole block.
+	 */
+	reg2 = reg3 ^ (__builtin_parity(col) ? 0xff : 0x00);
 
 	/* Create non-inverted ECC code from line parity */
 	tmp1  = (reg3 & 0x80) >> 0; /* B7 -> B7 */
@@ -104,6 +118,69 @@ int nand_calculate_ecc(const uint8_t *dat,
 	return 0;
 }
 
+/*
+ * Pages are independent, so batches of them are spread over a thread
+ * pool; each worker copies its pages into the output buffer and fills
+ * in the ECC bytes. OOB bytes outside the ECC stay zero, as before.
+ */
+#define ECC_PAGES_PER_BATCH	1024
+#define ECC_JOBS_MAX		16
+
+static int ecc_jobs;	/* 0 = one per online CPU */
+
+struct ecc_job {
+	const uint8_t *in;
+	uint8_t *out;
+	int pages;
+};
+
+static void ecc_pages(struct ecc_job *job)
+{
+	const uint8_t *in = job->in;
+	uint8_t *out = job->out;
+	int i, j;
+
+	for (i = 0; i < job->pages; i++) {
+		uint8_t *ecc_data = out + page_size + ecc_offset;
+
+		memcpy(out, in, page_size);
+		for (j = 0; j < page_size / 256; j++) {
+			nand_calculate_ecc(in + j * 256, ecc_data);
+			ecc_data += 3;
+		}
+		in += page_size;
+		out += page_size + oob_size;
+	}
+}
+
+static void ecc_task(size_t idx, void *arg)
+{
+	struct ecc_job *jobs = arg;
+
+	ecc_pages(&jobs[idx]);
+}
+
+static void ecc_batch(const uint8_t *in, uint8_t *out, int pages)
+{
+	struct ecc_job jobs[ECC_JOBS_MAX];
+	int n, i, per_job;
+
+	n = ecc_jobs > 0 ? ecc_jobs : (int)fwu_pool_threads(pages);
+	if (n > ECC_JOBS_MAX)
+		n = ECC_JOBS_MAX;
+	if (n > pages)
+		n = pages;
+
+	per_job = pages / n;
+	for (i = 0; i < n; i++) {
+		jobs[i].in = in + (size_t)i * per_job * page_size;
+		jobs[i].out = out + (size_t)i * per_job * (page_size + oob_size);
+		jobs[i].pages = (i == n - 1) ? pages - i * per_job : per_job;
+	}
+
+	fwu_pool_run(n, ecc_task, jobs);
+}
+
 /*
  *  usage: bb-nandflash-ecc    start_address  size
  */
@@ -114,6 +191,7 @@ void usage(const char *prog)
 		"    -p <pagesize>      NAND page size (default: %d)\n"
 		"    -o <oobsize>       NAND OOB size (default: %d)\n"
 		"    -e <offset>        NAND ECC offset (default: %d)\n"
+		"    -j <threads>       number of worker threads\n"
 		"\n", prog, DEF_NAND_PAGE_SIZE, DEF_NAND_OOB_SIZE,
 		DEF_NAND_ECC_OFFSET);
 	exit(1);
@@ -123,14 +201,13 @@ void usage(const char *prog)
   */
 int main(int argc, char **argv)
 {
-	uint8_t *page_data = NULL;
-	uint8_t *ecc_data;
+	uint8_t *in_data = NULL, *out_data = NULL;
 	int infd = -1, outfd = -1;
 	int ret = 1;
 	ssize_t bytes;
 	int ch;
 
-	while ((ch = getopt(argc, argv, "e:o:p:")) != -1) {
+	while ((ch = getopt(argc, argv, "e:j:o:p:")) != -1) {
 		switch(ch) {
 		case 'p':
 			page_size = strtoul(optarg, NULL, 0);
@@ -141,6 +218,9 @@ int main(int argc, char **argv)
 		case 'e':
 			ecc_offset = strtoul(optarg, NULL, 0);
 			break;
+		case 'j':
+			ecc_jobs = strtoul(optarg, NULL, 0);
+			break;
 		default:
 			usage(argv[0]);
 		}
@@ -163,18 +243,35 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
-	page_data = malloc(page_size + oob_size);
+	in_data = malloc((size_t)ECC_PAGES_PER_BATCH * page_size);
+	out_data = calloc(ECC_PAGES_PER_BATCH, page_size + oob_size);
+	if (!in_data || !out_data) {
+		perror("malloc");
+		goto out;
+	}
 
-	while ((bytes = read(infd, page_data, page_size)) == page_size) {
-		int j;
+	for (;;) {
+		size_t want = (size_t)ECC_PAGES_PER_BATCH * page_size;
+		size_t got = 0;
+		int pages;
 
-		ecc_data = page_data + page_size + ecc_offset;
-		for (j = 0; j < page_size / 256; j++)
-		{
-			nand_calculate_ecc(page_data + j * 256, ecc_data);
-			ecc_data += 3;
+		while (got < want) {
+			bytes = read(infd, in_data + got, want - got);
+			if (bytes <= 0)
+				break;
+			got += bytes;
 		}
-		write(outfd, page_data, page_size + oob_size);
+
+		/* a trailing partial page is dropped, as before */
+		pages = got / page_size;
+		if (!pages)
+			break;
+
+		ecc_batch(in_data, out_data, pages);
+		write(outfd, out_data, (size_t)pages * (page_size + oob_size));
+
+		if (got < want)
+			break;
 	}
 
 	ret = 0;
@@ -183,8 +280,8 @@ out:
 		close(infd);
 	if (outfd >= 0)
 		close(outfd);
-	if (page_data)
-		free(page_data);
+	free(in_data);
+	free(out_data);
 	return ret;
 }
 
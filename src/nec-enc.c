@@ -12,31 +12,11 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include "fwu_xor.h"
+
 #define KEY_LEN     16
 #define PATTERN_LEN 251
 
-static int
-xor_pattern(uint8_t *data, size_t len, const char *key, int k_len, int k_off)
-{
-	int offset = k_off;
-
-	while (len--) {
-		*data ^= key[offset];
-		data++;
-		offset = (offset + 1) % k_len;
-	}
-
-	return offset;
-}
-
-static void xor_data(uint8_t *data, size_t len, const uint8_t *pattern)
-{
-	for (int i = 0; i < len; i++) {
-		*data ^= pattern[i];
-		data++;
-	}
-}
-
 static void __attribute__((noreturn)) usage(void)
 {
 	fprintf(stderr, "Usage: nec-enc -i infile -o outfile -k <key>\n");
@@ -106,8 +86,8 @@ int main(int argc, char **argv)
 				ptn = 1;
 		}
 
-		k_off = xor_pattern(buf_pattern, n, key, k_len, k_off);
-		xor_data(buf, n, buf_pattern);
+		k_off = fwu_xor_pattern(buf_pattern, n, key, k_len, k_off);
+		fwu_xor_buf(buf, buf_pattern, n);
 
 		if (fwrite(buf, 1, n, out) != n) {
 			perror("failed to write");
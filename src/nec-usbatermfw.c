@@ -13,6 +13,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "fwu_csum.h"
+
 #define FWHDR_LEN		0x20
 #define BLKHDR_LEN		0x18
 
@@ -66,7 +68,6 @@ static int strtou32(char *arg, uint32_t *val)
 static int write_data(const char *buf, size_t length, uint32_t *cksum)
 {
 	size_t padlen = 0;
-	size_t pos;
 
 	if (length % PADBLK_LEN)
 		padlen = PADBLK_LEN - length % PADBLK_LEN;
@@ -76,13 +77,13 @@ static int write_data(const char *buf, size_t length, uint32_t *cksum)
 		return -EACCES;
 	}
 
-	if (cksum)
-		for (pos = 0; pos < length; pos += 2) {
-			if (length - pos == 1)
-				*cksum += le16toh(buf[pos]);
-			else
-				*cksum += le16toh(*(uint16_t *)(buf + pos));
-		}
+	if (cksum) {
+		*cksum += fwu_le16_sum(buf, length & ~(size_t)1);
+		/* a trailing odd byte keeps the (signed) char widening
+		 * of the old word loop */
+		if (length % 2)
+			*cksum += le16toh(buf[length - 1]);
+	}
 
 	if (padlen) {
 		int i;
@@ -12,6 +12,7 @@
  * Daniel Golle <daniel@makrotopia.org>
  */
 
+#define _GNU_SOURCE	/* fallocate */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -97,22 +98,6 @@ static size_t container_full_size(const container_t *cnt)
 	return sizeof(container_header_t) + cnt->payload_len;
 }
 
-/*
- * Write a container to a buffer
- */
-static size_t write_container(uint8_t *buffer, const container_t *cnt)
-{
-	container_header_t *header = (container_header_t *)buffer;
-	header->cnt_id = cnt->cnt_id;
-	header->payload_len = cnt->payload_len;
-
-	if (cnt->payload && cnt->payload_len > 0) {
-		memcpy(buffer + sizeof(container_header_t), cnt->payload, cnt->payload_len);
-	}
-
-	return container_full_size(cnt);
-}
-
 /*
  * Create a null block container for alignment
  */
@@ -195,7 +180,9 @@ static uint8_t *compress_zlib_data(const uint8_t *input, size_t input_len, size_
 				   size_t block_size)
 {
 	size_t max_output_size = input_len * 2 + 1024; /* Conservative estimate */
+	uLong scratch_size = compressBound(block_size);
 	uint8_t *buffer_out;
+	uint8_t *compressed;
 	size_t output_offset = 0;
 	size_t offset = 0;
 	uint32_t adler32;
@@ -203,6 +190,10 @@ static uint8_t *compress_zlib_data(const uint8_t *input, size_t input_len, size_
 	if ((buffer_out = malloc(max_output_size)) == NULL)
 		err(EXIT_FAILURE, "malloc");
 
+	/* every block fits the same bound; one scratch buffer for all */
+	if ((compressed = malloc(scratch_size)) == NULL)
+		err(EXIT_FAILURE, "malloc");
+
 	/* Compression method magic - matches Python b"\x78\x01" */
 	buffer_out[output_offset++] = 0x78;
 	buffer_out[output_offset++] = 0x01;
@@ -215,15 +206,10 @@ static uint8_t *compress_zlib_data(const uint8_t *input, size_t input_len, size_
 		size_t buffer_in_len = (offset + block_size <= input_len) ? block_size :
 									    (input_len - offset);
 		const uint8_t *buffer_in = input + offset;
-		uLong max_block_compressed = compressBound(buffer_in_len);
-		uint8_t *compressed;
 		uLong compressed_len;
 		int result;
 
-		if ((compressed = malloc(max_block_compressed)) == NULL)
-			err(EXIT_FAILURE, "malloc");
-
-		compressed_len = max_block_compressed;
+		compressed_len = scratch_size;
 		result = compress2(compressed, &compressed_len, buffer_in, buffer_in_len,
 				   0); /* level=0 */
 
@@ -264,10 +250,11 @@ static uint8_t *compress_zlib_data(const uint8_t *input, size_t input_len, size_
 			adler32 = adler32_z(adler32, compressed + 7, compressed_len - 11);
 		}
 
-		free(compressed);
 		offset += block_size;
 	}
 
+	free(compressed);
+
 	/* Add final adler32 checksum - matches Python struct.pack(">L", adler32) */
 	if (output_offset + 4 >= max_output_size) {
 		max_output_size += 4;
@@ -405,6 +392,10 @@ static int write_npk_file(const char *filename, container_t *containers, int num
 	if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
 		err(EXIT_FAILURE, "%s", filename);
 
+	/* the layout is already computed; reserve the file up front
+	 * (best effort) */
+	(void) fallocate(fd, 0, 0, sizeof(header) + (off_t)total_payload);
+
 	/* Write NPK header */
 	header.magic = NPK_MAGIC_BYTES;
 	header.payload_len = total_payload;
@@ -412,20 +403,21 @@ static int write_npk_file(const char *filename, container_t *containers, int num
 	if (write(fd, &header, sizeof(header)) != sizeof(header))
 		err(EXIT_FAILURE, "write header");
 
-	/* Write containers */
+	/* Write containers straight from their payload buffers; no
+	 * per-container staging copy */
 	for (i = 0; i < num_containers; i++) {
-		size_t container_size = container_full_size(&containers[i]);
-		uint8_t *buffer;
-
-		if ((buffer = malloc(container_size)) == NULL)
-			err(EXIT_FAILURE, "malloc");
+		container_header_t cnt_hdr;
 
-		write_container(buffer, &containers[i]);
+		cnt_hdr.cnt_id = containers[i].cnt_id;
+		cnt_hdr.payload_len = containers[i].payload_len;
 
-		if (write(fd, buffer, container_size) != container_size)
+		if (write(fd, &cnt_hdr, sizeof(cnt_hdr)) != sizeof(cnt_hdr))
 			err(EXIT_FAILURE, "write container");
 
-		free(buffer);
+		if (containers[i].payload && containers[i].payload_len > 0 &&
+		    write(fd, containers[i].payload, containers[i].payload_len)
+		    != containers[i].payload_len)
+			err(EXIT_FAILURE, "write container");
 	}
 
 	close(fd);
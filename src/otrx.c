@@ -15,6 +15,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "cyg_crc.h"
+#include "fwu_io.h"
+#include "fwu_perf.h"
+#include "fwu_pool.h"
+
 #if !defined(__BYTE_ORDER)
 #error "Unknown byte order"
 #endif
@@ -66,80 +71,117 @@ static inline size_t otrx_min(size_t x, size_t y) {
  * CRC32
  **************************************************/
 
-static const uint32_t crc32_tbl[] = {
-	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba,
-	0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
-	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
-	0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de,
-	0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec,
-	0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
-	0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
-	0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940,
-	0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116,
-	0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
-	0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
-	0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a,
-	0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818,
-	0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
-	0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
-	0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c,
-	0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2,
-	0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
-	0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
-	0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086,
-	0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4,
-	0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
-	0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
-	0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8,
-	0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe,
-	0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
-	0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
-	0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252,
-	0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60,
-	0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
-	0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
-	0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04,
-	0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a,
-	0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
-	0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
-	0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e,
-	0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c,
-	0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
-	0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
-	0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0,
-	0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6,
-	0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
-	0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d,
+uint32_t otrx_crc32(uint32_t crc, uint8_t *buf, size_t len) {
+	return cyg_crc32_accumulate(crc, buf, len);
+}
+
+/* GF(2) matrix times vector, zlib style, for combining chunk CRCs */
+static uint32_t otrx_gf2_matrix_times(const uint32_t *mat, uint32_t vec) {
+	uint32_t sum = 0;
+
+	while (vec) {
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+
+	return sum;
+}
+
+static void otrx_gf2_matrix_square(uint32_t *square, const uint32_t *mat) {
+	int n;
+
+	for (n = 0; n < 32; n++)
+		square[n] = otrx_gf2_matrix_times(mat, mat[n]);
+}
+
+/* Append a chunk's CRC (computed with initial value 0) to crc1 */
+static uint32_t otrx_crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2) {
+	uint32_t even[32];	/* even-power-of-two zeros operator */
+	uint32_t odd[32];	/* odd-power-of-two zeros operator */
+	uint32_t row;
+	int n;
+
+	if (!len2)
+		return crc1;
+
+	/* put operator for one zero bit in odd */
+	odd[0] = 0xedb88320;
+	row = 1;
+	for (n = 1; n < 32; n++) {
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	/* put operator for two zero bits in even, four in odd */
+	otrx_gf2_matrix_square(even, odd);
+	otrx_gf2_matrix_square(odd, even);
+
+	/* apply len2 zero bytes to crc1, squaring operators as we go */
+	do {
+		otrx_gf2_matrix_square(even, odd);
+		if (len2 & 1)
+			crc1 = otrx_gf2_matrix_times(even, crc1);
+		len2 >>= 1;
+		if (!len2)
+			break;
+
+		otrx_gf2_matrix_square(odd, even);
+		if (len2 & 1)
+			crc1 = otrx_gf2_matrix_times(odd, crc1);
+		len2 >>= 1;
+	} while (len2);
+
+	return crc1 ^ crc2;
+}
+
+struct otrx_crc32_job {
+	const uint8_t *buf;
+	size_t len;
+	uint32_t crc32;
 };
 
-uint32_t otrx_crc32(uint32_t crc, uint8_t *buf, size_t len) {
-	while (len) {
-		crc = crc32_tbl[(crc ^ *buf) & 0xff] ^ (crc >> 8);
-		buf++;
-		len--;
+static void otrx_crc32_task(size_t idx, void *arg) {
+	struct otrx_crc32_job *jobs = arg;
+
+	jobs[idx].crc32 = otrx_crc32(jobs[idx].crc32,
+				     (uint8_t *)jobs[idx].buf, jobs[idx].len);
+}
+
+/* Don't bother spawning threads below this chunk size */
+#define OTRX_CRC32_CHUNK_MIN		(4 * 1024 * 1024)
+#define OTRX_CRC32_JOBS_MAX		16
+
+/*
+ * CRC32 a memory region split into per-worker chunks over the shared
+ * pool, with a combine step to merge the per-chunk results.
+ */
+static uint32_t otrx_crc32_parallel(uint32_t crc, const uint8_t *buf, size_t len) {
+	struct otrx_crc32_job jobs[OTRX_CRC32_JOBS_MAX];
+	size_t chunk;
+	unsigned n_jobs;
+	unsigned i;
+
+	n_jobs = fwu_pool_threads(len / OTRX_CRC32_CHUNK_MIN);
+	if (n_jobs > OTRX_CRC32_JOBS_MAX)
+		n_jobs = OTRX_CRC32_JOBS_MAX;
+	if (n_jobs < 2)
+		return otrx_crc32(crc, (uint8_t *)buf, len);
+
+	chunk = len / n_jobs;
+	for (i = 0; i < n_jobs; i++) {
+		jobs[i].buf = buf + i * chunk;
+		jobs[i].len = i == n_jobs - 1 ? len - i * chunk : chunk;
+		jobs[i].crc32 = i == 0 ? crc : 0;
 	}
 
+	fwu_pool_run(n_jobs, otrx_crc32_task, jobs);
+
+	crc = 0;
+	for (i = 0; i < n_jobs; i++)
+		crc = i == 0 ? jobs[i].crc32 : otrx_crc32_combine(crc, jobs[i].crc32, jobs[i].len);
+
 	return crc;
 }
 
@@ -277,6 +319,7 @@ static void otrx_check_parse_options(int argc, char **argv) {
 
 static int otrx_check(int argc, char **argv) {
 	struct otrx_ctx otrx = { };
+	struct fwu_input input = { 0 };
 	size_t bytes, length;
 	uint8_t buf[1024];
 	uint32_t crc32;
@@ -292,6 +335,7 @@ static int otrx_check(int argc, char **argv) {
 	optind = 3;
 	otrx_check_parse_options(argc, argv);
 
+	fwu_perf_phase("parse");
 	err = otrx_open_parse(trx_path, "r", &otrx);
 	if (err) {
 		fprintf(stderr, "Couldn't open & parse %s: %d\n", trx_path, err);
@@ -299,18 +343,34 @@ static int otrx_check(int argc, char **argv) {
 		goto out;
 	}
 
-	crc32 = 0xffffffff;
-	crc32 = otrx_crc32(crc32, (uint8_t *)&otrx.hdr + TRX_FLAGS_OFFSET, sizeof(otrx.hdr) - TRX_FLAGS_OFFSET);
-	length = le32_to_cpu(otrx.hdr.length) - sizeof(otrx.hdr);
-	while ((bytes = fread(buf, 1, otrx_min(sizeof(buf), length), otrx.fp)) > 0) {
-		crc32 = otrx_crc32(crc32, buf, bytes);
-		length -= bytes;
-	}
+	fwu_perf_phase("crc32");
+	fwu_perf_bytes(le32_to_cpu(otrx.hdr.length) - TRX_FLAGS_OFFSET);
+
+	/* Prefer CRC32ing the file as one mapped region: it allows
+	 * splitting the work across CPUs, which pays off on big images */
+	if (strcmp(trx_path, "-") &&
+	    !fwu_input_open(&input, trx_path) &&
+	    input.size >= trx_offset + le32_to_cpu(otrx.hdr.length)) {
+		crc32 = otrx_crc32_parallel(0xffffffff,
+					    (uint8_t *)input.data + trx_offset + TRX_FLAGS_OFFSET,
+					    le32_to_cpu(otrx.hdr.length) - TRX_FLAGS_OFFSET);
+		fwu_input_close(&input);
+	} else {
+		fwu_input_close(&input);
+
+		crc32 = 0xffffffff;
+		crc32 = otrx_crc32(crc32, (uint8_t *)&otrx.hdr + TRX_FLAGS_OFFSET, sizeof(otrx.hdr) - TRX_FLAGS_OFFSET);
+		length = le32_to_cpu(otrx.hdr.length) - sizeof(otrx.hdr);
+		while ((bytes = fread(buf, 1, otrx_min(sizeof(buf), length), otrx.fp)) > 0) {
+			crc32 = otrx_crc32(crc32, buf, bytes);
+			length -= bytes;
+		}
 
-	if (length) {
-		fprintf(stderr, "Couldn't read last %zd B of data from %s\n", length, trx_path);
-		err = -EIO;
-		goto err_close;
+		if (length) {
+			fprintf(stderr, "Couldn't read last %zd B of data from %s\n", length, trx_path);
+			err = -EIO;
+			goto err_close;
+		}
 	}
 
 	if (crc32 != le32_to_cpu(otrx.hdr.crc32)) {
@@ -331,7 +391,7 @@ out:
  * Create
  **************************************************/
 
-static ssize_t otrx_create_append_file(FILE *trx, const char *in_path) {
+static ssize_t otrx_create_append_file(FILE *trx, const char *in_path, uint32_t *crc) {
 	FILE *in;
 	size_t bytes;
 	ssize_t length = 0;
@@ -343,71 +403,67 @@ static ssize_t otrx_create_append_file(FILE *trx, const char *in_path) {
 		return -EACCES;
 	}
 
+	fwu_perf_phase("append");
 	while ((bytes = fread(buf, 1, sizeof(buf), in)) > 0) {
 		if (fwrite(buf, 1, bytes, trx) != bytes) {
 			fprintf(stderr, "Couldn't write %zu B to %s\n", bytes, trx_path);
 			length = -EIO;
 			break;
 		}
+		*crc = otrx_crc32(*crc, buf, bytes);
 		length += bytes;
 	}
+	if (length > 0)
+		fwu_perf_bytes(length);
 
 	fclose(in);
 
 	return length;
 }
 
-static ssize_t otrx_create_append_zeros(FILE *trx, size_t length) {
-	uint8_t *buf;
-
-	buf = malloc(length);
-	if (!buf)
-		return -ENOMEM;
-	memset(buf, 0, length);
+static ssize_t otrx_create_append_zeros(FILE *trx, size_t length, uint32_t *crc) {
+	uint8_t zeros[1024] = { };
+	size_t todo = length;
 
-	if (fwrite(buf, 1, length, trx) != length) {
+	if (fwu_append_zeros(trx, length)) {
 		fprintf(stderr, "Couldn't write %zu B to %s\n", length, trx_path);
-		free(buf);
 		return -EIO;
 	}
 
-	free(buf);
+	while (todo) {
+		size_t bytes = otrx_min(todo, sizeof(zeros));
+
+		*crc = otrx_crc32(*crc, zeros, bytes);
+		todo -= bytes;
+	}
 
 	return length;
 }
 
-static ssize_t otrx_create_align(FILE *trx, size_t curr_offset, size_t alignment) {
+static ssize_t otrx_create_align(FILE *trx, size_t curr_offset, size_t alignment, uint32_t *crc) {
 	if (curr_offset & (alignment - 1)) {
 		size_t length = alignment - (curr_offset % alignment);
-		return otrx_create_append_zeros(trx, length);
+		return otrx_create_append_zeros(trx, length, crc);
 	}
 
 	return 0;
 }
 
-static int otrx_create_write_hdr(FILE *trx, struct trx_header *hdr) {
-	size_t bytes, length;
-	uint8_t buf[1024];
+/*
+ * The data CRC is accumulated (with initial value 0) while partitions
+ * are appended; all that's left here is CRC32ing the header tail and
+ * gluing the two with the zlib-style combine, so the data never gets
+ * re-read.
+ */
+static int otrx_create_write_hdr(FILE *trx, struct trx_header *hdr, uint32_t data_crc) {
+	size_t bytes;
 	uint32_t crc32;
 
+	fwu_perf_phase("header");
 	hdr->version = 1;
 
-	fseek(trx, 0, SEEK_SET);
-	bytes = fwrite(hdr, 1, sizeof(struct trx_header), trx);
-	if (bytes != sizeof(struct trx_header)) {
-		fprintf(stderr, "Couldn't write TRX header to %s\n", trx_path);
-		return -EIO;
-	}
-
-	length = le32_to_cpu(hdr->length);
-
-	crc32 = 0xffffffff;
-	fseek(trx, TRX_FLAGS_OFFSET, SEEK_SET);
-	length -= TRX_FLAGS_OFFSET;
-	while ((bytes = fread(buf, 1, otrx_min(sizeof(buf), length), trx)) > 0) {
-		crc32 = otrx_crc32(crc32, buf, bytes);
-		length -= bytes;
-	}
+	crc32 = otrx_crc32(0xffffffff, (uint8_t *)hdr + TRX_FLAGS_OFFSET, sizeof(*hdr) - TRX_FLAGS_OFFSET);
+	crc32 = otrx_crc32_combine(crc32, data_crc, le32_to_cpu(hdr->length) - sizeof(*hdr));
 	hdr->crc32 = cpu_to_le32(crc32);
 
 	fseek(trx, 0, SEEK_SET);
@@ -423,6 +479,7 @@ static int otrx_create_write_hdr(FILE *trx, struct trx_header *hdr) {
 static int otrx_create(int argc, char **argv) {
 	FILE *trx;
 	struct trx_header hdr = {};
+	uint32_t data_crc = 0;
 	ssize_t sbytes;
 	size_t curr_idx = 0;
 	size_t curr_offset = sizeof(hdr);
@@ -458,7 +515,7 @@ static int otrx_create(int argc, char **argv) {
 				goto err_close;
 			}
 
-			sbytes = otrx_create_append_file(trx, optarg);
+			sbytes = otrx_create_append_file(trx, optarg, &data_crc);
 			if (sbytes < 0) {
 				fprintf(stderr, "Failed to append file %s\n", optarg);
 			} else {
@@ -466,7 +523,7 @@ static int otrx_create(int argc, char **argv) {
 				curr_offset += sbytes;
 			}
 
-			sbytes = otrx_create_align(trx, curr_offset, 4);
+			sbytes = otrx_create_align(trx, curr_offset, 4, &data_crc);
 			if (sbytes < 0)
 				fprintf(stderr, "Failed to append zeros\n");
 			else
@@ -474,21 +531,21 @@ static int otrx_create(int argc, char **argv) {
 
 			break;
 		case 'A':
-			sbytes = otrx_create_append_file(trx, optarg);
+			sbytes = otrx_create_append_file(trx, optarg, &data_crc);
 			if (sbytes < 0) {
 				fprintf(stderr, "Failed to append file %s\n", optarg);
 			} else {
 				curr_offset += sbytes;
 			}
 
-			sbytes = otrx_create_align(trx, curr_offset, 4);
+			sbytes = otrx_create_align(trx, curr_offset, 4, &data_crc);
 			if (sbytes < 0)
 				fprintf(stderr, "Failed to append zeros\n");
 			else
 				curr_offset += sbytes;
 			break;
 		case 'a':
-			sbytes = otrx_create_align(trx, curr_offset, strtol(optarg, NULL, 0));
+			sbytes = otrx_create_align(trx, curr_offset, strtol(optarg, NULL, 0), &data_crc);
 			if (sbytes < 0)
 				fprintf(stderr, "Failed to append zeros\n");
 			else
@@ -499,7 +556,7 @@ static int otrx_create(int argc, char **argv) {
 			if (sbytes < 0) {
 				fprintf(stderr, "Current TRX length is 0x%zx, can't pad it with zeros to 0x%lx\n", curr_offset, strtol(optarg, NULL, 0));
 			} else {
-				sbytes = otrx_create_append_zeros(trx, sbytes);
+				sbytes = otrx_create_append_zeros(trx, sbytes, &data_crc);
 				if (sbytes < 0)
 					fprintf(stderr, "Failed to append zeros\n");
 				else
@@ -519,14 +576,14 @@ static int otrx_create(int argc, char **argv) {
 			break;
 	}
 
-	sbytes = otrx_create_align(trx, curr_offset, 0x1000);
+	sbytes = otrx_create_align(trx, curr_offset, 0x1000, &data_crc);
 	if (sbytes < 0)
 		fprintf(stderr, "Failed to append zeros\n");
 	else
 		curr_offset += sbytes;
 
 	hdr.length = curr_offset;
-	otrx_create_write_hdr(trx, &hdr);
+	otrx_create_write_hdr(trx, &hdr, data_crc);
 err_close:
 	fclose(trx);
 out:
@@ -559,9 +616,8 @@ static void otrx_extract_parse_options(int argc, char **argv) {
 }
 
 static int otrx_extract_copy(struct otrx_ctx *otrx, size_t length, char *out_path) {
+	ssize_t bytes;
 	FILE *out;
-	size_t bytes;
-	uint8_t *buf;
 	int err = 0;
 
 	out = fopen(out_path, "w");
@@ -571,31 +627,15 @@ static int otrx_extract_copy(struct otrx_ctx *otrx, size_t length, char *out_pat
 		goto out;
 	}
 
-	buf = malloc(length);
-	if (!buf) {
-		fprintf(stderr, "Couldn't alloc %zu B buffer\n", length);
-		err =  -ENOMEM;
+	bytes = fwu_copy_data(otrx->fp, out, length);
+	if (bytes != (ssize_t)length) {
+		fprintf(stderr, "Couldn't copy %zu B of data from %s to %s\n", length, trx_path, out_path);
+		err = -EIO;
 		goto err_close;
 	}
 
-	bytes = fread(buf, 1, length, otrx->fp);
-	if (bytes != length) {
-		fprintf(stderr, "Couldn't read %zu B of data from %s\n", length, trx_path);
-		err =  -ENOMEM;
-		goto err_free_buf;
-	};
-
-	bytes = fwrite(buf, 1, length, out);
-	if (bytes != length) {
-		fprintf(stderr, "Couldn't write %zu B to %s\n", length, out_path);
-		err =  -ENOMEM;
-		goto err_free_buf;
-	}
-
 	printf("Extracted 0x%zx bytes into %s\n", length, out_path);
 
-err_free_buf:
-	free(buf);
 err_close:
 	fclose(out);
 out:
@@ -667,15 +707,22 @@ static void usage() {
 }
 
 int main(int argc, char **argv) {
+	int err;
+
 	if (argc > 1) {
 		if (!strcmp(argv[1], "check"))
-			return otrx_check(argc, argv);
+			err = otrx_check(argc, argv);
 		else if (!strcmp(argv[1], "create"))
-			return otrx_create(argc, argv);
+			err = otrx_create(argc, argv);
 		else if (!strcmp(argv[1], "extract"))
-			return otrx_extract(argc, argv);
+			err = otrx_extract(argc, argv);
+		else
+			goto usage;
+		fwu_perf_done("otrx");
+		return err;
 	}
 
+usage:
 	usage();
 	return 0;
 }
@@ -24,22 +24,13 @@
 #include <sys/stat.h>
 
 struct pc1_ctx {
-	unsigned short	ax;
-	unsigned short	bx;
-	unsigned short	cx;
-	unsigned short	dx;
 	unsigned short	si;
-	unsigned short	tmp;
 	unsigned short	x1a2;
 	unsigned short	x1a0[8];
 	unsigned short	res;
 	unsigned short	i;
 	unsigned short	inter;
-	unsigned short	cfc;
-	unsigned short	cfd;
-	unsigned short	compte;
 	unsigned char	cle[17];
-	short		c;
 };
 
 static void pc1_finish(struct pc1_ctx *pc1)
@@ -48,97 +39,92 @@ static void pc1_finish(struct pc1_ctx *pc1)
 	memset(pc1, 0, sizeof(struct pc1_ctx));
 }
 
+/*
+ * Same register shuffle as the original assembly transcription, but on
+ * locals instead of context fields so the whole round stays in
+ * registers; only the carried state (si, x1a2, x1a0, res, i) touches
+ * memory.
+ */
 static void pc1_code(struct pc1_ctx *pc1)
 {
-	pc1->dx = pc1->x1a2 + pc1->i;
-	pc1->ax = pc1->x1a0[pc1->i];
-	pc1->cx = 0x015a;
-	pc1->bx = 0x4e35;
-
-	pc1->tmp = pc1->ax;
-	pc1->ax = pc1->si;
-	pc1->si = pc1->tmp;
-
-	pc1->tmp = pc1->ax;
-	pc1->ax = pc1->dx;
-	pc1->dx = pc1->tmp;
-
-	if (pc1->ax != 0) {
-		pc1->ax = pc1->ax * pc1->bx;
+	unsigned short dx = pc1->x1a2 + pc1->i;
+	unsigned short ax = pc1->x1a0[pc1->i];
+	unsigned short si = pc1->si;
+	unsigned short cx = 0x015a;
+	unsigned short bx = 0x4e35;
+	unsigned short tmp;
+
+	tmp = ax;
+	ax = si;
+	si = tmp;
+
+	tmp = ax;
+	ax = dx;
+	dx = tmp;
+
+	if (ax != 0) {
+		ax = ax * bx;
 	}
 
-	pc1->tmp = pc1->ax;
-	pc1->ax = pc1->cx;
-	pc1->cx = pc1->tmp;
+	tmp = ax;
+	ax = cx;
+	cx = tmp;
 
-	if (pc1->ax != 0) {
-		pc1->ax = pc1->ax * pc1->si;
-		pc1->cx = pc1->ax + pc1->cx;
+	if (ax != 0) {
+		ax = ax * si;
+		cx = ax + cx;
 	}
 
-	pc1->tmp = pc1->ax;
-	pc1->ax = pc1->si;
-	pc1->si = pc1->tmp;
-	pc1->ax = pc1->ax * pc1->bx;
-	pc1->dx = pc1->cx + pc1->dx;
+	tmp = ax;
+	ax = si;
+	si = tmp;
+	ax = ax * bx;
+	dx = cx + dx;
 
-	pc1->ax = pc1->ax + 1;
+	ax = ax + 1;
 
-	pc1->x1a2 = pc1->dx;
-	pc1->x1a0[pc1->i] = pc1->ax;
+	pc1->si = si;
+	pc1->x1a2 = dx;
+	pc1->x1a0[pc1->i] = ax;
 
-	pc1->res = pc1->ax ^ pc1->dx;
+	pc1->res = ax ^ dx;
 	pc1->i = pc1->i + 1;
 }
 
 static void pc1_assemble(struct pc1_ctx *pc1)
 {
-	pc1->x1a0[0] = (pc1->cle[0] * 256) + pc1->cle[1];
-
-	pc1_code(pc1);
-	pc1->inter = pc1->res;
-
-	pc1->x1a0[1] = pc1->x1a0[0] ^ ((pc1->cle[2]*256) + pc1->cle[3]);
-	pc1_code(pc1);
-	pc1->inter = pc1->inter ^ pc1->res;
-
-	pc1->x1a0[2] = pc1->x1a0[1] ^ ((pc1->cle[4]*256) + pc1->cle[5]);
-	pc1_code(pc1);
-	pc1->inter = pc1->inter ^ pc1->res;
-
-	pc1->x1a0[3] = pc1->x1a0[2] ^ ((pc1->cle[6]*256) + pc1->cle[7]);
-	pc1_code(pc1);
-	pc1->inter = pc1->inter ^ pc1->res;
+	unsigned short inter;
+	unsigned int k;
 
-	pc1->x1a0[4] = pc1->x1a0[3] ^ ((pc1->cle[8]*256) + pc1->cle[9]);
-	pc1_code(pc1);
-	pc1->inter = pc1->inter ^ pc1->res;
-
-	pc1->x1a0[5] = pc1->x1a0[4] ^ ((pc1->cle[10]*256) + pc1->cle[11]);
-	pc1_code(pc1);
-	pc1->inter = pc1->inter ^ pc1->res;
+	pc1->x1a0[0] = (pc1->cle[0] * 256) + pc1->cle[1];
 
-	pc1->x1a0[6] = pc1->x1a0[5] ^ ((pc1->cle[12]*256) + pc1->cle[13]);
 	pc1_code(pc1);
-	pc1->inter = pc1->inter ^ pc1->res;
+	inter = pc1->res;
 
-	pc1->x1a0[7] = pc1->x1a0[6] ^ ((pc1->cle[14]*256) + pc1->cle[15]);
-	pc1_code(pc1);
-	pc1->inter = pc1->inter ^ pc1->res;
+	for (k = 1; k <= 7; k++) {
+		pc1->x1a0[k] = pc1->x1a0[k - 1] ^
+			       ((pc1->cle[2 * k] * 256) + pc1->cle[2 * k + 1]);
+		pc1_code(pc1);
+		inter = inter ^ pc1->res;
+	}
 
+	pc1->inter = inter;
 	pc1->i = 0;
 }
 
 static unsigned char pc1_decrypt(struct pc1_ctx *pc1, short c)
 {
+	unsigned short cfc, cfd;
+	unsigned int compte;
+
 	pc1_assemble(pc1);
-	pc1->cfc = pc1->inter >> 8;
-	pc1->cfd = pc1->inter & 255; /* cfc^cfd = random byte */
+	cfc = pc1->inter >> 8;
+	cfd = pc1->inter & 255; /* cfc^cfd = random byte */
 
-	c = c ^ (pc1->cfc ^ pc1->cfd);
-	for (pc1->compte = 0; pc1->compte <= 15; pc1->compte++) {
+	c = c ^ (cfc ^ cfd);
+	for (compte = 0; compte <= 15; compte++) {
 		/* we mix the plaintext byte with the key */
-		pc1->cle[pc1->compte] = pc1->cle[pc1->compte] ^ c;
+		pc1->cle[compte] = pc1->cle[compte] ^ c;
 	}
 
 	return c;
@@ -146,15 +132,18 @@ static unsigned char pc1_decrypt(struct pc1_ctx *pc1, short c)
 
 static unsigned char pc1_encrypt(struct pc1_ctx *pc1, short c)
 {
+	unsigned short cfc, cfd;
+	unsigned int compte;
+
 	pc1_assemble(pc1);
-	pc1->cfc = pc1->inter >> 8;
-	pc1->cfd = pc1->inter & 255; /* cfc^cfd = random byte */
+	cfc = pc1->inter >> 8;
+	cfd = pc1->inter & 255; /* cfc^cfd = random byte */
 
-	for (pc1->compte = 0; pc1->compte <= 15; pc1->compte++) {
+	for (compte = 0; compte <= 15; compte++) {
 		/* we mix the plaintext byte with the key */
-		pc1->cle[pc1->compte] = pc1->cle[pc1->compte] ^ c;
+		pc1->cle[compte] = pc1->cle[compte] ^ c;
 	}
-	c = c ^ (pc1->cfc ^ pc1->cfd);
+	c = c ^ (cfc ^ cfd);
 
 	return c;
 }
@@ -164,7 +153,7 @@ static void pc1_init(struct pc1_ctx *pc1)
 	memset(pc1, 0, sizeof(struct pc1_ctx));
 
 	/* ('Remsaalps!123456') is the key used, you can change it */
-	strcpy(pc1->cle, "Remsaalps!123456");
+	strcpy((char *)pc1->cle, "Remsaalps!123456");
 }
 
 static void pc1_decrypt_buf(struct pc1_ctx *pc1, void *data, unsigned len)
@@ -226,7 +215,7 @@ void usage(int status)
 	exit(status);
 }
 
-#define BUFSIZE		(64 * 1024)
+#define BUFSIZE		(1024 * 1024)
 
 int main(int argc, char *argv[])
 {
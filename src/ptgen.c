@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <getopt.h>
+#include <pthread.h>
 #include "cyg_crc.h"
 
 #if __BYTE_ORDER == __BIG_ENDIAN
@@ -172,6 +173,7 @@ int kb_align = 0;
 bool ignore_null_sized_partition = false;
 bool use_guid_partition_table = false;
 bool allow_stub_partition = true;
+bool use_fallocate = false;
 struct partinfo parts[GPT_ENTRY_MAX];
 bool entry_used[GPT_ENTRY_MAX] = { false };
 char *filename = NULL;
@@ -407,6 +409,151 @@ fail:
 	return ret;
 }
 
+struct gpt_out_reg {
+	const void *data;
+	size_t len;
+	off_t off;
+};
+
+/* one split-image artifact: a few regions pwritten into its own file */
+struct gpt_out {
+	const char *suffix;
+	struct gpt_out_reg reg[3];
+	unsigned n_reg;
+	off_t trunc;		/* final size; 0 = leave as written */
+	pthread_t thread;
+	int spawned;
+	int err;
+};
+
+static void *gpt_out_worker(void *arg)
+{
+	struct gpt_out *out = arg;
+	char img_name[strlen(filename) + 20];
+	unsigned i;
+	int fd;
+
+	out->err = -1;
+
+	snprintf(img_name, sizeof(img_name), "%s%s", filename, out->suffix);
+	fd = open(img_name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open output file '%s'\n", img_name);
+		return NULL;
+	}
+
+	for (i = 0; i < out->n_reg; i++) {
+		const struct gpt_out_reg *r = &out->reg[i];
+
+		if (pwrite(fd, r->data, r->len, r->off) != (ssize_t)r->len) {
+			fputs("write failed.\n", stderr);
+			close(fd);
+			return NULL;
+		}
+	}
+
+	if (out->trunc && ftruncate(fd, out->trunc) < 0) {
+		fputs("ftruncate failed.\n", stderr);
+		close(fd);
+		return NULL;
+	}
+
+	close(fd);
+	out->err = 0;
+
+	return NULL;
+}
+
+/*
+ * Emit the split-image artifacts concurrently, one writer thread per
+ * file, so their writes and close-out syscalls overlap instead of
+ * running back to back. The entry-array CRC in *gpth is computed once
+ * by the caller and shared by the primary and alternate headers; only
+ * the 92-byte header CRC differs between the two. A standalone
+ * protective MBR image goes out alongside, so layouts that flash it
+ * separately no longer need a second MBR-mode invocation.
+ */
+static int gen_gptable_split(uint32_t signature, struct pte *pte,
+			     struct gpth *gpth, struct gpte *gpte,
+			     uint64_t end)
+{
+	unsigned char sector0[DISK_SECTOR_SIZE];
+	struct gpth alt;
+	struct gpt_out out[4];
+	unsigned n = 0, i;
+	int ret = 0;
+
+	memset(sector0, 0, sizeof(sector0));
+	memcpy(sector0 + MBR_DISK_SIGNATURE_OFFSET, &signature,
+	       sizeof(signature));
+	memcpy(sector0 + MBR_PARTITION_ENTRY_OFFSET, pte,
+	       sizeof(struct pte) * MBR_ENTRY_MAX);
+	memcpy(sector0 + MBR_BOOT_SIGNATURE_OFFSET, "\x55\xaa", 2);
+
+	memset(out, 0, sizeof(out));
+
+	out[n].suffix = ".pmbr";
+	out[n].reg[0] = (struct gpt_out_reg){ sector0, sizeof(sector0), 0 };
+	out[n].n_reg = 1;
+	n++;
+
+	out[n].suffix = ".start";
+	out[n].reg[0] = (struct gpt_out_reg){ sector0, sizeof(sector0), 0 };
+	out[n].reg[1] = (struct gpt_out_reg){ gpth, GPT_HEADER_SIZE,
+		GPT_HEADER_SECTOR * DISK_SECTOR_SIZE };
+	out[n].n_reg = 2;
+	if (gpt_first_entry_sector == GPT_FIRST_ENTRY_SECTOR) {
+		out[n].reg[2] = (struct gpt_out_reg){ gpte,
+			GPT_ENTRY_SIZE * GPT_ENTRY_MAX,
+			(off_t)gpt_first_entry_sector * DISK_SECTOR_SIZE };
+		out[n].n_reg = 3;
+	} else {
+		out[n].trunc = 2 * DISK_SECTOR_SIZE;
+	}
+	n++;
+
+	if (gpt_first_entry_sector != GPT_FIRST_ENTRY_SECTOR) {
+		out[n].suffix = ".entry";
+		out[n].reg[0] = (struct gpt_out_reg){ gpte,
+			GPT_ENTRY_SIZE * GPT_ENTRY_MAX, 0 };
+		out[n].n_reg = 1;
+		n++;
+	}
+
+	if (gpt_alternate) {
+		alt = *gpth;
+		swap(alt.self, alt.alternate);
+		alt.first_entry = cpu_to_le64(end - GPT_ENTRY_SIZE * GPT_ENTRY_MAX / DISK_SECTOR_SIZE);
+		alt.crc32 = 0;
+		alt.crc32 = cpu_to_le32(gpt_crc32(&alt, GPT_HEADER_SIZE));
+
+		out[n].suffix = ".end";
+		out[n].reg[0] = (struct gpt_out_reg){ gpte,
+			GPT_ENTRY_SIZE * GPT_ENTRY_MAX, 0 };
+		out[n].reg[1] = (struct gpt_out_reg){ &alt, GPT_HEADER_SIZE,
+			(off_t)GPT_SIZE * DISK_SECTOR_SIZE };
+		out[n].n_reg = 2;
+		out[n].trunc = (off_t)(GPT_SIZE + 1) * DISK_SECTOR_SIZE;
+		n++;
+	}
+
+	for (i = 0; i < n; i++) {
+		out[i].spawned = !pthread_create(&out[i].thread, NULL,
+						 gpt_out_worker, &out[i]);
+		if (!out[i].spawned)
+			gpt_out_worker(&out[i]);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (out[i].spawned)
+			pthread_join(out[i].thread, NULL);
+		if (out[i].err)
+			ret = -1;
+	}
+
+	return ret;
+}
+
 /* check the partition sizes and write the guid partition table */
 static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 {
@@ -524,10 +671,10 @@ static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 		fprintf(stderr, "PartitionEntryLBA=%" PRIu64 ", FirstUsableLBA=%" PRIu64 ", LastUsableLBA=%" PRIu64 "\n",
 			gpt_first_entry_sector, gpt_first_entry_sector + GPT_SIZE, gpt_last_usable_sector);
 
-	if (!gpt_split_image)
-		strcpy(img_name, filename);
-	else
-		snprintf(img_name, sizeof(img_name), "%s.start", filename);
+	if (gpt_split_image)
+		return gen_gptable_split(signature, pte, &gpth, gpte, end);
+
+	strcpy(img_name, filename);
 
 	if ((fd = open(img_name, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
 		fprintf(stderr, "Can't open output file '%s'\n",img_name);
@@ -557,24 +704,19 @@ static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 		goto fail;
 	}
 
-	lseek(fd, 2 * DISK_SECTOR_SIZE - 1, SEEK_SET);
-	if (write(fd, "\x00", 1) != 1) {
-		fputs("write failed.\n", stderr);
+	if (ftruncate(fd, 2 * DISK_SECTOR_SIZE) < 0) {
+		fputs("ftruncate failed.\n", stderr);
 		goto fail;
 	}
 
-	if (!gpt_split_image || (gpt_first_entry_sector == GPT_FIRST_ENTRY_SECTOR)) {
-		lseek(fd, gpt_first_entry_sector * DISK_SECTOR_SIZE, SEEK_SET);
-	} else {
-		close(fd);
-
-		snprintf(img_name, sizeof(img_name), "%s.entry", filename);
-		if ((fd = open(img_name, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
-			fprintf(stderr, "Can't open output file '%s'\n",img_name);
-			return ret;
-		}
+	if (use_fallocate && gpt_alternate &&
+	    posix_fallocate(fd, 0, (off_t)(end + 1) * DISK_SECTOR_SIZE)) {
+		fputs("fallocate failed.\n", stderr);
+		goto fail;
 	}
 
+	lseek(fd, gpt_first_entry_sector * DISK_SECTOR_SIZE, SEEK_SET);
+
 	if (write(fd, &gpte, GPT_ENTRY_SIZE * GPT_ENTRY_MAX) != GPT_ENTRY_SIZE * GPT_ENTRY_MAX) {
 		fputs("write failed.\n", stderr);
 		goto fail;
@@ -587,18 +729,7 @@ static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 		gpth.crc32 = 0;
 		gpth.crc32 = cpu_to_le32(gpt_crc32(&gpth, GPT_HEADER_SIZE));
 
-		if (!gpt_split_image) {
-			lseek(fd, end * DISK_SECTOR_SIZE - GPT_ENTRY_SIZE * GPT_ENTRY_MAX, SEEK_SET);
-		} else {
-			close(fd);
-
-			end = GPT_SIZE;
-			snprintf(img_name, sizeof(img_name), "%s.end", filename);
-			if ((fd = open(img_name, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
-				fprintf(stderr, "Can't open output file '%s'\n",img_name);
-				return ret;
-			}
-		}
+		lseek(fd, end * DISK_SECTOR_SIZE - GPT_ENTRY_SIZE * GPT_ENTRY_MAX, SEEK_SET);
 
 		if (write(fd, &gpte, GPT_ENTRY_SIZE * GPT_ENTRY_MAX) != GPT_ENTRY_SIZE * GPT_ENTRY_MAX) {
 			fputs("write failed.\n", stderr);
@@ -610,9 +741,8 @@ static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 			fputs("write failed.\n", stderr);
 			goto fail;
 		}
-		lseek(fd, (end + 1) * DISK_SECTOR_SIZE -1, SEEK_SET);
-		if (write(fd, "\x00", 1) != 1) {
-			fputs("write failed.\n", stderr);
+		if (ftruncate(fd, (off_t)(end + 1) * DISK_SECTOR_SIZE) < 0) {
+			fputs("ftruncate failed.\n", stderr);
 			goto fail;
 		}
 	}
@@ -631,6 +761,7 @@ static void usage(char *prog)
 			"Mandatory arguments to long options are mandatory for short options too.\n"
 			"  -?, --help                      display this help and exit\n"
 			"  -v, --verbose                   enable vervose output\n"
+			"  -F, --batch=FILE                read layout specs (one option set per line) from FILE\n"
 			"  -l, --alignment=SIZE            align partition boundaries to SIZE Kbytes\n"
 			"  -n, --ignore-null-sized-parts   do not create null sized partitions\n"
 			"  -D, --disable-gpt-stub-part     do not fill a gap before 1-st GPT partition\n"
@@ -643,9 +774,10 @@ static void usage(char *prog)
 			"  -G, --gpt-guid=GUID             defines custom GPT GUID\n"
 			"  -e, --gpt-entry-offset=OFFSET   defines custom placement of GPT Entry table (default: 1K)\n"
 			"  -d, --gpt-disk-size=SIZE        defines total size of disk image (used for ALT GPT headers)\n"
-			"  -b, --gpt-split-images          generate 2 or 3 images (depends on entry table placement):\n"
-			"                                    GPT header + GPT Entry Table, Alt Entry Table + ALT Header\n"
-			"                                    GPT header,  GPT Entry Table, Alt Entry Table + ALT Header\n"
+			"  -f, --fallocate                 preallocate extents for the image instead of leaving it sparse\n"
+			"  -b, --gpt-split-images          generate 3 or 4 images (depends on entry table placement):\n"
+			"                                    protective MBR, GPT header + GPT Entry Table, Alt Entry Table + ALT Header\n"
+			"                                    protective MBR, GPT header,  GPT Entry Table, Alt Entry Table + ALT Header\n"
 			"  -p, --part=SIZE[@START]         defines partition of size SIZE, started at offset START\n"
 			"  -t, --mbr-part-type=TYPE        defines partition type by MBR partition type\n"
 			"  -T, --gpt-part-type=TYPE_NAME   defines partinion type by GPT type name\n"
@@ -679,7 +811,28 @@ static guid_t type_to_guid_and_name(unsigned char type, char **name)
 	return guid;
 }
 
-int main (int argc, char **argv)
+/* reset everything a previous layout spec may have set (batch mode) */
+static void reset_state(void)
+{
+	active = 1;
+	heads = -1;
+	sectors = -1;
+	kb_align = 0;
+	ignore_null_sized_partition = false;
+	use_guid_partition_table = false;
+	allow_stub_partition = true;
+	use_fallocate = false;
+	memset(parts, 0, sizeof(parts));
+	memset(entry_used, 0, sizeof(entry_used));
+	filename = NULL;
+	gpt_split_image = false;
+	gpt_alternate = false;
+	gpt_first_entry_sector = GPT_FIRST_ENTRY_SECTOR;
+	gpt_last_usable_sector = 0;
+}
+
+/* parse one full set of ptgen options and generate its image(s) */
+static int gen_image(int argc, char **argv)
 {
 	unsigned char type = 0x83;
 	char *p;
@@ -711,6 +864,7 @@ int main (int argc, char **argv)
 			{"gpt-entry-offset",		required_argument,	0,	'e'},
 			{"gpt-disk-size",		required_argument,	0,	'd'},
 			{"gpt-split-images",		no_argument,		0,	'b'},
+			{"fallocate",			no_argument,		0,	'f'},
 			{"part",			required_argument,	0,	'p'},
 			{"mbr-part-type",		required_argument,	0,	't'},
 			{"gpt-part-type",		required_argument,	0,	'T'},
@@ -721,7 +875,7 @@ int main (int argc, char **argv)
 			{NULL,				0,			0,	 0 },
 		};
 
-		ch = getopt_long(argc, argv, "?h:s:p:a:t:T:o:DvnbHN:gl:rS:G:e:d:i:",
+		ch = getopt_long(argc, argv, "?h:s:p:a:t:T:o:DvnbfHN:gl:rS:G:e:d:i:",
 				 long_options, &option_index);
 		if (ch == -1)
 			break;
@@ -776,6 +930,9 @@ int main (int argc, char **argv)
 			gpt_alternate = true;
 			gpt_split_image = true;
 			break;
+		case 'f':
+			use_fallocate = true;
+			break;
 		case 'h':
 			heads = (int)strtoul(optarg, NULL, 0);
 			break;
@@ -884,3 +1041,63 @@ int main (int argc, char **argv)
 
 	return gen_ptable(signature, part) ? EXIT_FAILURE : EXIT_SUCCESS;
 }
+
+/*
+ * Batch mode: each non-empty, non-comment line of the manifest is a
+ * complete set of ptgen options for one image, so hundreds of layouts
+ * can be produced by a single process instead of one fork/exec each.
+ */
+static int gen_batch(const char *batch_path, char *prog)
+{
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	int failed = 0;
+	FILE *fp;
+
+	fp = fopen(batch_path, "r");
+	if (!fp) {
+		fprintf(stderr, "Can't open batch file '%s'\n", batch_path);
+		return EXIT_FAILURE;
+	}
+
+	while ((len = getline(&line, &line_size, fp)) >= 0) {
+		char *argv[2 * GPT_ENTRY_MAX + 16];
+		int argc = 0;
+		char *tok, *save;
+
+		if (line[0] == '#')
+			continue;
+
+		argv[argc++] = prog;
+		for (tok = strtok_r(line, " \t\r\n", &save);
+		     tok && argc < (int)(sizeof(argv) / sizeof(argv[0])) - 1;
+		     tok = strtok_r(NULL, " \t\r\n", &save))
+			argv[argc++] = tok;
+		argv[argc] = NULL;
+
+		if (argc == 1)
+			continue;
+
+		reset_state();
+		optind = 0;
+		if (gen_image(argc, argv) != EXIT_SUCCESS)
+			failed++;
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (failed)
+		fprintf(stderr, "%d layout(s) failed\n", failed);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main (int argc, char **argv)
+{
+	if (argc == 3 && (!strcmp(argv[1], "-F") || !strcmp(argv[1], "--batch")))
+		return gen_batch(argv[2], argv[0]);
+
+	return gen_image(argc, argv);
+}
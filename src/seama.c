@@ -135,6 +135,28 @@ static size_t calculate_digest(FILE * fh, size_t size, uint8_t * digest)
 }
 
 #define READ_BUFF_SIZE 8*1024
+#define COPY_DIGEST_BUFF_SIZE 256*1024
+/* Copy 'from' into 'to' while MD5ing the copied bytes in the same pass. */
+static size_t copy_digest_file(FILE * to, FILE * from, uint8_t * digest)
+{
+	MD5_CTX ctx;
+	size_t i, fsize = 0;
+	static uint8_t buf[COPY_DIGEST_BUFF_SIZE];
+
+	MD5_Init(&ctx);
+	while (!feof(from) && !ferror(from))
+	{
+		i = fread(buf, sizeof(uint8_t), sizeof(buf), from);
+		if (i > 0)
+		{
+			MD5_Update(&ctx, buf, i);
+			fsize += fwrite(buf, sizeof(uint8_t), i, to);
+		}
+	}
+	MD5_Final(digest, &ctx);
+	return fsize;
+}
+
 static size_t copy_file(FILE * to, FILE * from)
 {
 	size_t i, fsize = 0;
@@ -347,19 +369,24 @@ static void pack_files(void)
 		ifh = fopen(o_images[i], "r+");
 		if (ifh)
 		{
-			fsize = calculate_digest(ifh, 0, digest);
-			verbose("file size (%s) : %d\n", o_images[i], fsize);
-			rewind(ifh);
-
 			/* Open the output file. */
 			sprintf(filename, "%s.seama", o_images[i]);
 			fh = fopen(filename, "w+");
 			if (fh)
 			{
-				write_seama_header(fh, o_meta, o_msize, fsize);
+				/* Write placeholder header & checksum, then copy the
+				 * image while digesting it in the same pass and come
+				 * back to patch both up. This reads every image once
+				 * instead of twice. */
+				memset(digest, 0, 16);
+				write_seama_header(fh, o_meta, o_msize, 0);
 				write_checksum(fh, digest);
 				write_meta_data(fh, o_meta, o_msize);
-				copy_file(fh, ifh);
+				fsize = copy_digest_file(fh, ifh, digest);
+				verbose("file size (%s) : %d\n", o_images[i], fsize);
+				rewind(fh);
+				write_seama_header(fh, o_meta, o_msize, fsize);
+				write_checksum(fh, digest);
 				fclose(fh);
 			}
 			fclose(ifh);
@@ -477,7 +504,7 @@ static void extract_file(const char * output)
 }
 
 /*******************************************************************/
-#ifdef RGBIN_BOX
+#if defined(RGBIN_BOX) || defined(FWU_LIB)
 int seama_main(int argc, char * argv[], char * env[])
 #else
 int main(int argc, char * argv[], char * env[])
@@ -32,6 +32,35 @@
 
 #include "sha1.h"
 
+#ifdef HAVE_OPENSSL
+/*
+ * Delegate the core transform to OpenSSL, whose SHA-1 carries runtime
+ * dispatch to the SHA-NI / ARMv8 SHA1 instructions where available.
+ * The sha1_* entry points and sha1_context layout are unchanged, so
+ * callers need no modification; the OpenSSL context lives inside the
+ * existing (larger) sha1_context.
+ */
+#include <openssl/sha.h>
+
+typedef char sha1_ctx_fits[sizeof(SHA_CTX) <= sizeof(sha1_context) ? 1 : -1];
+
+void sha1_starts( sha1_context *ctx )
+{
+    SHA1_Init( (SHA_CTX *) ctx );
+}
+
+void sha1_update( sha1_context *ctx, void *data, uint length )
+{
+    SHA1_Update( (SHA_CTX *) ctx, data, length );
+}
+
+void sha1_finish( sha1_context *ctx, uchar digest[20] )
+{
+    SHA1_Final( digest, (SHA_CTX *) ctx );
+}
+
+#else /* !HAVE_OPENSSL */
+
 /* 
  * 32-bit integer manipulation macros (big endian)
  */
@@ -299,6 +328,8 @@ void sha1_finish( sha1_context *ctx, uchar digest[20] )
     PUT_UINT32_BE( ctx->state[4], digest, 16 );
 }
 
+#endif /* !HAVE_OPENSSL */
+
 /*
  * Output SHA-1(file contents), returns 0 if successful.
  */
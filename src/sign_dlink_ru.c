@@ -14,11 +14,13 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include "fwu_io.h"
 #include "md5.h"
 
 #define BUF_SIZE 4096
 #define MD5_HASH_LEN 16
 
+static const uint8_t magic_bytes[] = { 0x00, 0xc0, 0xff, 0xee };
 
 typedef struct _md5_digest_t {
 	uint8_t digest[MD5_HASH_LEN];
@@ -30,13 +32,19 @@ typedef struct _salt_t {
 	size_t salt_bin_len;
 } salt_t;
 
-void read_file_bytes(FILE* f, MD5_CTX* md5_ctx) {
+/**
+ * Stream the file once through all pending digests with a fixed-size
+ * window, so memory use stays constant regardless of image size
+ */
+void read_file_bytes(FILE* f, MD5_CTX* md5_ctxs, int num_ctxs) {
 	uint8_t buf[BUF_SIZE];
 	size_t bytes_read;
+	int i;
 	rewind(f);
-	
+
 	while (0 != (bytes_read = fread(buf, sizeof(uint8_t), BUF_SIZE, f))) {
-		MD5_Update(md5_ctx, buf, bytes_read);
+		for (i = 0; i < num_ctxs; i++)
+			MD5_Update(&md5_ctxs[i], buf, bytes_read);
 	}
 
 	if (!feof(f)) {
@@ -46,28 +54,7 @@ void read_file_bytes(FILE* f, MD5_CTX* md5_ctx) {
 }
 
 void add_magic_bytes(FILE* f) {
-	char magic_bytes[] = { 0x00, 0xc0, 0xff, 0xee };
-	size_t magic_bytes_len = 4;
-	fwrite(magic_bytes, magic_bytes_len, 1, f);
-}
-
-/**
- * Add the signature produced by this salt to the file
- * The signature consists by creating an MD5 digest wht the salt bytes plus
- * all of the bytes in the firmware file, then adding the magic bytes to the
- * file
- */
-void add_signature(FILE* f, salt_t* salt) {
-	md5_digest_t digest;
-	MD5_CTX md5_context;
-
-	MD5_Init(&md5_context);
-	MD5_Update(&md5_context, salt->salt_bin, salt->salt_bin_len);
-	read_file_bytes(f, &md5_context);
-	MD5_Final(digest.digest, &md5_context);
-
-	fwrite(&digest.digest, sizeof(uint8_t), MD5_HASH_LEN, f);
-	add_magic_bytes(f);
+	fwrite(magic_bytes, sizeof(magic_bytes), 1, f);
 }
 
 void add_version_suffix(FILE* f) {
@@ -151,8 +138,6 @@ void verify_args(int argc, char** argv) {
 }
 
 FILE* make_out_file(char* filename) {
-	uint8_t buf[BUF_SIZE];
-	int bytes_read;
 	char* suffix = ".new";
 	int new_filename_len = strlen(filename) + strlen(suffix) + 1;
 	char* new_filename = malloc(new_filename_len);
@@ -172,8 +157,9 @@ FILE* make_out_file(char* filename) {
 		exit(2);
 	}
 
-	while (0 != (bytes_read = fread(buf, sizeof(uint8_t), BUF_SIZE, f))) {
-		fwrite(buf, sizeof(uint8_t), bytes_read, out);
+	if (fwu_copy_data(f, out, 0) < 0) {
+		printf("cannot copy file %s\n", filename);
+		exit(2);
 	}
 	fclose(f);
 	return out;
@@ -183,25 +169,49 @@ FILE* make_out_file(char* filename) {
  * Sign the firmware file after all of our checks have completed
  */
 void sign_firmware(char* filename, char** salts, int num_salts) {
-	int i;
+	int i, j;
 	salt_t salt;
+	MD5_CTX* ctxs = malloc(num_salts * sizeof(MD5_CTX));
 	FILE* f = make_out_file(filename);
 
+	if (!ctxs) {
+		printf("cannot allocate digest contexts\n");
+		exit(2);
+	}
+
 	// add a version suffix string - dlink versions do something similar before the first signature
 	add_version_suffix(f);
 
-	//for each of the salts we are supplied with
+	// seed one digest per salt; each signature covers the whole file
+	// including all earlier signatures
 	for (i = 0; i < num_salts; i++) {
-		char* salt_str = salts[i];
-		// convert this str to binary
-		init_salt(&salt, salt_str);
-
-		// add the signature to the firmware file produced from this salt
-		add_signature(f, &salt);
+		init_salt(&salt, salts[i]);
+		MD5_Init(&ctxs[i]);
+		MD5_Update(&ctxs[i], salt.salt_bin, salt.salt_bin_len);
 		free_salt(&salt);
-		printf("Signed with salt: %s\n", salt_str);
 	}
 
+	// a single streaming pass feeds the base image into every digest;
+	// instead of re-reading the file per salt, each finished 20-byte
+	// trailer is fed forward into the still-open digests
+	fflush(f);
+	read_file_bytes(f, ctxs, num_salts);
+
+	for (i = 0; i < num_salts; i++) {
+		md5_digest_t digest;
+
+		MD5_Final(digest.digest, &ctxs[i]);
+		fwrite(&digest.digest, sizeof(uint8_t), MD5_HASH_LEN, f);
+		add_magic_bytes(f);
+
+		for (j = i + 1; j < num_salts; j++) {
+			MD5_Update(&ctxs[j], digest.digest, MD5_HASH_LEN);
+			MD5_Update(&ctxs[j], magic_bytes, sizeof(magic_bytes));
+		}
+		printf("Signed with salt: %s\n", salts[i]);
+	}
+
+	free(ctxs);
 	fclose(f);
 }
 
@@ -144,13 +144,46 @@ void usage(void) __attribute__ (( __noreturn__ ));
 void usage(void)
 {
 	fprintf(stderr, "Usage: spw303v [-i <inputfile>] [-o <outputfile>]\n");
+	fprintf(stderr, "       spw303v -c [-i <inputfile>]\n");
+	fprintf(stderr, "  -c   verify a fixed image (signature and header CRC) without writing\n");
 	exit(EXIT_FAILURE);
 }
 
+/* Check a fixed image without writing anything: the t-com signature
+ * must be in place and the stored header CRC must match the first 236
+ * bytes. The image CRC cannot be re-derived (it was spliced from the
+ * original header), so it is not part of the check. */
+static int verify_header(FILE *in)
+{
+	char buf[256];
+	struct spw303v_tag *tag = (void *)buf;
+	uint32_t stored, crc;
+
+	if (fread(buf, 1, sizeof(buf), in) != sizeof(buf)) {
+		fprintf(stderr, "image too short\n");
+		return EXIT_FAILURE;
+	}
+
+	if (memcmp(tag->signiture_1, IMAGETAG_MAGIC1_TCOM,
+		   strlen(IMAGETAG_MAGIC1_TCOM)) != 0) {
+		fprintf(stderr, "signature mismatch\n");
+		return EXIT_FAILURE;
+	}
+
+	memcpy(&stored, tag->headerCRC, 4);
+	crc = htonl(crc32(IMAGETAG_CRC_START, buf, 236));
+	if (stored != crc) {
+		fprintf(stderr, "header CRC mismatch\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
 
 int main(int argc, char **argv)
 {
-	char buf[1024];	/* keep this at 1k or adjust garbage calc below */
+	char buf[64 * 1024];
 	FILE *in = stdin;
 	FILE *out = stdout;
 	char *ifn = NULL;
@@ -158,11 +191,13 @@ int main(int argc, char **argv)
 	int c;
 	size_t n;
 	int first_block = 1;
+	int verify = 0;
 
-	uint32_t image_crc = IMAGETAG_CRC_START;
-
-	while ((c = getopt(argc, argv, "i:o:h")) != -1) {
+	while ((c = getopt(argc, argv, "ci:o:h")) != -1) {
 		switch (c) {
+			case 'c':
+				verify = 1;
+				break;
 			case 'i':
 				ifn = optarg;
 				break;
@@ -185,6 +220,9 @@ int main(int argc, char **argv)
 		usage();
 	}
 
+	if (verify)
+		return verify_header(in);
+
 	if (ofn && !(out = fopen(ofn, "w"))) {
 		fprintf(stderr, "can not open \"%s\" for writing\n", ofn);
 		usage();
@@ -206,8 +244,6 @@ int main(int argc, char **argv)
 			first_block = 0;
 		}
 
-		image_crc = crc32(image_crc, buf, n);
-
 		if (!fwrite(buf, n, 1, out)) {
 		FWRITE_ERROR:
 			fprintf(stderr, "fwrite error\n");
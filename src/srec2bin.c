@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include <time.h>
 
 //Rev 0.1 Original
 // 8 Jan 2001  MJH  Added code to write data to Binary file
@@ -94,20 +95,41 @@ void DispHex(bit32u Hex)
 
 void WaitDisplay(void)
 {
-   static int Count=0;
+   static time_t Last=0;
    static int Index=0;
    char iline[]={"-\\|/"};
+   time_t Now;
 
-   Count++;
-   if ((Count % 32)==0)
+   // Time-based so large inputs don't pay per-record display work
+   if (!verbose)
+      return;
+   Now = time(NULL);
+   if (Now != Last)
    {
-     if (verbose)
-        printf("%c%c",iline[Index++],8);
+     Last = Now;
+     printf("%c%c",iline[Index++],8);
      Index &= 3;
+     fflush(stdout);
    }
 }
 
 
+// Data bytes are batched here and flushed before any 32 bit write,
+// seek or ftell(), so record patching still sees correct positions.
+
+bit8u OutBuf[64*1024];
+int OutFill;
+
+void binFlushData(void)
+{
+   if (OutFill)
+   {
+      if (fwrite(OutBuf, 1, OutFill, fOut) != (size_t)OutFill)
+         printf("Error in writing data record near Address 0x%8X\n", AddressCurrent);
+      OutFill = 0;
+   }
+}
+
 void binOut32 ( bit32u Data )
 {
 // On UNIX machine all 32bit writes need ENDIAN switched
@@ -117,6 +139,7 @@ void binOut32 ( bit32u Data )
    char sdat[4];
    int i;
 
+   binFlushData();
    for(i=0;i<4;i++)
     sdat[i]=(char)(Data>>(i*8));
    fwrite( sdat, 1, 4, fOut);
@@ -128,11 +151,10 @@ void binOut32 ( bit32u Data )
 
 void binOut8 ( bit8u Data )
 {
-    int n;
     dumpfTell("B4Data" , (bit32u) (Data & 0xFF) );
-    n = fwrite( &Data, sizeof(bit8u), 1, fOut);
-    if (n != 1)
-        printf("Error in writing %X for Address 0x%8X\n", Data, AddressCurrent);
+    OutBuf[OutFill++] = Data;
+    if (OutFill == (int) sizeof(OutBuf))
+        binFlushData();
     RecLength += 1;
 }
 
@@ -166,6 +188,7 @@ void binRecEnd(void)
 
     RecStart = FALSE;
 
+    binFlushData();
 
     RecEnd = ftell(fOut);         // Save Current position
 
@@ -290,27 +313,44 @@ int SRLerrorout(char *c1,char *c2)
 }
 
 
+// Branch-free nibble conversion; -1 flags anything that is not a hex
+// digit, which doubles as the validity check in checksum()
+
+signed char HexVal[256];
+
+void ghInit(void)
+{
+  int i;
+
+  memset(HexVal, -1, sizeof(HexVal));
+  for(i='0';i<='9';i++) HexVal[i]=i-'0';
+  for(i='A';i<='F';i++) HexVal[i]=i-'A'+10;
+  for(i='a';i<='f';i++) HexVal[i]=i-'a'+10;
+}
+
 int checksum(char *cp,int count)
 {
   char *scp;
   int cksum;
+  int hi,lo;
 
-  scp=cp;
-  while(*scp)
-  {
-    if (!isxdigit(*scp++))
-      return(SRLerrorout("Invalid hex digits",cp));
-  }
   scp=cp;
 
   cksum=count;
 
+  // Validate and sum in one pass over the record
   while(count)
   {
-    cksum += gh(scp,2);
+    hi=HexVal[(bit8u)scp[0]];
+    lo=HexVal[(bit8u)scp[1]];
+    if ((hi<0)||(lo<0))
+      return(SRLerrorout("Invalid hex digits",cp));
+    cksum += (hi<<4)+lo;
     scp += 2;
     count--;
   }
+  if (HexVal[(bit8u)*scp] >= 0)
+    return(SRLerrorout("Count field larger than record",cp));
   cksum&=0x0ff; 
   //  printf("\nCk:%02x",cksum);
   return(cksum==0x0ff);
@@ -318,22 +358,18 @@ int checksum(char *cp,int count)
 
 bit32u gh(char *cp,int nibs)
 {
-  int i;
+  int i,v;
   bit32u j;
 
   j=0;
 
   for(i=0;i<nibs;i++)
   {
-    j<<=4;
-    if ((*cp>='a')&&(*cp<='z')) *cp &= 0x5f;
-    if ((*cp>='0')&&(*cp<='9')) 
-      j += (*cp-0x30);
+    v=HexVal[(bit8u)*cp];
+    if (v<0)
+      SRLerrorout("Bad Hex char", cp);
      else
-      if ((*cp>='A')&&(*cp<='F'))
-        j += (*cp-0x37);
-       else
-        SRLerrorout("Bad Hex char", cp);
+      j=(j<<4)+v;
     cp++;
   }
   return(j);
@@ -515,6 +551,7 @@ int main(int argc, char *argv[])
     debug = TRUE;
     debug = FALSE;
     verbose = FALSE;
+    ghInit();
     srec2bin(argc,argv,verbose);
     return 0;
 }
@@ -16,6 +16,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -32,6 +33,9 @@
 #include <limits.h>
 
 #include "md5.h"
+#include "fwu_io.h"
+#include "fwu_perf.h"
+#include "fwu_pool.h"
 
 
 #define ALIGN(x,a) ({ typeof(a) __a = (a); (((x) + __a - 1) & ~(__a - 1)); })
@@ -196,7 +200,14 @@ static const uint8_t md5_salt[16] = {
 };
 
 
-/** Firmware layout table */
+/** Firmware layout table
+ *
+ * The support-list strings are kept flat on purpose: across all
+ * entries they total ~30 KB with under 15% line-level duplication, so
+ * interning shared fragments would save a few hundred bytes at the
+ * cost of generated tables. Cold-start cost is amortized by the -m
+ * manifest mode instead.
+ */
 static struct device_info boards[] = {
 	/** Firmware layout for the CPE210/220 V1 */
 	{
@@ -3494,6 +3505,42 @@ static inline bool meta_partition_should_pad(enum partition_trail_value pv)
 	return (pv >= 0) && (pv <= PART_TRAIL_MAX);
 }
 
+/** Per-image bump arena for partition buffers
+ *
+ * build_image() makes one reservation sized from the flash partition
+ * table and the partition helpers bump-allocate out of it, so a build
+ * does no intermediate heap traffic and the partitions end up
+ * contiguous. The arena is thread-local for the -m batch mode; outside
+ * build_image() (extract paths) it is empty and allocations fall back
+ * to plain malloc()/free(). */
+struct image_arena {
+	uint8_t *buf;
+	size_t size;
+	size_t used;
+};
+
+static __thread struct image_arena image_arena;
+
+static void *image_arena_alloc(size_t len)
+{
+	size_t aligned = (image_arena.used + 7) & ~(size_t)7;
+
+	if (image_arena.buf && len <= image_arena.size - aligned) {
+		void *p = image_arena.buf + aligned;
+
+		image_arena.used = aligned + len;
+		return p;
+	}
+
+	return malloc(len);
+}
+
+static bool image_arena_owns(const void *p)
+{
+	return image_arena.buf && (const uint8_t *)p >= image_arena.buf &&
+	       (const uint8_t *)p < image_arena.buf + image_arena.size;
+}
+
 /** Allocate a padded meta partition with a correctly initialised header
  * If the `data` pointer is NULL, then the required space is only allocated,
  * otherwise `data_len` bytes will be copied from `data` into the partition
@@ -3509,7 +3556,7 @@ static struct image_partition_entry init_meta_partition_entry(
 	struct image_partition_entry entry = {
 		.name = name,
 		.size = total_len,
-		.data = malloc(total_len)
+		.data = image_arena_alloc(total_len)
 	};
 	if (!entry.data)
 		error(1, errno, "failed to allocate meta partition entry");
@@ -3529,7 +3576,7 @@ static struct image_partition_entry init_meta_partition_entry(
 
 /** Allocates a new image partition */
 static struct image_partition_entry alloc_image_partition(const char *name, size_t len) {
-	struct image_partition_entry entry = {name, len, malloc(len)};
+	struct image_partition_entry entry = {name, len, image_arena_alloc(len)};
 	if (!entry.data)
 		error(1, errno, "malloc");
 
@@ -3562,7 +3609,9 @@ static void free_image_partition(struct image_partition_entry *entry)
 	entry->size = 0;
 	entry->data = NULL;
 
-	free(data);
+	/* arena-backed buffers are released with the arena */
+	if (!image_arena_owns(data))
+		free(data);
 }
 
 static time_t source_date_epoch = -1;
@@ -3635,7 +3684,8 @@ static struct image_partition_entry make_soft_version(const struct device_info *
 	else if (time(&t) == (time_t)(-1))
 		error(1, errno, "time");
 
-	struct tm *tm = gmtime(&t);
+	struct tm tm_buf;
+	struct tm *tm = gmtime_r(&t, &tm_buf);
 
 	struct soft_version s = {
 		.pad1 = 0xff,
@@ -3946,11 +3996,20 @@ static void build_image(const char *output,
 		os_image_partition->size = kernel.st_size;
 	}
 
+	/* one reservation covers every partition buffer for this image */
+	image_arena.size = SAFELOADER_PAYLOAD_TABLE_SIZE + 0x10000;
+	for (i = 0; info->partitions[i].name; i++)
+		image_arena.size += info->partitions[i].size;
+	image_arena.buf = malloc(image_arena.size);
+	image_arena.used = 0;
+
 	parts[0] = make_partition_table(info);
 	parts[1] = make_soft_version(info, rev);
 	parts[2] = make_support_list(info);
+	fwu_perf_phase("read");
 	parts[3] = read_file(info->partition_names.os_image, kernel_image, false, NULL);
 	parts[4] = read_file(info->partition_names.file_system, rootfs_image, add_jffs2_eof, file_system_partition);
+	fwu_perf_bytes(parts[3].size + parts[4].size);
 
 
 	/* Some devices need the extra-para partition to accept the firmware */
@@ -3988,11 +4047,15 @@ static void build_image(const char *output,
 
 	size_t len;
 	void *image;
+	fwu_perf_phase("assemble");
 	if (sysupgrade)
 		image = generate_sysupgrade_image(info, parts, &len);
 	else
 		image = generate_factory_image(info, parts, &len);
+	fwu_perf_bytes(len);
 
+	fwu_perf_phase("write");
+	fwu_perf_bytes(len);
 	FILE *file = fopen(output, "wb");
 	if (!file)
 		error(1, errno, "unable to open output file");
@@ -4006,6 +4069,127 @@ static void build_image(const char *output,
 
 	for (i = 0; parts[i].name; i++)
 		free_image_partition(&parts[i]);
+
+	free(image_arena.buf);
+	memset(&image_arena, 0, sizeof(image_arena));
+}
+
+static struct device_info *find_board(const char *id);
+
+/** One line of a -m manifest */
+struct batch_job {
+	struct device_info *info;
+	char *kernel_image;
+	char *rootfs_image;
+	char *output;
+	bool add_jffs2_eof;
+	bool sysupgrade;
+};
+
+struct batch_ctx {
+	struct batch_job *jobs;
+	size_t n_jobs;
+	uint32_t rev;
+};
+
+static void batch_task(size_t idx, void *arg) {
+	struct batch_ctx *ctx = arg;
+	struct batch_job *job = &ctx->jobs[idx];
+	struct device_info local;
+
+	/* build_image() rewrites the partition list, so every build
+	   gets its own copy of the board entry */
+	local = *job->info;
+	build_image(job->output, job->kernel_image, job->rootfs_image,
+		ctx->rev, job->add_jffs2_eof, job->sysupgrade, &local);
+}
+
+/**
+   Builds images for a whole manifest of boards, spreading the builds over
+   the shared worker pool.
+
+   Manifest lines look like
+
+     <board> <kernel> <rootfs> <output> [sysupgrade] [jffs2]
+
+   with blank lines and lines starting with '#' ignored. The shared kernel
+   and rootfs files stay hot in the page cache across builds, so a full
+   release run does not re-read them from disk per board.
+*/
+static void build_batch(const char *manifest, uint32_t rev) {
+	struct batch_ctx ctx = {
+		.rev = rev,
+	};
+	size_t jobs_alloc = 0;
+	char *line = NULL;
+	size_t line_len = 0;
+	size_t lineno = 0;
+	size_t i;
+	FILE *file;
+
+	file = fopen(manifest, "r");
+	if (!file)
+		error(1, errno, "unable to open manifest `%s'", manifest);
+
+	while (getline(&line, &line_len, file) >= 0) {
+		char *board, *kernel, *rootfs, *output, *flag;
+		struct batch_job *job;
+		char *saveptr;
+
+		lineno++;
+
+		board = strtok_r(line, " \t\r\n", &saveptr);
+		if (!board || board[0] == '#')
+			continue;
+
+		kernel = strtok_r(NULL, " \t\r\n", &saveptr);
+		rootfs = strtok_r(NULL, " \t\r\n", &saveptr);
+		output = strtok_r(NULL, " \t\r\n", &saveptr);
+		if (!output)
+			error(1, 0, "%s:%zu: expected <board> <kernel> <rootfs> <output>",
+				manifest, lineno);
+
+		if (ctx.n_jobs == jobs_alloc) {
+			jobs_alloc = jobs_alloc ? jobs_alloc * 2 : 16;
+			ctx.jobs = realloc(ctx.jobs, jobs_alloc * sizeof(*ctx.jobs));
+			if (!ctx.jobs)
+				error(1, errno, "unable to alloc job list");
+		}
+
+		job = &ctx.jobs[ctx.n_jobs++];
+		memset(job, 0, sizeof(*job));
+
+		job->info = find_board(board);
+		if (!job->info)
+			error(1, 0, "%s:%zu: unsupported board %s", manifest, lineno, board);
+
+		job->kernel_image = strdup(kernel);
+		job->rootfs_image = strdup(rootfs);
+		job->output = strdup(output);
+		if (!job->kernel_image || !job->rootfs_image || !job->output)
+			error(1, errno, "unable to alloc job");
+
+		while ((flag = strtok_r(NULL, " \t\r\n", &saveptr))) {
+			if (!strcmp(flag, "sysupgrade"))
+				job->sysupgrade = true;
+			else if (!strcmp(flag, "jffs2"))
+				job->add_jffs2_eof = true;
+			else
+				error(1, 0, "%s:%zu: unknown flag `%s'", manifest, lineno, flag);
+		}
+	}
+
+	free(line);
+	fclose(file);
+
+	fwu_pool_run(ctx.n_jobs, batch_task, &ctx);
+
+	for (i = 0; i < ctx.n_jobs; i++) {
+		free(ctx.jobs[i].kernel_image);
+		free(ctx.jobs[i].rootfs_image);
+		free(ctx.jobs[i].output);
+	}
+	free(ctx.jobs);
 }
 
 /** Usage output */
@@ -4026,6 +4210,8 @@ static void usage(const char *argv0) {
 		"  -V <rev>        sets the revision number to <rev>\n"
 		"  -j              add jffs2 end-of-filesystem markers\n"
 		"  -S              create sysupgrade instead of factory image\n"
+		"  -m <manifest>   build all images listed in <manifest>; each line is\n"
+		"                  <board> <kernel> <rootfs> <output> [sysupgrade] [jffs2]\n"
 		"Extract an old image:\n"
 		"  -x <file>       extract all oem firmware partition\n"
 		"  -d <dir>        destination to extract the firmware partition\n"
@@ -4035,15 +4221,50 @@ static void usage(const char *argv0) {
 };
 
 
+/** Sorted index over boards[], built on first lookup */
+static struct device_info **board_index;
+static size_t board_count;
+
+static int board_index_compar(const void *a, const void *b)
+{
+	const struct device_info * const *boardA = a;
+	const struct device_info * const *boardB = b;
+
+	return strcasecmp((*boardA)->id, (*boardB)->id);
+}
+
+static int board_index_search(const void *key, const void *member)
+{
+	const struct device_info * const *board = member;
+
+	return strcasecmp(key, (*board)->id);
+}
+
 static struct device_info *find_board(const char *id)
 {
-	struct device_info *board = NULL;
+	struct device_info **match;
 
-	for (board = boards; board->id != NULL; board++)
-		if (strcasecmp(id, board->id) == 0)
-			return board;
+	if (!board_index) {
+		struct device_info *board;
+		size_t i = 0;
 
-	return NULL;
+		for (board = boards; board->id != NULL; board++)
+			board_count++;
+
+		board_index = malloc(board_count * sizeof(*board_index));
+		if (!board_index)
+			error(1, errno, "unable to alloc board index");
+
+		for (board = boards; board->id != NULL; board++)
+			board_index[i++] = board;
+		qsort(board_index, board_count, sizeof(*board_index),
+			board_index_compar);
+	}
+
+	match = bsearch(id, board_index, board_count, sizeof(*match),
+		board_index_search);
+
+	return match ? *match : NULL;
 }
 
 static int add_flash_partition(
@@ -4257,26 +4478,12 @@ static void write_partition(
 		struct flash_partition_entry *entry,
 		FILE *output_file)
 {
-	char buf[4096];
-	size_t offset;
-
 	fseek(input_file, entry->base + firmware_offset, SEEK_SET);
 
-	for (offset = 0; sizeof(buf) + offset <= entry->size; offset += sizeof(buf)) {
-		if (fread(buf, sizeof(buf), 1, input_file) != 1)
-			error(1, errno, "Can not read partition from input_file");
-
-		if (fwrite(buf, sizeof(buf), 1, output_file) != 1)
-			error(1, errno, "Can not write partition to output_file");
-	}
-	/* write last chunk smaller than buffer */
-	if (offset < entry->size) {
-		offset = entry->size - offset;
-		if (fread(buf, offset, 1, input_file) != 1)
-			error(1, errno, "Can not read partition from input_file");
-		if (fwrite(buf, offset, 1, output_file) != 1)
-			error(1, errno, "Can not write partition to output_file");
-	}
+	/* partition bytes are unchanged; splice them in kernel space */
+	if (fwu_copy_data(input_file, output_file, entry->size) !=
+	    (ssize_t)entry->size)
+		error(1, errno, "Can not write partition to output_file");
 }
 
 static int extract_firmware_partition(FILE *input_file, size_t firmware_offset, struct flash_partition_entry *entry, const char *output_directory)
@@ -4453,21 +4660,28 @@ static int firmware_info(const char *input)
 
 static void write_ff(FILE *output_file, size_t size)
 {
-	char buf[4096];
-	size_t offset;
+	/*
+	 * Fill regions span megabytes per image; reuse one large 0xff
+	 * buffer so each region goes out in a handful of writes. A hole
+	 * punched with fallocate() would read back as 0x00, not 0xff, so
+	 * the bytes really have to be written.
+	 */
+	static char *buf;
+	const size_t buf_size = 1024 * 1024;
+
+	if (!buf) {
+		buf = malloc(buf_size);
+		if (!buf)
+			error(1, errno, "Can not allocate 0xff fill buffer");
+		memset(buf, 0xff, buf_size);
+	}
 
-	memset(buf, 0xff, sizeof(buf));
+	while (size) {
+		size_t chunk = size < buf_size ? size : buf_size;
 
-	for (offset = 0; offset + sizeof(buf) < size ; offset += sizeof(buf)) {
-		if (fwrite(buf, sizeof(buf), 1, output_file) != 1)
+		if (fwrite(buf, chunk, 1, output_file) != 1)
 			error(1, errno, "Can not write 0xff to output_file");
-	}
-
-	/* write last chunk smaller than buffer */
-	if (offset < size) {
-		offset = size - offset;
-		if (fwrite(buf, offset, 1, output_file) != 1)
-			error(1, errno, "Can not write partition to output_file");
+		size -= chunk;
 	}
 }
 
@@ -4518,6 +4732,11 @@ static void convert_firmware(const char *input, const char *output)
 	flash_file_system = find_partition(flash, MAX_PARTITIONS,
 			"file-system", "Error can not find file-system partition (flash)");
 
+	/* preallocate the converted image at its final size (best effort) */
+	posix_fallocate(fileno(output_file), 0,
+			flash_file_system->base - flash_os_image->base +
+			fwup_file_system->size);
+
 	/* write os_image to 0x0 */
 	write_partition(input_file, info.payload_offset, fwup_os_image, output_file);
 	write_ff(output_file, flash_os_image->size - fwup_os_image->size);
@@ -4530,9 +4749,14 @@ static void convert_firmware(const char *input, const char *output)
 	fclose(input_file);
 }
 
+#ifdef FWU_LIB
+int tplink_safeloader_main(int argc, char *argv[]) {
+#else
 int main(int argc, char *argv[]) {
+#endif
 	const char *info_image = NULL, *board = NULL, *kernel_image = NULL, *rootfs_image = NULL, *output = NULL;
 	const char *extract_image = NULL, *output_directory = NULL, *convert_image = NULL;
+	const char *manifest = NULL;
 	bool add_jffs2_eof = false, sysupgrade = false;
 	unsigned rev = 0;
 	struct device_info *info;
@@ -4541,7 +4765,7 @@ int main(int argc, char *argv[]) {
 	while (true) {
 		int c;
 
-		c = getopt(argc, argv, "i:B:k:r:o:V:jSh:x:d:z:");
+		c = getopt(argc, argv, "i:B:k:r:o:V:jSh:x:d:z:m:");
 		if (c == -1)
 			break;
 
@@ -4586,6 +4810,10 @@ int main(int argc, char *argv[]) {
 			output_directory = optarg;
 			break;
 
+		case 'm':
+			manifest = optarg;
+			break;
+
 		case 'x':
 			extract_image = optarg;
 			break;
@@ -4608,6 +4836,8 @@ int main(int argc, char *argv[]) {
 		if (!output_directory)
 			error(1, 0, "Can not extract an image without output directory. Use -d <dir>");
 		extract_firmware(extract_image, output_directory);
+	} else if (manifest) {
+		build_batch(manifest, rev);
 	} else if (convert_image) {
 		if (!output)
 			error(1, 0, "Can not convert a factory/oem image into sysupgrade image without output file. Use -o <file>");
@@ -4630,5 +4860,7 @@ int main(int argc, char *argv[]) {
 		build_image(output, kernel_image, rootfs_image, rev, add_jffs2_eof, sysupgrade, info);
 	}
 
+	fwu_perf_done("tplink-safeloader");
+
 	return 0;
 }
@@ -37,8 +37,13 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "fwu_io.h"
+
 #if __BYTE_ORDER == __BIG_ENDIAN
 #define STORE32_LE(X)		bswap_32(X)
 #define LOAD32_LE(X)		bswap_32(X)
@@ -75,10 +80,68 @@ void usage(void)
 	fprintf(stderr, "Usage:\n");
 	fprintf(stderr, " trx [-2] [-o outfile] [-m maxlen] [-a align] [-b absolute offset] [-x relative offset]\n");
 	fprintf(stderr, "     [-f file] [-f file [-f file [-f file (v2 only)]]]\n");
+	fprintf(stderr, " trx --fixup image\n");
+	fprintf(stderr, "     recompute the crc32 of an existing image in place\n");
 	exit(EXIT_FAILURE);
 }
 
+/* Regenerate the crc32 field of an existing image in place: mmap the
+ * file, recompute the CRC over the mapped payload and patch the 4-byte
+ * header field, instead of rebuilding the whole image. */
+static int trx_fixup(const char *path)
+{
+	struct trx_header *p;
+	struct stat st;
+	uint32_t len;
+	char *image;
+	int fd;
+
+	fd = open(path, O_RDWR);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "can't open %s\n", path);
+		return EXIT_FAILURE;
+	}
+
+	if ((size_t)st.st_size < sizeof(struct trx_header)) {
+		fprintf(stderr, "%s is too short for a trx header\n", path);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (image == MAP_FAILED) {
+		fprintf(stderr, "mmap failed\n");
+		return EXIT_FAILURE;
+	}
+
+	p = (struct trx_header *)image;
+	if (LOAD32_LE(p->magic) != TRX_MAGIC) {
+		fprintf(stderr, "bad magic in %s\n", path);
+		munmap(image, st.st_size);
+		return EXIT_FAILURE;
+	}
+
+	len = LOAD32_LE(p->len);
+	if (len < sizeof(struct trx_header) || len > (size_t)st.st_size) {
+		fprintf(stderr, "bad length in %s\n", path);
+		munmap(image, st.st_size);
+		return EXIT_FAILURE;
+	}
+
+	p->crc32 = STORE32_LE(crc32buf((char *)&p->flag_version,
+				       len - offsetof(struct trx_header, flag_version)));
+
+	munmap(image, st.st_size);
+
+	return EXIT_SUCCESS;
+}
+
+#ifdef FWU_LIB
+int trx_main(int argc, char **argv)
+#else
 int main(int argc, char **argv)
+#endif
 {
 	FILE *out = stdout;
 	FILE *in;
@@ -96,6 +159,9 @@ int main(int argc, char **argv)
 
 	fprintf(stderr, "mjn3's trx replacement - v0.81.1\n");
 
+	if (argc == 3 && !strcmp(argv[1], "--fixup"))
+		return trx_fixup(argv[2]);
+
 	if (!(buf = malloc(maxlen))) {
 		fprintf(stderr, "malloc failed\n");
 		return EXIT_FAILURE;
@@ -154,7 +220,7 @@ int main(int argc, char **argv)
 				break;
 			case 'o':
 				ofn = optarg;
-				if (ofn && !(out = fopen(ofn, "w"))) {
+				if (ofn && !(out = fwu_fopen(ofn, "w"))) {
 					fprintf(stderr, "can not open \"%s\" for writing\n", ofn);
 					usage();
 				}
@@ -285,7 +351,10 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 	}
 
-	fclose(out);
+	if (fwu_fclose(out)) {
+		fprintf(stderr, "fwrite failed\n");
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -15,6 +15,8 @@
 #include <arpa/inet.h>
 #include <zlib.h>
 
+#include "fwu_io.h"
+
 
 /* from u-boot/include/image.h */
 #define IH_MAGIC	0x27051956	/* Image Magic Number		*/
@@ -54,8 +56,9 @@ static void usage(char *prog)
 int main(int argc, char *argv[])
 {
 	struct stat statbuf;
-	u_int8_t *filebuf;
-	int ifd;
+	u_int8_t *hdrbuf;
+	FILE *ifp;
+	FILE *ofp;
 	int ofd;
 	ssize_t rsz;
 	u_int32_t crc_recalc;
@@ -89,61 +92,66 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	ifd = open(infname, O_RDONLY);
-	if (ifd < 0) {
+	ifp = fopen(infname, "r");
+	if (!ifp) {
 		fprintf(stderr,
 			"could not open input file. (errno = %d)\n", errno);
 		exit(1);
 	}
 
 	ofd = open(outfname, O_WRONLY | O_CREAT, 0644);
-	if (ofd < 0) {
+	if (ofd < 0 || !(ofp = fdopen(ofd, "w"))) {
 		fprintf(stderr,
 			"could not open output file. (errno = %d)\n", errno);
 		exit(1);
 	}
 
-	if (fstat(ifd, &statbuf) < 0) {
+	if (fstat(fileno(ifp), &statbuf) < 0) {
 		fprintf(stderr,
 			"could not fstat input file. (errno = %d)\n", errno);
 		exit(1);
 	}
 
-	filebuf = malloc(statbuf.st_size + padsz);
-	if (!filebuf) {
+	/*
+	 * Padding only shifts the payload relative to the header, so
+	 * just the header and pad pass through user space; the payload
+	 * is copied in kernel space below.
+	 */
+	hdrbuf = malloc(sizeof(*imgh) + padsz);
+	if (!hdrbuf) {
 		fprintf(stderr, "buffer allocation failed\n");
 		exit(1);
 	}
 
-	rsz = read(ifd, filebuf, sizeof(*imgh));
-	if (rsz != sizeof(*imgh)) {
+	if (fread(hdrbuf, sizeof(*imgh), 1, ifp) != 1) {
 		fprintf(stderr,
 			"could not read input file (errno = %d).\n", errno);
 		exit(1);
 	}
 
-	memset(&(filebuf[sizeof(*imgh)]), 0, padsz);
-
-	rsz = read(ifd, &(filebuf[sizeof(*imgh) + padsz]),
-				statbuf.st_size - sizeof(*imgh));
-	if (rsz != (int32_t)(statbuf.st_size - sizeof(*imgh))) {
-		fprintf(stderr,
-			"could not read input file (errno = %d).\n", errno);
-		exit(1);
-	}
+	memset(&(hdrbuf[sizeof(*imgh)]), 0, padsz);
 
-	imgh = (image_header_t *)filebuf;
+	imgh = (image_header_t *)hdrbuf;
 
 	imgh->ih_hcrc = 0;
-	crc_recalc = crc32(0, filebuf, sizeof(*imgh) + padsz);
+	crc_recalc = crc32(0, hdrbuf, sizeof(*imgh) + padsz);
 	imgh->ih_hcrc = htonl(crc_recalc);
 
-	rsz = write(ofd, filebuf, statbuf.st_size + padsz);
-	if (rsz != (int32_t)statbuf.st_size + padsz) {
+	if (fwrite(hdrbuf, sizeof(*imgh) + padsz, 1, ofp) != 1) {
 		fprintf(stderr,
 			"could not write output file (errnor = %d).\n", errno);
 		exit(1);
 	}
 
+	rsz = fwu_copy_data(ifp, ofp, statbuf.st_size - sizeof(*imgh));
+	if (rsz != (ssize_t)(statbuf.st_size - sizeof(*imgh))) {
+		fprintf(stderr,
+			"could not write output file (errnor = %d).\n", errno);
+		exit(1);
+	}
+
+	fclose(ofp);
+	fclose(ifp);
+
 	return 0;
 }
@@ -12,10 +12,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
 #include <zlib.h>
 
+#include "fwu_io.h"
+
 
 /* from u-boot/include/image.h */
 #define IH_NMLEN		32	/* Image Name Length		*/
@@ -53,29 +56,260 @@ struct image_header {
 static void usage(char *prog)
 {
 	fprintf(stderr,
-		"%s -i <input_uimage_file> -o <output_file> -m <model> -h <hardware version> -s <software version>\n",
-		prog);
+		"%s -i <input_uimage_file> -o <output_file> -m <model> -h <hardware version> -s <software version>\n"
+		"%s -C <manifest>\n"
+		"    convert every image listed in <manifest>; each line is\n"
+		"    <input> <output> <model> <hw version> <sw version>, '#' comments\n",
+		prog, prog);
 }
 
-int main(int argc, char *argv[])
+/*
+ * Convert one uImage: only the 64-byte header plus the 96 SGE bytes
+ * pass through user space; the payload is unchanged by the conversion
+ * (ih_dcrc is kept) and gets spliced in kernel space.
+ */
+static int sge_convert(const char *infname, const char *outfname,
+		       const char *model, const char *hversion,
+		       const char *sversion)
 {
 	struct stat statbuf;
-	u_int8_t *filebuf;
-	int ifd;
+	u_int8_t hdrbuf[sizeof(struct image_header)];
+	FILE *ifp;
+	FILE *ofp;
 	int ofd;
 	ssize_t rsz;
 	u_int32_t crc_recalc;
 	struct image_header *imgh;
+
+	ifp = fopen(infname, "r");
+	if (!ifp) {
+		fprintf(stderr,
+			"could not open input file. (errno = %d)\n", errno);
+		return -1;
+	}
+
+	ofd = open(outfname, O_WRONLY | O_CREAT, 0644);
+	if (ofd < 0 || !(ofp = fdopen(ofd, "w"))) {
+		fprintf(stderr,
+			"could not open output file. (errno = %d)\n", errno);
+		fclose(ifp);
+		return -1;
+	}
+
+	if (fstat(fileno(ifp), &statbuf) < 0) {
+		fprintf(stderr,
+			"could not fstat input file. (errno = %d)\n", errno);
+		goto err;
+	}
+
+	if (fread(hdrbuf, OrignalHL, 1, ifp) != 1) {
+		fprintf(stderr,
+			"could not read input file (errno = %d).\n", errno);
+		goto err;
+	}
+
+	memset(&(hdrbuf[OrignalHL]), 0, IH_PAD_BYTES);
+
+	imgh = (struct image_header *)hdrbuf;
+
+	imgh->ih_hcrc = 0;
+
+	strncpy(imgh->sgeih_p, model, sizeof(imgh->sgeih_p));
+	strncpy(imgh->sgeih_sv, sversion, sizeof(imgh->sgeih_sv));
+	strncpy(imgh->sgeih_hv, hversion, sizeof(imgh->sgeih_hv));
+
+	crc_recalc = crc32(0, hdrbuf, sizeof(*imgh));
+	imgh->ih_hcrc = htonl(crc_recalc);
+
+	if (fwrite(hdrbuf, sizeof(*imgh), 1, ofp) != 1) {
+		fprintf(stderr,
+			"could not write output file (errnor = %d).\n", errno);
+		goto err;
+	}
+
+	rsz = fwu_copy_data(ifp, ofp, statbuf.st_size - OrignalHL);
+	if (rsz != (ssize_t)(statbuf.st_size - OrignalHL)) {
+		fprintf(stderr,
+			"could not write output file (errnor = %d).\n", errno);
+		goto err;
+	}
+
+	fclose(ofp);
+	fclose(ifp);
+	return 0;
+
+err:
+	fclose(ofp);
+	fclose(ifp);
+	return -1;
+}
+
+struct batch_entry {
+	char	*infname;
+	char	*outfname;
+	char	*model;
+	char	*hversion;
+	char	*sversion;
+};
+
+struct batch_ctx {
+	struct batch_entry	*entries;
+	size_t			n_entries;
+	size_t			next;
+	int			fails;
+	pthread_mutex_t		lock;
+};
+
+static void *batch_worker(void *arg)
+{
+	struct batch_ctx *ctx = arg;
+
+	for (;;) {
+		struct batch_entry *e;
+		int ret;
+
+		pthread_mutex_lock(&ctx->lock);
+		if (ctx->next >= ctx->n_entries) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		e = &ctx->entries[ctx->next++];
+		pthread_mutex_unlock(&ctx->lock);
+
+		ret = sge_convert(e->infname, e->outfname, e->model,
+				  e->hversion, e->sversion);
+
+		pthread_mutex_lock(&ctx->lock);
+		if (ret)
+			ctx->fails++;
+		pthread_mutex_unlock(&ctx->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Convert every image named in a manifest, one line per image:
+ * <input> <output> <model> <hw version> <sw version>. A release
+ * converts the whole model matrix, so the pool amortizes the process
+ * start and overlaps the per-image I/O.
+ */
+static int sge_convert_batch(const char *manifest)
+{
+	struct batch_ctx ctx = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t threads[16];
+	size_t alloc = 0;
+	char *line = NULL;
+	size_t line_len = 0;
+	long n_threads;
+	size_t i;
+	FILE *fp;
+	int ret = -1;
+
+	fp = fopen(manifest, "r");
+	if (fp == NULL) {
+		fprintf(stderr,
+			"could not open manifest file. (errno = %d)\n", errno);
+		return ret;
+	}
+
+	while (getline(&line, &line_len, fp) >= 0) {
+		struct batch_entry e;
+		char *in, *out, *model, *hver, *sver;
+		char *save = NULL;
+
+		line[strcspn(line, "\r\n")] = '\0';
+		if (!line[0] || line[0] == '#')
+			continue;
+
+		in = strtok_r(line, " \t", &save);
+		out = strtok_r(NULL, " \t", &save);
+		model = strtok_r(NULL, " \t", &save);
+		hver = strtok_r(NULL, " \t", &save);
+		sver = strtok_r(NULL, " \t", &save);
+
+		if (!in || !out || !model || !hver || !sver) {
+			fprintf(stderr, "invalid manifest line for '%s'\n",
+				in ? in : "");
+			goto out;
+		}
+
+		e.infname = strdup(in);
+		e.outfname = strdup(out);
+		e.model = strdup(model);
+		e.hversion = strdup(hver);
+		e.sversion = strdup(sver);
+		if (!e.infname || !e.outfname || !e.model ||
+		    !e.hversion || !e.sversion) {
+			fprintf(stderr, "no memory for batch entry\n");
+			goto out;
+		}
+
+		if (ctx.n_entries == alloc) {
+			struct batch_entry *entries;
+
+			alloc = alloc ? alloc * 2 : 32;
+			entries = realloc(ctx.entries,
+					  alloc * sizeof(*entries));
+			if (!entries) {
+				fprintf(stderr, "no memory for batch entries\n");
+				goto out;
+			}
+			ctx.entries = entries;
+		}
+		ctx.entries[ctx.n_entries++] = e;
+	}
+
+	n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads < 1)
+		n_threads = 1;
+	if ((size_t)n_threads > ctx.n_entries)
+		n_threads = ctx.n_entries;
+	if (n_threads > (long)(sizeof(threads) / sizeof(threads[0])))
+		n_threads = sizeof(threads) / sizeof(threads[0]);
+
+	for (i = 0; i < (size_t)n_threads; i++)
+		if (pthread_create(&threads[i], NULL, batch_worker, &ctx)) {
+			n_threads = i;
+			break;
+		}
+	for (i = 0; i < (size_t)n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (!ctx.fails)
+		ret = 0;
+
+out:
+	for (i = 0; i < ctx.n_entries; i++) {
+		free(ctx.entries[i].infname);
+		free(ctx.entries[i].outfname);
+		free(ctx.entries[i].model);
+		free(ctx.entries[i].hversion);
+		free(ctx.entries[i].sversion);
+	}
+	free(ctx.entries);
+	free(line);
+	fclose(fp);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
 	int opt;
 	char *infname = NULL;
 	char *outfname = NULL;
 	char *model = NULL;
 	char *hversion = NULL;
 	char *sversion = NULL;
-	int padsz = IH_PAD_BYTES;
+	char *manifest = NULL;
 
-	while ((opt = getopt(argc, argv, "i:o:m:h:s:")) != -1) {
+	while ((opt = getopt(argc, argv, "C:i:o:m:h:s:")) != -1) {
 		switch (opt) {
+		case 'C':
+			manifest = optarg;
+			break;
 		case 'i':
 			infname = optarg;
 			break;
@@ -96,71 +330,16 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (!infname || !outfname) {
-		usage(argv[0]);
-		exit(1);
-	}
-
-	ifd = open(infname, O_RDONLY);
-	if (ifd < 0) {
-		fprintf(stderr,
-			"could not open input file. (errno = %d)\n", errno);
-		exit(1);
-	}
+	if (manifest)
+		return sge_convert_batch(manifest) ? 1 : 0;
 
-	ofd = open(outfname, O_WRONLY | O_CREAT, 0644);
-	if (ofd < 0) {
-		fprintf(stderr,
-			"could not open output file. (errno = %d)\n", errno);
-		exit(1);
-	}
-
-	if (fstat(ifd, &statbuf) < 0) {
-		fprintf(stderr,
-			"could not fstat input file. (errno = %d)\n", errno);
-		exit(1);
-	}
-
-	filebuf = malloc(statbuf.st_size + padsz);
-	if (!filebuf) {
-		fprintf(stderr, "buffer allocation failed\n");
-		exit(1);
-	}
-
-	rsz = read(ifd, filebuf, OrignalHL);
-	if (rsz != OrignalHL) {
-		fprintf(stderr,
-			"could not read input file (errno = %d).\n", errno);
-		exit(1);
-	}
-
-	memset(&(filebuf[OrignalHL]), 0, padsz);
-
-	rsz = read(ifd, &(filebuf[sizeof(*imgh)]),
-				statbuf.st_size - OrignalHL);
-	if (rsz != (int32_t)(statbuf.st_size - OrignalHL)) {
-		fprintf(stderr,
-			"could not read input file (errno = %d).\n", errno);
+	if (!infname || !outfname || !model || !hversion || !sversion) {
+		usage(argv[0]);
 		exit(1);
 	}
 
-	imgh = (struct image_header *)filebuf;
-
-	imgh->ih_hcrc = 0;
-
-	strncpy(imgh->sgeih_p, model, sizeof(imgh->sgeih_p));
-	strncpy(imgh->sgeih_sv, sversion, sizeof(imgh->sgeih_sv));
-	strncpy(imgh->sgeih_hv, hversion, sizeof(imgh->sgeih_hv));
-
-	crc_recalc = crc32(0, filebuf, sizeof(*imgh));
-	imgh->ih_hcrc = htonl(crc_recalc);
-
-	rsz = write(ofd, filebuf, statbuf.st_size + padsz);
-	if (rsz != (int32_t)statbuf.st_size + padsz) {
-		fprintf(stderr,
-			"could not write output file (errnor = %d).\n", errno);
+	if (sge_convert(infname, outfname, model, hversion, sversion))
 		exit(1);
-	}
 
 	return 0;
 }
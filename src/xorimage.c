@@ -12,36 +12,26 @@
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include "fwu_io.h"
+#include "fwu_xor.h"
+
 static char default_pattern[] = "12345678";
 static int is_hex_pattern;
 
 
-int xor_data(void *data, size_t len, const void *pattern, int p_len, int p_off)
-{
-	const uint8_t *key = pattern;
-	uint8_t *d = data;
-
-	while (len--) {
-		*d ^= key[p_off];
-		d++;
-		p_off = (p_off + 1) % p_len;
-	}
-	return p_off;
-}
-
-
 void usage(void) __attribute__ (( __noreturn__ ));
 
 void usage(void)
 {
-	fprintf(stderr, "Usage: xorimage [-i infile] [-o outfile] [-p <pattern>] [-x]\n");
+	fprintf(stderr, "Usage: xorimage [-i infile] [-o outfile] [-p <pattern>] [-x] [-B <bufsize>]\n");
 	exit(EXIT_FAILURE);
 }
 
 
 int main(int argc, char **argv)
 {
-	char buf[1024];	/* keep this at 1k or adjust garbage calc below */
+	size_t bufsize = 1024 * 1024;
+	char *buf;
 	FILE *in = stdin;
 	FILE *out = stdout;
 	char *ifn = NULL;
@@ -53,7 +43,7 @@ int main(int argc, char **argv)
 	size_t n;
 	int p_len, p_off = 0;
 
-	while ((c = getopt(argc, argv, "i:o:p:xh")) != -1) {
+	while ((c = getopt(argc, argv, "i:o:p:xB:h")) != -1) {
 		switch (c) {
 			case 'i':
 				ifn = optarg;
@@ -67,6 +57,13 @@ int main(int argc, char **argv)
 			case 'x':
 				is_hex_pattern = true;
 				break;
+			case 'B':
+				bufsize = strtoul(optarg, NULL, 0);
+				if (!bufsize) {
+					fprintf(stderr, "invalid buffer size \"%s\"\n", optarg);
+					usage();
+				}
+				break;
 			case 'h':
 			default:
 				usage();
@@ -78,16 +75,22 @@ int main(int argc, char **argv)
 		usage();
 	}
 
-	if (ifn && !(in = fopen(ifn, "r"))) {
+	if (ifn && !(in = fwu_fopen(ifn, "r"))) {
 		fprintf(stderr, "can not open \"%s\" for reading\n", ifn);
 		usage();
 	}
 
-	if (ofn && !(out = fopen(ofn, "w"))) {
+	if (ofn && !(out = fwu_fopen(ofn, "w"))) {
 		fprintf(stderr, "can not open \"%s\" for writing\n", ofn);
 		usage();
 	}
 
+	buf = malloc(bufsize);
+	if (!buf) {
+		fprintf(stderr, "can not alloc %zu B buffer\n", bufsize);
+		return EXIT_FAILURE;
+	}
+
 	p_len = strlen(pattern);
 
 	if (p_len == 0) {
@@ -117,8 +120,8 @@ int main(int argc, char **argv)
 		}
 	}
 
-	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
-		if (n < sizeof(buf)) {
+	while ((n = fread(buf, 1, bufsize, in)) > 0) {
+		if (n < bufsize) {
 			if (ferror(in)) {
 			FREAD_ERROR:
 				fprintf(stderr, "fread error\n");
@@ -127,10 +130,10 @@ int main(int argc, char **argv)
 		}
 
 		if (is_hex_pattern) {
-			p_off = xor_data(buf, n, hex_pattern, (p_len / 2),
-					 p_off);
+			p_off = fwu_xor_pattern(buf, n, hex_pattern,
+						(p_len / 2), p_off);
 		} else {
-			p_off = xor_data(buf, n, pattern, p_len, p_off);
+			p_off = fwu_xor_pattern(buf, n, pattern, p_len, p_off);
 		}
 
 		if (!fwrite(buf, n, 1, out)) {
@@ -148,8 +151,12 @@ int main(int argc, char **argv)
 		goto FWRITE_ERROR;
 	}
 
-	fclose(in);
-	fclose(out);
+	fwu_fclose(in);
+	if (fwu_fclose(out)) {
+		fprintf(stderr, "fwrite error\n");
+		return EXIT_FAILURE;
+	}
+	free(buf);
 
 	return EXIT_SUCCESS;
 }
@@ -97,7 +97,6 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
-#include <fcntl.h>
 #include <inttypes.h>
 #include <netinet/in.h>
 #include <signal.h>
@@ -106,13 +105,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "fwu_csum.h"
+#include "fwu_io.h"
+
 /* defaulting to 10 ms interpacket delay */
 static int pktdelay = 10000;
+static long pace_mbps;
 static int sockfd = -1;
 static bool exiting;
 
@@ -158,36 +162,44 @@ static void errexit(const char *msg)
 	exit(EXIT_FAILURE);
 }
 
-static void *map_input(const char *name, size_t *len)
+static uint16_t chksum(uint8_t *p, size_t len)
 {
-	struct stat stat;
-	void *mapped;
-	int fd;
+	uint32_t sum = fwu_byte_sum(p, len);
 
-	fd = open(name, O_RDONLY);
-	if (fd < 0)
-		return NULL;
-	if (fstat(fd, &stat) < 0) {
-		close(fd);
-		return NULL;
-	}
-	*len = stat.st_size;
-	mapped = mmap(NULL, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (close(fd) < 0) {
-		(void) munmap(mapped, stat.st_size);
-		return NULL;
-	}
-	return mapped;
+	return (uint16_t)((sum >> 16) + sum);
 }
 
-static uint16_t chksum(uint8_t *p, size_t len)
+/*
+ * Rate-based pacing (-m): sleep until the absolute deadline the
+ * configured rate allows for the next packet.  If we fall behind, the
+ * deadline snaps to now rather than accumulating a burst debt - the
+ * bootloaders drop anything they can't process, so catch-up bursts
+ * only cause retransmission rounds.
+ */
+static void pace_wait(struct timespec *next, uint32_t bytes)
 {
-	int i;
-	uint32_t sum = 0;
+	struct timespec now;
 
-	for (i = 0; i < len; i++)
-		sum += *p++;
-	return (uint16_t)((sum >> 16) + sum);
+	if (!pace_mbps) {
+		/* No need to kill the network. The target can't
+		 * process packets as fast as we send them anyway.
+		 */
+		usleep(pktdelay);
+		return;
+	}
+
+	next->tv_nsec += (uint64_t)bytes * 8 * 1000 / pace_mbps;
+	while (next->tv_nsec >= 1000000000L) {
+		next->tv_sec++;
+		next->tv_nsec -= 1000000000L;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > next->tv_sec ||
+	    (now.tv_sec == next->tv_sec && now.tv_nsec >= next->tv_nsec)) {
+		*next = now;
+		return;
+	}
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL);
 }
 
 static int pushimage(void *file, struct zycast_t *phdr)
@@ -195,6 +207,16 @@ static int pushimage(void *file, struct zycast_t *phdr)
 	uint32_t count = 0;
 	uint32_t len = ntohl(phdr->flen);
 	uint32_t plen = CHUNK;
+	struct timespec next;
+	struct iovec iov[2];
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = 2,
+	};
+
+	iov[0].iov_base = phdr;
+	iov[0].iov_len = HDRSIZE;
+	clock_gettime(CLOCK_MONOTONIC, &next);
 
 	while (!exiting && len > 0) {
 		if (len < CHUNK)
@@ -202,17 +224,15 @@ static int pushimage(void *file, struct zycast_t *phdr)
 		phdr->plen = htonl(plen);
 		phdr->pid = htonl(count++);
 		phdr->chksum = htons(chksum(file, plen));
-		if (send(sockfd, phdr, HDRSIZE, MSG_MORE | MSG_DONTROUTE) < 0)
-			errexit("send(phdr)");
-		if (send(sockfd, file, plen, MSG_DONTROUTE) < 0)
-			errexit("send(payload)");
+		/* one datagram per sendmsg(), payload straight from the mapping */
+		iov[1].iov_base = file;
+		iov[1].iov_len = plen;
+		if (sendmsg(sockfd, &msg, MSG_DONTROUTE) < 0)
+			errexit("sendmsg()");
 		file += plen;
 		len -= plen;
 
-		/* No need to kill the network. The target can't
-		 * process packets as fast as we send them anyway.
-		 */
-		usleep(pktdelay);
+		pace_wait(&next, HDRSIZE + plen);
 	}
 	return 0;
 }
@@ -230,6 +250,7 @@ static void usage(const char *name)
 	fprintf(stderr, "Options:\n");
 	fprintf(stderr, "\t-i interface            outgoing interface for multicast packets\n");
 	fprintf(stderr, "\t-t delay                interpacket delay in milliseconds\n");
+	fprintf(stderr, "\t-m mbps                 pace packets at the given rate instead of -t\n");
 	fprintf(stderr, "\t-f rasimage             primary firmware image\n");
 	fprintf(stderr, "\t-b backupimage          secondary firmware image (if supported)\n");
 	fprintf(stderr, "\t-d rom                  data for the \"rom\" or \"data\" partition\n");
@@ -250,15 +271,13 @@ static void usage(const char *name)
 #define ADD_IMAGE(nr) \
 	do { \
 		hdr.images |= BIT(nr); \
-		file[nr] = map_input(optarg, &len[nr]); \
-		if (!file[nr]) \
+		if (fwu_input_open(&file[nr], optarg) < 0) \
 			errexit(optarg); \
 	} while (0)
 
 int main(int argc, char **argv)
 {
-	void *file[_MAX_IMAGETYPE] = {};
-	size_t len[_MAX_IMAGETYPE] = {};
+	struct fwu_input file[_MAX_IMAGETYPE] = {};
 	struct zycast_t hdr = {
 		.magic = htonl(MAGIC),
 		.cc    = {'F', 'F' },
@@ -279,7 +298,7 @@ int main(int argc, char **argv)
 	if (connect(sockfd, (struct sockaddr *)&dest, sizeof(dest)) < 0)
 		errexit("connect()");
 
-	while ((c = getopt(argc, argv, "i:t:f:b:d:r:u:")) != -1) {
+	while ((c = getopt(argc, argv, "i:t:m:f:b:d:r:u:")) != -1) {
 		switch (c) {
 		case 'i':
 			if (setsockopt(sockfd, SOL_SOCKET, SO_BINDTODEVICE,  optarg, strlen(optarg)) < 0)
@@ -291,6 +310,11 @@ int main(int argc, char **argv)
 				i = 1;
 			pktdelay = i * 1000;
 			break;
+		case 'm':
+			pace_mbps = strtoul(optarg, NULL, 0);
+			if (pace_mbps < 1)
+				usage(argv[0]);
+			break;
 		case 'f':
 			ADD_IMAGE(RAS);
 			break;
@@ -321,8 +345,8 @@ int main(int argc, char **argv)
 		for (i = 0; i < _MAX_IMAGETYPE; i++) {
 			if (hdr.images & BIT(i)) {
 				hdr.type = BIT(i);
-				hdr.flen = htonl(len[i]);
-				pushimage(file[i], &hdr);
+				hdr.flen = htonl(file[i].size);
+				pushimage(file[i].data, &hdr);
 			}
 		}
 	};
@@ -332,7 +356,7 @@ int main(int argc, char **argv)
 		close(sockfd);
 	for (i = 0; i < _MAX_IMAGETYPE; i++)
 		if (hdr.images & BIT(i))
-			munmap(file[i], len[i]);
+			fwu_input_close(&file[i]);
 
 	return EXIT_SUCCESS;
 }
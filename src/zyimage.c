@@ -3,70 +3,227 @@
  * Copyright (C) 2014 Soul Trace <S-trace@list.ru>
  */
 
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <string.h>
 #include <unistd.h>
 
-#define szbuf 32768
+#include "cyg_crc.h"
+#include "fwu_io.h"
 
-u_int32_t crc_tab[256];
+struct signature
+{
+  const char magic[4];
+  unsigned int device_id;
+  char firmware_version[48];
+  unsigned int crc32;
+};
 
-u_int32_t chksum_crc32 (FILE *f)
+/*
+ * Check one signed image: the trailing signature must carry the ZNBG
+ * magic and its stored CRC must match the bytes in front of it.
+ * Returns 0 and fills *sig on success, -errno otherwise.
+ */
+static int zyimage_verify_file(const char *path, struct signature *sig)
 {
-  register unsigned long crc;
-  unsigned long i, j;
-  char *buffer = malloc(szbuf);
-  char *buf;
+  struct fwu_input in = { 0 };
+  int err = 0;
 
-  crc = 0xFFFFFFFF;
-  while (!feof(f))
-  {
-    j = fread(buffer, 1, szbuf, f);
-    buf = buffer;
-    for (i = 0; i < j; i++)
-      crc = ((crc >> 8) & 0x00FFFFFF) ^ crc_tab[(crc ^ *buf++) & 0xFF];
+  if (fwu_input_open(&in, path))
+    return -errno;
+
+  if (in.size < sizeof(*sig)) {
+    err = -EINVAL;
+    goto out;
+  }
+
+  memcpy(sig, (char *)in.data + in.size - sizeof(*sig), sizeof(*sig));
+  if (strncmp(sig->magic, "ZNBG", sizeof(sig->magic)) != 0) {
+    err = -EINVAL;
+    goto out;
   }
-  free(buffer);
-  return crc;
+
+  if (cyg_crc32_accumulate(0xFFFFFFFF, in.data, in.size - sizeof(*sig)) != sig->crc32)
+    err = -EBADMSG;
+
+out:
+  fwu_input_close(&in);
+  return err;
 }
 
-void chksum_crc32gentab ()
+struct zyimage_verify_ctx {
+  char **paths;
+  size_t n_paths;
+  size_t next;
+  int fails;
+  pthread_mutex_t lock;
+};
+
+static void *zyimage_verify_worker(void *arg)
 {
-  unsigned long crc, poly;
-  int i, j;
+  struct zyimage_verify_ctx *ctx = arg;
 
-  poly = 0xEDB88320L;
-  for (i = 0; i < 256; i++)
-  {
-    crc = i;
-    for (j = 8; j > 0; j--)
-    {
-      if (crc & 1)
-        crc = (crc >> 1) ^ poly;
-      else
-        crc >>= 1;
+  for (;;) {
+    struct signature sig;
+    const char *path;
+    int err;
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->next >= ctx->n_paths) {
+      pthread_mutex_unlock(&ctx->lock);
+      break;
+    }
+    path = ctx->paths[ctx->next++];
+    pthread_mutex_unlock(&ctx->lock);
+
+    err = zyimage_verify_file(path, &sig);
+
+    /* one tab-separated line per file, under the lock so lines
+     * from different workers never interleave */
+    pthread_mutex_lock(&ctx->lock);
+    if (err) {
+      printf("%s\tFAIL\t%s\n", path,
+             err == -EBADMSG ? "crc32" : "signature");
+      ctx->fails++;
+    } else {
+      printf("%s\tOK\t0x%08x\t%.48s\t0x%08x\n", path,
+             sig.device_id, sig.firmware_version, sig.crc32);
     }
-    crc_tab[i] = crc;
+    pthread_mutex_unlock(&ctx->lock);
+  }
+
+  return NULL;
+}
+
+static int zyimage_verify_add_path(struct zyimage_verify_ctx *ctx, size_t *alloc, const char *path)
+{
+  if (ctx->n_paths == *alloc) {
+    char **paths;
+
+    *alloc = *alloc ? *alloc * 2 : 64;
+    paths = realloc(ctx->paths, *alloc * sizeof(*paths));
+    if (!paths)
+      return -ENOMEM;
+    ctx->paths = paths;
   }
+
+  ctx->paths[ctx->n_paths] = strdup(path);
+  if (!ctx->paths[ctx->n_paths])
+    return -ENOMEM;
+  ctx->n_paths++;
+
+  return 0;
+}
+
+/*
+ * Verify every image in a directory or newline-delimited manifest on
+ * a small thread pool, one process for the whole release tree instead
+ * of one cold start per file.
+ */
+static int zyimage_verify_batch(const char *arg)
+{
+  struct zyimage_verify_ctx ctx = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+  };
+  size_t alloc = 0;
+  pthread_t threads[16];
+  struct stat st;
+  long n_threads;
+  size_t i;
+  int err = 0;
+
+  if (stat(arg, &st)) {
+    fprintf(stderr, "Couldn't stat %s\n", arg);
+    return 1;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    struct dirent *d;
+    char path[4096];
+    DIR *dir;
+
+    dir = opendir(arg);
+    if (!dir) {
+      fprintf(stderr, "Couldn't open %s\n", arg);
+      return 1;
+    }
+    while ((d = readdir(dir))) {
+      if (d->d_name[0] == '.')
+        continue;
+      snprintf(path, sizeof(path), "%s/%s", arg, d->d_name);
+      if (stat(path, &st) || !S_ISREG(st.st_mode))
+        continue;
+      err = zyimage_verify_add_path(&ctx, &alloc, path);
+      if (err)
+        break;
+    }
+    closedir(dir);
+  } else {
+    char *line = NULL;
+    size_t line_len = 0;
+    FILE *fp;
+
+    fp = fopen(arg, "r");
+    if (!fp) {
+      fprintf(stderr, "Couldn't open %s\n", arg);
+      return 1;
+    }
+    while (getline(&line, &line_len, fp) >= 0) {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (!line[0] || line[0] == '#')
+        continue;
+      err = zyimage_verify_add_path(&ctx, &alloc, line);
+      if (err)
+        break;
+    }
+    free(line);
+    fclose(fp);
+  }
+  if (err)
+    goto out;
+
+  n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n_threads < 1)
+    n_threads = 1;
+  if ((size_t)n_threads > ctx.n_paths)
+    n_threads = ctx.n_paths;
+  if (n_threads > (long)(sizeof(threads) / sizeof(threads[0])))
+    n_threads = sizeof(threads) / sizeof(threads[0]);
+
+  for (i = 0; i < (size_t)n_threads; i++)
+    if (pthread_create(&threads[i], NULL, zyimage_verify_worker, &ctx)) {
+      n_threads = i;
+      break;
+    }
+  for (i = 0; i < (size_t)n_threads; i++)
+    pthread_join(threads[i], NULL);
+
+  if (ctx.fails)
+    err = 1;
+
+out:
+  for (i = 0; i < ctx.n_paths; i++)
+    free(ctx.paths[i]);
+  free(ctx.paths);
+  return err ? 1 : 0;
 }
 
 void usage(char *progname)
 {
   printf("Usage: %s [ -v Version ] [ -d Device_ID ] <input file>\n", progname);
+  printf("       %s -C <dir|manifest>\n", progname);
+  printf("  -C   verify all signed images in a directory or manifest (one\n");
+  printf("       tab-separated result line per file), without writing\n");
   exit(1);
 }
 
 int main(int argc, char *argv[]) {
-  struct signature
-  {
-    const char magic[4];
-    unsigned int device_id;
-    char firmware_version[48];
-    unsigned int crc32;
-  }
-  sign =
+  struct signature sign =
   {
     { 'Z', 'N', 'B', 'G' },
     1,
@@ -74,6 +231,7 @@ int main(int argc, char *argv[]) {
     0
   };
   FILE *f;
+  struct fwu_input in = { 0 };
   struct signature oldsign;
   char *filename;
   static const char *optString;
@@ -82,7 +240,7 @@ int main(int argc, char *argv[]) {
   if (argc < 1)
     usage(argv[0]);
 
-  optString = "v:d:h";
+  optString = "v:d:C:h";
   opt = getopt( argc, argv, optString );
   while( opt != -1 ) {
     switch( opt ) {
@@ -99,6 +257,9 @@ int main(int argc, char *argv[]) {
           sign.device_id = (int)strtol(optarg, NULL, 16);
         break;
 
+      case 'C':
+        return zyimage_verify_batch(optarg);
+
       case '?':
       case 'h':
         usage(argv[0]);
@@ -111,8 +272,6 @@ int main(int argc, char *argv[]) {
     opt = getopt( argc, argv, optString );
   }
 
-  chksum_crc32gentab();
-
   filename=argv[optind];
   if (access(filename, W_OK) || access(filename, R_OK))
   {
@@ -131,8 +290,15 @@ int main(int argc, char *argv[]) {
       exit(0);
     }
 
-    fseek(f, 0, SEEK_SET);
-    sign.crc32 = chksum_crc32(f);
+    if (fwu_input_open(&in, filename))
+    {
+      printf("Not open input file %s\n", filename);
+      exit(1);
+    }
+    sign.crc32 = cyg_crc32_accumulate(0xFFFFFFFF, in.data, in.size);
+    fwu_input_close(&in);
+
+    fseek(f, 0, SEEK_END);
     fwrite(&sign, sizeof(sign), 1, f);
     fclose(f);
 
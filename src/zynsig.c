@@ -23,6 +23,7 @@
 #include <sys/mman.h>
 
 #include "zynos.h"
+#include "fwu_io.h"
 
 #if (__BYTE_ORDER == __LITTLE_ENDIAN)
 #  define HOST_TO_LE16(x)	(x)
@@ -265,8 +266,10 @@ int main(int argc, char *argv[]) {
 	int c;
 
 	struct zyn_rombin_hdr bootext_hdr;
+	struct stat ist, ost;
 
 	FILE *outfile;
+	FILE *infile;
 
 	progname=basename(argv[0]);
 
@@ -308,6 +311,16 @@ int main(int argc, char *argv[]) {
 		goto out;
 	}
 
+	/* the header is prepended, so the output cannot be produced in
+	 * place; catch input==output before the truncating open below
+	 * destroys the input */
+	if (stat(ifname, &ist) == 0 && stat(ofname, &ost) == 0 &&
+	    ist.st_dev == ost.st_dev && ist.st_ino == ost.st_ino) {
+		ERR("input and output must be different files");
+		/* not via out: that would unlink the shared file */
+		return EXIT_FAILURE;
+	}
+
 	input_file = map_input(ifname, &file_len);
 	if(!input_file) {
 		ERR("input file not found.");
@@ -330,7 +343,17 @@ int main(int argc, char *argv[]) {
 
 	outfile = fopen(ofname, "w");
 	fwrite(&bootext_hdr, sizeof(bootext_hdr), 1, outfile);
-	fwrite(input_file, file_len, 1, outfile);
+	/* the payload is copied through unchanged; fwu_copy_data() keeps
+	 * it in the kernel instead of pushing the mapping back out through
+	 * userspace */
+	infile = fopen(ifname, "r");
+	if (!infile ||
+	    fwu_copy_data(infile, outfile, 0) != (ssize_t)file_len) {
+		ERR("writing output file failed");
+		fclose(outfile);
+		goto out;
+	}
+	fclose(infile);
 	fflush(outfile);
 	fclose(outfile);
 
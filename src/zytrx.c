@@ -16,38 +16,17 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
 #include <string.h>
 #include <netinet/in.h>
 #include <inttypes.h>
+#include <sys/uio.h>
 
-#define BPB 8 /* bits/byte */
-
-static uint32_t crc32[1<<BPB];
-
-static void init_crc32(void)
-{
-	const uint32_t poly = ntohl(0x2083b8ed);
-	int n;
-
-	for (n = 0; n < 1<<BPB; n++) {
-		uint32_t crc = n;
-		int bit;
-
-		for (bit = 0; bit < BPB; bit++)
-			crc = (crc & 1) ? (poly ^ (crc >> 1)) : (crc >> 1);
-		crc32[n] = crc;
-	}
-}
+#include "cyg_crc.h"
+#include "fwu_io.h"
 
 static uint32_t crc32buf(const unsigned char *buf, size_t len)
 {
-	uint32_t crc = 0xFFFFFFFF;
-
-	for (; len; len--, buf++)
-		crc = crc32[(uint8_t)crc ^ *buf] ^ (crc >> BPB);
-	return ~crc;
+	return cyg_ether_crc32((void *)buf, len);
 }
 
 /* HDR0 reversed, to be stored as BE */
@@ -98,27 +77,32 @@ static struct board_t {
 	{}
 };
 
-static int find_board(struct zytrx_t *h, char *board)
+static struct board_t *find_board(char *board)
 {
 	struct board_t *p;
 
-	for (p = boards; p->modelid; p++) {
-		if (strncmp((const char *)p->boardid, board, sizeof(p->boardid)))
-			continue;
-		memcpy(h->chipid, p->chipid, sizeof(h->chipid));
-		memcpy(h->boardid, p->boardid, sizeof(h->boardid));
-		h->modelid = htonl(p->modelid);
-		return 0;
-	}
-	return -1;
+	for (p = boards; p->modelid; p++)
+		if (!strncmp((const char *)p->boardid, board, sizeof(p->boardid)))
+			return p;
+	return NULL;
 }
 
+/* one output image per board; the family shares the payload */
+#define MAX_OUT		(sizeof(boards) / sizeof(boards[0]) - 1)
+
+struct out_t {
+	struct board_t *board;
+	const char *fname;
+};
+
 static void usage(const char *name)
 {
 	struct board_t *p;
 
 	fprintf(stderr, "Usage:\n");
 	fprintf(stderr, " %s -B <board> -v <versionstr> -i <file> [-o <outputfile>]\n\n", name);
+	fprintf(stderr, "-B/-o may be repeated to emit images for several boards\n");
+	fprintf(stderr, "from the same payload in one run.\n\n");
 	fprintf(stderr, "Supported <board> values:\n");
 	for (p = boards; p->modelid; p++)
 		fprintf(stderr, "\t%-12s\n", p->boardid);
@@ -134,34 +118,15 @@ static void errexit(const char *msg)
 	exit(EXIT_FAILURE);
 }
 
-static void *map_input(const char *name, size_t *len)
-{
-	struct stat stat;
-	void *mapped;
-	int fd;
-
-	fd = open(name, O_RDONLY);
-	if (fd < 0)
-		return NULL;
-	if (fstat(fd, &stat) < 0) {
-		close(fd);
-		return NULL;
-	}
-	*len = stat.st_size;
-	mapped = mmap(NULL, stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (close(fd) < 0) {
-		(void) munmap(mapped, stat.st_size);
-		return NULL;
-	}
-	return mapped;
-}
-
 int main(int argc, char **argv)
 {
-	int c, fdout = STDOUT_FILENO;
-	void *input_file = NULL;
-	size_t file_len, len;
-	uint32_t crc;
+	int c, i, fdout;
+	struct fwu_input input = { 0 };
+	struct out_t outs[MAX_OUT] = { 0 };
+	const char *pending_ofname = NULL;
+	int n_outs = 0;
+	size_t len;
+	uint32_t crc_p;
 	struct zytrx_t h = {
 		.magic		= htonl(MAGIC),
 		.len_h		= htonl(sizeof(h)),
@@ -174,8 +139,12 @@ int main(int argc, char **argv)
 	while ((c = getopt(argc, argv, "B:v:i:o:")) != -1) {
 		switch (c) {
 		case 'B':
-			if (find_board(&h, optarg) < 0)
+			if (n_outs == (int)MAX_OUT)
+				errexit("too many boards");
+			outs[n_outs].board = find_board(optarg);
+			if (!outs[n_outs].board)
 				errexit("unsupported board");
+			n_outs++;
 			break;
 		case 'v':
 			len = strlen(optarg);
@@ -185,43 +154,78 @@ int main(int argc, char **argv)
 			memcpy(h.swVersionExt, optarg, len);
 			break;
 		case 'i':
-			input_file = map_input(optarg, &file_len);
-			if (!input_file)
+			if (fwu_input_open(&input, optarg) < 0)
 				errexit(optarg);
 			break;
 		case 'o':
-			fdout = open(optarg, O_WRONLY | O_CREAT, 0644);
-			if (fdout < 0)
-				errexit(optarg);
+			if (!n_outs)
+				pending_ofname = optarg;
+			else if (outs[n_outs - 1].fname)
+				errexit("more than one output per board");
+			else
+				outs[n_outs - 1].fname = optarg;
 			break;
 		default:
 			usage(argv[0]);
 		}
 	}
 
+	/* -o may precede the (single) -B it belongs to */
+	if (pending_ofname) {
+		if (!n_outs || outs[0].fname)
+			errexit("stray output file");
+		outs[0].fname = pending_ofname;
+	}
+
 	/* required paremeters */
-	if (!input_file || !h.modelid || !h.swVersionInt[0])
+	if (!input.data || !n_outs || !h.swVersionInt[0])
 		usage(argv[0]);
 
 	/* length fields */
-	h.len_t = htonl(sizeof(h) + file_len);
-	h.len_p = htonl(file_len);
-
-	/* crc fields */
-	init_crc32();
-	crc = crc32buf(input_file, file_len);
-	h.crc32_p = htonl(~crc);
-	crc = crc32buf((unsigned char *)&h, sizeof(h));
-	h.crc32_h = htonl(~crc);
-
-	/* dump new image */
-	write(fdout, &h, sizeof(h));
-	write(fdout, input_file, file_len);
-
-	/* close files */
-	munmap(input_file, file_len);
-	if (fdout != STDOUT_FILENO)
-		close(fdout);
+	h.len_t = htonl(sizeof(h) + input.size);
+	h.len_p = htonl(input.size);
+
+	/* payload crc, computed once and shared by all boards */
+	crc_p = crc32buf(input.data, input.size);
+	h.crc32_p = htonl(~crc_p);
+
+	for (i = 0; i < n_outs; i++) {
+		struct board_t *p = outs[i].board;
+		struct zytrx_t hb = h;
+		struct iovec iov[2];
+		uint32_t crc;
+
+		memcpy(hb.chipid, p->chipid, sizeof(hb.chipid));
+		memcpy(hb.boardid, p->boardid, sizeof(hb.boardid));
+		hb.modelid = htonl(p->modelid);
+
+		crc = crc32buf((unsigned char *)&hb, sizeof(hb));
+		hb.crc32_h = htonl(~crc);
+
+		if (outs[i].fname) {
+			fdout = open(outs[i].fname, O_WRONLY | O_CREAT, 0644);
+			if (fdout < 0)
+				errexit(outs[i].fname);
+		} else if (n_outs == 1) {
+			fdout = STDOUT_FILENO;
+		} else {
+			errexit("missing output file for board");
+		}
+
+		/* dump new image */
+		iov[0].iov_base = &hb;
+		iov[0].iov_len = sizeof(hb);
+		iov[1].iov_base = input.data;
+		iov[1].iov_len = input.size;
+		if (writev(fdout, iov, 2) !=
+		    (ssize_t)(sizeof(hb) + input.size))
+			errexit("short write");
+
+		if (fdout != STDOUT_FILENO)
+			close(fdout);
+	}
+
+	fwu_input_close(&input);
 
 	return EXIT_SUCCESS;
 }